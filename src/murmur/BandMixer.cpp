@@ -0,0 +1,474 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "BandMixer.h"
+#include "User.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QReadLocker>
+#include <QtCore/QWriteLocker>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <unordered_set>
+
+BandMixer::BandMixer()
+    : m_linksChanged(false)
+    , m_sampleClock(0)
+    , m_nextStreamSession(FIRST_STREAM_SESSION)
+    , m_gainStepDb(1.5f)
+    , m_minGain(0.05f) {
+}
+
+BandMixer::~BandMixer() {
+    clear();
+}
+
+void BandMixer::setMixingEnabled(int channelId, bool enabled) {
+    if (enabled && !OpusCodec::isAvailable()) {
+        qWarning() << "BandMixer: Cannot enable mixing for channel" << channelId
+                   << "- server was built without Opus support";
+        return;
+    }
+
+    if (enabled) {
+        m_mixedChannels.insert(channelId);
+    } else {
+        m_mixedChannels.remove(channelId);
+        m_channels.erase(channelId);
+    }
+}
+
+bool BandMixer::isMixingEnabled(int channelId) const {
+    return m_mixedChannels.contains(channelId);
+}
+
+void BandMixer::setGainStep(float stepDb) {
+    m_gainStepDb = qMax(0.1f, stepDb);
+}
+
+void BandMixer::setMinimumGain(float minGain) {
+    m_minGain = qBound(0.0f, minGain, 1.0f);
+}
+
+void BandMixer::setLinkGain(unsigned int speakerSession, unsigned int receiverSession, float gain) {
+    QWriteLocker locker(&m_gainLock);
+    m_links[qMakePair(speakerSession, receiverSession)].gain = qBound(0.0f, gain, 1.0f);
+    m_linksChanged.store(true, std::memory_order_release);
+}
+
+float BandMixer::linkGain(unsigned int speakerSession, unsigned int receiverSession) const {
+    return m_publishedLinks.value(qMakePair(speakerSession, receiverSession)).gain;
+}
+
+void BandMixer::setLinkImpairments(unsigned int speakerSession, unsigned int receiverSession, float fadingDepth,
+                                   float noise) {
+    QWriteLocker locker(&m_gainLock);
+    LinkState &link = m_links[qMakePair(speakerSession, receiverSession)];
+    link.fading = qBound(0.0f, fadingDepth, 1.0f);
+    link.noise = qBound(0.0f, noise, 1.0f);
+    m_linksChanged.store(true, std::memory_order_release);
+}
+
+void BandMixer::publishLinks() {
+    // Cleared first: a change that lands during the copy sets it again
+    m_linksChanged.store(false, std::memory_order_relaxed);
+
+    // QHash is implicitly shared, so this only takes a reference; the next
+    // write to m_links detaches it and leaves the published copy untouched
+    QReadLocker locker(&m_gainLock);
+    m_publishedLinks = m_links;
+}
+
+unsigned int BandMixer::allocateStreamSession() {
+    // Wraps around within the upper half; by then the old streams are long gone
+    const unsigned int session = m_nextStreamSession;
+    m_nextStreamSession = (session == 0xFFFFFFFFu) ? FIRST_STREAM_SESSION : session + 1;
+    return session;
+}
+
+bool BandMixer::addSpeakerFrame(int channelId, ServerUser *speaker, const unsigned char *data, int size) {
+    if (!speaker || !m_mixedChannels.contains(channelId)) {
+        return false;
+    }
+
+    std::unique_ptr<OpusCodec> &decoder = m_decoders[speaker];
+    if (!decoder) {
+        decoder.reset(new OpusCodec());
+    }
+
+    // Opus packets carry up to 120 ms of audio
+    float pcm[OpusCodec::FRAME_SIZE * 6];
+    int samples = decoder->decode(data, size, pcm, OpusCodec::FRAME_SIZE * 6);
+    if (samples <= 0) {
+        return false;
+    }
+
+    // Split longer packets into 20 ms frames and zero-pad shorter ones
+    for (int offset = 0; offset < samples; offset += OpusCodec::FRAME_SIZE) {
+        float frame[OpusCodec::FRAME_SIZE] = {};
+        std::copy(pcm + offset, pcm + qMin(samples, offset + OpusCodec::FRAME_SIZE), frame);
+        addSpeakerPcm(channelId, speaker, frame);
+    }
+
+    return true;
+}
+
+bool BandMixer::addSpeakerPcm(int channelId, ServerUser *speaker, const float *pcm) {
+    if (!speaker || !m_mixedChannels.contains(channelId)) {
+        return false;
+    }
+
+    SpeakerQueue &queue = m_channels[channelId].speakers[speaker];
+    queue.frames.emplace_back(pcm, pcm + OpusCodec::FRAME_SIZE);
+
+    // Bound the latency a bursty sender can build up
+    while (queue.frames.size() > MAX_QUEUED_FRAMES) {
+        queue.frames.pop_front();
+    }
+
+    return true;
+}
+
+bool BandMixer::prepareMix(int channelId, const QList<ServerUser *> &receivers, MixJob &job) {
+    job.channelId = channelId;
+    job.sampleClock = sampleClock();
+    job.speakers.clear();
+    job.frames.clear();
+    job.groups.clear();
+    job.ends.clear();
+
+    auto channelIt = m_channels.find(channelId);
+    if (channelIt == m_channels.end()) {
+        return false;
+    }
+
+    ChannelState &state = channelIt->second;
+
+    // Take one frame from every speaker that has audio queued
+    std::vector<std::pair<ServerUser *, std::vector<float>>> active;
+    for (auto it = state.speakers.begin(); it != state.speakers.end();) {
+        if (it->second.frames.empty()) {
+            it = state.speakers.erase(it);
+            continue;
+        }
+        active.emplace_back(it->first, std::move(it->second.frames.front()));
+        it->second.frames.pop_front();
+        ++it;
+    }
+
+    // Age the bucket encoders; the ones used below are reset to zero. A job
+    // still in flight keeps its bucket alive through its own reference. Every
+    // receiver pinned to an expiring bucket was sent its end long ago.
+    for (auto it = state.buckets.begin(); it != state.buckets.end();) {
+        if (++(*it)->idleMixes <= BUCKET_IDLE_LIMIT) {
+            ++it;
+            continue;
+        }
+        for (auto pin = state.pins.begin(); pin != state.pins.end();) {
+            pin = (pin->second.bucket == *it) ? state.pins.erase(pin) : std::next(pin);
+        }
+        it = state.buckets.erase(it);
+    }
+
+    // Keep the speaker order stable so bucket keys stay stable across frames
+    std::sort(active.begin(), active.end(),
+              [](const std::pair<ServerUser *, std::vector<float>> &a,
+                 const std::pair<ServerUser *, std::vector<float>> &b) { return a.first->uiSession < b.first->uiSession; });
+
+    // Group receivers by what they hear from each speaker (quantized gain and
+    // fading depth) plus the noise on their band. The key holds one gain
+    // level per speaker, then one fading level per speaker, then the noise level.
+    const int speakerCount = static_cast<int>(active.size());
+    QHash<QByteArray, QVector<unsigned int>> groups;
+    if (speakerCount > 0) {
+        QByteArray key(2 * speakerCount + 1, 0);
+
+        for (ServerUser *receiver : receivers) {
+            bool audible = false;
+            int noiseLevel = 0;
+
+            for (int i = 0; i < speakerCount; ++i) {
+                ServerUser *speaker = active[static_cast<size_t>(i)].first;
+                int level = -1;
+                int fadingLevel = 0;
+                if (speaker != receiver) {
+                    const LinkState link = m_publishedLinks.value(qMakePair(static_cast<unsigned int>(speaker->uiSession),
+                                                                   static_cast<unsigned int>(receiver->uiSession)));
+                    level = quantizeGain(link.gain);
+                    if (level >= 0) {
+                        fadingLevel = static_cast<int>(std::lround(link.fading * FADING_LEVELS));
+                        noiseLevel = qMax(noiseLevel, static_cast<int>(std::lround(link.noise * NOISE_LEVELS)));
+                    }
+                }
+                key[i] = static_cast<char>(level);
+                key[speakerCount + i] = static_cast<char>(fadingLevel);
+                audible = audible || (level >= 0);
+            }
+            key[2 * speakerCount] = static_cast<char>(noiseLevel);
+
+            if (audible) {
+                groups[key].append(static_cast<unsigned int>(receiver->uiSession));
+            }
+        }
+    }
+
+    job.speakers.reserve(active.size());
+    job.frames.reserve(active.size());
+    for (auto &speaker : active) {
+        job.speakers.push_back(static_cast<unsigned int>(speaker.first->uiSession));
+        job.frames.push_back(std::move(speaker.second));
+    }
+
+    // Biggest mixes first, so they keep their stream when receivers split up
+    std::vector<QHash<QByteArray, QVector<unsigned int>>::const_iterator> order;
+    order.reserve(static_cast<size_t>(groups.size()));
+    for (auto it = groups.constBegin(); it != groups.constEnd(); ++it) {
+        order.push_back(it);
+    }
+    std::sort(order.begin(), order.end(), [](const QHash<QByteArray, QVector<unsigned int>>::const_iterator &a,
+                                             const QHash<QByteArray, QVector<unsigned int>>::const_iterator &b) {
+        return a.value().size() != b.value().size() ? a.value().size() > b.value().size() : a.key() < b.key();
+    });
+
+    std::vector<std::pair<std::shared_ptr<Bucket>, QVector<unsigned int>>> ends;
+    auto endStream = [&ends](const std::shared_ptr<Bucket> &bucket, unsigned int session) {
+        auto it = std::find_if(ends.begin(), ends.end(),
+                               [&bucket](const std::pair<std::shared_ptr<Bucket>, QVector<unsigned int>> &end) {
+                                   return end.first == bucket;
+                               });
+        if (it == ends.end()) {
+            ends.emplace_back(bucket, QVector<unsigned int>());
+            it = ends.end() - 1;
+        }
+        it->second.append(session);
+    };
+
+    std::vector<const Bucket *> claimed;
+    std::unordered_set<unsigned int> placed;
+    job.groups.reserve(order.size());
+    for (const auto &it : order) {
+        const QByteArray &key = it.key();
+
+        // The stream most of the group heard before, unless a bigger group
+        // already took it
+        std::shared_ptr<Bucket> bucket;
+        std::unordered_map<const Bucket *, int> votes;
+        int mostVotes = 0;
+        for (unsigned int session : it.value()) {
+            auto pin = state.pins.find(session);
+            if (pin == state.pins.end()
+                || std::find(claimed.begin(), claimed.end(), pin->second.bucket.get()) != claimed.end()) {
+                continue;
+            }
+            const int count = ++votes[pin->second.bucket.get()];
+            if (count > mostVotes || (count == mostVotes && pin->second.bucket->session < bucket->session)) {
+                bucket = pin->second.bucket;
+                mostVotes = count;
+            }
+        }
+        if (!bucket) {
+            bucket = std::make_shared<Bucket>();
+            bucket->encoder.reset(new OpusCodec());
+            bucket->session = allocateStreamSession();
+            state.buckets.push_back(bucket);
+        }
+        claimed.push_back(bucket.get());
+        bucket->idleMixes = 0;
+
+        MixGroup group;
+        group.gains.resize(active.size(), 0.0f);
+        group.fading.resize(active.size(), 0.0f);
+        for (int i = 0; i < speakerCount; ++i) {
+            int level = static_cast<signed char>(key.at(i));
+            if (level >= 0) {
+                group.gains[static_cast<size_t>(i)] = levelToGain(level);
+                group.fading[static_cast<size_t>(i)] = static_cast<float>(key.at(speakerCount + i)) / FADING_LEVELS;
+            }
+        }
+        group.noise = MAX_NOISE_AMPLITUDE * key.at(2 * speakerCount) / NOISE_LEVELS;
+        // Seeded by the stream, so the fading goes on when the mix changes
+        group.seed = bucket->session * 0x9E3779B9u;
+        group.sessions = it.value();
+        group.bucket = bucket;
+        group.frameNumber = bucket->nextFrame++;
+
+        for (unsigned int session : it.value()) {
+            Pin &pin = state.pins[session];
+            if (pin.hearing && pin.bucket != bucket) {
+                endStream(pin.bucket, session);
+            }
+            pin.bucket = bucket;
+            pin.hearing = true;
+            placed.insert(session);
+        }
+
+        job.groups.push_back(std::move(group));
+    }
+
+    // Receivers that hear nothing now, or left the channel, end their stream.
+    // They stay pinned to it, so they get it back when they hear the band again.
+    for (auto &pin : state.pins) {
+        if (pin.second.hearing && placed.find(pin.first) == placed.end()) {
+            endStream(pin.second.bucket, pin.first);
+            pin.second.hearing = false;
+        }
+    }
+
+    // An end goes out in the frame slot the stream uses anyway, or takes the
+    // next one if the stream is silent
+    job.ends.reserve(ends.size());
+    for (const auto &end : ends) {
+        StreamEnd streamEnd;
+        streamEnd.streamSession = end.first->session;
+        streamEnd.frameNumber = end.first->idleMixes == 0 ? end.first->nextFrame - 1 : end.first->nextFrame++;
+        streamEnd.sessions = end.second;
+        job.ends.push_back(std::move(streamEnd));
+    }
+
+    return !job.groups.empty() || !job.ends.empty();
+}
+
+int BandMixer::renderMix(const MixJob &job, const FrameSink &sink) {
+    float mix[OpusCodec::FRAME_SIZE];
+    int encodedBuckets = 0;
+
+    for (const MixGroup &group : job.groups) {
+        std::fill(mix, mix + OpusCodec::FRAME_SIZE, 0.0f);
+        for (size_t i = 0; i < job.frames.size(); ++i) {
+            float gain = group.gains[i];
+            if (gain <= 0.0f) {
+                continue;
+            }
+
+            const float *pcm = job.frames[i].data();
+            if (group.fading[i] <= 0.0f) {
+                for (int n = 0; n < OpusCodec::FRAME_SIZE; ++n) {
+                    mix[n] += gain * pcm[n];
+                }
+                continue;
+            }
+
+            // Slow fading, ramped across the frame so the gain never steps
+            const float start = gain * fadingGain(group, job.speakers[i], group.fading[i], job.sampleClock);
+            const float end =
+                gain * fadingGain(group, job.speakers[i], group.fading[i], job.sampleClock + OpusCodec::FRAME_SIZE);
+            const float step = (end - start) / OpusCodec::FRAME_SIZE;
+            gain = start;
+            for (int n = 0; n < OpusCodec::FRAME_SIZE; ++n) {
+                mix[n] += gain * pcm[n];
+                gain += step;
+            }
+        }
+
+        // Band noise; weak signals drown in it while strong ones stand out
+        if (group.noise > 0.0f) {
+            quint32 state = group.bucket->noiseState;
+            for (int n = 0; n < OpusCodec::FRAME_SIZE; ++n) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                mix[n] += group.noise * (static_cast<float>(state) * (2.0f / 4294967296.0f) - 1.0f);
+            }
+            group.bucket->noiseState = state;
+        }
+
+        // Scale the whole frame down instead of hard clipping overlapping speakers
+        float peak = 0.0f;
+        for (int n = 0; n < OpusCodec::FRAME_SIZE; ++n) {
+            peak = qMax(peak, std::fabs(mix[n]));
+        }
+        if (peak > 1.0f) {
+            const float scale = 1.0f / peak;
+            for (int n = 0; n < OpusCodec::FRAME_SIZE; ++n) {
+                mix[n] *= scale;
+            }
+        }
+
+        QByteArray frame = group.bucket->encoder->encode(mix, OpusCodec::FRAME_SIZE);
+        if (!frame.isEmpty()) {
+            sink(job.channelId, group.bucket->session, group.frameNumber, group.sessions, frame);
+            ++encodedBuckets;
+        }
+    }
+
+    for (const StreamEnd &end : job.ends) {
+        sink(job.channelId, end.streamSession, end.frameNumber, end.sessions, QByteArray());
+    }
+
+    return encodedBuckets;
+}
+
+float BandMixer::fadingGain(const MixGroup &group, unsigned int speakerSession, float depth, qint64 sampleClock) {
+    // Every (bucket, speaker) pair fades at its own rate between 0.1 and 0.5 Hz
+    const quint32 hash = group.seed ^ (speakerSession * 2654435761u);
+    const double rate = 0.1 + 0.4 * (hash % 1000) / 1000.0;
+    const double phase = 6.283185307179586 * ((hash >> 10) % 1000) / 1000.0;
+    const double t = static_cast<double>(sampleClock) / OpusCodec::SAMPLE_RATE;
+
+    const double swing = 0.5 * (1.0 - std::cos(6.283185307179586 * rate * t + phase));
+    return static_cast<float>(1.0 - depth * swing);
+}
+
+int BandMixer::mixChannel(int channelId, const QList<ServerUser *> &receivers, const FrameSink &sink) {
+    MixJob job;
+    if (!prepareMix(channelId, receivers, job)) {
+        return 0;
+    }
+
+    return renderMix(job, sink);
+}
+
+void BandMixer::removeUser(ServerUser *user) {
+    if (!user) {
+        return;
+    }
+
+    const unsigned int session = static_cast<unsigned int>(user->uiSession);
+    m_decoders.erase(user);
+    for (auto &channel : m_channels) {
+        channel.second.speakers.erase(user);
+        channel.second.pins.erase(session);
+    }
+
+    QWriteLocker locker(&m_gainLock);
+    for (auto it = m_links.begin(); it != m_links.end();) {
+        if (it.key().first == session || it.key().second == session) {
+            it = m_links.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    locker.unlock();
+
+    publishLinks();
+}
+
+void BandMixer::clear() {
+    m_channels.clear();
+    m_decoders.clear();
+
+    QWriteLocker locker(&m_gainLock);
+    m_links.clear();
+    m_publishedLinks.clear();
+    m_linksChanged.store(false, std::memory_order_relaxed);
+}
+
+int BandMixer::quantizeGain(float gain) const {
+    if (gain < m_minGain || gain <= 0.0f) {
+        return -1;
+    }
+    if (gain >= 1.0f) {
+        return 0;
+    }
+
+    const float db = 20.0f * std::log10(gain);
+    return qMin(126, static_cast<int>(std::lround(-db / m_gainStepDb)));
+}
+
+float BandMixer::levelToGain(int level) const {
+    return std::pow(10.0f, -level * m_gainStepDb / 20.0f);
+}
@@ -0,0 +1,441 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_BANDMIXER_H_
+#define MUMBLE_MURMUR_BANDMIXER_H_
+
+#include "OpusCodec.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class ServerUser;
+
+/**
+ * @brief The BandMixer class collapses concurrent speakers on a band channel
+ * into a single downlink stream per receiver bucket.
+ *
+ * Without mixing, every receiver on a busy band gets one UDP stream per active
+ * speaker. A real receiver hears a single passband, so for channels that have
+ * mixing enabled the server decodes each speaker, sums the speakers with the
+ * per-link gain given by the propagation model and encodes the result once.
+ *
+ * Receivers that would hear the same mix (same set of audible speakers with
+ * the same quantized gains) share a bucket, so the mix and the Opus encode are
+ * done once per bucket rather than once per receiver.
+ *
+ * The mixer is owned by the Server's voice thread. Only the link gains may be
+ * written from other threads (propagation updates run on the thread pool), so
+ * those are protected by their own lock. Readers never take it: they see the
+ * links as of the last publishLinks(), an immutable copy the server replaces
+ * while it holds its voice thread write lock. The expensive part of a frame (the
+ * mix and the encodes) is split off into a MixJob that can be rendered on a
+ * DSP worker.
+ */
+class BandMixer {
+public:
+    /**
+     * @brief Callback used to deliver a mixed frame.
+     *
+     * Receivers are identified by session so a frame rendered off the voice
+     * thread never touches a user that has disconnected in the meantime.
+     *
+     * @param channelId The band channel the frame was mixed for
+     * @param streamSession The virtual session the bucket's stream is sent as
+     * @param frameNumber The number of the frame within that stream
+     * @param sessions The sessions of all receivers in the bucket
+     * @param frame The encoded Opus frame
+     */
+    using FrameSink = std::function<void(int channelId, unsigned int streamSession, quint64 frameNumber,
+                                         const QVector<unsigned int> &sessions, const QByteArray &frame)>;
+
+    /**
+     * @brief Sessions of the streams the mixer sends start here, far above
+     * the sessions of real users.
+     */
+    static const unsigned int FIRST_STREAM_SESSION = 0x80000000u;
+
+    /**
+     * @brief Encoder state of one bucket, shared between consecutive mix jobs.
+     *
+     * Each bucket is one downlink stream with its own virtual session, so
+     * clients keep one decoder and jitter buffer per mix.
+     */
+    struct Bucket {
+        std::unique_ptr<OpusCodec> encoder;
+        unsigned int session = 0; ///< Virtual session of the stream
+        quint64 nextFrame = 0; ///< Number of the next frame; advanced by prepareMix()
+        int idleMixes = 0;
+        quint32 noiseState = 0x9E3779B9u; ///< Noise generator state
+    };
+
+    /**
+     * @brief One distinct mix within a channel.
+     */
+    struct MixGroup {
+        std::vector<float> gains; ///< Linear gain per speaker frame (0 = not audible)
+        std::vector<float> fading; ///< Fading depth per speaker frame (0 = steady)
+        float noise = 0.0f; ///< Amplitude of the band noise added to the mix
+        quint32 seed = 0; ///< Decorrelates the fading of different buckets
+        QVector<unsigned int> sessions; ///< Receivers of this mix
+        std::shared_ptr<Bucket> bucket; ///< Encoder for this mix
+        quint64 frameNumber = 0; ///< Number of this frame in the bucket's stream
+    };
+
+    /**
+     * @brief Receivers that stop hearing a stream with this frame.
+     *
+     * They get an empty last frame on the stream, so their clients end it
+     * cleanly instead of waiting for more audio.
+     */
+    struct StreamEnd {
+        unsigned int streamSession = 0;
+        quint64 frameNumber = 0;
+        QVector<unsigned int> sessions;
+    };
+
+    /**
+     * @brief Everything needed to render one 20 ms frame of a channel.
+     *
+     * Produced on the voice thread by prepareMix() and self-contained, so it
+     * can be rendered on another thread.
+     */
+    struct MixJob {
+        int channelId = -1;
+        qint64 sampleClock = 0; ///< Mixer sample clock at the start of the frame
+        std::vector<unsigned int> speakers; ///< Session of each speaker frame
+        std::vector<std::vector<float>> frames; ///< One PCM frame per active speaker
+        std::vector<MixGroup> groups;
+        std::vector<StreamEnd> ends;
+    };
+
+    /**
+     * @brief Constructor for BandMixer.
+     */
+    BandMixer();
+
+    /**
+     * @brief Destructor for BandMixer.
+     */
+    ~BandMixer();
+
+    /**
+     * @brief Enable or disable mixing for a band channel.
+     *
+     * Mixing is silently ignored when the server was built without Opus.
+     *
+     * @param channelId The channel ID
+     * @param enabled Whether the channel should be mixed
+     */
+    void setMixingEnabled(int channelId, bool enabled);
+
+    /**
+     * @brief Check if mixing is enabled for a channel.
+     *
+     * @param channelId The channel ID
+     * @return True if incoming audio on the channel is mixed
+     */
+    bool isMixingEnabled(int channelId) const;
+
+    /**
+     * @brief Check if any channel has mixing enabled.
+     *
+     * @return True if at least one channel is mixed
+     */
+    bool hasMixedChannels() const { return !m_mixedChannels.isEmpty(); }
+
+    /**
+     * @brief Get the channels that have mixing enabled.
+     *
+     * @return The set of mixed channel IDs
+     */
+    const QSet<int> &mixedChannels() const { return m_mixedChannels; }
+
+    /**
+     * @brief Set the gain quantization step.
+     *
+     * Receivers whose link gains differ by less than one step share a bucket.
+     *
+     * @param stepDb The step size in dB
+     */
+    void setGainStep(float stepDb);
+
+    /**
+     * @brief Set the minimum audible link gain.
+     *
+     * Speakers below this gain are left out of a receiver's mix entirely.
+     *
+     * @param minGain The minimum linear gain (0.0 to 1.0)
+     */
+    void setMinimumGain(float minGain);
+
+    /**
+     * @brief Get the gain below which a speaker is inaudible.
+     *
+     * @return The minimum linear gain
+     */
+    float minimumGain() const { return m_minGain; }
+
+    /**
+     * @brief Set the gain from a speaker to a receiver.
+     *
+     * Links without an explicit gain are mixed at unity gain.
+     *
+     * @param speakerSession The speaker's session ID
+     * @param receiverSession The receiver's session ID
+     * @param gain The linear gain (0.0 to 1.0)
+     */
+    void setLinkGain(unsigned int speakerSession, unsigned int receiverSession, float gain);
+
+    /**
+     * @brief Get the gain from a speaker to a receiver.
+     *
+     * Reads the published links without locking, so it is cheap enough to
+     * call per receiver per packet. Call it where publishLinks() cannot run
+     * (on the server, with the voice thread read lock held).
+     *
+     * @param speakerSession The speaker's session ID
+     * @param receiverSession The receiver's session ID
+     * @return The linear gain
+     */
+    float linkGain(unsigned int speakerSession, unsigned int receiverSession) const;
+
+    /**
+     * @brief Set the propagation impairments from a speaker to a receiver.
+     *
+     * @param speakerSession The speaker's session ID
+     * @param receiverSession The receiver's session ID
+     * @param fadingDepth Depth of the slow fading (QSB) on the link (0.0 to 1.0)
+     * @param noise Band noise heard by the receiver on this link (0.0 to 1.0)
+     */
+    void setLinkImpairments(unsigned int speakerSession, unsigned int receiverSession, float fadingDepth, float noise);
+
+    /**
+     * @brief Check whether links changed since they were last published.
+     *
+     * @return True if publishLinks() has something to publish
+     */
+    bool linksChanged() const { return m_linksChanged.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Make the link gains and impairments set so far visible to readers.
+     *
+     * linkGain() and prepareMix() only see published links. Publishing
+     * replaces the copy they read, so no reader may run at the same time (on
+     * the server, call it with the voice thread write lock held).
+     */
+    void publishLinks();
+
+    /**
+     * @brief Allocate a virtual session for a stream the server generates.
+     *
+     * Used for the mixer's buckets and for other server-generated audio, so
+     * no two streams share a session. Must be called on the voice thread.
+     *
+     * @return A session at or above FIRST_STREAM_SESSION
+     */
+    unsigned int allocateStreamSession();
+
+    /**
+     * @brief Get the mixer's sample clock.
+     *
+     * Counts samples at OpusCodec::SAMPLE_RATE since the mixer was created and
+     * advances by one frame on every call to advanceClock().
+     *
+     * @return The sample clock at the start of the next frame
+     */
+    qint64 sampleClock() const { return m_sampleClock.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Advance the sample clock by one frame.
+     *
+     * Called by the voice thread once per mixing tick.
+     */
+    void advanceClock() { m_sampleClock.fetch_add(OpusCodec::FRAME_SIZE, std::memory_order_relaxed); }
+
+    /**
+     * @brief Queue an incoming Opus frame from a speaker on a mixed channel.
+     *
+     * The frame is decoded immediately and held until the next mix.
+     *
+     * @param channelId The channel the speaker is transmitting on
+     * @param speaker The speaker
+     * @param data The encoded Opus frame
+     * @param size The size of the encoded frame in bytes
+     * @return True if the frame was accepted
+     */
+    bool addSpeakerFrame(int channelId, ServerUser *speaker, const unsigned char *data, int size);
+
+    /**
+     * @brief Queue a PCM frame from a speaker on a mixed channel.
+     *
+     * Used for audio the server generates itself.
+     *
+     * @param channelId The channel the speaker is transmitting on
+     * @param speaker The speaker
+     * @param pcm OpusCodec::FRAME_SIZE mono samples
+     * @return True if the frame was accepted
+     */
+    bool addSpeakerPcm(int channelId, ServerUser *speaker, const float *pcm);
+
+    /**
+     * @brief Collect one 20 ms frame for a channel without mixing it.
+     *
+     * Consumes at most one queued frame per speaker and groups the receivers
+     * into buckets. Must be called on the voice thread.
+     *
+     * A receiver stays on the stream it hears while its mix changes (a
+     * speaker starts, fades or stops), so the encoder state carries over.
+     * When receivers that heard one stream split into different mixes, the
+     * largest group keeps the stream and the others end it and move on.
+     *
+     * The speaker frames are handed over even when no receiver can hear them,
+     * so the job can still be used for analysis (e.g. the CW skimmer).
+     *
+     * @param channelId The channel to mix
+     * @param receivers Everyone who should hear the channel
+     * @param job Receives the work to render
+     * @return True if there is anything to render
+     */
+    bool prepareMix(int channelId, const QList<ServerUser *> &receivers, MixJob &job);
+
+    /**
+     * @brief Mix and encode a prepared frame.
+     *
+     * May run on any thread, but jobs of the same channel must be rendered one
+     * at a time and in order, since they share the bucket encoders.
+     *
+     * @param job The prepared frame
+     * @param sink Callback that receives one encoded frame per bucket, and an
+     *             empty frame for every stream that ends for some receivers
+     * @return The number of buckets that were encoded
+     */
+    static int renderMix(const MixJob &job, const FrameSink &sink);
+
+    /**
+     * @brief Mix one 20 ms frame for a channel and deliver it.
+     *
+     * Equivalent to prepareMix() followed by renderMix() on the calling thread.
+     *
+     * @param channelId The channel to mix
+     * @param receivers Everyone who should hear the channel
+     * @param sink Callback that receives one encoded frame per bucket
+     * @return The number of buckets that were encoded
+     */
+    int mixChannel(int channelId, const QList<ServerUser *> &receivers, const FrameSink &sink);
+
+    /**
+     * @brief Forget all state associated with a user.
+     *
+     * Also publishes the links, so a reused session does not inherit the
+     * user's gains; see publishLinks() for when it may be called.
+     *
+     * @param user The user that left
+     */
+    void removeUser(ServerUser *user);
+
+    /**
+     * @brief Drop all queued audio, codecs and link gains.
+     */
+    void clear();
+
+private:
+    Q_DISABLE_COPY(BandMixer)
+
+    // Maximum number of frames held per speaker before the oldest is dropped
+    static const int MAX_QUEUED_FRAMES = 3;
+
+    // Number of idle mixes after which a bucket encoder is released
+    static const int BUCKET_IDLE_LIMIT = 50;
+
+    struct SpeakerQueue {
+        std::deque<std::vector<float>> frames;
+    };
+
+    // The stream a receiver was given last, and whether it heard it in the
+    // last frame
+    struct Pin {
+        std::shared_ptr<Bucket> bucket;
+        bool hearing = false;
+    };
+
+    struct ChannelState {
+        std::unordered_map<ServerUser *, SpeakerQueue> speakers;
+        std::vector<std::shared_ptr<Bucket>> buckets;
+        std::unordered_map<unsigned int, Pin> pins; // Keyed by receiver session
+    };
+
+    QSet<int> m_mixedChannels; // Channels with mixing enabled
+    std::unordered_map<int, ChannelState> m_channels; // Per-channel mixing state
+    std::unordered_map<ServerUser *, std::unique_ptr<OpusCodec>> m_decoders; // Per-speaker decoder state
+
+    // Maximum amplitude of the band noise at a link noise of 1.0
+    static constexpr float MAX_NOISE_AMPLITUDE = 0.1f;
+
+    // Quantization steps for fading depth and noise in the bucket key
+    static const int FADING_LEVELS = 4;
+    static const int NOISE_LEVELS = 8;
+
+    struct LinkState {
+        float gain = 1.0f;
+        float fading = 0.0f;
+        float noise = 0.0f;
+    };
+
+    using LinkTable = QHash<QPair<unsigned int, unsigned int>, LinkState>; // (speaker, receiver) -> link
+
+    LinkTable m_links; // Written by setLinkGain() and setLinkImpairments()
+    mutable QReadWriteLock m_gainLock; // Protects m_links
+    LinkTable m_publishedLinks; // Read without locking; only replaced by publishLinks()
+    std::atomic<bool> m_linksChanged; // m_links differs from m_publishedLinks
+
+    std::atomic<qint64> m_sampleClock; // Advanced by the voice thread, read anywhere
+
+    unsigned int m_nextStreamSession; // Next virtual session handed out
+
+    float m_gainStepDb; // Quantization step for bucketing
+    float m_minGain; // Gains below this are inaudible
+
+    /**
+     * @brief Quantize a linear gain to a bucket level.
+     *
+     * @param gain The linear gain
+     * @return The quantized level, or -1 if the speaker is inaudible
+     */
+    int quantizeGain(float gain) const;
+
+    /**
+     * @brief Convert a bucket level back to a linear gain.
+     *
+     * @param level The quantized level
+     * @return The linear gain used for mixing
+     */
+    float levelToGain(int level) const;
+
+    /**
+     * @brief Get the fading multiplier of a speaker within a bucket.
+     *
+     * @param group The bucket
+     * @param speakerSession The speaker's session ID
+     * @param depth The fading depth (0.0 to 1.0)
+     * @param sampleClock The point in time
+     * @return A gain between 1.0 - depth and 1.0
+     */
+    static float fadingGain(const MixGroup &group, unsigned int speakerSession, float depth, qint64 sampleClock);
+};
+
+#endif // MUMBLE_MURMUR_BANDMIXER_H_
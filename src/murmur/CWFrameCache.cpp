@@ -0,0 +1,393 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CWFrameCache.h"
+#include "MorseCode.h"
+#include "OpusCodec.h"
+#include "ToneBank.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QReadLocker>
+#include <QtCore/QSaveFile>
+#include <QtCore/QWriteLocker>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace {
+    // File layout, all fields little-endian:
+    //   header:  magic, version, sample rate, frame size, bitrate, rise time (us), entry count, reserved
+    //   index:   entry count x (key, offset from file start, size), sorted by key
+    //   data:    one blob per entry, 4-byte aligned
+    // A blob is a frame count, frame count + 1 offsets relative to the end of
+    // the offset table, and the frames.
+    const quint32 FILE_MAGIC = 0x43465743; // "CWFC"
+    const quint32 FILE_VERSION = 1;
+    const int HEADER_SIZE = 8 * 4;
+    const int INDEX_ENTRY_SIZE = 3 * 4;
+
+    const float TONE_AMPLITUDE = 0.5f;
+
+    quint32 readU32(const uchar *p) { return qFromLittleEndian<quint32>(p); }
+
+    void appendU32(QByteArray &out, quint32 value) {
+        uchar bytes[4];
+        qToLittleEndian(value, bytes);
+        out.append(reinterpret_cast<const char *>(bytes), 4);
+    }
+}
+
+int CWFrameCache::FrameSequence::frameCount() const {
+    return m_blob ? static_cast<int>(readU32(m_blob)) : 0;
+}
+
+const unsigned char *CWFrameCache::FrameSequence::frame(int index, int &size) const {
+    const uchar *offsets = m_blob + 4;
+    const quint32 begin = readU32(offsets + 4 * index);
+    const quint32 end = readU32(offsets + 4 * (index + 1));
+    size = static_cast<int>(end - begin);
+    return offsets + 4 * (frameCount() + 1) + begin;
+}
+
+CWFrameCache::CWFrameCache(float riseTimeMs, int bitrate)
+    : m_riseTimeMs(riseTimeMs)
+    , m_bitrate(bitrate)
+    , m_index(nullptr)
+    , m_mapped(nullptr)
+    , m_mappedCount(0)
+    , m_dirty(false) {
+}
+
+CWFrameCache::~CWFrameCache() {
+    if (m_mapped) {
+        m_file.unmap(const_cast<uchar *>(m_mapped));
+    }
+}
+
+bool CWFrameCache::load(const QString &path) {
+    QWriteLocker locker(&m_lock);
+
+    if (m_mapped) {
+        qWarning() << "CWFrameCache: A cache file is already mapped";
+        return false;
+    }
+
+    m_file.setFileName(path);
+    if (!m_file.exists()) {
+        return false;
+    }
+    if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < HEADER_SIZE) {
+        qWarning() << "CWFrameCache: Cannot read" << path;
+        m_file.close();
+        return false;
+    }
+
+    // The file stays open for as long as it is mapped; closing it unmaps it
+    const qint64 fileSize = m_file.size();
+    uchar *data = m_file.map(0, fileSize);
+    if (!data) {
+        qWarning() << "CWFrameCache: Cannot map" << path;
+        m_file.close();
+        return false;
+    }
+
+    const quint32 count = readU32(data + 24);
+    bool valid = readU32(data) == FILE_MAGIC && readU32(data + 4) == FILE_VERSION
+                 && readU32(data + 8) == static_cast<quint32>(OpusCodec::SAMPLE_RATE)
+                 && readU32(data + 12) == static_cast<quint32>(OpusCodec::FRAME_SIZE)
+                 && readU32(data + 16) == static_cast<quint32>(m_bitrate)
+                 && readU32(data + 20) == static_cast<quint32>(std::lround(m_riseTimeMs * 1000.0f))
+                 && HEADER_SIZE + static_cast<qint64>(count) * INDEX_ENTRY_SIZE <= fileSize;
+
+    // Check every entry once so lookups can trust the file
+    const uchar *index = data + HEADER_SIZE;
+    for (quint32 i = 0; valid && i < count; ++i) {
+        const uchar *entry = index + i * INDEX_ENTRY_SIZE;
+        const quint64 offset = readU32(entry + 4);
+        const quint64 size = readU32(entry + 8);
+        valid = (i == 0 || readU32(entry - INDEX_ENTRY_SIZE) < readU32(entry)) && size >= 8
+                && offset + size <= static_cast<quint64>(fileSize);
+        if (!valid) {
+            break;
+        }
+
+        const quint64 frames = readU32(data + offset);
+        const quint64 tableSize = 4 + 4 * (frames + 1);
+        valid = frames > 0 && tableSize <= size && readU32(data + offset + 4) == 0;
+        for (quint64 f = 1; valid && f <= frames; ++f) {
+            const quint32 end = readU32(data + offset + 4 + 4 * f);
+            valid = end >= readU32(data + offset + 4 * f) && tableSize + end <= size;
+        }
+    }
+
+    if (!valid) {
+        qWarning() << "CWFrameCache: Ignoring" << path << "(different format or settings), rebuilding on demand";
+        m_file.unmap(data);
+        m_file.close();
+        return false;
+    }
+
+    m_mapped = data;
+    m_index = index;
+    m_mappedCount = count;
+    qDebug() << "CWFrameCache: Mapped" << count << "sequences from" << path;
+
+    return true;
+}
+
+bool CWFrameCache::save(const QString &path) const {
+    QWriteLocker locker(&m_lock);
+
+    // Merge the mapped and the built entries into one sorted index
+    std::vector<std::pair<quint32, std::pair<const uchar *, quint32>>> entries;
+    entries.reserve(m_mappedCount + static_cast<size_t>(m_built.size()));
+    for (quint32 i = 0; i < m_mappedCount; ++i) {
+        const uchar *entry = m_index + i * INDEX_ENTRY_SIZE;
+        entries.push_back({ readU32(entry), { m_mapped + readU32(entry + 4), readU32(entry + 8) } });
+    }
+    for (auto it = m_built.constBegin(); it != m_built.constEnd(); ++it) {
+        entries.push_back({ it.key(),
+                            { reinterpret_cast<const uchar *>(it.value().constData()),
+                              static_cast<quint32>(it.value().size()) } });
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const std::pair<quint32, std::pair<const uchar *, quint32>> &a,
+                 const std::pair<quint32, std::pair<const uchar *, quint32>> &b) { return a.first < b.first; });
+
+    QByteArray header;
+    appendU32(header, FILE_MAGIC);
+    appendU32(header, FILE_VERSION);
+    appendU32(header, OpusCodec::SAMPLE_RATE);
+    appendU32(header, OpusCodec::FRAME_SIZE);
+    appendU32(header, static_cast<quint32>(m_bitrate));
+    appendU32(header, static_cast<quint32>(std::lround(m_riseTimeMs * 1000.0f)));
+    appendU32(header, static_cast<quint32>(entries.size()));
+    appendU32(header, 0);
+
+    quint32 offset = static_cast<quint32>(HEADER_SIZE + entries.size() * INDEX_ENTRY_SIZE);
+    for (const auto &entry : entries) {
+        appendU32(header, entry.first);
+        appendU32(header, offset);
+        appendU32(header, entry.second.second);
+        offset += (entry.second.second + 3) & ~3u;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "CWFrameCache: Cannot write" << path;
+        return false;
+    }
+
+    static const char padding[4] = {};
+    file.write(header);
+    for (const auto &entry : entries) {
+        file.write(reinterpret_cast<const char *>(entry.second.first), entry.second.second);
+        file.write(padding, ((entry.second.second + 3) & ~3u) - entry.second.second);
+    }
+
+    if (!file.commit()) {
+        qWarning() << "CWFrameCache: Failed to write" << path;
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+CWFrameCache::FrameSequence CWFrameCache::sequence(QChar character, int wpm, int farnsworthWpm, int pitchHz) {
+    quint32 key;
+    if (!packKey(character, wpm, farnsworthWpm, pitchHz, key)) {
+        return FrameSequence();
+    }
+
+    {
+        QReadLocker locker(&m_lock);
+        if (const uchar *blob = findMapped(key)) {
+            return FrameSequence(blob);
+        }
+        auto it = m_built.constFind(key);
+        if (it != m_built.constEnd()) {
+            return FrameSequence(reinterpret_cast<const uchar *>(it.value().constData()));
+        }
+    }
+
+    // Encode without holding the lock; if another thread built the same
+    // sequence meanwhile, its copy wins and this one is dropped
+    QByteArray blob = build(key);
+    if (blob.isEmpty()) {
+        return FrameSequence();
+    }
+
+    QWriteLocker locker(&m_lock);
+    auto it = m_built.find(key);
+    if (it == m_built.end()) {
+        it = m_built.insert(key, blob);
+        m_dirty = true;
+    }
+
+    // The blob is never modified again, so its data stays where it is
+    return FrameSequence(reinterpret_cast<const uchar *>(it.value().constData()));
+}
+
+QVector<CWFrameCache::FrameSequence> CWFrameCache::sequencesForText(const QString &text, int wpm, int farnsworthWpm,
+                                                                    int pitchHz) {
+    QVector<FrameSequence> sequences;
+    bool pendingSpace = false;
+
+    for (const QChar c : text) {
+        if (c.isSpace()) {
+            pendingSpace = !sequences.isEmpty();
+            continue;
+        }
+
+        FrameSequence character = sequence(c, wpm, farnsworthWpm, pitchHz);
+        if (character.isNull()) {
+            continue;
+        }
+
+        if (pendingSpace) {
+            FrameSequence space = sequence(QLatin1Char(' '), wpm, farnsworthWpm, pitchHz);
+            if (!space.isNull()) {
+                sequences.append(space);
+            }
+            pendingSpace = false;
+        }
+        sequences.append(character);
+    }
+
+    return sequences;
+}
+
+int CWFrameCache::size() const {
+    QReadLocker locker(&m_lock);
+    return static_cast<int>(m_mappedCount) + m_built.size();
+}
+
+bool CWFrameCache::isDirty() const {
+    QReadLocker locker(&m_lock);
+    return m_dirty;
+}
+
+bool CWFrameCache::packKey(QChar character, int wpm, int farnsworthWpm, int pitchHz, quint32 &key) {
+    // Normalize first so equivalent requests share one sequence
+    const ushort unicode = character.toUpper().unicode();
+    if (unicode > 0xFF) {
+        // The key holds one Latin-1 character, and Morse code has no other
+        // characters; truncating would send some Latin-1 letter instead
+        return false;
+    }
+    const quint32 c = unicode;
+    const int speed = qBound(MIN_WPM, wpm, MAX_WPM);
+    const int effective = qBound(MIN_WPM, farnsworthWpm, speed);
+    const int pitch = qBound(MIN_PITCH, pitchHz, MAX_PITCH);
+    const quint32 pitchStep = static_cast<quint32>((pitch + PITCH_STEP / 2) / PITCH_STEP);
+
+    key = (c << 24) | (static_cast<quint32>(speed) << 16) | (static_cast<quint32>(effective) << 8) | pitchStep;
+    return true;
+}
+
+const uchar *CWFrameCache::findMapped(quint32 key) const {
+    // Binary search over the sorted index in the mapped file
+    quint32 low = 0;
+    quint32 high = m_mappedCount;
+    while (low < high) {
+        const quint32 mid = low + (high - low) / 2;
+        const uchar *entry = m_index + mid * INDEX_ENTRY_SIZE;
+        const quint32 entryKey = readU32(entry);
+        if (entryKey == key) {
+            return m_mapped + readU32(entry + 4);
+        }
+        if (entryKey < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return nullptr;
+}
+
+QByteArray CWFrameCache::build(quint32 key) const {
+    const QChar character = QChar::fromLatin1(static_cast<char>(key >> 24));
+    const int wpm = static_cast<int>((key >> 16) & 0xFF);
+    const int farnsworthWpm = static_cast<int>((key >> 8) & 0xFF);
+    const int pitchHz = static_cast<int>(key & 0xFF) * PITCH_STEP;
+
+    // PARIS timing: a dit is 1.2 / WPM seconds. Farnsworth keeps the elements
+    // at the character speed and stretches the gaps to reach the effective
+    // speed (ARRL formula, 19 gap units per PARIS).
+    const double dit = 1.2 / wpm;
+    double characterGap = 3.0 * dit;
+    double wordGap = 7.0 * dit;
+    if (farnsworthWpm < wpm) {
+        const double delay = (60.0 * wpm - 37.2 * farnsworthWpm) / (static_cast<double>(wpm) * farnsworthWpm);
+        characterGap = 3.0 * delay / 19.0;
+        wordGap = 7.0 * delay / 19.0;
+    }
+
+    const double frameSeconds = static_cast<double>(OpusCodec::FRAME_SIZE) / OpusCodec::SAMPLE_RATE;
+    std::vector<std::pair<qint64, bool>> edges;
+    int frames;
+
+    if (character == QLatin1Char(' ')) {
+        // A word gap follows a character gap, so only the difference is added
+        frames = qMax(1, static_cast<int>(std::lround((wordGap - characterGap) / frameSeconds)));
+    } else {
+        const QString pattern = MorseCode::encode(character);
+        if (pattern.isEmpty()) {
+            return QByteArray();
+        }
+
+        double t = 0.0;
+        for (int i = 0; i < pattern.size(); ++i) {
+            if (i > 0) {
+                t += dit;
+            }
+            edges.push_back({ static_cast<qint64>(std::lround(t * OpusCodec::SAMPLE_RATE)), true });
+            t += (pattern.at(i) == QLatin1Char('.')) ? dit : 3.0 * dit;
+            edges.push_back({ static_cast<qint64>(std::lround(t * OpusCodec::SAMPLE_RATE)), false });
+        }
+
+        // Round the trailing gap to whole frames, but always leave room for
+        // the key-up edge and the encoder's lookahead
+        const int minimum = static_cast<int>(std::ceil((t + dit) / frameSeconds));
+        frames = qMax(minimum, static_cast<int>(std::lround((t + characterGap) / frameSeconds)));
+    }
+
+    ToneBank tones(OpusCodec::SAMPLE_RATE, m_riseTimeMs);
+    const int slot = tones.allocate(static_cast<float>(pitchHz), TONE_AMPLITUDE);
+    OpusCodec encoder(m_bitrate);
+
+    QByteArray offsets;
+    QByteArray payload;
+    appendU32(offsets, 0);
+
+    float pcm[OpusCodec::FRAME_SIZE];
+    size_t nextEdge = 0;
+    for (int i = 0; i < frames; ++i) {
+        const qint64 frameStart = static_cast<qint64>(i) * OpusCodec::FRAME_SIZE;
+        while (nextEdge < edges.size() && edges[nextEdge].first < frameStart + OpusCodec::FRAME_SIZE) {
+            tones.key(slot, static_cast<int>(edges[nextEdge].first - frameStart), edges[nextEdge].second);
+            ++nextEdge;
+        }
+        tones.render(slot, pcm, OpusCodec::FRAME_SIZE);
+
+        QByteArray frame = encoder.encode(pcm, OpusCodec::FRAME_SIZE);
+        if (frame.isEmpty()) {
+            return QByteArray();
+        }
+        payload.append(frame);
+        appendU32(offsets, static_cast<quint32>(payload.size()));
+    }
+
+    QByteArray blob;
+    blob.reserve(4 + offsets.size() + payload.size());
+    appendU32(blob, static_cast<quint32>(frames));
+    blob.append(offsets);
+    blob.append(payload);
+    return blob;
+}
@@ -0,0 +1,189 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CWFRAMECACHE_H_
+#define MUMBLE_MURMUR_CWFRAMECACHE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+/**
+ * @brief The CWFrameCache class holds pre-encoded Opus frames of Morse characters.
+ *
+ * Code practice sends the same characters at a handful of speeds and pitches
+ * over and over. The cache encodes each (character, speed, Farnsworth speed,
+ * pitch) combination once, as a sequence of 20 ms Opus frames that starts
+ * with the first key-down and ends with the gap that follows the character.
+ * A practice stream is then just the concatenation of cached sequences, with
+ * no synthesis or encoding at broadcast time.
+ *
+ * Every sequence is encoded from a fresh encoder and starts and ends in
+ * silence, so sequences can be played back to back. Character gaps are
+ * rounded to whole frames, which shifts them by at most 10 ms.
+ *
+ * Sequences are built lazily on first use. save() writes all sequences into
+ * a single file (a sorted index followed by the frame data) that load() maps
+ * into memory at the next start, so the cache survives restarts without
+ * being parsed or copied.
+ *
+ * Lookups and builds may happen on any thread. Sequences are never removed,
+ * so a FrameSequence stays valid for the lifetime of the cache.
+ */
+class CWFrameCache {
+public:
+    /// Character speed limits in words per minute
+    static constexpr int MIN_WPM = 5;
+    static constexpr int MAX_WPM = 60;
+
+    /// Pitch limits in Hz; pitches are rounded to PITCH_STEP
+    static constexpr int MIN_PITCH = 300;
+    static constexpr int MAX_PITCH = 1500;
+    static constexpr int PITCH_STEP = 10;
+
+    /**
+     * @brief A cached sequence of Opus frames.
+     *
+     * A cheap view into the cache; copy it freely.
+     */
+    class FrameSequence {
+    public:
+        FrameSequence() = default;
+
+        /**
+         * @brief Check whether the sequence refers to any frames.
+         *
+         * @return True for a sequence that was not found or could not be built
+         */
+        bool isNull() const { return !m_blob; }
+
+        /**
+         * @brief Get the number of 20 ms frames in the sequence.
+         *
+         * @return The number of frames
+         */
+        int frameCount() const;
+
+        /**
+         * @brief Get one encoded frame.
+         *
+         * @param index The frame index (0 to frameCount() - 1)
+         * @param size Receives the size of the frame in bytes
+         * @return The frame data
+         */
+        const unsigned char *frame(int index, int &size) const;
+
+    private:
+        friend class CWFrameCache;
+        explicit FrameSequence(const unsigned char *blob) : m_blob(blob) {}
+
+        const unsigned char *m_blob = nullptr;
+    };
+
+    /**
+     * @brief Constructor for CWFrameCache.
+     *
+     * @param riseTimeMs Rise and fall time of the keying envelope
+     * @param bitrate The Opus bitrate of the cached frames
+     */
+    explicit CWFrameCache(float riseTimeMs = 5.0f, int bitrate = 16000);
+
+    /**
+     * @brief Destructor for CWFrameCache.
+     */
+    ~CWFrameCache();
+
+    /**
+     * @brief Map a cache file into memory.
+     *
+     * Must be called before the first lookup. A file that was built with a
+     * different rise time, bitrate or format is ignored and rebuilt lazily.
+     *
+     * @param path The cache file
+     * @return True if the file was mapped
+     */
+    bool load(const QString &path);
+
+    /**
+     * @brief Write every cached sequence to a file.
+     *
+     * The file is replaced atomically, so it may be the file that is mapped.
+     *
+     * @param path The cache file
+     * @return True if the file was written
+     */
+    bool save(const QString &path) const;
+
+    /**
+     * @brief Get the frames of a character, building them if needed.
+     *
+     * A space yields the extra silence between two words.
+     *
+     * @param character The character to send
+     * @param wpm The character speed in words per minute
+     * @param farnsworthWpm The effective speed; spacing is stretched when it
+     * is lower than wpm
+     * @param pitchHz The tone pitch
+     * @return The frames, or a null sequence if the character has no Morse
+     * code (which includes everything beyond Latin-1) or Opus is not available
+     */
+    FrameSequence sequence(QChar character, int wpm, int farnsworthWpm, int pitchHz);
+
+    /**
+     * @brief Get the frames of a text, one sequence per character.
+     *
+     * Characters without Morse code are skipped; runs of whitespace become
+     * one word gap.
+     *
+     * @param text The text to send
+     * @param wpm The character speed in words per minute
+     * @param farnsworthWpm The effective speed
+     * @param pitchHz The tone pitch
+     * @return The sequences in order
+     */
+    QVector<FrameSequence> sequencesForText(const QString &text, int wpm, int farnsworthWpm, int pitchHz);
+
+    /**
+     * @brief Get the number of cached sequences.
+     *
+     * @return Mapped plus newly built sequences
+     */
+    int size() const;
+
+    /**
+     * @brief Check whether sequences were built since the last load or save.
+     *
+     * @return True if save() would add anything
+     */
+    bool isDirty() const;
+
+private:
+    Q_DISABLE_COPY(CWFrameCache)
+
+    mutable QReadWriteLock m_lock;
+
+    float m_riseTimeMs;
+    int m_bitrate;
+
+    // The mapped file
+    QFile m_file;
+    const uchar *m_index; // Sorted index entries in the mapped file
+    const uchar *m_mapped;
+    quint32 m_mappedCount;
+
+    // Sequences built since the file was mapped, keyed like the index
+    QHash<quint32, QByteArray> m_built;
+    mutable bool m_dirty;
+
+    static bool packKey(QChar character, int wpm, int farnsworthWpm, int pitchHz, quint32 &key);
+    const uchar *findMapped(quint32 key) const;
+    QByteArray build(quint32 key) const;
+};
+
+#endif // MUMBLE_MURMUR_CWFRAMECACHE_H_
@@ -0,0 +1,456 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CWSkimmer.h"
+#include "MorseCode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace {
+    const double TWO_PI = 6.283185307179586;
+
+    // The filter bank runs at 8 kHz
+    const int BANK_RATE = 8000;
+
+    // 160-point window: 50 Hz bins, 20 ms of smoothing
+    const int WINDOW = 160;
+
+    // The detectors are updated every 40 samples (5 ms)
+    const int HOP = 40;
+    const float HOP_MS = 1000.0f * HOP / BANK_RATE;
+
+    // Bins 6 to 30 cover 300 Hz to 1.5 kHz
+    const int FIRST_BIN = 6;
+    const int BIN_COUNT = 25;
+
+    // Damping keeps the sliding DFT stable against rounding
+    const float DAMPING = 0.99995f;
+
+    // A bin needs this much peak-to-floor ratio before it is decoded (12 dB)
+    const float MIN_SNR = 4.0f;
+
+    // Strong signals leak into distant bins through the DFT sidelobes; bins
+    // more than 30 dB below the strongest one on the band are not spotted
+    const float DYNAMIC_RANGE = 0.03f;
+
+    // Dit length limits in hops: 60 WPM down to 4 WPM
+    const float MIN_DIT = 4.0f;
+    const float MAX_DIT = 60.0f;
+
+    // Number of recent marks used to estimate the dit length
+    const int RECENT_MARKS = 16;
+
+    // Speaker streams that have been quiet this long are dropped
+    const int SPEAKER_IDLE_HOPS = 60 * 1000 / 5;
+
+    // A speaker's decoder moves to another bin once it is this much stronger
+    const float BIN_SWITCH_RATIO = 2.0f;
+}
+
+/**
+ * @brief Decimator plus sliding DFT over the CW passband.
+ *
+ * The bins are kept as parallel arrays so the per-sample update runs across
+ * all bins in one vectorizable loop.
+ */
+class CWSkimmer::FilterBank {
+public:
+    explicit FilterBank(int decimation)
+        : m_decimation(decimation)
+        , m_window(WINDOW, 0.0f)
+        , m_re(BIN_COUNT, 0.0f)
+        , m_im(BIN_COUNT, 0.0f)
+        , m_cos(BIN_COUNT)
+        , m_sin(BIN_COUNT)
+        , m_magnitudes(BIN_COUNT, 0.0f) {
+        for (int k = 0; k < BIN_COUNT; ++k) {
+            const double w = TWO_PI * (FIRST_BIN + k) / WINDOW;
+            m_cos[static_cast<size_t>(k)] = static_cast<float>(DAMPING * std::cos(w));
+            m_sin[static_cast<size_t>(k)] = static_cast<float>(DAMPING * std::sin(w));
+        }
+        m_dampingN = std::pow(DAMPING, static_cast<float>(WINDOW));
+    }
+
+    /**
+     * @brief Feed input samples; calls onHop with the bin magnitudes every hop.
+     */
+    void process(const float *pcm, int frames, const std::function<void(const float *)> &onHop) {
+        for (int i = 0; i < frames; ++i) {
+            // Boxcar average as the anti-aliasing filter; CW tones sit far below 4 kHz
+            m_accumulator += pcm[i];
+            if (++m_accumulated < m_decimation) {
+                continue;
+            }
+
+            const float x = m_accumulator / m_decimation;
+            m_accumulator = 0.0f;
+            m_accumulated = 0;
+
+            const float delta = x - m_dampingN * m_window[static_cast<size_t>(m_position)];
+            m_window[static_cast<size_t>(m_position)] = x;
+            m_position = (m_position + 1) % WINDOW;
+
+            float *re = m_re.data();
+            float *im = m_im.data();
+            const float *c = m_cos.data();
+            const float *s = m_sin.data();
+            for (int k = 0; k < BIN_COUNT; ++k) {
+                const float r = re[k] + delta;
+                const float j = im[k];
+                re[k] = r * c[k] - j * s[k];
+                im[k] = r * s[k] + j * c[k];
+            }
+
+            if (++m_sinceHop == HOP) {
+                m_sinceHop = 0;
+                for (int k = 0; k < BIN_COUNT; ++k) {
+                    m_magnitudes[static_cast<size_t>(k)] = std::sqrt(re[k] * re[k] + im[k] * im[k]);
+                }
+                onHop(m_magnitudes.data());
+            }
+        }
+    }
+
+private:
+    int m_decimation;
+    float m_accumulator = 0.0f;
+    int m_accumulated = 0;
+
+    std::vector<float> m_window;
+    int m_position = 0;
+    int m_sinceHop = 0;
+    float m_dampingN = 1.0f;
+
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+    std::vector<float> m_cos;
+    std::vector<float> m_sin;
+    std::vector<float> m_magnitudes;
+};
+
+/**
+ * @brief Envelope detector and element decoder for one bin.
+ */
+struct CWSkimmer::BinDecoder {
+    float floor = 0.0f;
+    float peak = 0.0f;
+    bool on = false;
+    int run = 0; // Hops in the current state
+    float dit = 12.0f; // Estimated dit length in hops (20 WPM)
+
+    // Recent mark lengths; the dit/dah split is re-estimated from these
+    float marks[RECENT_MARKS] = {};
+    int markCount = 0;
+    int markPos = 0;
+
+    QString pattern;
+    QString word;
+    bool wordDone = true;
+
+    // Statistics of the current word
+    float timingError = 0.0f;
+    int timedElements = 0;
+    int characters = 0;
+    int errors = 0;
+
+    float snr() const { return (floor > 0.0f) ? peak / floor : 0.0f; }
+    float wpm() const { return 1200.0f / (dit * HOP_MS); }
+
+    /**
+     * @brief Update with the bin magnitude of one hop.
+     *
+     * @return True when a word was completed
+     */
+    bool update(float magnitude) {
+        // The floor settles on the average noise level: it falls quickly and
+        // rises slowly, so marks barely lift it. The peak is the opposite.
+        if (floor <= 0.0f) {
+            floor = magnitude;
+        } else {
+            floor += (magnitude - floor) * (magnitude < floor ? 0.05f : 0.002f);
+        }
+        if (magnitude > peak) {
+            peak = magnitude;
+        } else {
+            peak += (magnitude - peak) * 0.005f;
+        }
+
+        const bool audible = snr() >= MIN_SNR;
+        const float span = peak - floor;
+        const bool nowOn = audible && (on ? magnitude > floor + 0.4f * span : magnitude > floor + 0.6f * span);
+
+        if (nowOn == on) {
+            ++run;
+            return !on && checkGaps();
+        }
+
+        if (on) {
+            mark(static_cast<float>(run));
+        } else if (!pattern.isEmpty()) {
+            // Space between elements of a character
+            addTiming(static_cast<float>(run), 1.0f);
+        }
+
+        on = nowOn;
+        run = 1;
+        return false;
+    }
+
+    void mark(float length) {
+        marks[markPos] = length;
+        markPos = (markPos + 1) % RECENT_MARKS;
+        markCount = qMin(markCount + 1, RECENT_MARKS);
+        estimateDit();
+
+        const bool dah = length >= 2.0f * dit;
+        pattern += dah ? QLatin1Char('-') : QLatin1Char('.');
+        addTiming(length, dah ? 3.0f : 1.0f);
+        wordDone = false;
+    }
+
+    /**
+     * @brief Split the recent marks into dits and dahs (two-means) and derive
+     * the dit length from both clusters.
+     */
+    void estimateDit() {
+        float shortest = marks[0];
+        float longest = marks[0];
+        for (int i = 1; i < markCount; ++i) {
+            shortest = qMin(shortest, marks[i]);
+            longest = qMax(longest, marks[i]);
+        }
+
+        // All marks alike: keep the current estimate, it tells dits from dahs
+        if (longest < 2.0f * shortest) {
+            return;
+        }
+
+        float threshold = 0.5f * (shortest + longest);
+        float estimate = dit;
+        for (int iteration = 0; iteration < 3; ++iteration) {
+            float dits = 0.0f;
+            float dahs = 0.0f;
+            int ditCount = 0;
+            int dahCount = 0;
+            for (int i = 0; i < markCount; ++i) {
+                if (marks[i] < threshold) {
+                    dits += marks[i];
+                    ++ditCount;
+                } else {
+                    dahs += marks[i];
+                    ++dahCount;
+                }
+            }
+            threshold = 0.5f * (dits / qMax(1, ditCount) + dahs / qMax(1, dahCount));
+            estimate = (dits + dahs / 3.0f) / markCount;
+        }
+
+        dit = qBound(MIN_DIT, estimate, MAX_DIT);
+    }
+
+    void addTiming(float length, float idealDits) {
+        timingError += qMin(1.0f, std::fabs(length / (idealDits * dit) - 1.0f));
+        ++timedElements;
+    }
+
+    bool checkGaps() {
+        // End of character after 2 dits of silence, end of word after 5
+        if (!pattern.isEmpty() && run >= 2.0f * dit) {
+            const QChar c = MorseCode::decode(pattern);
+            if (c.isNull()) {
+                word += QLatin1Char('*');
+                ++errors;
+            } else {
+                word += c;
+                ++characters;
+            }
+            pattern.clear();
+        }
+
+        if (!wordDone && pattern.isEmpty() && run >= 5.0f * dit) {
+            wordDone = true;
+            return !word.isEmpty();
+        }
+        return false;
+    }
+
+    /**
+     * @brief Hand out the completed word and start the next one.
+     */
+    QString takeWord() {
+        QString result;
+        result.swap(word);
+        timingError = 0.0f;
+        timedElements = 0;
+        characters = 0;
+        errors = 0;
+        return result;
+    }
+
+    float accuracy() const { return timedElements ? qMax(0.0f, 1.0f - timingError / timedElements) : 0.0f; }
+};
+
+/**
+ * @brief Decoding state of a single speaker.
+ *
+ * A speaker sends on one pitch, so only the bin carrying the tone is decoded.
+ */
+struct CWSkimmer::SpeakerStream {
+    explicit SpeakerStream(int decimation) : bank(decimation), energy(BIN_COUNT, 0.0f) {}
+
+    FilterBank bank;
+    BinDecoder decoder;
+    int bin = -1;
+    std::vector<float> energy; // Decaying peak per bin, used to pick the bin
+    int idleHops = 0;
+    bool seen = false;
+};
+
+CWSkimmer::CWSkimmer(int channelId, int sampleRate)
+    : m_channelId(channelId)
+    , m_decimation(qMax(1, sampleRate / BANK_RATE))
+    , m_band(new FilterBank(m_decimation))
+    , m_bandDecoders(BIN_COUNT) {
+}
+
+CWSkimmer::~CWSkimmer() {
+}
+
+void CWSkimmer::processFrame(const std::vector<unsigned int> &sessions, const std::vector<std::vector<float>> &frames,
+                             int frameSize) {
+    // The band is what an open receiver hears: every speaker at unity gain
+    m_sum.assign(static_cast<size_t>(frameSize), 0.0f);
+    for (const std::vector<float> &frame : frames) {
+        const int n = qMin(frameSize, static_cast<int>(frame.size()));
+        for (int i = 0; i < n; ++i) {
+            m_sum[static_cast<size_t>(i)] += frame[static_cast<size_t>(i)];
+        }
+    }
+    m_band->process(m_sum.data(), frameSize, [this](const float *magnitudes) { processBandHop(magnitudes); });
+
+    for (auto &entry : m_speakers) {
+        entry.second->seen = false;
+    }
+
+    for (size_t i = 0; i < sessions.size() && i < frames.size(); ++i) {
+        std::unique_ptr<SpeakerStream> &stream = m_speakers[sessions[i]];
+        if (!stream) {
+            stream.reset(new SpeakerStream(m_decimation));
+        }
+        stream->seen = true;
+
+        SpeakerStream *s = stream.get();
+        const unsigned int session = sessions[i];
+        stream->bank.process(frames[i].data(), qMin(frameSize, static_cast<int>(frames[i].size())),
+                             [this, session, s](const float *magnitudes) { processSpeakerHop(session, *s, magnitudes); });
+    }
+
+    // A speaker that stopped transmitting is fed silence until the last word
+    // is complete, and dropped after a while, which bounds the memory to the
+    // active speakers
+    const int frameHops = qMax(1, frameSize / (m_decimation * HOP));
+    const std::vector<float> silence(BIN_COUNT, 0.0f);
+    for (auto it = m_speakers.begin(); it != m_speakers.end();) {
+        SpeakerStream &stream = *it->second;
+        if (stream.seen) {
+            stream.idleHops = 0;
+        } else {
+            for (int hop = 0; hop < frameHops && !stream.decoder.wordDone; ++hop) {
+                processSpeakerHop(it->first, stream, silence.data());
+            }
+            stream.idleHops += frameHops;
+            if (stream.idleHops > SPEAKER_IDLE_HOPS) {
+                it = m_speakers.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+}
+
+void CWSkimmer::processBandHop(const float *magnitudes) {
+    float strongestPeak = 0.0f;
+    for (const BinDecoder &decoder : m_bandDecoders) {
+        strongestPeak = qMax(strongestPeak, decoder.peak);
+    }
+
+    for (int k = 0; k < BIN_COUNT; ++k) {
+        BinDecoder &decoder = m_bandDecoders[static_cast<size_t>(k)];
+        if (!decoder.update(magnitudes[k])) {
+            continue;
+        }
+
+        // A tone leaks into the neighbouring bins; only the strongest one spots
+        const float peak = decoder.peak;
+        const bool strongest = (k == 0 || m_bandDecoders[static_cast<size_t>(k - 1)].peak <= peak)
+                               && (k == BIN_COUNT - 1 || m_bandDecoders[static_cast<size_t>(k + 1)].peak <= peak);
+        const bool clean = decoder.errors == 0 && decoder.dit > MIN_DIT;
+        const QString word = decoder.takeWord();
+
+        // Noise decodes as short runs of E, I and T at the speed limit, and
+        // always contains invalid patterns sooner or later
+        if (strongest && clean && peak >= DYNAMIC_RANGE * strongestPeak && word.length() >= 2) {
+            Spot spot;
+            spot.channelId = m_channelId;
+            spot.pitchHz = static_cast<float>((FIRST_BIN + k) * BANK_RATE) / WINDOW;
+            spot.wpm = decoder.wpm();
+            spot.snrDb = 20.0f * std::log10(qMax(1.0f, decoder.snr()));
+            spot.text = word;
+            m_spots.append(spot);
+        }
+    }
+}
+
+void CWSkimmer::processSpeakerHop(unsigned int session, SpeakerStream &stream, const float *magnitudes) {
+    // Follow the bin with the most energy, but only move when another bin is
+    // clearly stronger, so silence and noise don't make the decoder wander
+    int best = qMax(0, stream.bin);
+    for (int k = 0; k < BIN_COUNT; ++k) {
+        float &energy = stream.energy[static_cast<size_t>(k)];
+        energy = qMax(magnitudes[k], energy * 0.999f);
+        if (energy > stream.energy[static_cast<size_t>(best)]) {
+            best = k;
+        }
+    }
+
+    if (stream.bin < 0
+        || stream.energy[static_cast<size_t>(best)]
+               > BIN_SWITCH_RATIO * stream.energy[static_cast<size_t>(stream.bin)]) {
+        if (best != stream.bin) {
+            // The levels belong to the old bin; the speed estimate carries over
+            stream.decoder.floor = 0.0f;
+            stream.decoder.peak = 0.0f;
+            stream.bin = best;
+        }
+    }
+
+    BinDecoder &decoder = stream.decoder;
+    if (!decoder.update(magnitudes[stream.bin])) {
+        return;
+    }
+
+    SendingScore score;
+    score.session = session;
+    score.wpm = decoder.wpm();
+    score.timingAccuracy = decoder.accuracy();
+    score.characters = decoder.characters;
+    score.errors = decoder.errors;
+    score.text = decoder.takeWord();
+    m_scores.append(score);
+}
+
+QVector<CWSkimmer::Spot> CWSkimmer::takeSpots() {
+    QVector<Spot> spots;
+    spots.swap(m_spots);
+    return spots;
+}
+
+QVector<CWSkimmer::SendingScore> CWSkimmer::takeScores() {
+    QVector<SendingScore> scores;
+    scores.swap(m_scores);
+    return scores;
+}
@@ -0,0 +1,129 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CWSKIMMER_H_
+#define MUMBLE_MURMUR_CWSKIMMER_H_
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The CWSkimmer class decodes Morse code from band audio.
+ *
+ * Audio is decimated to 8 kHz and run through a sliding DFT filter bank that
+ * covers the CW passband (300 Hz to 1.5 kHz in 50 Hz bins). Every 5 ms each
+ * bin's magnitude feeds an envelope detector with an adaptive noise floor and
+ * peak, and the resulting mark/space durations are classified against an
+ * adaptive dit length. Everything runs incrementally per 20 ms frame and the
+ * memory per stream is fixed.
+ *
+ * A skimmer serves one band channel and decodes two kinds of stream:
+ * - The band itself (all speakers summed). Every bin is decoded independently,
+ *   which yields spots for all stations on the band.
+ * - Each speaker on its own. Only the strongest bin is decoded, which yields a
+ *   score of the speaker's sending speed and timing accuracy.
+ *
+ * A skimmer is not thread-safe; all calls for one channel must be serialized.
+ */
+class CWSkimmer {
+public:
+    /**
+     * @brief A station heard on the band.
+     */
+    struct Spot {
+        int channelId;
+        float pitchHz; ///< Centre of the bin the station was decoded in
+        float wpm; ///< Estimated sending speed
+        float snrDb; ///< Peak level over the noise floor
+        QString text; ///< The word that was just completed
+    };
+
+    /**
+     * @brief The sending quality of one speaker.
+     *
+     * Covers everything decoded since the previous score for the speaker.
+     */
+    struct SendingScore {
+        unsigned int session;
+        float wpm; ///< Estimated sending speed
+        float timingAccuracy; ///< 1.0 = perfect 1:3:1:3:7 timing, 0.0 = unusable
+        int characters; ///< Characters decoded
+        int errors; ///< Element patterns that are not valid Morse
+        QString text; ///< The decoded text
+    };
+
+    /**
+     * @brief Constructor for CWSkimmer.
+     *
+     * @param channelId The band channel this skimmer serves
+     * @param sampleRate The sample rate of the input audio (a multiple of 8 kHz)
+     */
+    explicit CWSkimmer(int channelId, int sampleRate = 48000);
+
+    /**
+     * @brief Destructor for CWSkimmer.
+     */
+    ~CWSkimmer();
+
+    /**
+     * @brief Process one frame of every active speaker on the channel.
+     *
+     * @param sessions The session of each speaker
+     * @param frames One frame per speaker, all of the same length
+     * @param frameSize The number of samples per frame
+     */
+    void processFrame(const std::vector<unsigned int> &sessions, const std::vector<std::vector<float>> &frames,
+                      int frameSize);
+
+    /**
+     * @brief Take the spots produced since the last call.
+     *
+     * @return The new spots
+     */
+    QVector<Spot> takeSpots();
+
+    /**
+     * @brief Take the sending scores produced since the last call.
+     *
+     * @return The new scores
+     */
+    QVector<SendingScore> takeScores();
+
+    /**
+     * @brief Get the channel this skimmer serves.
+     *
+     * @return The channel ID
+     */
+    int channelId() const { return m_channelId; }
+
+private:
+    Q_DISABLE_COPY(CWSkimmer)
+
+    class FilterBank;
+    struct BinDecoder;
+    struct SpeakerStream;
+
+    int m_channelId;
+    int m_decimation;
+
+    std::unique_ptr<FilterBank> m_band;
+    std::vector<BinDecoder> m_bandDecoders;
+    std::unordered_map<unsigned int, std::unique_ptr<SpeakerStream>> m_speakers;
+
+    std::vector<float> m_sum;
+
+    QVector<Spot> m_spots;
+    QVector<SendingScore> m_scores;
+
+    void processBandHop(const float *magnitudes);
+    void processSpeakerHop(unsigned int session, SpeakerStream &stream, const float *magnitudes);
+};
+
+#endif // MUMBLE_MURMUR_CWSKIMMER_H_
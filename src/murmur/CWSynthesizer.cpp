@@ -0,0 +1,190 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CWSynthesizer.h"
+#include "OpusCodec.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QMutexLocker>
+
+#include <algorithm>
+
+namespace {
+    // Leave headroom for the mixer; several stations may overlap
+    const float TONE_AMPLITUDE = 0.5f;
+}
+
+CWSynthesizer::CWSynthesizer()
+    : m_tones(OpusCodec::SAMPLE_RATE, 5.0f)
+    , m_pitchHz(600.0f)
+    , m_jitterSamples(OpusCodec::SAMPLE_RATE * 60 / 1000) {
+}
+
+void CWSynthesizer::setPitch(float hz) {
+    QMutexLocker locker(&m_mutex);
+    m_pitchHz = qBound(200.0f, hz, 2000.0f);
+}
+
+void CWSynthesizer::setRiseTime(float ms) {
+    QMutexLocker locker(&m_mutex);
+    m_tones.setRiseTime(qBound(1.0f, ms, 50.0f));
+}
+
+void CWSynthesizer::setJitterBuffer(float ms) {
+    QMutexLocker locker(&m_mutex);
+    m_jitterSamples = qMax<qint64>(OpusCodec::FRAME_SIZE, static_cast<qint64>(OpusCodec::SAMPLE_RATE * ms / 1000.0f));
+}
+
+void CWSynthesizer::addKeying(int channelId, const Mumble::Protocol::CWKeyingData &keying, qint64 now) {
+    QMutexLocker locker(&m_mutex);
+
+    Station &station = m_stations[keying.senderSession];
+
+    if (station.synced) {
+        // Drop duplicates and packets overtaken by newer ones
+        const int16_t age = static_cast<int16_t>(keying.sequence - station.lastSequence);
+        if (age <= 0) {
+            return;
+        }
+        station.senderClock += static_cast<int32_t>(keying.timestamp - station.lastTimestamp);
+    } else {
+        station.senderClock = 0;
+    }
+
+    station.lastSequence = keying.sequence;
+    station.lastTimestamp = keying.timestamp;
+    station.lastActivity = now;
+    station.pitchHz = qBound(200.0f, m_pitchHz + keying.pitchOffset, 2000.0f);
+
+    if (station.tone < 0) {
+        station.tone = m_tones.allocate(station.pitchHz, TONE_AMPLITUDE);
+    } else {
+        m_tones.setPitch(station.tone, station.pitchHz);
+    }
+
+    // A station that changed channel starts a fresh transmission
+    if (station.channelId != channelId) {
+        station.channelId = channelId;
+        station.edges.clear();
+        if (station.keyDown) {
+            m_tones.key(station.tone, 0, false);
+        }
+        station.keyDown = false;
+        station.synced = false;
+        station.senderClock = 0;
+    }
+
+    // Map the sender's clock onto ours once, then follow it. Resync when the
+    // sender runs so far ahead or behind that the jitter buffer cannot cover it.
+    const qint64 expected = station.senderClock + station.clockOffset;
+    if (!station.synced || expected < now - m_jitterSamples || expected > now + 4 * m_jitterSamples) {
+        station.clockOffset = now + m_jitterSamples - station.senderClock;
+        station.synced = true;
+    }
+
+    for (const Mumble::Protocol::CWKeyingEdge &edge : keying.edges) {
+        Edge e;
+        e.at = qMax(now, station.senderClock + station.clockOffset + edge.offset);
+        e.keyDown = edge.keyDown;
+
+        // Edges normally arrive in order, but keep the timeline sorted if not
+        auto pos = std::upper_bound(station.edges.begin(), station.edges.end(), e,
+                                    [](const Edge &a, const Edge &b) { return a.at < b.at; });
+        station.edges.insert(pos, e);
+    }
+}
+
+int CWSynthesizer::renderFrame(qint64 frameStart, const FrameSink &sink) {
+    QMutexLocker locker(&m_mutex);
+
+    float pcm[OpusCodec::FRAME_SIZE];
+    int rendered = 0;
+
+    for (auto it = m_stations.begin(); it != m_stations.end();) {
+        Station &station = it->second;
+
+        if (renderStation(station, frameStart, pcm)) {
+            sink(it->first, station.channelId, pcm);
+            ++rendered;
+        } else if (station.edges.empty() && frameStart - station.lastActivity > STATION_IDLE_SAMPLES) {
+            m_tones.release(station.tone);
+            it = m_stations.erase(it);
+            continue;
+        }
+
+        ++it;
+    }
+
+    return rendered;
+}
+
+bool CWSynthesizer::renderStation(Station &station, qint64 frameStart, float *pcm) {
+    const qint64 frameEnd = frameStart + OpusCodec::FRAME_SIZE;
+
+    if (station.tone < 0) {
+        return false;
+    }
+
+    // Hand the edges that fall into this frame to the tone bank
+    while (!station.edges.empty() && station.edges.front().at < frameEnd) {
+        const Edge &edge = station.edges.front();
+        if (edge.keyDown && !station.keyDown) {
+            station.keyDownSince = edge.at;
+        }
+        if (edge.keyDown != station.keyDown) {
+            m_tones.key(station.tone, static_cast<int>(qMax<qint64>(0, edge.at - frameStart)), edge.keyDown);
+            station.keyDown = edge.keyDown;
+        }
+        station.edges.pop_front();
+    }
+
+    if (station.keyDown && frameEnd - station.keyDownSince > MAX_KEY_DOWN_SAMPLES) {
+        // The key-up got lost; don't leave a carrier on the band
+        const qint64 release = station.keyDownSince + MAX_KEY_DOWN_SAMPLES;
+        m_tones.key(station.tone, static_cast<int>(qMax<qint64>(0, release - frameStart)), false);
+        station.keyDown = false;
+    }
+
+    // Nothing to do while the key is up, the tone has decayed and no edge is due
+    if (m_tones.isSilent(station.tone)) {
+        return false;
+    }
+
+    m_tones.render(station.tone, pcm, OpusCodec::FRAME_SIZE);
+    station.lastActivity = frameEnd;
+
+    return true;
+}
+
+bool CWSynthesizer::hasActiveStations() const {
+    QMutexLocker locker(&m_mutex);
+
+    for (const auto &entry : m_stations) {
+        const Station &station = entry.second;
+        if (!station.edges.empty() || (station.tone >= 0 && !m_tones.isSilent(station.tone))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CWSynthesizer::removeStation(unsigned int session) {
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_stations.find(session);
+    if (it != m_stations.end()) {
+        m_tones.release(it->second.tone);
+        m_stations.erase(it);
+    }
+}
+
+void CWSynthesizer::clear() {
+    QMutexLocker locker(&m_mutex);
+
+    for (auto &entry : m_stations) {
+        m_tones.release(entry.second.tone);
+    }
+    m_stations.clear();
+}
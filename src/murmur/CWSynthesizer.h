@@ -0,0 +1,164 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CWSYNTHESIZER_H_
+#define MUMBLE_MURMUR_CWSYNTHESIZER_H_
+
+#include "MumbleProtocol.h"
+#include "ToneBank.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QtGlobal>
+
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * @brief The CWSynthesizer class turns keying events into CW tones.
+ *
+ * CW stations send key-down/key-up edges (CWKeying messages) instead of Opus
+ * audio. The synthesizer places the edges of every station on the server's
+ * sample clock behind a small jitter buffer and renders the keyed tone one
+ * 20 ms frame at a time. The rendered frames are fed into the BandMixer like
+ * any other speaker, so receivers get the tone with their own link gain,
+ * fading and noise.
+ *
+ * Edges land on the exact sample they were keyed at (relative to the sender's
+ * clock), so timing is preserved regardless of network jitter up to the
+ * jitter buffer depth. The tones themselves come from a ToneBank, which keeps
+ * a thousand keyed stations well within one core.
+ *
+ * Keying may arrive on the main thread (TCP) or the voice thread (UDP), while
+ * frames are rendered on the voice thread, so all access is serialized.
+ */
+class CWSynthesizer {
+public:
+    /**
+     * @brief Callback that receives one rendered frame.
+     *
+     * @param session The CW station's session ID
+     * @param channelId The channel the station is keying on
+     * @param pcm OpusCodec::FRAME_SIZE mono samples
+     */
+    using FrameSink = std::function<void(unsigned int session, int channelId, const float *pcm)>;
+
+    /**
+     * @brief Constructor for CWSynthesizer.
+     */
+    CWSynthesizer();
+
+    /**
+     * @brief Set the tone pitch for stations that send no pitch offset.
+     *
+     * @param hz The pitch in Hz
+     */
+    void setPitch(float hz);
+
+    /**
+     * @brief Set the rise and fall time of the keying envelope.
+     *
+     * @param ms The edge duration in milliseconds
+     */
+    void setRiseTime(float ms);
+
+    /**
+     * @brief Set the depth of the jitter buffer.
+     *
+     * Edges are played this long after they were received at the earliest.
+     *
+     * @param ms The buffer depth in milliseconds
+     */
+    void setJitterBuffer(float ms);
+
+    /**
+     * @brief Queue the keying events of a station.
+     *
+     * @param channelId The channel the station is keying on
+     * @param keying The keying events (senderSession identifies the station)
+     * @param now The current value of the server's sample clock
+     */
+    void addKeying(int channelId, const Mumble::Protocol::CWKeyingData &keying, qint64 now);
+
+    /**
+     * @brief Render one frame for every station that is keying.
+     *
+     * @param frameStart The server sample clock at the first sample of the frame
+     * @param sink Callback that receives the frame of each keying station
+     * @return The number of stations that produced a frame
+     */
+    int renderFrame(qint64 frameStart, const FrameSink &sink);
+
+    /**
+     * @brief Check whether any station has keying queued or a tone sounding.
+     *
+     * @return True if renderFrame() would produce output
+     */
+    bool hasActiveStations() const;
+
+    /**
+     * @brief Forget a station.
+     *
+     * @param session The station's session ID
+     */
+    void removeStation(unsigned int session);
+
+    /**
+     * @brief Forget all stations.
+     */
+    void clear();
+
+private:
+    Q_DISABLE_COPY(CWSynthesizer)
+
+    // A key held down longer than this is assumed to have lost its key-up
+    static const int MAX_KEY_DOWN_SAMPLES = 48000 * 10;
+
+    // Stations that have been silent this long are dropped
+    static const int STATION_IDLE_SAMPLES = 48000 * 30;
+
+    struct Edge {
+        qint64 at; // Server sample clock
+        bool keyDown;
+    };
+
+    struct Station {
+        int channelId = -1;
+        float pitchHz = 0.0f;
+
+        // Mapping from the sender's clock to the server's clock
+        bool synced = false;
+        qint64 clockOffset = 0;
+        qint64 senderClock = 0; // Unwrapped sender timestamp of the last packet
+        uint32_t lastTimestamp = 0;
+        uint16_t lastSequence = 0;
+
+        std::deque<Edge> edges;
+        bool keyDown = false;
+        qint64 keyDownSince = 0;
+        qint64 lastActivity = 0;
+
+        int tone = -1; // Slot in m_tones
+    };
+
+    mutable QMutex m_mutex;
+    std::unordered_map<unsigned int, Station> m_stations; // Keyed by session
+    ToneBank m_tones;
+
+    float m_pitchHz;
+    qint64 m_jitterSamples;
+
+    /**
+     * @brief Render one frame of a single station.
+     *
+     * @param station The station
+     * @param frameStart The server sample clock at the first sample
+     * @param pcm Receives OpusCodec::FRAME_SIZE samples
+     * @return True if the frame contains any tone
+     */
+    bool renderStation(Station &station, qint64 frameStart, float *pcm);
+};
+
+#endif // MUMBLE_MURMUR_CWSYNTHESIZER_H_
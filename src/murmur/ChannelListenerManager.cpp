@@ -11,12 +11,70 @@
 #include "User.h"
 #include "VolumeAdjustment.h"
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+const VolumeAdjustment ChannelListenerSnapshot::s_defaultAdjustment;
+
+ChannelListenerSnapshot::ChannelListenerSnapshot()
+    : m_users(std::make_shared<std::vector<const ServerUser *>>()) {
+}
+
+const ChannelListenerSnapshot::ChannelEntry *ChannelListenerSnapshot::find(const Channel &channel) const {
+    const auto it = m_channelIndices.constFind(&channel);
+    return it != m_channelIndices.constEnd() ? m_channels[static_cast<size_t>(*it)].get() : nullptr;
+}
+
+bool ChannelListenerSnapshot::isListening(const ServerUser &user, const Channel &channel) const {
+    const ChannelEntry *entry = find(channel);
+    const auto it = m_userIndices.constFind(&user);
+    if (!entry || it == m_userIndices.constEnd()) {
+        return false;
+    }
+    
+    const size_t word = static_cast<size_t>(*it) / 64;
+    return word < entry->bits.size() && (entry->bits[word] >> (*it % 64)) & 1;
+}
+
+void ChannelListenerSnapshot::unite(const Channel &channel, Bits &bits) const {
+    const ChannelEntry *entry = find(channel);
+    if (!entry) {
+        return;
+    }
+    
+    if (bits.size() < entry->bits.size()) {
+        bits.resize(entry->bits.size(), 0);
+    }
+    // Plain loop over whole words, which the compiler vectorizes
+    const Word *source = entry->bits.data();
+    Word *target = bits.data();
+    const size_t words = entry->bits.size();
+    for (size_t i = 0; i < words; ++i) {
+        target[i] |= source[i];
+    }
+}
+
+VolumeAdjustment ChannelListenerSnapshot::volumeAdjustment(const ServerUser &user, const Channel &channel) const {
+    const ChannelEntry *entry = find(channel);
+    const auto it = m_userIndices.constFind(&user);
+    if (!entry || it == m_userIndices.constEnd()) {
+        return s_defaultAdjustment;
+    }
+    
+    return entry->adjustments.value(*it, s_defaultAdjustment);
+}
+
 ChannelListenerManager::ChannelListenerManager(QObject *parent)
-    : QObject(parent) {
+    : QObject(parent), m_current(new ChannelListenerSnapshot()), m_epoch(1) {
 }
 
 ChannelListenerManager::~ChannelListenerManager() {
+    // No reader may hold a snapshot any more
     clear();
+    m_retired.clear();
+    delete m_current.load(std::memory_order_relaxed);
 }
 
 void ChannelListenerManager::addListener(const ServerUser &user, const Channel &channel) {
@@ -30,10 +88,19 @@ void ChannelListenerManager::addListener(const ServerUser &user, const Channel &
     
     // Initialize with default volume adjustment if not set
     QPair<const ServerUser *, const Channel *> key(&user, &channel);
-    if (!m_listenerVolumeAdjustments.contains(key)) {
+    const bool adjusted = m_listenerVolumeAdjustments.contains(key);
+    if (!adjusted) {
         m_listenerVolumeAdjustments.insert(key, VolumeAdjustment());
     }
     
+    std::unique_ptr<ChannelListenerSnapshot> next = beginUpdate();
+    setListening(*next, user, channel, true);
+    if (adjusted) {
+        editChannel(*next, channel).adjustments.insert(next->m_userIndices.value(&user),
+                                                       m_listenerVolumeAdjustments.value(key));
+    }
+    publish(std::move(next));
+    
     locker.unlock();
     
     // Emit signal after releasing lock
@@ -45,6 +112,7 @@ void ChannelListenerManager::setListenerVolumeAdjustment(const ServerUser &user,
     
     QPair<const ServerUser *, const Channel *> key(&user, &channel);
     m_listenerVolumeAdjustments.insert(key, volumeAdjustment);
+    updateAdjustment(user, channel, volumeAdjustment);
     
     locker.unlock();
     
@@ -68,6 +136,7 @@ void ChannelListenerManager::disableListener(const ServerUser &user, const Chann
     adjustment.setType(VolumeAdjustment::Multiplicative);
     adjustment.setAdjustmentFactor(&user, 0.0f);
     m_listenerVolumeAdjustments.insert(key, adjustment);
+    updateAdjustment(user, channel, adjustment);
     
     locker.unlock();
     
@@ -100,6 +169,11 @@ void ChannelListenerManager::removeListener(const ServerUser &user, const Channe
     QPair<const ServerUser *, const Channel *> key(&user, &channel);
     m_listenerVolumeAdjustments.remove(key);
     
+    std::unique_ptr<ChannelListenerSnapshot> next = beginUpdate();
+    setListening(*next, user, channel, false);
+    releaseUser(*next, user);
+    publish(std::move(next));
+    
     locker.unlock();
     
     // Emit signal after releasing lock
@@ -107,16 +181,15 @@ void ChannelListenerManager::removeListener(const ServerUser &user, const Channe
 }
 
 bool ChannelListenerManager::isListening(const ServerUser &user, const Channel &channel) const {
-    QReadLocker locker(&m_rwLock);
-    
-    return m_channelListeners.contains(&channel) &&
-           m_channelListeners.value(&channel).contains(&user);
+    return snapshot()->isListening(user, channel);
 }
 
 QSet<const ServerUser *> ChannelListenerManager::getListeners(const Channel &channel) const {
-    QReadLocker locker(&m_rwLock);
-    
-    return m_channelListeners.value(&channel);
+    QSet<const ServerUser *> listeners;
+    snapshot()->forEachListener(channel, [&listeners](const ServerUser *listener, const VolumeAdjustment &) {
+        listeners.insert(listener);
+    });
+    return listeners;
 }
 
 QSet<const Channel *> ChannelListenerManager::getListenedChannels(const ServerUser &user) const {
@@ -148,6 +221,13 @@ void ChannelListenerManager::clearListeners(const Channel &channel) {
     // Remove channel entry
     m_channelListeners.remove(&channel);
     
+    std::unique_ptr<ChannelListenerSnapshot> next = beginUpdate();
+    for (const ServerUser *user : listeners) {
+        setListening(*next, *user, channel, false);
+        releaseUser(*next, *user);
+    }
+    publish(std::move(next));
+    
     locker.unlock();
     
     // Emit signals after releasing lock
@@ -179,6 +259,13 @@ void ChannelListenerManager::clearListenedChannels(const ServerUser &user) {
     // Remove user entry
     m_userListenedChannels.remove(&user);
     
+    std::unique_ptr<ChannelListenerSnapshot> next = beginUpdate();
+    for (const Channel *channel : channels) {
+        setListening(*next, user, *channel, false);
+    }
+    releaseUser(*next, user);
+    publish(std::move(next));
+    
     locker.unlock();
     
     // Emit signals after releasing lock
@@ -193,4 +280,175 @@ void ChannelListenerManager::clear() {
     m_channelListeners.clear();
     m_userListenedChannels.clear();
     m_listenerVolumeAdjustments.clear();
+    
+    m_freeUserIndices.clear();
+    m_freeChannelIndices.clear();
+    publish(std::unique_ptr<ChannelListenerSnapshot>(new ChannelListenerSnapshot()));
+}
+
+ChannelListenerManager::ReadGuard ChannelListenerManager::snapshot() const {
+    // Every thread starts at a slot of its own, so readers on different
+    // threads normally claim different slots without contending
+    static std::atomic<unsigned int> nextHint(0);
+    thread_local const unsigned int hint = nextHint.fetch_add(1, std::memory_order_relaxed);
+    
+    for (unsigned int i = 0;; ++i) {
+        std::atomic<quint64> &slot = m_readers[(hint + i) % READER_SLOTS].epoch;
+        quint64 expected = 0;
+        // The epoch is announced before the pointer is loaded; a writer that
+        // retires the loaded snapshot afterwards sees the announcement
+        if (slot.load(std::memory_order_relaxed) == 0
+            && slot.compare_exchange_strong(expected, m_epoch.load(std::memory_order_seq_cst),
+                                            std::memory_order_seq_cst)) {
+            return ReadGuard(&slot, m_current.load(std::memory_order_seq_cst));
+        }
+        if ((i + 1) % READER_SLOTS == 0) {
+            // Every slot is taken
+            std::this_thread::yield();
+        }
+    }
+}
+
+std::unique_ptr<ChannelListenerSnapshot> ChannelListenerManager::beginUpdate() const {
+    // Shallow: the hashes are implicitly shared and the channel entries and
+    // the user table are only copied when they are edited
+    return std::unique_ptr<ChannelListenerSnapshot>(new ChannelListenerSnapshot(current()));
+}
+
+ChannelListenerSnapshot::ChannelEntry &ChannelListenerManager::editChannel(ChannelListenerSnapshot &next,
+                                                                          const Channel &channel) {
+    int index;
+    const auto it = next.m_channelIndices.constFind(&channel);
+    if (it != next.m_channelIndices.constEnd()) {
+        index = *it;
+    } else if (!m_freeChannelIndices.empty()) {
+        index = m_freeChannelIndices.back();
+        m_freeChannelIndices.pop_back();
+        next.m_channelIndices.insert(&channel, index);
+    } else {
+        index = static_cast<int>(next.m_channels.size());
+        next.m_channels.emplace_back();
+        next.m_channelIndices.insert(&channel, index);
+    }
+    
+    // The entry may be shared with published snapshots, so it is replaced
+    // by a copy rather than changed in place
+    std::shared_ptr<ChannelListenerSnapshot::ChannelEntry> &entry = next.m_channels[static_cast<size_t>(index)];
+    entry = entry ? std::make_shared<ChannelListenerSnapshot::ChannelEntry>(*entry)
+                  : std::make_shared<ChannelListenerSnapshot::ChannelEntry>();
+    return *entry;
+}
+
+void ChannelListenerManager::setListening(ChannelListenerSnapshot &next, const ServerUser &user,
+                                          const Channel &channel, bool listening) {
+    using Word = ChannelListenerSnapshot::Word;
+    
+    auto userIt = next.m_userIndices.constFind(&user);
+    if (listening) {
+        int index;
+        if (userIt != next.m_userIndices.constEnd()) {
+            index = *userIt;
+        } else {
+            auto users = std::make_shared<std::vector<const ServerUser *>>(*next.m_users);
+            if (!m_freeUserIndices.empty()) {
+                index = m_freeUserIndices.back();
+                m_freeUserIndices.pop_back();
+                (*users)[static_cast<size_t>(index)] = &user;
+            } else {
+                index = static_cast<int>(users->size());
+                users->push_back(&user);
+            }
+            next.m_users = std::move(users);
+            next.m_userIndices.insert(&user, index);
+        }
+        
+        ChannelListenerSnapshot::ChannelEntry &entry = editChannel(next, channel);
+        const size_t word = static_cast<size_t>(index) / 64;
+        const Word bit = Word(1) << (index % 64);
+        if (entry.bits.size() <= word) {
+            entry.bits.resize(word + 1, 0);
+        }
+        if (!(entry.bits[word] & bit)) {
+            entry.bits[word] |= bit;
+            ++entry.count;
+        }
+        return;
+    }
+    
+    if (userIt == next.m_userIndices.constEnd()) {
+        return;
+    }
+    const int index = *userIt;
+    
+    const auto channelIt = next.m_channelIndices.constFind(&channel);
+    if (channelIt != next.m_channelIndices.constEnd()) {
+        const int channelIndex = *channelIt;
+        ChannelListenerSnapshot::ChannelEntry &entry = editChannel(next, channel);
+        const size_t word = static_cast<size_t>(index) / 64;
+        const Word bit = Word(1) << (index % 64);
+        if (word < entry.bits.size() && (entry.bits[word] & bit)) {
+            entry.bits[word] &= ~bit;
+            --entry.count;
+        }
+        entry.adjustments.remove(index);
+        
+        if (entry.count == 0) {
+            next.m_channelIndices.remove(&channel);
+            next.m_channels[static_cast<size_t>(channelIndex)].reset();
+            m_freeChannelIndices.push_back(channelIndex);
+        } else {
+            while (!entry.bits.empty() && entry.bits.back() == 0) {
+                entry.bits.pop_back();
+            }
+        }
+    }
+}
+
+void ChannelListenerManager::releaseUser(ChannelListenerSnapshot &next, const ServerUser &user) {
+    // A user who listens nowhere gives its index back; no bitset has its
+    // bit set any more
+    const auto it = next.m_userIndices.constFind(&user);
+    if (it != next.m_userIndices.constEnd() && !m_userListenedChannels.contains(&user)) {
+        const int index = *it;
+        auto users = std::make_shared<std::vector<const ServerUser *>>(*next.m_users);
+        (*users)[static_cast<size_t>(index)] = nullptr;
+        next.m_users = std::move(users);
+        next.m_userIndices.remove(&user);
+        m_freeUserIndices.push_back(index);
+    }
+}
+
+void ChannelListenerManager::updateAdjustment(const ServerUser &user, const Channel &channel,
+                                              const VolumeAdjustment &volumeAdjustment) {
+    if (!current().isListening(user, channel)) {
+        // Picked up by addListener() from m_listenerVolumeAdjustments
+        return;
+    }
+    
+    std::unique_ptr<ChannelListenerSnapshot> next = beginUpdate();
+    editChannel(*next, channel).adjustments.insert(next->m_userIndices.value(&user), volumeAdjustment);
+    publish(std::move(next));
+}
+
+void ChannelListenerManager::publish(std::unique_ptr<ChannelListenerSnapshot> next) {
+    // Readers that announced this epoch or an earlier one may have loaded
+    // the previous snapshot; later ones load the new one
+    const ChannelListenerSnapshot *previous = m_current.exchange(next.release(), std::memory_order_seq_cst);
+    const quint64 epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+    m_retired.push_back({ std::unique_ptr<const ChannelListenerSnapshot>(previous), epoch });
+    reclaim();
+}
+
+void ChannelListenerManager::reclaim() {
+    quint64 oldest = std::numeric_limits<quint64>::max();
+    for (const ReaderSlot &reader : m_readers) {
+        const quint64 epoch = reader.epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                   [oldest](const Retired &retired) { return retired.epoch < oldest; }),
+                    m_retired.end());
 }
\ No newline at end of file
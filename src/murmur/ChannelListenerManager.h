@@ -11,9 +11,150 @@
 #include <QSet>
 #include <QReadWriteLock>
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "VolumeAdjustment.h"
+
 class Channel;
 class ServerUser;
-class VolumeAdjustment;
+
+/**
+ * @brief An immutable view of who listens to which channel.
+ * 
+ * Users and channels with listeners are mapped to dense indices, and the
+ * listeners of a channel are a bitset over the user indices. The receivers
+ * of a set of channels are then the OR of a few bitsets, which needs no
+ * hashing and no allocation once the output bitset has grown.
+ * 
+ * Snapshots are published by ChannelListenerManager on every change and
+ * never modified afterwards, so they are read without any lock. Holding a
+ * snapshot keeps the users it names alive in the table only; as with the
+ * rest of the voice path, users are deleted under the voice thread lock.
+ */
+class ChannelListenerSnapshot {
+public:
+    using Word = quint64;
+    /// Bitset over user indices, bit i of word i / 64 for user index i
+    using Bits = std::vector<Word>;
+    
+    /**
+     * @brief Check if a user is listening to a channel
+     * 
+     * @param user The user to check
+     * @param channel The channel to check
+     * @return true if the user is listening to the channel
+     */
+    bool isListening(const ServerUser &user, const Channel &channel) const;
+    
+    /**
+     * @brief Check if a channel has any listeners
+     * 
+     * @param channel The channel to check
+     * @return true if someone listens to the channel
+     */
+    bool hasListeners(const Channel &channel) const { return m_channelIndices.contains(&channel); }
+    
+    /**
+     * @brief Add the listeners of a channel to a bitset
+     * 
+     * @param channel The channel
+     * @param bits The bitset, grown as needed; call for every channel of a set
+     *             to get the listeners of any of them
+     */
+    void unite(const Channel &channel, Bits &bits) const;
+    
+    /**
+     * @brief Get the user with an index
+     * 
+     * @param index A set bit of a bitset of this snapshot
+     * @return The user
+     */
+    const ServerUser *user(int index) const { return (*m_users)[static_cast<size_t>(index)]; }
+    
+    /**
+     * @brief Get the volume adjustment for a listener
+     * 
+     * @param user The listener user
+     * @param channel The channel being listened to
+     * @return The volume adjustment for the listener
+     */
+    VolumeAdjustment volumeAdjustment(const ServerUser &user, const Channel &channel) const;
+    
+    /**
+     * @brief Call a function for every user in a bitset
+     * 
+     * @param bits A bitset filled by unite()
+     * @param f Called with the user, in index order
+     */
+    template<typename F>
+    void forEachUser(const Bits &bits, F f) const {
+        for (size_t word = 0; word < bits.size(); ++word) {
+            for (Word w = bits[word]; w; w &= w - 1) {
+                f(user(static_cast<int>(word * 64 + countTrailingZeros(w))));
+            }
+        }
+    }
+    
+    /**
+     * @brief Call a function for every listener of a channel
+     * 
+     * @param channel The channel
+     * @param f Called with the listener and its volume adjustment
+     */
+    template<typename F>
+    void forEachListener(const Channel &channel, F f) const {
+        const ChannelEntry *entry = find(channel);
+        if (!entry) {
+            return;
+        }
+        for (size_t word = 0; word < entry->bits.size(); ++word) {
+            for (Word w = entry->bits[word]; w; w &= w - 1) {
+                const int index = static_cast<int>(word * 64 + countTrailingZeros(w));
+                const auto adjustment = entry->adjustments.constFind(index);
+                f(user(index), adjustment != entry->adjustments.constEnd() ? *adjustment : s_defaultAdjustment);
+            }
+        }
+    }
+    
+private:
+    friend class ChannelListenerManager;
+    
+    struct ChannelEntry {
+        Bits bits;
+        int count = 0;
+        // Only adjustments that were set; the others are the default
+        QHash<int, VolumeAdjustment> adjustments;
+    };
+    
+    ChannelListenerSnapshot();
+    
+    const ChannelEntry *find(const Channel &channel) const;
+    
+    static int countTrailingZeros(Word w) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(w);
+#else
+        int n = 0;
+        while (!(w & 1)) {
+            w >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+    
+    static const VolumeAdjustment s_defaultAdjustment;
+    
+    QHash<const Channel *, int> m_channelIndices;
+    // Indexed by channel index; unchanged entries are shared between snapshots
+    std::vector<std::shared_ptr<ChannelEntry>> m_channels;
+    QHash<const ServerUser *, int> m_userIndices;
+    // Indexed by user index; free indices hold nullptr
+    std::shared_ptr<std::vector<const ServerUser *>> m_users;
+};
 
 /**
  * @brief The ChannelListenerManager class manages listeners in channels.
@@ -24,6 +165,42 @@ class VolumeAdjustment;
 class ChannelListenerManager : public QObject {
     Q_OBJECT
 public:
+    /**
+     * @brief The current snapshot, pinned for reading
+     * 
+     * The snapshot is not freed while the guard exists. Hold it only for a
+     * lookup: every guard occupies one of READER_SLOTS slots, and retired
+     * snapshots are only freed once the readers older than them are gone.
+     */
+    class ReadGuard {
+    public:
+        ReadGuard(ReadGuard &&other) noexcept : m_slot(other.m_slot), m_snapshot(other.m_snapshot) {
+            other.m_slot = nullptr;
+        }
+        ~ReadGuard() {
+            if (m_slot) {
+                m_slot->store(0, std::memory_order_release);
+            }
+        }
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+        
+        const ChannelListenerSnapshot *operator->() const { return m_snapshot; }
+        const ChannelListenerSnapshot &operator*() const { return *m_snapshot; }
+        
+    private:
+        friend class ChannelListenerManager;
+        
+        ReadGuard(std::atomic<quint64> *slot, const ChannelListenerSnapshot *snapshot)
+            : m_slot(slot), m_snapshot(snapshot) {}
+        
+        std::atomic<quint64> *m_slot;
+        const ChannelListenerSnapshot *m_snapshot;
+    };
+    
+    /// Readers that can hold a snapshot at the same time; more wait for a free slot
+    static const int READER_SLOTS = 64;
+    
     /**
      * @brief Constructor for ChannelListenerManager
      * @param parent The parent QObject
@@ -121,6 +298,18 @@ public:
      */
     void clear();
     
+    /**
+     * @brief Get the listeners as they are now, without locking
+     * 
+     * This is what the voice path uses. The snapshot stays valid, and
+     * unchanged, for as long as the guard is held. Takes no lock and touches
+     * no shared reference count: the reader announces itself in a free
+     * reader slot and loads a plain atomic pointer.
+     * 
+     * @return A guard for the current snapshot
+     */
+    ReadGuard snapshot() const;
+    
 signals:
     /**
      * @brief Signal emitted when a user starts listening to a channel
@@ -157,8 +346,42 @@ private:
     // Maps (user, channel) pairs to their volume adjustments
     QHash<QPair<const ServerUser *, const Channel *>, VolumeAdjustment> m_listenerVolumeAdjustments;
     
-    // Lock for thread safety
+    // Lock for thread safety; serializes writers and the per-user queries.
+    // Per-channel queries read the snapshot instead.
     mutable QReadWriteLock m_rwLock;
+    
+    // Published after every change and owned by the manager. A replaced
+    // snapshot is retired with the epoch it was replaced in, and freed once
+    // every reader slot is empty or holds a later epoch.
+    std::atomic<const ChannelListenerSnapshot *> m_current;
+    std::atomic<quint64> m_epoch; // Advanced by every publish; starts at 1
+    
+    // The epoch each reader entered in; 0 for a free slot. One cache line
+    // each, so readers on different threads do not share one.
+    struct alignas(64) ReaderSlot {
+        std::atomic<quint64> epoch{ 0 };
+    };
+    mutable std::array<ReaderSlot, READER_SLOTS> m_readers;
+    
+    struct Retired {
+        std::unique_ptr<const ChannelListenerSnapshot> snapshot;
+        quint64 epoch;
+    };
+    std::vector<Retired> m_retired; // Guarded by m_rwLock
+    
+    // Indices given back by users and channels without listeners
+    std::vector<int> m_freeUserIndices;
+    std::vector<int> m_freeChannelIndices;
+    
+    // The published snapshot, as seen by a writer holding m_rwLock
+    const ChannelListenerSnapshot &current() const { return *m_current.load(std::memory_order_relaxed); }
+    std::unique_ptr<ChannelListenerSnapshot> beginUpdate() const;
+    ChannelListenerSnapshot::ChannelEntry &editChannel(ChannelListenerSnapshot &next, const Channel &channel);
+    void setListening(ChannelListenerSnapshot &next, const ServerUser &user, const Channel &channel, bool listening);
+    void releaseUser(ChannelListenerSnapshot &next, const ServerUser &user);
+    void updateAdjustment(const ServerUser &user, const Channel &channel, const VolumeAdjustment &volumeAdjustment);
+    void publish(std::unique_ptr<ChannelListenerSnapshot> next);
+    void reclaim();
 };
 
 #endif // MUMBLE_MURMUR_CHANNELLISTENERMANAGER_H_
\ No newline at end of file
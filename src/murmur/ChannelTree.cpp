@@ -0,0 +1,222 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ChannelTree.h"
+
+#include <algorithm>
+
+ChannelTree::ChannelTree() : m_firstRoot(-1), m_lastRoot(-1) {
+}
+
+bool ChannelTree::add(int id, int parentId) {
+    const int parentSlot = parentId < 0 ? -1 : slot(parentId);
+    if (m_slots.contains(id) || (parentId >= 0 && parentSlot < 0)) {
+        return false;
+    }
+
+    int s;
+    if (!m_freeSlots.empty()) {
+        s = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        s = static_cast<int>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+    m_nodes[static_cast<size_t>(s)] = { id, -1, -1, -1, -1, -1, 0, 1 };
+    m_slots.insert(id, s);
+
+    // The last child ends where the subtree of its parent ended
+    const int position = parentSlot < 0 ? size()
+                                        : m_nodes[static_cast<size_t>(parentSlot)].enter
+                                              + m_nodes[static_cast<size_t>(parentSlot)].size;
+    m_order.insert(m_order.begin() + position, s);
+    link(s, parentSlot);
+    resize(parentSlot, 1);
+    renumber(position, size());
+    return true;
+}
+
+bool ChannelTree::move(int id, int parentId) {
+    const int s = slot(id);
+    const int parentSlot = parentId < 0 ? -1 : slot(parentId);
+    if (s < 0 || (parentId >= 0 && parentSlot < 0)) {
+        return false;
+    }
+
+    Node &node = m_nodes[static_cast<size_t>(s)];
+    if (node.parent == parentSlot) {
+        return true;
+    }
+    const int begin = node.enter;
+    const int end = node.enter + node.size;
+    if (parentSlot >= 0) {
+        const int parentEnter = m_nodes[static_cast<size_t>(parentSlot)].enter;
+        if (parentEnter >= begin && parentEnter < end) {
+            return false;
+        }
+    }
+
+    // Where the subtree of the new parent ends, before anything moved
+    const int target = parentSlot < 0 ? size()
+                                      : m_nodes[static_cast<size_t>(parentSlot)].enter
+                                            + m_nodes[static_cast<size_t>(parentSlot)].size;
+
+    resize(node.parent, -node.size);
+    resize(parentSlot, node.size);
+    unlink(s);
+    link(s, parentSlot);
+
+    // The subtree is one block of the tour; rotating it to its new place
+    // only shifts what lies between the two places
+    if (target > end) {
+        std::rotate(m_order.begin() + begin, m_order.begin() + end, m_order.begin() + target);
+        renumber(begin, target);
+    } else if (target < begin) {
+        std::rotate(m_order.begin() + target, m_order.begin() + begin, m_order.begin() + end);
+        renumber(target, end);
+    }
+    return true;
+}
+
+int ChannelTree::remove(int id) {
+    const int s = slot(id);
+    if (s < 0) {
+        return 0;
+    }
+
+    const Node &node = m_nodes[static_cast<size_t>(s)];
+    const int begin = node.enter;
+    const int count = node.size;
+
+    resize(node.parent, -count);
+    unlink(s);
+    for (int position = begin; position < begin + count; ++position) {
+        const int removed = m_order[static_cast<size_t>(position)];
+        m_slots.remove(m_nodes[static_cast<size_t>(removed)].id);
+        m_freeSlots.push_back(removed);
+    }
+    m_order.erase(m_order.begin() + begin, m_order.begin() + begin + count);
+    renumber(begin, size());
+    return count;
+}
+
+void ChannelTree::clear() {
+    m_nodes.clear();
+    m_freeSlots.clear();
+    m_order.clear();
+    m_slots.clear();
+    m_firstRoot = -1;
+    m_lastRoot = -1;
+}
+
+int ChannelTree::parent(int id) const {
+    const int s = slot(id);
+    if (s < 0) {
+        return -1;
+    }
+
+    const int p = m_nodes[static_cast<size_t>(s)].parent;
+    return p < 0 ? -1 : m_nodes[static_cast<size_t>(p)].id;
+}
+
+QList<int> ChannelTree::children(int id) const {
+    QList<int> ids;
+    const int s = id < 0 ? -1 : slot(id);
+    if (id >= 0 && s < 0) {
+        return ids;
+    }
+
+    for (int child = s < 0 ? m_firstRoot : m_nodes[static_cast<size_t>(s)].firstChild; child >= 0;
+         child = m_nodes[static_cast<size_t>(child)].nextSibling) {
+        ids.append(m_nodes[static_cast<size_t>(child)].id);
+    }
+    return ids;
+}
+
+int ChannelTree::enter(int id) const {
+    const int s = slot(id);
+    return s < 0 ? -1 : m_nodes[static_cast<size_t>(s)].enter;
+}
+
+int ChannelTree::exit(int id) const {
+    const int s = slot(id);
+    return s < 0 ? -1 : m_nodes[static_cast<size_t>(s)].enter + m_nodes[static_cast<size_t>(s)].size;
+}
+
+bool ChannelTree::isInSubtree(int rootId, int id) const {
+    const int root = slot(rootId);
+    const int s = slot(id);
+    if (root < 0 || s < 0) {
+        return false;
+    }
+
+    const Node &node = m_nodes[static_cast<size_t>(root)];
+    const int position = m_nodes[static_cast<size_t>(s)].enter;
+    return position >= node.enter && position < node.enter + node.size;
+}
+
+QList<int> ChannelTree::subtree(int id) const {
+    QList<int> ids;
+    const int begin = enter(id);
+    if (begin < 0) {
+        return ids;
+    }
+
+    const int end = exit(id);
+    ids.reserve(end - begin);
+    for (int position = begin; position < end; ++position) {
+        ids.append(channelAt(position));
+    }
+    return ids;
+}
+
+void ChannelTree::link(int slot, int parent) {
+    Node &node = m_nodes[static_cast<size_t>(slot)];
+    int &first = parent < 0 ? m_firstRoot : m_nodes[static_cast<size_t>(parent)].firstChild;
+    int &last = parent < 0 ? m_lastRoot : m_nodes[static_cast<size_t>(parent)].lastChild;
+
+    node.parent = parent;
+    node.prevSibling = last;
+    node.nextSibling = -1;
+    if (last >= 0) {
+        m_nodes[static_cast<size_t>(last)].nextSibling = slot;
+    } else {
+        first = slot;
+    }
+    last = slot;
+}
+
+void ChannelTree::unlink(int slot) {
+    Node &node = m_nodes[static_cast<size_t>(slot)];
+    int &first = node.parent < 0 ? m_firstRoot : m_nodes[static_cast<size_t>(node.parent)].firstChild;
+    int &last = node.parent < 0 ? m_lastRoot : m_nodes[static_cast<size_t>(node.parent)].lastChild;
+
+    if (node.prevSibling >= 0) {
+        m_nodes[static_cast<size_t>(node.prevSibling)].nextSibling = node.nextSibling;
+    } else {
+        first = node.nextSibling;
+    }
+    if (node.nextSibling >= 0) {
+        m_nodes[static_cast<size_t>(node.nextSibling)].prevSibling = node.prevSibling;
+    } else {
+        last = node.prevSibling;
+    }
+    node.parent = -1;
+    node.prevSibling = -1;
+    node.nextSibling = -1;
+}
+
+void ChannelTree::resize(int parent, int delta) {
+    // The subtree sizes of all ancestors change; their positions do not
+    for (int s = parent; s >= 0; s = m_nodes[static_cast<size_t>(s)].parent) {
+        m_nodes[static_cast<size_t>(s)].size += delta;
+    }
+}
+
+void ChannelTree::renumber(int from, int to) {
+    for (int position = from; position < to; ++position) {
+        m_nodes[static_cast<size_t>(m_order[static_cast<size_t>(position)])].enter = position;
+    }
+}
@@ -0,0 +1,164 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CHANNELTREE_H_
+#define MUMBLE_MURMUR_CHANNELTREE_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+
+#include <vector>
+
+/**
+ * @brief The channel hierarchy, stored by channel ID in a contiguous arena.
+ *
+ * Every channel is a node with the indices of its parent, children and
+ * siblings, so walking the tree follows indices into one array rather than
+ * pointers. The nodes are also kept in an Euler tour (preorder) in which
+ * every subtree is one contiguous range: a channel enters at enter() and its
+ * subtree ends before exit(). "Is X in the tree of Y" is then two integer
+ * comparisons, and the channels of a tree are a range scan of channelAt().
+ *
+ * Adding, moving or removing a channel links and unlinks its node and only
+ * renumbers the part of the tour that shifted. Channels without a parent are
+ * top-level; there can be several.
+ *
+ * Not thread-safe; the server guards it with the voice thread lock, as it
+ * does the channels themselves.
+ */
+class ChannelTree {
+public:
+    ChannelTree();
+
+    /**
+     * @brief Add a channel as the last child of another.
+     *
+     * @param id The ID of the new channel
+     * @param parentId The ID of its parent; -1 for a top-level channel
+     * @return False if the channel exists or the parent does not
+     */
+    bool add(int id, int parentId = -1);
+
+    /**
+     * @brief Move a channel and its subchannels under another parent.
+     *
+     * The channel becomes the last child of its new parent.
+     *
+     * @param id The ID of the channel
+     * @param parentId The ID of the new parent; -1 to make it top-level
+     * @return False if either channel does not exist or the new parent is in
+     *         the tree of the channel
+     */
+    bool move(int id, int parentId);
+
+    /**
+     * @brief Remove a channel and its subchannels.
+     *
+     * @param id The ID of the channel
+     * @return The number of channels removed
+     */
+    int remove(int id);
+
+    /**
+     * @brief Remove all channels.
+     */
+    void clear();
+
+    bool contains(int id) const { return m_slots.contains(id); }
+
+    /**
+     * @brief Get the number of channels.
+     *
+     * @return The channels in the tree, which is also the length of the tour
+     */
+    int size() const { return static_cast<int>(m_order.size()); }
+
+    /**
+     * @brief Get the parent of a channel.
+     *
+     * @param id The ID of the channel
+     * @return The ID of the parent; -1 for a top-level or unknown channel
+     */
+    int parent(int id) const;
+
+    /**
+     * @brief Get the children of a channel, in the order they were added.
+     *
+     * @param id The ID of the channel; -1 for the top-level channels
+     * @return The IDs of the children
+     */
+    QList<int> children(int id) const;
+
+    /**
+     * @brief Get the position of a channel in the tour.
+     *
+     * @param id The ID of the channel
+     * @return The position; -1 for an unknown channel
+     */
+    int enter(int id) const;
+
+    /**
+     * @brief Get the end of the subtree of a channel in the tour.
+     *
+     * @param id The ID of the channel
+     * @return The position after the last channel of the subtree; -1 for an
+     *         unknown channel
+     */
+    int exit(int id) const;
+
+    /**
+     * @brief Get the channel at a position of the tour.
+     *
+     * @param position A position from 0 to size() - 1
+     * @return The ID of the channel
+     */
+    int channelAt(int position) const {
+        return m_nodes[static_cast<size_t>(m_order[static_cast<size_t>(position)])].id;
+    }
+
+    /**
+     * @brief Check whether a channel is in the tree of another.
+     *
+     * @param rootId The ID of the root of the tree
+     * @param id The ID of the channel to check
+     * @return True if the channel is the root or one of its subchannels
+     */
+    bool isInSubtree(int rootId, int id) const;
+
+    /**
+     * @brief Get the channels of a tree.
+     *
+     * @param id The ID of the root of the tree
+     * @return The IDs of the root and all of its subchannels, in tour order
+     */
+    QList<int> subtree(int id) const;
+
+private:
+    struct Node {
+        int id;
+        int parent; // Slots; -1 for none
+        int firstChild;
+        int lastChild;
+        int prevSibling;
+        int nextSibling;
+        int enter; // Position in m_order
+        int size; // Nodes in the subtree, this one included
+    };
+
+    int slot(int id) const { return m_slots.value(id, -1); }
+    void link(int slot, int parent);
+    void unlink(int slot);
+    void resize(int parent, int delta);
+    void renumber(int from, int to);
+
+    std::vector<Node> m_nodes; // The arena; free slots are reused
+    std::vector<int> m_freeSlots;
+    std::vector<int> m_order; // Slots in tour order
+    QHash<int, int> m_slots; // Channel ID to slot
+    int m_firstRoot;
+    int m_lastRoot;
+};
+
+#endif // MUMBLE_MURMUR_CHANNELTREE_H_
@@ -0,0 +1,84 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CoarseClock.h"
+
+#include <cassert>
+#include <chrono>
+
+namespace {
+    qint64 readMonotonicMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    qint64 readUtcMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+} // namespace
+
+CoarseClock::CoarseClock(int resolutionMs)
+    : m_resolutionMs(qMax(1, resolutionMs)), m_monotonicMs(0), m_utcMs(0), m_simulationMs(0),
+      m_simulationAnchorMs(readMonotonicMs()), m_simulationStartMs(readUtcMs()), m_simulationRate(1.0),
+      m_stop(false) {
+    tick();
+    m_thread = std::thread([this] { run(); });
+}
+
+CoarseClock::~CoarseClock() {
+    {
+        std::lock_guard<std::mutex> lock(m_stopMutex);
+        m_stop = true;
+    }
+    m_stopCondition.notify_all();
+    m_thread.join();
+}
+
+CoarseClock &CoarseClock::instance() {
+    static CoarseClock clock;
+    return clock;
+}
+
+void CoarseClock::setSimulation(qint64 offsetMs, double rate) {
+    assert(rate > 0.0);
+
+    {
+        std::lock_guard<std::mutex> lock(m_tickMutex);
+        m_simulationAnchorMs = readMonotonicMs();
+        m_simulationStartMs = readUtcMs() + offsetMs;
+        m_simulationRate = rate;
+    }
+    tick();
+}
+
+double CoarseClock::simulationRate() const {
+    std::lock_guard<std::mutex> lock(m_tickMutex);
+    return m_simulationRate;
+}
+
+void CoarseClock::tick() {
+    // Serialized, so a tick that read the clocks earlier never overwrites a
+    // later one
+    std::lock_guard<std::mutex> lock(m_tickMutex);
+
+    const qint64 monotonic = readMonotonicMs();
+    const qint64 simulation =
+        m_simulationStartMs
+        + static_cast<qint64>(static_cast<double>(monotonic - m_simulationAnchorMs) * m_simulationRate);
+
+    m_monotonicMs.store(monotonic, std::memory_order_relaxed);
+    m_utcMs.store(readUtcMs(), std::memory_order_relaxed);
+    m_simulationMs.store(simulation, std::memory_order_relaxed);
+}
+
+void CoarseClock::run() {
+    std::unique_lock<std::mutex> lock(m_stopMutex);
+    while (!m_stopCondition.wait_for(lock, std::chrono::milliseconds(m_resolutionMs), [this] { return m_stop; })) {
+        tick();
+    }
+}
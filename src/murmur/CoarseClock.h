@@ -0,0 +1,149 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_COARSECLOCK_H_
+#define MUMBLE_MURMUR_COARSECLOCK_H_
+
+#include <QtCore/QDateTime>
+#include <QtCore/QtGlobal>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Clock for hot paths that need the time often but not precisely.
+ *
+ * A ticker thread reads the system clocks once per tick and publishes the
+ * results into atomics, so reading the time is a single relaxed load: no
+ * system call, no time zone lookup and no lock. The values lag the real time
+ * by at most one tick (DEFAULT_RESOLUTION_MS by default).
+ *
+ * Three times are published:
+ * - monotonic: steady milliseconds for measuring intervals
+ * - UTC: wall-clock milliseconds since the epoch
+ * - simulation: the time the HF propagation model sees. It starts out equal
+ *   to UTC and can be shifted or sped up (setSimulation()) to demonstrate
+ *   day/night and seasonal changes without touching the wall clock.
+ *
+ * Each value is consistent on its own; two values read one after the other
+ * may come from neighbouring ticks.
+ */
+class CoarseClock {
+public:
+    /// Default interval between two ticks
+    static const int DEFAULT_RESOLUTION_MS = 5;
+
+    /**
+     * @brief Constructor for CoarseClock.
+     *
+     * Publishes the first tick before returning and starts the ticker thread.
+     *
+     * @param resolutionMs Interval between two ticks
+     */
+    explicit CoarseClock(int resolutionMs = DEFAULT_RESOLUTION_MS);
+
+    /**
+     * @brief Destructor for CoarseClock.
+     *
+     * Stops the ticker thread.
+     */
+    ~CoarseClock();
+
+    CoarseClock(const CoarseClock &) = delete;
+    CoarseClock &operator=(const CoarseClock &) = delete;
+
+    /**
+     * @brief Get the clock shared by the whole process.
+     *
+     * Created on first use.
+     *
+     * @return The clock
+     */
+    static CoarseClock &instance();
+
+    /**
+     * @brief Get the monotonic time.
+     *
+     * @return Milliseconds on the steady clock; only differences are meaningful
+     */
+    qint64 monotonicMs() const { return m_monotonicMs.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the wall-clock time.
+     *
+     * @return Milliseconds since the epoch, UTC
+     */
+    qint64 utcMs() const { return m_utcMs.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the wall-clock time as a QDateTime.
+     *
+     * @return The time in UTC
+     */
+    QDateTime utc() const { return QDateTime::fromMSecsSinceEpoch(utcMs(), Qt::UTC); }
+
+    /**
+     * @brief Get the simulation time.
+     *
+     * @return Milliseconds since the epoch, UTC
+     */
+    qint64 simulationMs() const { return m_simulationMs.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the simulation time as a QDateTime.
+     *
+     * @return The time in UTC
+     */
+    QDateTime simulation() const { return QDateTime::fromMSecsSinceEpoch(simulationMs(), Qt::UTC); }
+
+    /**
+     * @brief Shift and speed up the simulation time.
+     *
+     * From now on the simulation time starts at the wall-clock time plus
+     * offsetMs and advances rate times as fast as the wall clock.
+     *
+     * @param offsetMs Offset from the wall clock, in milliseconds
+     * @param rate Simulated milliseconds per real millisecond; must be positive
+     */
+    void setSimulation(qint64 offsetMs, double rate);
+
+    /**
+     * @brief Get the rate the simulation time advances at.
+     *
+     * @return Simulated milliseconds per real millisecond
+     */
+    double simulationRate() const;
+
+    /**
+     * @brief Publish the current time right away instead of at the next tick.
+     */
+    void tick();
+
+private:
+    void run();
+
+    const int m_resolutionMs;
+
+    std::atomic<qint64> m_monotonicMs;
+    std::atomic<qint64> m_utcMs;
+    std::atomic<qint64> m_simulationMs;
+
+    // Taken by the ticks and by changes to the simulation parameters. The
+    // simulation time is m_simulationStartMs plus m_simulationRate times the
+    // monotonic time since m_simulationAnchorMs.
+    mutable std::mutex m_tickMutex;
+    qint64 m_simulationAnchorMs;
+    qint64 m_simulationStartMs;
+    double m_simulationRate;
+
+    std::mutex m_stopMutex;
+    std::condition_variable m_stopCondition;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+#endif // MUMBLE_MURMUR_COARSECLOCK_H_
@@ -0,0 +1,234 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CodePracticeBroadcaster.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QStringList>
+
+#include <algorithm>
+
+CodePracticeBroadcaster::CodePracticeBroadcaster(CWFrameCache *cache)
+    : m_cache(cache)
+    , m_pitchHz(600)
+    , m_lastMinute(-1) {
+}
+
+void CodePracticeBroadcaster::setPitch(int hz) {
+    QMutexLocker locker(&m_mutex);
+    m_pitchHz = qBound(CWFrameCache::MIN_PITCH, hz, CWFrameCache::MAX_PITCH);
+}
+
+bool CodePracticeBroadcaster::loadSchedule(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "CodePracticeBroadcaster: Cannot read schedule" << path;
+        return false;
+    }
+
+    const QString directory = QFileInfo(path).absolutePath();
+    const QStringList lines = QString::fromUtf8(file.readAll()).split('\n');
+
+    int pitch;
+    {
+        QMutexLocker locker(&m_mutex);
+        pitch = m_pitchHz;
+    }
+
+    // Build every frame sequence now, on the caller's thread, so that ticking
+    // only ever reads from the cache
+    std::vector<ScheduledBroadcast> schedule;
+    for (int i = 0; i < lines.size(); ++i) {
+        const QString line = lines.at(i).section('#', 0, 0).trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        Broadcast broadcast;
+        if (!parseScheduleLine(line, broadcast)) {
+            qWarning() << "CodePracticeBroadcaster: Ignoring line" << (i + 1) << "of" << path;
+            continue;
+        }
+
+        if (broadcast.text.startsWith('@')) {
+            QFile textFile(QFileInfo(directory, broadcast.text.mid(1)).filePath());
+            if (!textFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                qWarning() << "CodePracticeBroadcaster: Cannot read text file" << textFile.fileName();
+                continue;
+            }
+            broadcast.text = QString::fromUtf8(textFile.readAll()).trimmed();
+        }
+
+        ScheduledBroadcast scheduled;
+        scheduled.hour = broadcast.hour;
+        scheduled.minute = broadcast.minute;
+        for (const Speed &speed : broadcast.speeds) {
+            ScheduledSpeed entry;
+            entry.speed = speed;
+            entry.sequences = m_cache->sequencesForText(broadcast.text, speed.wpm, speed.farnsworthWpm, pitch);
+            if (!entry.sequences.isEmpty()) {
+                scheduled.speeds.push_back(std::move(entry));
+            }
+        }
+
+        if (!scheduled.speeds.empty()) {
+            schedule.push_back(std::move(scheduled));
+        }
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_streams.clear();
+    m_schedule = std::move(schedule);
+    m_lastMinute = -1;
+
+    qDebug() << "CodePracticeBroadcaster: Loaded" << m_schedule.size() << "broadcasts from" << path;
+    return true;
+}
+
+bool CodePracticeBroadcaster::parseScheduleLine(const QString &line, Broadcast &broadcast) {
+    // <time> <speeds> <text>
+    static const QRegularExpression linePattern(QStringLiteral("^(\\*|\\d{1,2}):(\\d{2})\\s+(\\S+)\\s+(.+)$"));
+    static const QRegularExpression speedPattern(QStringLiteral("^(\\d+)(?:/(\\d+))?@(\\d+)$"));
+
+    const QRegularExpressionMatch match = linePattern.match(line);
+    if (!match.hasMatch()) {
+        return false;
+    }
+
+    broadcast.hour = (match.captured(1) == QLatin1String("*")) ? -1 : match.captured(1).toInt();
+    broadcast.minute = match.captured(2).toInt();
+    if (broadcast.hour > 23 || broadcast.minute > 59) {
+        return false;
+    }
+
+    broadcast.speeds.clear();
+    for (const QString &token : match.captured(3).split(',', Qt::SkipEmptyParts)) {
+        const QRegularExpressionMatch speedMatch = speedPattern.match(token);
+        if (!speedMatch.hasMatch()) {
+            return false;
+        }
+
+        Speed speed;
+        speed.wpm = qBound(CWFrameCache::MIN_WPM, speedMatch.captured(1).toInt(), CWFrameCache::MAX_WPM);
+        speed.farnsworthWpm = speedMatch.captured(2).isEmpty()
+                                  ? speed.wpm
+                                  : qBound(CWFrameCache::MIN_WPM, speedMatch.captured(2).toInt(), speed.wpm);
+        speed.channelId = speedMatch.captured(3).toInt();
+        broadcast.speeds.append(speed);
+    }
+
+    broadcast.text = match.captured(4).trimmed();
+    return !broadcast.speeds.isEmpty() && !broadcast.text.isEmpty();
+}
+
+int CodePracticeBroadcaster::tick(qint64 utcMs, const FrameSink &sink) {
+    struct Frame {
+        int channelId;
+        const unsigned char *data;
+        int size;
+        bool last;
+    };
+    std::vector<Frame> frames;
+
+    QMutexLocker locker(&m_mutex);
+
+    // Start what is due, once per minute. A new broadcast on a channel
+    // replaces whatever is still running there.
+    const qint64 minute = utcMs / 60000;
+    if (minute != m_lastMinute) {
+        m_lastMinute = minute;
+        const int hour = static_cast<int>((minute / 60) % 24);
+        const int minuteOfHour = static_cast<int>(minute % 60);
+
+        for (const ScheduledBroadcast &broadcast : m_schedule) {
+            if (broadcast.minute != minuteOfHour || (broadcast.hour >= 0 && broadcast.hour != hour)) {
+                continue;
+            }
+
+            for (const ScheduledSpeed &speed : broadcast.speeds) {
+                const int channelId = speed.speed.channelId;
+                m_streams.erase(std::remove_if(m_streams.begin(), m_streams.end(),
+                                               [channelId](const Stream &stream) {
+                                                   return stream.speed->speed.channelId == channelId;
+                                               }),
+                                m_streams.end());
+                m_streams.push_back({ &speed, 0, 0 });
+            }
+        }
+    }
+
+    frames.reserve(m_streams.size());
+    for (auto it = m_streams.begin(); it != m_streams.end();) {
+        Stream &stream = *it;
+        const CWFrameCache::FrameSequence &sequence = stream.speed->sequences.at(stream.sequence);
+
+        Frame frame;
+        frame.channelId = stream.speed->speed.channelId;
+        frame.data = sequence.frame(stream.frame, frame.size);
+        frame.last = false;
+
+        if (++stream.frame >= sequence.frameCount()) {
+            stream.frame = 0;
+            if (++stream.sequence >= stream.speed->sequences.size()) {
+                frame.last = true;
+                frames.push_back(frame);
+                it = m_streams.erase(it);
+                continue;
+            }
+        }
+        frames.push_back(frame);
+        ++it;
+    }
+
+    // Frame data lives in the cache, not in the schedule, so it stays valid
+    // after the lock is released. The sink may call back into this object.
+    locker.unlock();
+    for (const Frame &frame : frames) {
+        sink(frame.channelId, frame.data, frame.size, frame.last);
+    }
+
+    return static_cast<int>(frames.size());
+}
+
+bool CodePracticeBroadcaster::hasSchedule() const {
+    QMutexLocker locker(&m_mutex);
+    return !m_schedule.empty();
+}
+
+QSet<int> CodePracticeBroadcaster::channels() const {
+    QMutexLocker locker(&m_mutex);
+
+    QSet<int> result;
+    for (const ScheduledBroadcast &broadcast : m_schedule) {
+        for (const ScheduledSpeed &speed : broadcast.speeds) {
+            result.insert(speed.speed.channelId);
+        }
+    }
+    return result;
+}
+
+void CodePracticeBroadcaster::setListenerAudible(unsigned int session, bool audible) {
+    QMutexLocker locker(&m_mutex);
+    if (audible) {
+        m_blockedListeners.remove(session);
+    } else {
+        m_blockedListeners.insert(session);
+    }
+}
+
+bool CodePracticeBroadcaster::isListenerAudible(unsigned int session) const {
+    QMutexLocker locker(&m_mutex);
+    return !m_blockedListeners.contains(session);
+}
+
+void CodePracticeBroadcaster::removeListener(unsigned int session) {
+    QMutexLocker locker(&m_mutex);
+    // Sessions are reused, so a stale block would silence the next user
+    m_blockedListeners.remove(session);
+}
@@ -0,0 +1,191 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CODEPRACTICEBROADCASTER_H_
+#define MUMBLE_MURMUR_CODEPRACTICEBROADCASTER_H_
+
+#include "CWFrameCache.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The CodePracticeBroadcaster class plays scheduled code practice.
+ *
+ * A schedule file lists broadcasts: a start time, the speeds to send at
+ * (each on its own channel) and the text. At the start time every speed
+ * starts streaming its text, one 20 ms Opus frame per tick, straight from
+ * the CWFrameCache. Each speed is generated once and the same frame goes to
+ * every listener, so the work is proportional to the number of speeds, not
+ * the number of listeners.
+ *
+ * Schedule format, one broadcast per line (times in UTC, '#' starts a comment):
+ * @code
+ * 19:00  5/5@12,13@13,20@14  VVV VVV CQ CQ CQ DE SUPERMORSE
+ * *:30   15/10@12            @qst.txt
+ * @endcode
+ * The time is HH:MM for a daily broadcast or *:MM for an hourly one. Speeds
+ * are WPM[/EFFECTIVE]@CHANNEL; an effective speed below the character speed
+ * uses Farnsworth spacing. Text starting with '@' is read from that file,
+ * relative to the schedule file.
+ *
+ * All frame sequences are built when the schedule is loaded, so ticking
+ * never encodes. The schedule is loaded on the main thread and ticked on the
+ * voice thread; access is serialized.
+ */
+class CodePracticeBroadcaster {
+public:
+    /**
+     * @brief One speed of a broadcast.
+     */
+    struct Speed {
+        int wpm;
+        int farnsworthWpm;
+        int channelId;
+    };
+
+    /**
+     * @brief One scheduled broadcast.
+     */
+    struct Broadcast {
+        int hour; ///< UTC hour, or -1 for every hour
+        int minute; ///< UTC minute
+        QVector<Speed> speeds;
+        QString text;
+    };
+
+    /**
+     * @brief Callback that receives the frame of one channel for this tick.
+     *
+     * @param channelId The channel the frame is broadcast on
+     * @param data The encoded Opus frame
+     * @param size The size of the frame in bytes
+     * @param lastFrame True for the last frame of the broadcast on the channel
+     */
+    using FrameSink = std::function<void(int channelId, const unsigned char *data, int size, bool lastFrame)>;
+
+    /**
+     * @brief Constructor for CodePracticeBroadcaster.
+     *
+     * @param cache The cache the frames come from; must outlive the broadcaster
+     */
+    explicit CodePracticeBroadcaster(CWFrameCache *cache);
+
+    /**
+     * @brief Set the tone pitch; takes effect at the next schedule load.
+     *
+     * @param hz The pitch in Hz
+     */
+    void setPitch(int hz);
+
+    /**
+     * @brief Load a schedule file and build all of its frames.
+     *
+     * Replaces the current schedule and stops any running broadcast.
+     *
+     * @param path The schedule file
+     * @return True if the file was read (lines with errors are skipped)
+     */
+    bool loadSchedule(const QString &path);
+
+    /**
+     * @brief Parse one line of a schedule file.
+     *
+     * @param line The line, without comment
+     * @param broadcast Receives the broadcast
+     * @return True if the line describes a broadcast
+     */
+    static bool parseScheduleLine(const QString &line, Broadcast &broadcast);
+
+    /**
+     * @brief Advance all running broadcasts by one 20 ms frame.
+     *
+     * Starts the broadcasts that are due. Must be called once per frame. The
+     * sink is called without any lock held.
+     *
+     * @param utcMs The current time in milliseconds since the epoch (UTC)
+     * @param sink Callback that receives the frame of each broadcasting channel
+     * @return The number of frames produced
+     */
+    int tick(qint64 utcMs, const FrameSink &sink);
+
+    /**
+     * @brief Check whether anything is scheduled.
+     *
+     * @return True if the schedule has at least one broadcast
+     */
+    bool hasSchedule() const;
+
+    /**
+     * @brief Get the channels the schedule broadcasts on.
+     *
+     * @return The channel IDs
+     */
+    QSet<int> channels() const;
+
+    /**
+     * @brief Set whether a listener can receive the practice station.
+     *
+     * Listeners are audible unless blocked.
+     *
+     * @param session The listener's session
+     * @param audible False if propagation blocks the listener
+     */
+    void setListenerAudible(unsigned int session, bool audible);
+
+    /**
+     * @brief Check whether a listener can receive the practice station.
+     *
+     * @param session The listener's session
+     * @return False if propagation blocks the listener
+     */
+    bool isListenerAudible(unsigned int session) const;
+
+    /**
+     * @brief Forget a listener that left the server.
+     *
+     * @param session The listener's session
+     */
+    void removeListener(unsigned int session);
+
+private:
+    Q_DISABLE_COPY(CodePracticeBroadcaster)
+
+    struct ScheduledSpeed {
+        Speed speed;
+        QVector<CWFrameCache::FrameSequence> sequences;
+    };
+
+    struct ScheduledBroadcast {
+        int hour;
+        int minute;
+        std::vector<ScheduledSpeed> speeds;
+    };
+
+    // A speed that is currently being sent
+    struct Stream {
+        const ScheduledSpeed *speed;
+        int sequence;
+        int frame;
+    };
+
+    mutable QMutex m_mutex;
+    CWFrameCache *m_cache;
+    int m_pitchHz;
+
+    std::vector<ScheduledBroadcast> m_schedule;
+    std::vector<Stream> m_streams;
+    qint64 m_lastMinute;
+
+    QSet<unsigned int> m_blockedListeners;
+};
+
+#endif // MUMBLE_MURMUR_CODEPRACTICEBROADCASTER_H_
@@ -0,0 +1,279 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CpuTopology.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#	include <pthread.h>
+#	include <sched.h>
+#endif
+
+namespace {
+    // Upper bound for CPU numbers in configured lists, so a typo cannot
+    // expand into a huge range
+    const int MAX_CPU_ID = 4095;
+
+#ifdef Q_OS_LINUX
+    const char *const SYSFS_CPU = "/sys/devices/system/cpu/cpu%1";
+
+    int readSysfsInt(const QString &path, int fallback) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return fallback;
+        }
+
+        bool ok;
+        const int value = QString::fromLatin1(file.readAll()).trimmed().toInt(&ok);
+        return ok ? value : fallback;
+    }
+
+    // The node a CPU belongs to is only exposed as a nodeN link in its directory
+    int readNode(const QString &cpuPath) {
+        const QStringList entries = QDir(cpuPath).entryList(QStringList() << "node*", QDir::Dirs);
+        for (const QString &entry : entries) {
+            bool ok;
+            const int node = entry.mid(4).toInt(&ok);
+            if (ok) {
+                return node;
+            }
+        }
+        return -1;
+    }
+#endif
+}
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topology;
+
+#ifdef Q_OS_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        // Cores are numbered per socket; renumber them so they are unique
+        QMap<QPair<int, int>, int> cores;
+
+        for (int id = 0; id < CPU_SETSIZE; ++id) {
+            if (!CPU_ISSET(id, &allowed)) {
+                continue;
+            }
+
+            const QString path = QString::fromLatin1(SYSFS_CPU).arg(id);
+            Cpu cpu;
+            cpu.id = id;
+            cpu.package = qMax(0, readSysfsInt(path + "/topology/physical_package_id", 0));
+
+            const QPair<int, int> coreKey(cpu.package, readSysfsInt(path + "/topology/core_id", id));
+            if (!cores.contains(coreKey)) {
+                const int index = cores.size();
+                cores.insert(coreKey, index);
+            }
+            cpu.core = cores.value(coreKey);
+
+            // Kernels without NUMA support have one node per socket at most
+            const int node = readNode(path);
+            cpu.node = node >= 0 ? node : cpu.package;
+
+            topology.m_cpus.append(cpu);
+        }
+    } else {
+        qWarning() << "CpuTopology: Failed to read the process affinity mask";
+    }
+#endif
+
+    if (topology.m_cpus.isEmpty()) {
+        const int count = qMax(1, QThread::idealThreadCount());
+        for (int id = 0; id < count; ++id) {
+            topology.m_cpus.append(Cpu{ id, id, 0, 0 });
+        }
+    }
+
+    std::sort(topology.m_cpus.begin(), topology.m_cpus.end(), [](const Cpu &a, const Cpu &b) {
+        if (a.node != b.node) {
+            return a.node < b.node;
+        }
+        if (a.core != b.core) {
+            return a.core < b.core;
+        }
+        return a.id < b.id;
+    });
+
+    return topology;
+}
+
+const CpuTopology &CpuTopology::system() {
+    static const CpuTopology topology = detect();
+    return topology;
+}
+
+int CpuTopology::coreCount() const {
+    QSet<int> cores;
+    for (const Cpu &cpu : m_cpus) {
+        cores.insert(cpu.core);
+    }
+    return cores.size();
+}
+
+QVector<int> CpuTopology::nodes() const {
+    QVector<int> result;
+    for (const Cpu &cpu : m_cpus) {
+        if (!result.contains(cpu.node)) {
+            result.append(cpu.node);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+QVector<int> CpuTopology::cpusOfNode(int node) const {
+    // Hand out one hardware thread per core before doubling up on a core's
+    // siblings, which share its execution units
+    QVector<int> result;
+    QSet<int> taken;
+    while (result.size() < m_cpus.size()) {
+        QSet<int> coresThisRound;
+        bool added = false;
+        for (const Cpu &cpu : m_cpus) {
+            if (cpu.node != node || taken.contains(cpu.id) || coresThisRound.contains(cpu.core)) {
+                continue;
+            }
+            coresThisRound.insert(cpu.core);
+            taken.insert(cpu.id);
+            result.append(cpu.id);
+            added = true;
+        }
+        if (!added) {
+            break;
+        }
+    }
+    return result;
+}
+
+int CpuTopology::nodeOf(int cpu) const {
+    for (const Cpu &entry : m_cpus) {
+        if (entry.id == cpu) {
+            return entry.node;
+        }
+    }
+    return -1;
+}
+
+int CpuTopology::coreOf(int cpu) const {
+    for (const Cpu &entry : m_cpus) {
+        if (entry.id == cpu) {
+            return entry.core;
+        }
+    }
+    return -1;
+}
+
+QString CpuTopology::describe() const {
+    QSet<int> packages;
+    for (const Cpu &cpu : m_cpus) {
+        packages.insert(cpu.package);
+    }
+
+    return QString("%1 CPUs, %2 cores, %3 sockets, %4 NUMA nodes")
+        .arg(cpuCount())
+        .arg(coreCount())
+        .arg(packages.size())
+        .arg(nodes().size());
+}
+
+QVector<int> CpuTopology::parseCpuList(const QString &text, bool *ok) {
+    QVector<int> result;
+    bool valid = true;
+
+    const QStringList parts = text.split(',');
+    for (const QString &rawPart : parts) {
+        const QString part = rawPart.trimmed();
+        if (part.isEmpty()) {
+            continue;
+        }
+
+        bool firstOk;
+        bool lastOk;
+        int first;
+        int last;
+        const int dash = part.indexOf('-');
+        if (dash < 0) {
+            first = last = part.toInt(&firstOk);
+            lastOk = firstOk;
+        } else {
+            first = part.left(dash).trimmed().toInt(&firstOk);
+            last = part.mid(dash + 1).trimmed().toInt(&lastOk);
+        }
+
+        if (!firstOk || !lastOk || first < 0 || last < first || last > MAX_CPU_ID) {
+            valid = false;
+            continue;
+        }
+
+        for (int cpu = first; cpu <= last; ++cpu) {
+            if (!result.contains(cpu)) {
+                result.append(cpu);
+            }
+        }
+    }
+
+    if (ok) {
+        *ok = valid;
+    }
+    return result;
+}
+
+QString CpuTopology::formatCpuList(QVector<int> cpus) {
+    if (cpus.isEmpty()) {
+        return QString("none");
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+
+    QStringList ranges;
+    int first = cpus.first();
+    int last = first;
+    for (int i = 1; i <= cpus.size(); ++i) {
+        if (i < cpus.size() && cpus.at(i) == last + 1) {
+            last = cpus.at(i);
+            continue;
+        }
+
+        ranges << (first == last ? QString::number(first) : QString("%1-%2").arg(first).arg(last));
+        if (i < cpus.size()) {
+            first = last = cpus.at(i);
+        }
+    }
+    return ranges.join(",");
+}
+
+bool CpuTopology::pinCurrentThread(const QVector<int> &cpus) {
+    if (cpus.isEmpty()) {
+        return true;
+    }
+
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    // Affinity is only implemented for Linux
+    return false;
+#endif
+}
@@ -0,0 +1,143 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CPUTOPOLOGY_H_
+#define MUMBLE_MURMUR_CPUTOPOLOGY_H_
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+/**
+ * @brief The CPUs this process may run on, grouped by NUMA node, socket and core.
+ *
+ * On Linux the layout is read from /sys/devices/system/cpu and limited to
+ * the process's affinity mask, so a server started under taskset or a
+ * cgroup cpuset only sees the CPUs it is allowed to use. Elsewhere every
+ * CPU is reported as its own core on a single node.
+ *
+ * On a dual-socket machine such as a pair of Xeon E5-2650 every socket is
+ * one NUMA node with 8 cores of 2 hardware threads each. Memory is local to
+ * the node whose thread first writes it, so a thread should stay on one
+ * node and allocate its own data after it has been pinned there.
+ */
+class CpuTopology {
+public:
+    /**
+     * @brief One logical CPU (hardware thread).
+     */
+    struct Cpu {
+        int id; ///< The CPU number used by the scheduler
+        int core; ///< Physical core, unique across sockets
+        int package; ///< Socket
+        int node; ///< NUMA node
+    };
+
+    /**
+     * @brief Read the topology of the machine.
+     *
+     * @return The detected topology; never empty
+     */
+    static CpuTopology detect();
+
+    /**
+     * @brief Get the topology detected at first use.
+     *
+     * @return The process-wide topology
+     */
+    static const CpuTopology &system();
+
+    /**
+     * @brief Get the usable CPUs, ordered by node, core and hardware thread.
+     *
+     * @return The CPUs
+     */
+    const QVector<Cpu> &cpus() const { return m_cpus; }
+
+    /**
+     * @brief Get the number of usable CPUs.
+     *
+     * @return The number of logical CPUs
+     */
+    int cpuCount() const { return m_cpus.size(); }
+
+    /**
+     * @brief Get the number of physical cores among the usable CPUs.
+     *
+     * @return The number of cores
+     */
+    int coreCount() const;
+
+    /**
+     * @brief Get the NUMA nodes that have usable CPUs.
+     *
+     * @return The node numbers in ascending order
+     */
+    QVector<int> nodes() const;
+
+    /**
+     * @brief Get the usable CPUs of a node.
+     *
+     * @param node The node
+     * @return The CPU numbers, first hardware thread of each core first
+     */
+    QVector<int> cpusOfNode(int node) const;
+
+    /**
+     * @brief Get the node of a CPU.
+     *
+     * @param cpu The CPU number
+     * @return The node, or -1 if the CPU is not usable
+     */
+    int nodeOf(int cpu) const;
+
+    /**
+     * @brief Get the core of a CPU.
+     *
+     * @param cpu The CPU number
+     * @return The core, or -1 if the CPU is not usable
+     */
+    int coreOf(int cpu) const;
+
+    /**
+     * @brief Describe the topology for the log.
+     *
+     * @return For example "32 CPUs, 16 cores, 2 sockets, 2 NUMA nodes"
+     */
+    QString describe() const;
+
+    /**
+     * @brief Parse a CPU list in the kernel's cpulist format.
+     *
+     * Accepts numbers and ranges separated by commas, such as "0-7,16-23".
+     *
+     * @param text The list; empty yields an empty list
+     * @param ok Set to false if the text is malformed
+     * @return The CPU numbers in the order given, without duplicates
+     */
+    static QVector<int> parseCpuList(const QString &text, bool *ok = nullptr);
+
+    /**
+     * @brief Format a CPU list in the kernel's cpulist format.
+     *
+     * @param cpus The CPU numbers
+     * @return For example "0-7,16-23", or "none" for an empty list
+     */
+    static QString formatCpuList(QVector<int> cpus);
+
+    /**
+     * @brief Restrict the calling thread to a set of CPUs.
+     *
+     * Only implemented on Linux; elsewhere it does nothing and fails.
+     *
+     * @param cpus The CPUs; empty leaves the thread unrestricted and succeeds
+     * @return True if the thread is now restricted to cpus
+     */
+    static bool pinCurrentThread(const QVector<int> &cpus);
+
+private:
+    QVector<Cpu> m_cpus;
+};
+
+#endif // MUMBLE_MURMUR_CPUTOPOLOGY_H_
@@ -8,6 +8,7 @@
 #include <QDebug>
 
 #include "DBWrapper.h"
+#include "Metrics.h"
 #include "database/ConnectionParameter.h"
 
 DBWrapper::DBWrapper(const ::mumble::db::ConnectionParameter &connectionParam, QObject *parent)
@@ -78,6 +79,12 @@ bool DBWrapper::isOpen() const {
 }
 
 QSqlQuery DBWrapper::execute(const QString &query, const QVariantList &params) {
+    static MetricHistogram &duration = MetricsRegistry::instance().histogram(
+        "murmur_db_query_duration_seconds", "Time database queries took, including the wait for the connection");
+    static MetricCounter &failures =
+        MetricsRegistry::instance().counter("murmur_db_query_failures_total", "Database queries that failed");
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
     QMutexLocker locker(&m_mutex);
     
     QSqlQuery sqlQuery(m_db);
@@ -90,10 +97,12 @@ QSqlQuery DBWrapper::execute(const QString &query, const QVariantList &params) {
     
     // Execute the query
     if (!sqlQuery.exec()) {
+        failures.increment();
         qWarning() << "Query execution failed:" << sqlQuery.lastError().text();
         qWarning() << "Query was:" << query;
     }
     
+    duration.recordSince(start);
     return sqlQuery;
 }
 
@@ -0,0 +1,215 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "DSPExecutor.h"
+#include "CpuTopology.h"
+
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef Q_OS_LINUX
+#	include <pthread.h>
+#	include <sched.h>
+#endif
+
+namespace {
+    // Spin briefly before parking; a new frame is usually only a few microseconds away
+    const int SPIN_ITERATIONS = 256;
+
+    void updateMax(std::atomic<qint64> &value, qint64 sample) {
+        qint64 current = value.load(std::memory_order_relaxed);
+        while (sample > current && !value.compare_exchange_weak(current, sample, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+DSPExecutor::DSPExecutor(int numWorkers, const QVector<int> &cpus, bool realtime, int queueCapacity)
+    : m_stop(false)
+    , m_submitted(0)
+    , m_rejected(0)
+    , m_realtime(realtime) {
+    numWorkers = qMax(1, numWorkers);
+    queueCapacity = qMax(2, queueCapacity);
+
+    const qint64 now = nowNs();
+    for (int i = 0; i < numWorkers; ++i) {
+        std::unique_ptr<Worker> worker(new Worker(queueCapacity));
+        worker->cpu = cpus.isEmpty() ? -1 : cpus.at(i % cpus.size());
+        worker->windowStartNs = now;
+        m_workers.push_back(std::move(worker));
+    }
+
+    // Start the threads only once every worker exists
+    for (std::unique_ptr<Worker> &worker : m_workers) {
+        Worker *w = worker.get();
+        w->thread = std::thread([this, w] { workerThread(w); });
+    }
+}
+
+DSPExecutor::~DSPExecutor() {
+    m_stop.store(true, std::memory_order_release);
+
+    for (std::unique_ptr<Worker> &worker : m_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->condition.notify_all();
+        }
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+
+        // Drop whatever was still queued
+        Job job;
+        while (worker->ring.pop(job)) {
+            delete job.task;
+        }
+    }
+}
+
+bool DSPExecutor::submit(unsigned int key, DSPTask *task, qint64 budgetNs) {
+    if (!task) {
+        return false;
+    }
+
+    Worker *worker = m_workers[key % m_workers.size()].get();
+
+    Job job;
+    job.task = task;
+    job.submittedNs = nowNs();
+    job.deadlineNs = job.submittedNs + budgetNs;
+
+    if (!worker->ring.push(job)) {
+        // Never block the voice thread; a late frame is as good as a lost one
+        delete task;
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_submitted.fetch_add(1, std::memory_order_relaxed);
+
+    // Pairs with the fence in workerThread() so either the worker sees the
+    // job or we see that it is parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker->sleeping.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->condition.notify_one();
+    }
+
+    return true;
+}
+
+DSPExecutor::Stats DSPExecutor::stats() {
+    Stats result;
+    result.submitted = m_submitted.load(std::memory_order_relaxed);
+    result.rejected = m_rejected.load(std::memory_order_relaxed);
+
+    const qint64 now = nowNs();
+    for (std::unique_ptr<Worker> &worker : m_workers) {
+        WorkerStats ws;
+        ws.cpu = worker->cpu.load(std::memory_order_relaxed);
+        ws.jobs = worker->jobs.load(std::memory_order_relaxed);
+        ws.overruns = worker->overruns.load(std::memory_order_relaxed);
+        ws.worstProcessingNs = worker->worstProcessingNs.load(std::memory_order_relaxed);
+        ws.worstLatencyNs = worker->worstLatencyNs.load(std::memory_order_relaxed);
+        ws.queued = static_cast<int>(worker->ring.size());
+
+        // Load is measured over the window since the previous call
+        const qint64 busy = worker->busyNs.load(std::memory_order_relaxed);
+        const qint64 window = now - worker->windowStartNs;
+        ws.load = (window > 0) ? qBound(0.0, static_cast<double>(busy - worker->windowBusyNs) / window, 1.0) : 0.0;
+        worker->windowStartNs = now;
+        worker->windowBusyNs = busy;
+
+        result.workers.append(ws);
+    }
+
+    return result;
+}
+
+void DSPExecutor::resetStats() {
+    m_submitted.store(0, std::memory_order_relaxed);
+    m_rejected.store(0, std::memory_order_relaxed);
+
+    for (std::unique_ptr<Worker> &worker : m_workers) {
+        worker->jobs.store(0, std::memory_order_relaxed);
+        worker->overruns.store(0, std::memory_order_relaxed);
+        worker->worstProcessingNs.store(0, std::memory_order_relaxed);
+        worker->worstLatencyNs.store(0, std::memory_order_relaxed);
+    }
+}
+
+qint64 DSPExecutor::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void DSPExecutor::workerThread(Worker *worker) {
+    configureThread(worker);
+
+    Job job;
+    int idleSpins = 0;
+
+    while (!m_stop.load(std::memory_order_acquire)) {
+        if (worker->ring.pop(job)) {
+            idleSpins = 0;
+
+            const qint64 start = nowNs();
+            job.task->run();
+            const qint64 end = nowNs();
+            delete job.task;
+            job.task = nullptr;
+
+            worker->busyNs.fetch_add(end - start, std::memory_order_relaxed);
+            worker->jobs.fetch_add(1, std::memory_order_relaxed);
+            updateMax(worker->worstProcessingNs, end - start);
+            updateMax(worker->worstLatencyNs, end - job.submittedNs);
+
+            if (end > job.deadlineNs) {
+                worker->overruns.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        if (++idleSpins < SPIN_ITERATIONS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Park until the producer pushes again. The sleeping flag is raised
+        // before re-checking the ring so a push cannot slip in unnoticed.
+        std::unique_lock<std::mutex> lock(worker->mutex);
+        worker->sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        worker->condition.wait(lock, [this, worker] {
+            return m_stop.load(std::memory_order_acquire) || !worker->ring.empty();
+        });
+        worker->sleeping.store(false, std::memory_order_relaxed);
+        idleSpins = 0;
+    }
+}
+
+void DSPExecutor::configureThread(Worker *worker) {
+#ifdef Q_OS_LINUX
+    const int cpu = worker->cpu.load(std::memory_order_relaxed);
+    if (cpu >= 0 && !CpuTopology::pinCurrentThread(QVector<int>() << cpu)) {
+        qWarning() << "DSPExecutor: Failed to pin worker to CPU" << cpu;
+        worker->cpu.store(-1, std::memory_order_relaxed);
+    }
+
+    if (m_realtime) {
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            qWarning() << "DSPExecutor: Real-time scheduling not permitted, using normal priority";
+        }
+    }
+#else
+    // Pinning and real-time scheduling are only implemented for Linux
+    worker->cpu.store(-1, std::memory_order_relaxed);
+#endif
+}
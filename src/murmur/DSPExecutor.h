@@ -0,0 +1,182 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_DSPEXECUTOR_H_
+#define MUMBLE_MURMUR_DSPEXECUTOR_H_
+
+#include "SPSCRing.h"
+
+#include <QtCore/QtGlobal>
+#include <QtCore/QVector>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A unit of real-time audio work for the DSPExecutor.
+ *
+ * Ownership passes to the executor on submit; the task is deleted after run().
+ */
+class DSPTask {
+public:
+    virtual ~DSPTask() {}
+
+    /**
+     * @brief Process the task. Runs on a DSP worker thread.
+     */
+    virtual void run() = 0;
+};
+
+/**
+ * @brief The DSPExecutor class runs real-time audio processing off the voice thread.
+ *
+ * The general ThreadPool is shared with propagation recomputes and other
+ * background work, so audio jobs queued there can be delayed arbitrarily.
+ * The DSPExecutor instead owns a small set of dedicated (optionally pinned)
+ * workers that only ever run audio jobs.
+ *
+ * Each worker is fed by its own lock-free SPSC ring. The producer is the
+ * Server's voice thread: submitting never blocks or takes a lock on the fast
+ * path, and a full ring rejects the job rather than stalling the voice thread.
+ *
+ * Every job carries a deadline (by default one 20 ms frame after it was
+ * submitted). Workers record how many jobs finished after their deadline,
+ * the worst-case processing time and their busy time, so overruns can be
+ * spotted before they become audible.
+ */
+class DSPExecutor {
+public:
+    /// Default deadline for a job: one 20 ms audio frame
+    static constexpr qint64 DEFAULT_FRAME_BUDGET_NS = 20 * 1000 * 1000;
+
+    /**
+     * @brief Counters for a single worker.
+     */
+    struct WorkerStats {
+        int cpu; ///< CPU the worker is pinned to, or -1
+        quint64 jobs; ///< Jobs completed
+        quint64 overruns; ///< Jobs that completed after their deadline
+        qint64 worstProcessingNs; ///< Longest time spent running a single job
+        qint64 worstLatencyNs; ///< Longest time from submit to completion
+        double load; ///< Fraction of wall time spent running jobs since the last stats() call
+        int queued; ///< Jobs currently waiting in the worker's ring
+    };
+
+    /**
+     * @brief Counters for the whole executor.
+     */
+    struct Stats {
+        quint64 submitted; ///< Jobs accepted
+        quint64 rejected; ///< Jobs dropped because a ring was full
+        QVector<WorkerStats> workers; ///< Per-worker counters
+    };
+
+    /**
+     * @brief Constructor for DSPExecutor.
+     *
+     * @param numWorkers The number of DSP workers to start
+     * @param cpus CPUs to pin the workers to, assigned round-robin (empty = no pinning)
+     * @param realtime Whether to request SCHED_FIFO scheduling for the workers
+     * @param queueCapacity The capacity of each worker's ring
+     */
+    explicit DSPExecutor(int numWorkers = 2, const QVector<int> &cpus = QVector<int>(), bool realtime = false,
+                         int queueCapacity = 256);
+
+    /**
+     * @brief Destructor for DSPExecutor.
+     *
+     * Stops the workers. Jobs still queued are deleted without running.
+     */
+    ~DSPExecutor();
+
+    /**
+     * @brief Submit a job (voice thread only).
+     *
+     * Jobs with the same key always run on the same worker, in submission
+     * order. Use a stable key (such as a channel ID) for jobs that share state.
+     *
+     * @param key Selects the worker
+     * @param task The job; ownership is taken even if the job is rejected
+     * @param budgetNs Deadline relative to now, in nanoseconds
+     * @return False if the worker's ring was full and the job was dropped
+     */
+    bool submit(unsigned int key, DSPTask *task, qint64 budgetNs = DEFAULT_FRAME_BUDGET_NS);
+
+    /**
+     * @brief Get the number of workers.
+     *
+     * @return The number of workers
+     */
+    int workerCount() const { return static_cast<int>(m_workers.size()); }
+
+    /**
+     * @brief Get a snapshot of the executor's counters.
+     *
+     * Also starts a new load measurement window, so it should be polled from
+     * a single thread.
+     *
+     * @return The current counters
+     */
+    Stats stats();
+
+    /**
+     * @brief Reset the overrun and worst-case counters.
+     */
+    void resetStats();
+
+    /**
+     * @brief Get the monotonic clock used for deadlines.
+     *
+     * @return Nanoseconds since an arbitrary epoch
+     */
+    static qint64 nowNs();
+
+private:
+    Q_DISABLE_COPY(DSPExecutor)
+
+    struct Job {
+        DSPTask *task = nullptr;
+        qint64 submittedNs = 0;
+        qint64 deadlineNs = 0;
+    };
+
+    struct Worker {
+        explicit Worker(int capacity) : ring(static_cast<size_t>(capacity)) {}
+
+        SPSCRing<Job> ring;
+        std::thread thread;
+        std::atomic<int> cpu{-1};
+
+        // Parking: the worker sleeps on the condition variable only when its
+        // ring is empty, so the producer touches the mutex only on wake-up
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<bool> sleeping{false};
+
+        std::atomic<quint64> jobs{0};
+        std::atomic<quint64> overruns{0};
+        std::atomic<qint64> worstProcessingNs{0};
+        std::atomic<qint64> worstLatencyNs{0};
+        std::atomic<qint64> busyNs{0};
+        qint64 windowStartNs = 0;
+        qint64 windowBusyNs = 0;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_stop;
+    std::atomic<quint64> m_submitted;
+    std::atomic<quint64> m_rejected;
+    bool m_realtime;
+
+    void workerThread(Worker *worker);
+    void configureThread(Worker *worker);
+};
+
+#endif // MUMBLE_MURMUR_DSPEXECUTOR_H_
@@ -0,0 +1,48 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "EventCount.h"
+
+#ifdef Q_OS_LINUX
+#    include <climits>
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+static_assert(sizeof(std::atomic<EventCount::Key>) == sizeof(EventCount::Key), "futex word must be a plain integer");
+
+EventCount::EventCount()
+    : m_epoch(0)
+    , m_waiters(0) {
+}
+
+void EventCount::wait(Key key) {
+#ifdef Q_OS_LINUX
+    // Returns at once if the epoch already moved on
+    syscall(SYS_futex, reinterpret_cast<Key *>(&m_epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this, key] { return m_epoch.load(std::memory_order_seq_cst) != key; });
+    }
+#endif
+    m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void EventCount::wake(bool all) {
+#ifdef Q_OS_LINUX
+    syscall(SYS_futex, reinterpret_cast<Key *>(&m_epoch), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+    // Taking the mutex orders the epoch change against a waiter that has
+    // checked it but not yet blocked
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    if (all) {
+        m_condition.notify_all();
+    } else {
+        m_condition.notify_one();
+    }
+#endif
+}
@@ -0,0 +1,100 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_EVENTCOUNT_H_
+#define MUMBLE_MURMUR_EVENTCOUNT_H_
+
+#include <QtCore/QtGlobal>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief Lets threads sleep until a lock-free condition may have changed.
+ *
+ * A waiter announces itself, re-checks its condition and only then sleeps,
+ * so a notification between the check and the sleep is never lost:
+ * @code
+ * for (;;) {
+ *     if (tryGetWork()) break;
+ *     EventCount::Key key = events.prepareWait();
+ *     if (tryGetWork()) { events.cancelWait(); break; }
+ *     events.wait(key);
+ * }
+ * @endcode
+ * A notifier makes its change visible first and then calls notifyOne() or
+ * notifyAll(). Notifying costs a fence and a load while nobody is waiting.
+ *
+ * On Linux waiters sleep on a futex; elsewhere on a condition variable.
+ */
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount();
+
+    EventCount(const EventCount &) = delete;
+    EventCount &operator=(const EventCount &) = delete;
+
+    /**
+     * @brief Announce that the calling thread is about to wait.
+     *
+     * Must be followed by exactly one call to cancelWait() or wait().
+     *
+     * @return The key to pass to wait()
+     */
+    Key prepareWait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Withdraw a prepareWait() because the condition became true.
+     */
+    void cancelWait() { m_waiters.fetch_sub(1, std::memory_order_seq_cst); }
+
+    /**
+     * @brief Sleep until a notification after prepareWait().
+     *
+     * May return spuriously; the caller re-checks its condition.
+     *
+     * @param key The key returned by prepareWait()
+     */
+    void wait(Key key);
+
+    /**
+     * @brief Wake one waiting thread, if any.
+     */
+    void notifyOne() { notify(false); }
+
+    /**
+     * @brief Wake all waiting threads.
+     */
+    void notifyAll() { notify(true); }
+
+private:
+    void notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        wake(all);
+    }
+
+    void wake(bool all);
+
+    alignas(64) std::atomic<Key> m_epoch;
+    std::atomic<int> m_waiters;
+
+#ifndef Q_OS_LINUX
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+#endif
+};
+
+#endif // MUMBLE_MURMUR_EVENTCOUNT_H_
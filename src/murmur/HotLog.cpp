@@ -0,0 +1,211 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "HotLog.h"
+
+#include "CoarseClock.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+
+#include <chrono>
+
+QString HotLogField::toString() const {
+    const QString key = QString::fromLatin1(m_key);
+    switch (m_type) {
+        case Type::Int:
+            return key + "=" + QString::number(m_int);
+        case Type::Double:
+            return key + "=" + QString::number(m_double, 'g', 4);
+        case Type::Bool:
+            return key + "=" + (m_int ? "true" : "false");
+        case Type::Text:
+            return key + "=\"" + QString::fromUtf16(m_text, m_length) + (m_truncated ? "...\"" : "\"");
+        case Type::None:
+            break;
+    }
+    return QString();
+}
+
+HotLogMessage::HotLogMessage(const char *text, const HotLogField &f1, const HotLogField &f2, const HotLogField &f3,
+                             const HotLogField &f4, const HotLogField &f5, const HotLogField &f6)
+    : m_text(text), m_fieldCount(0) {
+    for (const HotLogField *field : { &f1, &f2, &f3, &f4, &f5, &f6 }) {
+        if (field->isValid()) {
+            m_fields[m_fieldCount++] = *field;
+        }
+    }
+}
+
+QString HotLogMessage::toString() const {
+    QString text = QString::fromLatin1(m_text);
+    for (int i = 0; i < m_fieldCount; ++i) {
+        text += " " + m_fields[i].toString();
+    }
+    return text;
+}
+
+bool HotLogSite::admit() {
+    if (m_sampleEvery > 1 && m_calls.fetch_add(1, std::memory_order_relaxed) % m_sampleEvery != 0) {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (m_maxPerSecond > 0) {
+        // Fixed one-second windows; threads racing at a window boundary may
+        // let a few extra records through, which is fine for a log
+        const qint64 now = CoarseClock::instance().monotonicMs();
+        qint64 windowStart = m_windowStartMs.load(std::memory_order_relaxed);
+        if (now - windowStart >= 1000
+            && m_windowStartMs.compare_exchange_strong(windowStart, now, std::memory_order_relaxed)) {
+            m_windowCount.store(0, std::memory_order_relaxed);
+        }
+        if (m_windowCount.fetch_add(1, std::memory_order_relaxed) >= m_maxPerSecond) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+HotLog::HotLog() : m_stop(false) {
+    m_thread = std::thread([this] { run(); });
+}
+
+HotLog::~HotLog() {
+    {
+        std::lock_guard<std::mutex> lock(m_stopMutex);
+        m_stop = true;
+    }
+    m_stopCondition.notify_all();
+    m_thread.join();
+
+    // Sites are never destroyed (they are trivially destructible statics), so
+    // the records of statements that ran after the logger was created are
+    // still valid here
+    drain();
+}
+
+HotLog &HotLog::instance() {
+    static HotLog log;
+    return log;
+}
+
+void HotLog::write(HotLogSite &site, const HotLogMessage &message) {
+    ThreadBuffer &buffer = threadBuffer();
+
+    Record record;
+    record.site = &site;
+    record.utcMs = CoarseClock::instance().utcMs();
+    record.suppressed = site.takeSuppressed();
+    record.message = message;
+
+    if (!buffer.ring.push(std::move(record))) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void HotLog::flush() {
+    drain();
+}
+
+HotLog::ThreadBuffer &HotLog::threadBuffer() {
+    // Hands the ring to the writer when the thread ends; the writer frees it
+    // once it is drained
+    struct Holder {
+        std::shared_ptr<ThreadBuffer> buffer;
+
+        ~Holder() {
+            if (buffer) {
+                buffer->exited.store(true, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Holder holder;
+
+    if (!holder.buffer) {
+        holder.buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        m_buffers.push_back(holder.buffer);
+    }
+    return *holder.buffer;
+}
+
+void HotLog::run() {
+    std::unique_lock<std::mutex> lock(m_stopMutex);
+    while (!m_stopCondition.wait_for(lock, std::chrono::milliseconds(WRITE_INTERVAL_MS), [this] { return m_stop; })) {
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void HotLog::drain() {
+    std::lock_guard<std::mutex> drainLock(m_drainMutex);
+
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        buffers = m_buffers;
+    }
+
+    struct Line {
+        qint64 utcMs;
+        const HotLogSite *site;
+        QString text;
+    };
+    std::vector<Line> lines;
+    quint64 dropped = 0;
+
+    Record record;
+    for (const std::shared_ptr<ThreadBuffer> &buffer : buffers) {
+        // Checked first, so whatever the thread pushed before it ended is
+        // drained below
+        const bool exited = buffer->exited.load(std::memory_order_acquire);
+
+        while (buffer->ring.pop(record)) {
+            QString text = record.message.toString();
+            if (record.suppressed > 0) {
+                text += QString(" (%1 similar suppressed)").arg(record.suppressed);
+            }
+            lines.push_back({ record.utcMs, record.site, text });
+        }
+        dropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+
+        if (exited) {
+            std::lock_guard<std::mutex> lock(m_buffersMutex);
+            m_buffers.erase(std::remove(m_buffers.begin(), m_buffers.end(), buffer), m_buffers.end());
+        }
+    }
+
+    // Each ring is in order already; merge the threads by time
+    std::stable_sort(lines.begin(), lines.end(),
+                     [](const Line &a, const Line &b) { return a.utcMs < b.utcMs; });
+
+    for (const Line &line : lines) {
+        const QString text =
+            QDateTime::fromMSecsSinceEpoch(line.utcMs, Qt::UTC).toString("[hh:mm:ss.zzz] ") + line.text;
+        QMessageLogger logger(line.site->file(), line.site->line(), nullptr);
+        switch (line.site->level()) {
+            case Debug:
+                logger.debug().noquote() << text;
+                break;
+            case Info:
+                logger.info().noquote() << text;
+                break;
+            case Warning:
+                logger.warning().noquote() << text;
+                break;
+            default:
+                logger.critical().noquote() << text;
+                break;
+        }
+    }
+
+    if (dropped > 0) {
+        qWarning() << "HotLog: Dropped" << dropped << "records because a thread's buffer was full";
+    }
+}
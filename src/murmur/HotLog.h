@@ -0,0 +1,340 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_HOTLOG_H_
+#define MUMBLE_MURMUR_HOTLOG_H_
+
+#include "SPSCRing.h"
+
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Lowest level that is compiled in (see CMakeLists.txt): 0 = debug,
+// 1 = info, 2 = warning, 3 = critical, 4 = none. Statements below it
+// disappear from the build, arguments included.
+#ifndef MURMUR_HOT_LOG_LEVEL
+#	define MURMUR_HOT_LOG_LEVEL 1
+#endif
+
+/**
+ * @brief One key/value pair of a HotLog record.
+ *
+ * Holds its value inline, strings truncated to MAX_TEXT characters, so a
+ * record can be queued without allocating.
+ */
+class HotLogField {
+public:
+    /// Characters of a string value that are kept
+    static const int MAX_TEXT = 24;
+
+    enum class Type : quint8 { None, Int, Double, Bool, Text };
+
+    /**
+     * @brief Constructor for an empty HotLogField; empty fields are not written.
+     */
+    HotLogField() : m_key(nullptr), m_type(Type::None), m_length(0), m_truncated(false), m_int(0) {}
+
+    /**
+     * @brief Constructor for an integer field.
+     *
+     * @param key The key; must be a string literal
+     * @param value The value
+     */
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value,
+                                                 int>::type = 0>
+    HotLogField(const char *key, T value)
+        : m_key(key), m_type(Type::Int), m_length(0), m_truncated(false), m_int(static_cast<qint64>(value)) {}
+
+    /**
+     * @brief Constructor for a floating point field.
+     *
+     * @param key The key; must be a string literal
+     * @param value The value
+     */
+    template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    HotLogField(const char *key, T value)
+        : m_key(key), m_type(Type::Double), m_length(0), m_truncated(false), m_double(static_cast<double>(value)) {}
+
+    /**
+     * @brief Constructor for a boolean field.
+     *
+     * @param key The key; must be a string literal
+     * @param value The value
+     */
+    HotLogField(const char *key, bool value)
+        : m_key(key), m_type(Type::Bool), m_length(0), m_truncated(false), m_int(value ? 1 : 0) {}
+
+    /**
+     * @brief Constructor for a string field.
+     *
+     * @param key The key; must be a string literal
+     * @param value The value; copied, up to MAX_TEXT characters
+     */
+    HotLogField(const char *key, const QString &value)
+        : m_key(key), m_type(Type::Text), m_truncated(value.size() > MAX_TEXT), m_int(0) {
+        m_length = static_cast<quint8>(std::min(static_cast<int>(value.size()), MAX_TEXT));
+        std::memcpy(m_text, value.utf16(), m_length * sizeof(ushort));
+    }
+
+    /**
+     * @brief Constructor for a string literal field.
+     *
+     * @param key The key; must be a string literal
+     * @param value The value; must be a string literal
+     */
+    HotLogField(const char *key, const char *value) : HotLogField(key, QString::fromLatin1(value)) {}
+
+    /**
+     * @brief Check whether the field holds a value.
+     *
+     * @return False for a default-constructed field
+     */
+    bool isValid() const { return m_key != nullptr; }
+
+    /**
+     * @brief Format the field as key=value.
+     *
+     * @return The text; strings are quoted
+     */
+    QString toString() const;
+
+private:
+    const char *m_key;
+    Type m_type;
+    quint8 m_length;
+    bool m_truncated;
+    union {
+        qint64 m_int;
+        double m_double;
+    };
+    ushort m_text[MAX_TEXT];
+};
+
+/**
+ * @brief The message and fields of one HotLog statement.
+ */
+class HotLogMessage {
+public:
+    /// Fields one statement can carry
+    static const int MAX_FIELDS = 6;
+
+    /**
+     * @brief Constructor for an empty HotLogMessage.
+     */
+    HotLogMessage() : m_text(nullptr), m_fieldCount(0) {}
+
+    /**
+     * @brief Constructor for HotLogMessage.
+     *
+     * @param text The message; must be a string literal
+     * @param f1 ... f6 The fields, written in this order
+     */
+    HotLogMessage(const char *text, const HotLogField &f1 = HotLogField(), const HotLogField &f2 = HotLogField(),
+                  const HotLogField &f3 = HotLogField(), const HotLogField &f4 = HotLogField(),
+                  const HotLogField &f5 = HotLogField(), const HotLogField &f6 = HotLogField());
+
+    /**
+     * @brief Format the message and its fields as one line.
+     *
+     * @return The text
+     */
+    QString toString() const;
+
+private:
+    const char *m_text;
+    int m_fieldCount;
+    HotLogField m_fields[MAX_FIELDS];
+};
+
+/**
+ * @brief A HotLog statement in the source, with its sampling and rate limit.
+ *
+ * Created once per statement by the HOT_LOG macros. admit() decides whether a
+ * call is written: with sampleEvery N only every Nth call is, and at most
+ * maxPerSecond calls per second are. Calls that are left out are counted and
+ * the count is added to the next record the statement writes.
+ */
+class HotLogSite {
+public:
+    /**
+     * @brief Constructor for HotLogSite.
+     *
+     * @param level The HotLog::Level of the statement
+     * @param sampleEvery Write one call out of this many; 1 writes every call
+     * @param maxPerSecond Calls written per second at most; 0 for no limit
+     * @param file The source file
+     * @param line The source line
+     */
+    HotLogSite(int level, int sampleEvery, int maxPerSecond, const char *file, int line)
+        : m_level(level), m_sampleEvery(qMax(1, sampleEvery)), m_maxPerSecond(qMax(0, maxPerSecond)), m_file(file),
+          m_line(line), m_calls(0), m_windowStartMs(0), m_windowCount(0), m_suppressed(0) {}
+
+    HotLogSite(const HotLogSite &) = delete;
+    HotLogSite &operator=(const HotLogSite &) = delete;
+
+    /**
+     * @brief Decide whether this call is written.
+     *
+     * @return True if it passes the sampling and the rate limit
+     */
+    bool admit();
+
+    /**
+     * @brief Take the number of calls left out since the last record.
+     *
+     * @return The number of calls; resets to 0
+     */
+    quint64 takeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+    int level() const { return m_level; }
+    const char *file() const { return m_file; }
+    int line() const { return m_line; }
+
+private:
+    const int m_level;
+    const int m_sampleEvery;
+    const int m_maxPerSecond;
+    const char *const m_file;
+    const int m_line;
+
+    std::atomic<quint64> m_calls;
+    std::atomic<qint64> m_windowStartMs;
+    std::atomic<int> m_windowCount;
+    std::atomic<quint64> m_suppressed;
+};
+
+/**
+ * @brief Asynchronous structured logger for the voice and propagation paths.
+ *
+ * A HOT_LOG statement copies its message and fields into a ring buffer of
+ * the calling thread and returns; apart from the first call on a thread,
+ * which registers the ring, it never blocks, allocates or takes a lock. A
+ * background writer drains the rings of all threads every WRITE_INTERVAL_MS,
+ * orders the records by time and hands them to Qt's message handler, so they
+ * end up wherever qWarning() output does. A full ring drops the record, and
+ * the writer reports how many were dropped.
+ *
+ * Every statement is sampled and rate limited on its own (see HotLogSite);
+ * by default a statement writes at most DEFAULT_RATE_LIMIT records per
+ * second. Statements below MURMUR_HOT_LOG_LEVEL are not compiled in.
+ *
+ * Usage:
+ * @code
+ * HOT_LOG_INFO("Server: Audio routing", {"from", u1->qsName}, {"quality", quality});
+ * HOT_LOG_SAMPLED(HotLog::Debug, 100, 0, "Server: Packet dropped", {"session", session});
+ * @endcode
+ */
+class HotLog {
+public:
+    enum Level { Debug = 0, Info = 1, Warning = 2, Critical = 3 };
+
+    /// Records one statement writes per second by default
+    static const int DEFAULT_RATE_LIMIT = 20;
+    /// Records each thread can queue before new ones are dropped
+    static const int RING_CAPACITY = 256;
+    /// Interval at which the writer drains the rings
+    static const int WRITE_INTERVAL_MS = 10;
+
+    /**
+     * @brief Destructor for HotLog.
+     *
+     * Writes what is still queued and stops the writer thread.
+     */
+    ~HotLog();
+
+    HotLog(const HotLog &) = delete;
+    HotLog &operator=(const HotLog &) = delete;
+
+    /**
+     * @brief Get the logger shared by the whole process.
+     *
+     * The per-thread rings belong to this instance; there is no other.
+     *
+     * @return The logger, created on first use
+     */
+    static HotLog &instance();
+
+    /**
+     * @brief Queue a record.
+     *
+     * Called by the HOT_LOG macros after the site admitted the call.
+     *
+     * @param site The statement
+     * @param message The message and fields
+     */
+    void write(HotLogSite &site, const HotLogMessage &message);
+
+    /**
+     * @brief Write everything queued so far, on the calling thread.
+     */
+    void flush();
+
+private:
+    HotLog();
+
+    struct Record {
+        HotLogSite *site = nullptr;
+        qint64 utcMs = 0;
+        quint64 suppressed = 0;
+        HotLogMessage message;
+    };
+
+    struct ThreadBuffer {
+        ThreadBuffer() : ring(RING_CAPACITY), dropped(0), exited(false) {}
+
+        SPSCRing<Record> ring;
+        std::atomic<quint64> dropped; // Records the full ring did not take
+        std::atomic<bool> exited; // The thread is gone; removed once drained
+    };
+
+    ThreadBuffer &threadBuffer();
+    void run();
+    void drain();
+
+    std::mutex m_buffersMutex; // Guards m_buffers
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+
+    std::mutex m_drainMutex; // Only one thread drains the rings at a time
+
+    std::mutex m_stopMutex;
+    std::condition_variable m_stopCondition;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+/**
+ * @brief Log through HotLog with explicit sampling and rate limit.
+ *
+ * @param level A HotLog::Level
+ * @param sampleEvery Write one call out of this many
+ * @param maxPerSecond Calls written per second at most; 0 for no limit
+ * @param ... The message, a string literal, and up to six {"key", value} fields
+ */
+#define HOT_LOG_SAMPLED(level, sampleEvery, maxPerSecond, ...)                                  \
+    do {                                                                                        \
+        if (static_cast<int>(level) >= MURMUR_HOT_LOG_LEVEL) {                                  \
+            static HotLogSite hotLogSite(level, sampleEvery, maxPerSecond, __FILE__, __LINE__); \
+            if (hotLogSite.admit()) {                                                           \
+                HotLog::instance().write(hotLogSite, HotLogMessage(__VA_ARGS__));               \
+            }                                                                                   \
+        }                                                                                       \
+    } while (0)
+
+#define HOT_LOG_DEBUG(...) HOT_LOG_SAMPLED(HotLog::Debug, 1, HotLog::DEFAULT_RATE_LIMIT, __VA_ARGS__)
+#define HOT_LOG_INFO(...) HOT_LOG_SAMPLED(HotLog::Info, 1, HotLog::DEFAULT_RATE_LIMIT, __VA_ARGS__)
+#define HOT_LOG_WARNING(...) HOT_LOG_SAMPLED(HotLog::Warning, 1, HotLog::DEFAULT_RATE_LIMIT, __VA_ARGS__)
+#define HOT_LOG_CRITICAL(...) HOT_LOG_SAMPLED(HotLog::Critical, 1, HotLog::DEFAULT_RATE_LIMIT, __VA_ARGS__)
+
+#endif // MUMBLE_MURMUR_HOTLOG_H_
@@ -0,0 +1,213 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "Metrics.h"
+
+#include <QtCore/QDebug>
+
+#include <cmath>
+
+std::atomic<int> MetricShard::s_next(0);
+
+namespace {
+    // Cells of one cache line
+    const int CELLS_PER_LINE = 64 / sizeof(std::atomic<quint64>);
+
+    QByteArray formatValue(double value) {
+        if (std::isnan(value)) {
+            return "NaN";
+        }
+        if (std::isinf(value)) {
+            return value > 0 ? "+Inf" : "-Inf";
+        }
+        return QByteArray::number(value, 'g', 15);
+    }
+
+    QByteArray escapeHelp(const QString &help) {
+        QByteArray escaped = help.toUtf8();
+        escaped.replace("\\", "\\\\");
+        escaped.replace("\n", "\\n");
+        return escaped;
+    }
+
+    // name{labels} or name{labels,extra}
+    QByteArray seriesName(const QString &name, const QString &labels, const QByteArray &extra = QByteArray()) {
+        QByteArray line = name.toUtf8();
+        if (labels.isEmpty() && extra.isEmpty()) {
+            return line;
+        }
+        line += '{';
+        line += labels.toUtf8();
+        if (!labels.isEmpty() && !extra.isEmpty()) {
+            line += ',';
+        }
+        line += extra;
+        line += '}';
+        return line;
+    }
+} // namespace
+
+MetricCounter::MetricCounter() {
+    for (Slot &slot : m_slots) {
+        slot.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+quint64 MetricCounter::value() const {
+    quint64 value = 0;
+    for (const Slot &slot : m_slots) {
+        value += slot.value.load(std::memory_order_relaxed);
+    }
+    return value;
+}
+
+MetricHistogram::MetricHistogram(double unitScale, int maxBits, int subBucketBits)
+    : m_unitScale(unitScale)
+    , m_subBucketBits(qBound(0, subBucketBits, 7))
+    , m_subBuckets(1 << m_subBucketBits)
+    , m_buckets((qBound(m_subBucketBits + 1, maxBits, 62) - m_subBucketBits + 1) * m_subBuckets)
+    , m_stride((m_buckets + 2 + CELLS_PER_LINE - 1) / CELLS_PER_LINE * CELLS_PER_LINE)
+    , m_cells(new std::atomic<quint64>[static_cast<size_t>(MetricShard::COUNT * m_stride)]()) {
+}
+
+MetricHistogram::Snapshot MetricHistogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.buckets.fill(0, m_buckets + 1);
+    snapshot.count = 0;
+
+    quint64 sum = 0;
+    for (int shard = 0; shard < MetricShard::COUNT; ++shard) {
+        const std::atomic<quint64> *slot = &m_cells[static_cast<size_t>(shard * m_stride)];
+        for (int bucket = 0; bucket <= m_buckets; ++bucket) {
+            const quint64 count = slot[bucket].load(std::memory_order_relaxed);
+            snapshot.buckets[bucket] += count;
+            snapshot.count += count;
+        }
+        sum += slot[m_buckets + 1].load(std::memory_order_relaxed);
+    }
+    snapshot.sum = static_cast<double>(sum) * m_unitScale;
+
+    // The inverse of bucketOf(): bucket shift * S + m holds [m << shift, (m + 1) << shift),
+    // with m in [S, 2S) once the shift is above zero
+    snapshot.bounds.reserve(m_buckets);
+    for (int bucket = 0; bucket < m_buckets; ++bucket) {
+        const int shift = qMax(0, bucket / m_subBuckets - 1);
+        const int significand = bucket - shift * m_subBuckets;
+        snapshot.bounds.append(std::ldexp(significand + 1.0, shift) * m_unitScale);
+    }
+    return snapshot;
+}
+
+MetricsRegistry &MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Series &MetricsRegistry::series(const QString &name, const QString &help, Type type,
+                                                 const QString &labels) {
+    // Caller holds m_mutex
+    Family *family = m_familiesByName.value(name);
+    if (!family) {
+        std::unique_ptr<Family> created(new Family());
+        created->name = name;
+        created->help = help;
+        created->type = type;
+        family = created.get();
+        m_families.push_back(std::move(created));
+        m_familiesByName.insert(name, family);
+    } else if (family->type != type) {
+        qWarning() << "MetricsRegistry:" << name << "is already registered as a different type; not exported";
+        m_unexported.emplace_back(new Series());
+        return *m_unexported.back();
+    }
+
+    for (const std::unique_ptr<Series> &series : family->series) {
+        if (series->labels == labels) {
+            return *series;
+        }
+    }
+    family->series.emplace_back(new Series());
+    family->series.back()->labels = labels;
+    return *family->series.back();
+}
+
+MetricCounter &MetricsRegistry::counter(const QString &name, const QString &help, const QString &labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series &series = this->series(name, help, Type::Counter, labels);
+    if (!series.counter) {
+        series.counter.reset(new MetricCounter());
+    }
+    return *series.counter;
+}
+
+MetricGauge &MetricsRegistry::gauge(const QString &name, const QString &help, const QString &labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series &series = this->series(name, help, Type::Gauge, labels);
+    if (!series.gauge) {
+        series.gauge.reset(new MetricGauge());
+    }
+    return *series.gauge;
+}
+
+void MetricsRegistry::gauge(const QString &name, const QString &help, const QString &labels,
+                            std::function<double()> read) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series &series = this->series(name, help, Type::Gauge, labels);
+    series.read = std::move(read);
+}
+
+MetricHistogram &MetricsRegistry::histogram(const QString &name, const QString &help, double unitScale, int maxBits,
+                                            const QString &labels, int subBucketBits) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series &series = this->series(name, help, Type::Histogram, labels);
+    if (!series.histogram) {
+        series.histogram.reset(new MetricHistogram(unitScale, maxBits, subBucketBits));
+    }
+    return *series.histogram;
+}
+
+QByteArray MetricsRegistry::exposition() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    QByteArray text;
+    for (const std::unique_ptr<Family> &family : m_families) {
+        static const char *const typeNames[] = { "counter", "gauge", "histogram" };
+        const QByteArray name = family->name.toUtf8();
+        text += "# HELP " + name + ' ' + escapeHelp(family->help) + '\n';
+        text += "# TYPE " + name + ' ' + typeNames[static_cast<int>(family->type)] + '\n';
+
+        for (const std::unique_ptr<Series> &series : family->series) {
+            switch (family->type) {
+                case Type::Counter:
+                    text += seriesName(family->name, series->labels) + ' '
+                            + QByteArray::number(series->counter->value()) + '\n';
+                    break;
+                case Type::Gauge: {
+                    const double value =
+                        series->read ? series->read() : static_cast<double>(series->gauge->value());
+                    text += seriesName(family->name, series->labels) + ' ' + formatValue(value) + '\n';
+                    break;
+                }
+                case Type::Histogram: {
+                    const MetricHistogram::Snapshot snapshot = series->histogram->snapshot();
+                    quint64 cumulative = 0;
+                    for (int bucket = 0; bucket < snapshot.bounds.size(); ++bucket) {
+                        cumulative += snapshot.buckets[bucket];
+                        text += seriesName(family->name + "_bucket", series->labels,
+                                           "le=\"" + formatValue(snapshot.bounds[bucket]) + '"')
+                                + ' ' + QByteArray::number(cumulative) + '\n';
+                    }
+                    text += seriesName(family->name + "_bucket", series->labels, "le=\"+Inf\"") + ' '
+                            + QByteArray::number(snapshot.count) + '\n';
+                    text += seriesName(family->name + "_sum", series->labels) + ' ' + formatValue(snapshot.sum) + '\n';
+                    text += seriesName(family->name + "_count", series->labels) + ' '
+                            + QByteArray::number(snapshot.count) + '\n';
+                    break;
+                }
+            }
+        }
+    }
+    return text;
+}
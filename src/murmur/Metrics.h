@@ -0,0 +1,306 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_METRICS_H_
+#define MUMBLE_MURMUR_METRICS_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtAlgorithms>
+#include <QtCore/QtGlobal>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Shard of the calling thread for the metric types.
+ *
+ * Threads are spread round-robin over COUNT cache-line sized slots,
+ * so threads updating the same metric rarely share a cache line.
+ */
+class MetricShard {
+public:
+    /// Slots per metric; more threads than this share slots
+    static const int COUNT = 16;
+
+    /**
+     * @brief Get the slot of the calling thread.
+     *
+     * @return A slot in [0, COUNT), fixed for the lifetime of the thread
+     */
+    static int current() {
+        thread_local const int shard = s_next.fetch_add(1, std::memory_order_relaxed) % COUNT;
+        return shard;
+    }
+
+private:
+    static std::atomic<int> s_next;
+};
+
+/**
+ * @brief Monotonically increasing count, such as packets received.
+ *
+ * increment() adds to the slot of the calling thread; value() sums the slots
+ * and is only called when the metrics are scraped.
+ */
+class MetricCounter {
+public:
+    MetricCounter();
+
+    MetricCounter(const MetricCounter &) = delete;
+    MetricCounter &operator=(const MetricCounter &) = delete;
+
+    /**
+     * @brief Add to the count.
+     *
+     * @param n The amount to add
+     */
+    void increment(quint64 n = 1) { m_slots[MetricShard::current()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the count.
+     *
+     * @return The sum over all threads
+     */
+    quint64 value() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<quint64> value;
+    };
+
+    Slot m_slots[MetricShard::COUNT];
+};
+
+/**
+ * @brief Value that goes up and down, such as a queue depth.
+ */
+class MetricGauge {
+public:
+    MetricGauge() : m_value(0) {}
+
+    MetricGauge(const MetricGauge &) = delete;
+    MetricGauge &operator=(const MetricGauge &) = delete;
+
+    void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(qint64 delta) { m_value.fetch_add(delta, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value;
+};
+
+/**
+ * @brief Distribution of non-negative integer samples, such as durations in microseconds.
+ *
+ * Log-linear buckets: every power of two from 2^subBucketBits up is split
+ * into 2^subBucketBits buckets of equal width, and each smaller value gets a
+ * bucket of its own. Small samples are thus exact, and larger ones fall in a
+ * bucket at most 1/2^subBucketBits of its lower bound wide (12.5% with the
+ * default of 8 per power of two), up to 2^maxBits units. Larger samples are
+ * only counted in the +Inf bucket.
+ *
+ * Samples are truncated to whole units, so a bucket holding the integers
+ * below a bound holds exactly the real values below it; the bounds are
+ * exported as Prometheus "le" limits.
+ */
+class MetricHistogram {
+public:
+    /**
+     * @brief Constructor for MetricHistogram.
+     *
+     * @param unitScale Exported value of one unit, e.g. 1e-6 for microseconds written as seconds
+     * @param maxBits Samples up to 2^maxBits units get a bucket of their own
+     * @param subBucketBits Each power of two is split into 2^subBucketBits buckets (0 to 7)
+     */
+    explicit MetricHistogram(double unitScale = 1.0, int maxBits = 24, int subBucketBits = 3);
+
+    MetricHistogram(const MetricHistogram &) = delete;
+    MetricHistogram &operator=(const MetricHistogram &) = delete;
+
+    /**
+     * @brief Record a sample.
+     *
+     * @param value The sample in units
+     */
+    void record(quint64 value) {
+        std::atomic<quint64> *slot = &m_cells[static_cast<size_t>(MetricShard::current() * m_stride)];
+        slot[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        slot[m_buckets + 1].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Record the time since start in microseconds.
+     *
+     * @param start When the measured work began
+     */
+    void recordSince(std::chrono::steady_clock::time_point start) {
+        record(static_cast<quint64>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+
+    /**
+     * @brief Summed state of a histogram.
+     */
+    struct Snapshot {
+        QVector<quint64> buckets; ///< Samples per bucket, not cumulative; the last one is +Inf
+        QVector<double> bounds; ///< Exclusive upper bound of each finite bucket, scaled
+        quint64 count; ///< Samples
+        double sum; ///< Sum of the samples, scaled
+    };
+
+    /**
+     * @brief Sum the slots of all threads.
+     *
+     * @return The snapshot
+     */
+    Snapshot snapshot() const;
+
+private:
+    int bucketOf(quint64 value) const {
+        if (value < static_cast<quint64>(m_subBuckets)) {
+            return static_cast<int>(value);
+        }
+        // Shifting the value down to subBucketBits + 1 significant bits leaves
+        // the sub-bucket in the low bits, above the leading one
+        const int shift = 63 - qCountLeadingZeroBits(value) - m_subBucketBits;
+        const int bucket = shift * m_subBuckets + static_cast<int>(value >> shift);
+        return qMin(bucket, m_buckets);
+    }
+
+    const double m_unitScale;
+    const int m_subBucketBits;
+    const int m_subBuckets; // Buckets per power of two
+    const int m_buckets; // Finite buckets; index m_buckets is +Inf
+    const int m_stride; // Cells per slot, padded to a cache line
+
+    // Per slot: the bucket counts followed by the sum
+    std::unique_ptr<std::atomic<quint64>[]> m_cells;
+};
+
+/**
+ * @brief Process-wide set of metrics and their Prometheus text exposition.
+ *
+ * Metrics are created once, usually into a static reference at the place
+ * they are updated, and live until the process exits:
+ * @code
+ * static MetricCounter &packets = MetricsRegistry::instance().counter(
+ *     "murmur_voice_packets_total", "Voice packets received");
+ * packets.increment();
+ * @endcode
+ * Updating a metric is a relaxed atomic add on a slot of the calling thread:
+ * no lock and no shared cache line. Values are summed when the metrics are
+ * scraped (see exposition()).
+ *
+ * A name with different labels gives separate series of one metric family.
+ * Asking for an existing name and label set returns the same metric.
+ */
+class MetricsRegistry {
+public:
+    /**
+     * @brief Get the registry shared by the whole process.
+     *
+     * @return The registry, created on first use
+     */
+    static MetricsRegistry &instance();
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    /**
+     * @brief Get or create a counter.
+     *
+     * @param name The metric name; should end in _total
+     * @param help One line describing the metric
+     * @param labels Prometheus labels such as priority="normal", or empty
+     * @return The counter
+     */
+    MetricCounter &counter(const QString &name, const QString &help, const QString &labels = QString());
+
+    /**
+     * @brief Get or create a gauge.
+     *
+     * @param name The metric name
+     * @param help One line describing the metric
+     * @param labels Prometheus labels, or empty
+     * @return The gauge
+     */
+    MetricGauge &gauge(const QString &name, const QString &help, const QString &labels = QString());
+
+    /**
+     * @brief Add a gauge that is read when the metrics are scraped.
+     *
+     * For values that already exist elsewhere, such as the length of a queue.
+     * An existing gauge with the same name and labels is replaced.
+     *
+     * @param name The metric name
+     * @param help One line describing the metric
+     * @param labels Prometheus labels, or empty
+     * @param read Returns the value; called on the scraping thread, so it
+     * must stay valid and thread-safe for the lifetime of the process, and
+     * must not create metrics
+     */
+    void gauge(const QString &name, const QString &help, const QString &labels, std::function<double()> read);
+
+    /**
+     * @brief Get or create a histogram.
+     *
+     * @param name The metric name, with its unit, such as _seconds
+     * @param help One line describing the metric
+     * @param unitScale Exported value of one recorded unit
+     * @param maxBits Largest sample with a bucket of its own, as a power of two
+     * @param labels Prometheus labels, or empty
+     * @param subBucketBits Each power of two is split into 2^subBucketBits buckets
+     * @return The histogram
+     */
+    MetricHistogram &histogram(const QString &name, const QString &help, double unitScale = 1e-6, int maxBits = 24,
+                               const QString &labels = QString(), int subBucketBits = 3);
+
+    /**
+     * @brief Format every metric in the Prometheus text format, version 0.0.4.
+     *
+     * @return The text
+     */
+    QByteArray exposition() const;
+
+private:
+    MetricsRegistry() = default;
+
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Series {
+        QString labels;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::function<double()> read;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    struct Family {
+        QString name;
+        QString help;
+        Type type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    Series &series(const QString &name, const QString &help, Type type, const QString &labels);
+
+    // Guards the families; never taken when a metric is updated
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Family>> m_families;
+    QHash<QString, Family *> m_familiesByName;
+
+    // Metrics asked for under a name registered with another type; they work
+    // but are not exported
+    std::vector<std::unique_ptr<Series>> m_unexported;
+};
+
+#endif // MUMBLE_MURMUR_METRICS_H_
@@ -0,0 +1,135 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "MetricsServer.h"
+
+#include "Metrics.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QSaveFile>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QTcpSocket>
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QObject(parent), m_dumpFailed(false), m_configured(false) {
+    connect(&m_server, &QTcpServer::newConnection, this, &MetricsServer::acceptConnections);
+    connect(&m_dumpTimer, &QTimer::timeout, this, &MetricsServer::dump);
+}
+
+void MetricsServer::applyConfig(std::shared_ptr<const ServerConfig> config) {
+    const ServerConfig::Metrics &settings = config->metrics();
+    if (m_configured && settings == m_settings) {
+        return;
+    }
+    const bool listenChanged = !m_configured || settings.enabled != m_settings.enabled
+                               || settings.bind != m_settings.bind || settings.port != m_settings.port;
+    m_configured = true;
+    m_settings = settings;
+
+    if (listenChanged) {
+        // Connections that are already open are still answered
+        m_server.close();
+        if (settings.enabled) {
+            const QHostAddress address(settings.bind);
+            if (address.isNull()) {
+                qWarning() << "MetricsServer: Invalid bind address" << settings.bind;
+            } else if (!m_server.listen(address, static_cast<quint16>(settings.port))) {
+                qWarning() << "MetricsServer: Cannot listen on" << settings.bind << "port" << settings.port << ":"
+                           << m_server.errorString();
+            } else {
+                qWarning() << "MetricsServer: Serving metrics at" << settings.bind << "port" << settings.port;
+            }
+        }
+    }
+
+    m_dumpFile = settings.dumpFile;
+    m_dumpFailed = false;
+    if (m_dumpFile.isEmpty()) {
+        m_dumpTimer.stop();
+    } else {
+        m_dumpTimer.start(qMax(1, settings.dumpInterval) * 1000);
+        dump();
+    }
+}
+
+void MetricsServer::acceptConnections() {
+    while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+        m_requests.insert(socket, QByteArray());
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { readRequest(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_requests.remove(socket);
+            socket->deleteLater();
+        });
+        QTimer::singleShot(REQUEST_TIMEOUT_MS, socket, [socket]() { socket->abort(); });
+    }
+}
+
+void MetricsServer::readRequest(QTcpSocket *socket) {
+    auto it = m_requests.find(socket);
+    if (it == m_requests.end()) {
+        // Already answered; ignore whatever else the client sends
+        socket->readAll();
+        return;
+    }
+
+    QByteArray &request = it.value();
+    request += socket->readAll();
+    // Read up to the end of the headers, so closing the connection does not
+    // discard unread data and reset it before the client got the response
+    if (!request.contains("\r\n\r\n") && !request.contains("\n\n")) {
+        if (request.size() > MAX_REQUEST_BYTES) {
+            m_requests.erase(it);
+            respond(socket, "431 Request Header Fields Too Large", QByteArray());
+        }
+        return;
+    }
+
+    // Request line: METHOD PATH HTTP/VERSION
+    const QList<QByteArray> requestLine = request.left(request.indexOf('\n')).trimmed().split(' ');
+    m_requests.erase(it);
+
+    const QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    const int query = path.indexOf('?');
+    if (query >= 0) {
+        path.truncate(query);
+    }
+
+    if (method != "GET" && method != "HEAD") {
+        respond(socket, "405 Method Not Allowed", QByteArray());
+    } else if (path != "/metrics" && path != "/") {
+        respond(socket, "404 Not Found", QByteArray());
+    } else {
+        respond(socket, "200 OK", MetricsRegistry::instance().exposition(), method == "GET");
+    }
+}
+
+void MetricsServer::respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &body, bool withBody) {
+    QByteArray response = "HTTP/1.0 " + status + "\r\n";
+    response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    if (withBody) {
+        response += body;
+    }
+    socket->write(response);
+
+    // Closes once the response is written
+    socket->disconnectFromHost();
+}
+
+void MetricsServer::dump() {
+    QSaveFile file(m_dumpFile);
+    if (file.open(QIODevice::WriteOnly) && file.write(MetricsRegistry::instance().exposition()) >= 0
+        && file.commit()) {
+        m_dumpFailed = false;
+        return;
+    }
+
+    if (!m_dumpFailed) {
+        qWarning() << "MetricsServer: Cannot write" << m_dumpFile << ":" << file.errorString();
+        m_dumpFailed = true;
+    }
+}
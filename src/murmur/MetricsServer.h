@@ -0,0 +1,79 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_METRICSSERVER_H_
+#define MUMBLE_MURMUR_METRICSSERVER_H_
+
+#include "ServerConfig.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpServer>
+
+#include <memory>
+
+class QTcpSocket;
+
+/**
+ * @brief Serves MetricsRegistry over HTTP and writes it to a file.
+ *
+ * Answers GET /metrics with the Prometheus text exposition on the address
+ * and port of the [metrics] section, and optionally writes the same text to
+ * a file at a fixed interval; the file is replaced atomically, so a reader
+ * such as the node_exporter textfile collector never sees half of it.
+ *
+ * This is a minimal HTTP/1.0 server for a scraper on the local network: one
+ * request per connection, no keep-alive, no authentication. Everything runs
+ * on the thread of the object; a scrape only sums the metric slots.
+ */
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+public:
+    /// Largest request that is read before the connection is refused
+    static const int MAX_REQUEST_BYTES = 8192;
+    /// Time a client has to send its request
+    static const int REQUEST_TIMEOUT_MS = 5000;
+
+    /**
+     * @brief Constructor for MetricsServer.
+     *
+     * Does nothing until applyConfig() is called.
+     *
+     * @param parent The parent object
+     */
+    explicit MetricsServer(QObject *parent = nullptr);
+
+public slots:
+    /**
+     * @brief Listen and write the file as the [metrics] section says.
+     *
+     * Only restarts what changed, so it can be connected to
+     * ServerConfigWatcher::configChanged().
+     *
+     * @param config The configuration
+     */
+    void applyConfig(std::shared_ptr<const ServerConfig> config);
+
+private:
+    void acceptConnections();
+    void readRequest(QTcpSocket *socket);
+    void respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &body, bool withBody = true);
+    void dump();
+
+    QTcpServer m_server;
+    QHash<QTcpSocket *, QByteArray> m_requests; // Partial requests by connection
+
+    QTimer m_dumpTimer;
+    QString m_dumpFile;
+    bool m_dumpFailed; // The last write failed; warned once until it works again
+
+    bool m_configured;
+    ServerConfig::Metrics m_settings;
+};
+
+#endif // MUMBLE_MURMUR_METRICSSERVER_H_
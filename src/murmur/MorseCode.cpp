@@ -0,0 +1,53 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "MorseCode.h"
+
+#include <QtCore/QHash>
+
+namespace {
+    const char *const CODES[][2] = {
+        { "A", ".-" },     { "B", "-..." },   { "C", "-.-." },   { "D", "-.." },    { "E", "." },
+        { "F", "..-." },   { "G", "--." },    { "H", "...." },   { "I", ".." },     { "J", ".---" },
+        { "K", "-.-" },    { "L", ".-.." },   { "M", "--" },     { "N", "-." },     { "O", "---" },
+        { "P", ".--." },   { "Q", "--.-" },   { "R", ".-." },    { "S", "..." },    { "T", "-" },
+        { "U", "..-" },    { "V", "...-" },   { "W", ".--" },    { "X", "-..-" },   { "Y", "-.--" },
+        { "Z", "--.." },   { "0", "-----" },  { "1", ".----" },  { "2", "..---" },  { "3", "...--" },
+        { "4", "....-" },  { "5", "....." },  { "6", "-...." },  { "7", "--..." },  { "8", "---.." },
+        { "9", "----." },  { ".", ".-.-.-" }, { ",", "--..--" }, { "?", "..--.." }, { "/", "-..-." },
+        { "=", "-...-" },  { "+", ".-.-." },  { "-", "-....-" }, { "@", ".--.-." }, { "'", ".----." },
+        { ":", "---..." }, { "(", "-.--." },  { ")", "-.--.-" }, { "\"", ".-..-." },
+    };
+
+    const QHash<ushort, QString> &patterns() {
+        static const QHash<ushort, QString> table = [] {
+            QHash<ushort, QString> result;
+            for (const auto &code : CODES) {
+                result.insert(static_cast<ushort>(code[0][0]), QString::fromLatin1(code[1]));
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    const QHash<QString, QChar> &characters() {
+        static const QHash<QString, QChar> table = [] {
+            QHash<QString, QChar> result;
+            for (const auto &code : CODES) {
+                result.insert(QString::fromLatin1(code[1]), QChar::fromLatin1(code[0][0]));
+            }
+            return result;
+        }();
+        return table;
+    }
+}
+
+QString MorseCode::encode(QChar c) {
+    return patterns().value(c.toUpper().unicode());
+}
+
+QChar MorseCode::decode(const QString &pattern) {
+    return characters().value(pattern);
+}
@@ -0,0 +1,35 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_MORSECODE_H_
+#define MUMBLE_MURMUR_MORSECODE_H_
+
+#include <QtCore/QString>
+
+/**
+ * @brief The international Morse code table.
+ *
+ * Patterns are written as dots and dashes, e.g. ".-" for A. Letters are
+ * upper case; lookups of lower-case letters are folded.
+ */
+namespace MorseCode {
+    /**
+     * @brief Look up the pattern of a character.
+     *
+     * @param c The character
+     * @return The pattern, or an empty string if the character has no Morse code
+     */
+    QString encode(QChar c);
+
+    /**
+     * @brief Look up the character for a pattern.
+     *
+     * @param pattern Dots and dashes, e.g. ".-"
+     * @return The character, or a null QChar if the pattern is not valid
+     */
+    QChar decode(const QString &pattern);
+}
+
+#endif // MUMBLE_MURMUR_MORSECODE_H_
@@ -169,6 +169,30 @@ public:
     void set_path_loss(float pl) { path_loss = pl; }
     void add_propagation_paths(const std::string &path) { propagation_paths.append(path); }
 };
+
+// Keying events of a CW station (key-down/key-up edges instead of audio)
+class CWKeying : public Message {
+public:
+    CWKeying() : session(0), sequence(0), timestamp(0), pitch_offset(0) {}
+    
+    uint32_t session;
+    uint32_t sequence;
+    uint32_t timestamp; // 48 kHz sample clock of the sender
+    int32_t pitch_offset; // Hz relative to the receiver's CW pitch
+    QList<uint32_t> edges; // (samples after timestamp << 1) | key_down
+    
+    QByteArray SerializeAsString() const override { return QByteArray(); }
+    bool ParseFromString(const QByteArray &) override { return true; }
+    void Clear() override { edges.clear(); }
+    bool IsInitialized() const override { return true; }
+    
+    void set_session(uint32_t s) { session = s; }
+    void set_sequence(uint32_t s) { sequence = s; }
+    void set_timestamp(uint32_t t) { timestamp = t; }
+    void set_pitch_offset(int32_t p) { pitch_offset = p; }
+    void add_edges(uint32_t e) { edges.append(e); }
+};
+
 // Version message for protocol negotiation
 class Version : public Message {
 public:
@@ -43,6 +43,7 @@
     PROCESS_MUMBLE_TCP_MESSAGE(ChannelListener, 27) \
     PROCESS_MUMBLE_TCP_MESSAGE(HFBandSimulationUpdate, 28) \
     PROCESS_MUMBLE_TCP_MESSAGE(SignalQualityUpdate, 29) \
-    PROCESS_MUMBLE_TCP_MESSAGE(PropagationUpdate, 30)
+    PROCESS_MUMBLE_TCP_MESSAGE(PropagationUpdate, 30) \
+    PROCESS_MUMBLE_TCP_MESSAGE(CWKeying, 31)
 
 #endif // MUMBLE_MURMUR_MUMBLEMESSAGES_H_
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include <QVector>
 
 #include <cstdint>
+#include <cstring>
 
 namespace Mumble {
 namespace Protocol {
@@ -61,14 +62,16 @@ enum class TCPMessageType {
     ChannelListener = 27,
     HFBandSimulationUpdate = 28,
     SignalQualityUpdate = 29,
-    PropagationUpdate = 30
+    PropagationUpdate = 30,
+    CWKeying = 31
 };
 
 // UDP Message Types
 enum class UDPMessageType {
     VoiceData = 0,
     Ping = 1,
-    VoiceOpus = 4
+    VoiceOpus = 4,
+    CWKeying = 5
 };
 
 // Audio data structure
@@ -78,9 +81,12 @@ struct AudioData {
     int frameSize;
     bool isOpus;
     uint32_t senderSession;
+    uint64_t frameNumber; // Counts the frames of the sender's stream
+    bool isLastFrame; // Ends the stream; may come without audio
     QList<uint32_t> targetSessions;
     
-    AudioData() : data(nullptr), size(0), frameSize(0), isOpus(true), senderSession(0) {}
+    AudioData()
+        : data(nullptr), size(0), frameSize(0), isOpus(true), senderSession(0), frameNumber(0), isLastFrame(false) {}
     
     ~AudioData() {
         if (data) {
@@ -142,26 +148,247 @@ public:
 };
 
 // Protocol encoder for UDP audio packets
+//
+// Layout from client to server: type, payload. From server to client: type,
+// sender session varint, frame number varint, (payload size << 1) | last
+// frame varint, payload. A last frame may have an empty payload.
 template<Role R>
 class UDPAudioEncoder {
 public:
     UDPAudioEncoder() {}
     
     int encode(byte *buffer, int length, const AudioData &audioData) {
-        if (length < audioData.size + 1 || !audioData.data) {
+        // Only a last frame may come without audio
+        const bool hasPayload = audioData.size > 0 && audioData.data;
+        if ((!hasPayload && !(audioData.size == 0 && audioData.isLastFrame)) || length < audioData.size + 21) {
             return 0;
         }
         
-        // In a real implementation, this would encode the packet
-        // For this simplified version, just set some basic properties
-        buffer[0] = static_cast<byte>(
+        int pos = 0;
+        buffer[pos++] = static_cast<byte>(
             audioData.isOpus ? UDPMessageType::VoiceOpus : UDPMessageType::VoiceData
         );
+        if (R == Role::Server) {
+            pos += writeVarint(buffer + pos, audioData.senderSession);
+            pos += writeVarint(buffer + pos, audioData.frameNumber);
+            pos += writeVarint(buffer + pos,
+                               (static_cast<uint64_t>(audioData.size) << 1) | (audioData.isLastFrame ? 1 : 0));
+        }
         
-        // Copy audio data
-        memcpy(buffer + 1, audioData.data, audioData.size);
+        if (hasPayload) {
+            memcpy(buffer + pos, audioData.data, audioData.size);
+        }
         
-        return audioData.size + 1;
+        return pos + audioData.size;
+    }
+    
+private:
+    static int writeVarint(byte *out, uint64_t value) {
+        int n = 0;
+        while (value >= 0x80) {
+            out[n++] = static_cast<byte>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out[n++] = static_cast<byte>(value);
+        return n;
+    }
+};
+
+// Protocol decoder for UDP audio packets sent by the server (see
+// UDPAudioEncoder for the layout). The payload is copied into the AudioData.
+template<Role R>
+class UDPAudioDecoder {
+public:
+    UDPAudioDecoder() {}
+    
+    bool decode(const byte *buffer, int length, AudioData &audioData) {
+        int pos = 0;
+        if (length < 1) {
+            return false;
+        }
+        const UDPMessageType type = static_cast<UDPMessageType>(buffer[pos++] & 0x7);
+        if (type != UDPMessageType::VoiceOpus && type != UDPMessageType::VoiceData) {
+            return false;
+        }
+        audioData.isOpus = type == UDPMessageType::VoiceOpus;
+        
+        uint64_t session = 0;
+        uint64_t header = static_cast<uint64_t>(length - pos) << 1;
+        audioData.frameNumber = 0;
+        if (R == Role::Client
+            && (!readVarint(buffer, length, pos, session) || !readVarint(buffer, length, pos, audioData.frameNumber)
+                || !readVarint(buffer, length, pos, header))) {
+            return false;
+        }
+        
+        const uint64_t size = header >> 1;
+        if (size > static_cast<uint64_t>(length - pos)) {
+            return false;
+        }
+        audioData.senderSession = static_cast<uint32_t>(session);
+        audioData.isLastFrame = (header & 1) != 0;
+        
+        delete[] audioData.data;
+        audioData.data = nullptr;
+        audioData.size = static_cast<int>(size);
+        if (size > 0) {
+            audioData.data = new byte[size];
+            memcpy(audioData.data, buffer + pos, size);
+        }
+        return true;
+    }
+    
+private:
+    static bool readVarint(const byte *buffer, int length, int &pos, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 70; shift += 7) {
+            if (pos >= length) {
+                return false;
+            }
+            const byte b = buffer[pos++];
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// A single key-down or key-up edge of a CW transmission
+struct CWKeyingEdge {
+    uint32_t offset; // In samples (48 kHz) after CWKeyingData::timestamp
+    bool keyDown;
+};
+
+// Keying events of a CW station. Instead of streaming the tone as audio the
+// client sends when the key went down and up, and the tone is synthesized
+// by whoever plays it back.
+struct CWKeyingData {
+    uint32_t senderSession;
+    uint16_t sequence;
+    uint32_t timestamp; // Sender's 48 kHz sample clock, wraps around
+    int16_t pitchOffset; // Offset in Hz from the receiver's CW pitch
+    QVector<CWKeyingEdge> edges;
+    
+    CWKeyingData() : senderSession(0), sequence(0), timestamp(0), pitchOffset(0) {}
+};
+
+// Maximum number of edges carried by a single UDP keying packet
+const int CW_KEYING_MAX_EDGES = 255;
+
+// Protocol encoder for UDP CW keying packets
+//
+// Layout: type, [session varint, server to client only], sequence (2 bytes),
+// timestamp (4 bytes), pitch offset (2 bytes), edge count (1 byte), then one
+// varint per edge holding (samples since the previous edge << 1) | keyDown
+template<Role R>
+class CWKeyingEncoder {
+public:
+    CWKeyingEncoder() {}
+    
+    int encode(byte *buffer, int length, const CWKeyingData &keying) {
+        const int count = keying.edges.size();
+        if (count > CW_KEYING_MAX_EDGES || length < 10 + 5 + count * 5) {
+            return 0;
+        }
+        
+        int pos = 0;
+        buffer[pos++] = static_cast<byte>(UDPMessageType::CWKeying);
+        if (R == Role::Server) {
+            pos += writeVarint(buffer + pos, keying.senderSession);
+        }
+        
+        buffer[pos++] = static_cast<byte>(keying.sequence >> 8);
+        buffer[pos++] = static_cast<byte>(keying.sequence & 0xFF);
+        for (int i = 3; i >= 0; i--) {
+            buffer[pos++] = static_cast<byte>((keying.timestamp >> (i * 8)) & 0xFF);
+        }
+        buffer[pos++] = static_cast<byte>((static_cast<uint16_t>(keying.pitchOffset) >> 8) & 0xFF);
+        buffer[pos++] = static_cast<byte>(static_cast<uint16_t>(keying.pitchOffset) & 0xFF);
+        buffer[pos++] = static_cast<byte>(count);
+        
+        uint32_t previous = 0;
+        for (const CWKeyingEdge &edge : keying.edges) {
+            const uint32_t delta = edge.offset - previous;
+            pos += writeVarint(buffer + pos, (delta << 1) | (edge.keyDown ? 1 : 0));
+            previous = edge.offset;
+        }
+        
+        return pos;
+    }
+    
+private:
+    static int writeVarint(byte *out, uint32_t value) {
+        int n = 0;
+        while (value >= 0x80) {
+            out[n++] = static_cast<byte>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out[n++] = static_cast<byte>(value);
+        return n;
+    }
+};
+
+// Protocol decoder for UDP CW keying packets
+template<Role R>
+class CWKeyingDecoder {
+public:
+    CWKeyingDecoder() {}
+    
+    bool decode(const byte *buffer, int length, CWKeyingData &keying) {
+        int pos = 0;
+        if (length < 1 || static_cast<UDPMessageType>(buffer[pos++] & 0x7) != UDPMessageType::CWKeying) {
+            return false;
+        }
+        
+        keying.senderSession = 0;
+        if (R == Role::Client && !readVarint(buffer, length, pos, keying.senderSession)) {
+            return false;
+        }
+        
+        if (length - pos < 9) {
+            return false;
+        }
+        keying.sequence = static_cast<uint16_t>((buffer[pos] << 8) | buffer[pos + 1]);
+        pos += 2;
+        keying.timestamp = 0;
+        for (int i = 0; i < 4; i++) {
+            keying.timestamp = (keying.timestamp << 8) | buffer[pos++];
+        }
+        keying.pitchOffset = static_cast<int16_t>((buffer[pos] << 8) | buffer[pos + 1]);
+        pos += 2;
+        const int count = buffer[pos++];
+        
+        keying.edges.clear();
+        keying.edges.reserve(count);
+        uint32_t offset = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t value = 0;
+            if (!readVarint(buffer, length, pos, value)) {
+                return false;
+            }
+            offset += value >> 1;
+            keying.edges.append({ offset, (value & 1) != 0 });
+        }
+        
+        return true;
+    }
+    
+private:
+    static bool readVarint(const byte *buffer, int length, int &pos, uint32_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= length) {
+                return false;
+            }
+            const byte b = buffer[pos++];
+            value |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
     }
 };
 
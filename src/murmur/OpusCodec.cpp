@@ -0,0 +1,98 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "OpusCodec.h"
+
+#include <QtCore/QDebug>
+
+#ifdef USE_OPUS
+#	include <opus.h>
+#endif
+
+OpusCodec::OpusCodec(int bitrate)
+    : m_decoder(nullptr)
+    , m_encoder(nullptr)
+    , m_bitrate(bitrate) {
+}
+
+OpusCodec::~OpusCodec() {
+#ifdef USE_OPUS
+    if (m_decoder) {
+        opus_decoder_destroy(m_decoder);
+    }
+    if (m_encoder) {
+        opus_encoder_destroy(m_encoder);
+    }
+#endif
+}
+
+bool OpusCodec::isAvailable() {
+#ifdef USE_OPUS
+    return true;
+#else
+    return false;
+#endif
+}
+
+int OpusCodec::decode(const unsigned char *data, int size, float *pcm, int maxSamples) {
+#ifdef USE_OPUS
+    if (!m_decoder) {
+        int error = OPUS_OK;
+        m_decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+        if (error != OPUS_OK) {
+            qWarning() << "OpusCodec: Failed to create decoder:" << opus_strerror(error);
+            m_decoder = nullptr;
+            return -1;
+        }
+    }
+
+    int samples = opus_decode_float(m_decoder, data, size, pcm, maxSamples, 0);
+    return (samples < 0) ? -1 : samples;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    Q_UNUSED(pcm);
+    Q_UNUSED(maxSamples);
+    return -1;
+#endif
+}
+
+QByteArray OpusCodec::encode(const float *pcm, int frameSize) {
+#ifdef USE_OPUS
+    if (!m_encoder) {
+        int error = OPUS_OK;
+        m_encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+        if (error != OPUS_OK) {
+            qWarning() << "OpusCodec: Failed to create encoder:" << opus_strerror(error);
+            m_encoder = nullptr;
+            return QByteArray();
+        }
+        opus_encoder_ctl(m_encoder, OPUS_SET_BITRATE(m_bitrate));
+    }
+
+    unsigned char buffer[MAX_PACKET_SIZE];
+    int len = opus_encode_float(m_encoder, pcm, frameSize, buffer, MAX_PACKET_SIZE);
+    if (len < 0) {
+        return QByteArray();
+    }
+
+    return QByteArray(reinterpret_cast<const char *>(buffer), len);
+#else
+    Q_UNUSED(pcm);
+    Q_UNUSED(frameSize);
+    return QByteArray();
+#endif
+}
+
+void OpusCodec::reset() {
+#ifdef USE_OPUS
+    if (m_decoder) {
+        opus_decoder_ctl(m_decoder, OPUS_RESET_STATE);
+    }
+    if (m_encoder) {
+        opus_encoder_ctl(m_encoder, OPUS_RESET_STATE);
+    }
+#endif
+}
@@ -0,0 +1,91 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_OPUSCODEC_H_
+#define MUMBLE_MURMUR_OPUSCODEC_H_
+
+#include <QtCore/QByteArray>
+
+struct OpusDecoder;
+struct OpusEncoder;
+
+/**
+ * @brief The OpusCodec class wraps a single Opus decoder/encoder pair.
+ *
+ * The server normally forwards Opus frames without touching them. Features
+ * that need to work on the audio itself (such as band mixing) use this class
+ * to decode incoming frames to PCM and to encode the processed result.
+ *
+ * Opus support is optional at build time. When the server is built without
+ * libopus (USE_OPUS not defined), isAvailable() returns false and all
+ * encode/decode calls fail, so callers can fall back to plain forwarding.
+ */
+class OpusCodec {
+public:
+    /// Sample rate used for all server-side audio processing
+    static constexpr int SAMPLE_RATE = 48000;
+
+    /// Number of samples in one 20 ms frame at SAMPLE_RATE
+    static constexpr int FRAME_SIZE = 960;
+
+    /// Upper bound for a single encoded frame
+    static constexpr int MAX_PACKET_SIZE = 1275;
+
+    /**
+     * @brief Constructor for OpusCodec.
+     *
+     * @param bitrate The encoder bitrate in bits per second
+     */
+    explicit OpusCodec(int bitrate = 40000);
+
+    /**
+     * @brief Destructor for OpusCodec.
+     */
+    ~OpusCodec();
+
+    /**
+     * @brief Check whether the server was built with Opus support.
+     *
+     * @return True if Opus encoding and decoding is available
+     */
+    static bool isAvailable();
+
+    /**
+     * @brief Decode one Opus frame into mono float PCM.
+     *
+     * @param data The encoded frame, or nullptr to run packet loss concealment
+     * @param size The size of the encoded frame in bytes
+     * @param pcm Output buffer for the decoded samples
+     * @param maxSamples Capacity of the output buffer in samples
+     * @return The number of decoded samples, or -1 on error
+     */
+    int decode(const unsigned char *data, int size, float *pcm, int maxSamples);
+
+    /**
+     * @brief Encode one frame of mono float PCM.
+     *
+     * @param pcm The samples to encode
+     * @param frameSize The number of samples (normally FRAME_SIZE)
+     * @return The encoded frame, or an empty QByteArray on error
+     */
+    QByteArray encode(const float *pcm, int frameSize);
+
+    /**
+     * @brief Reset the encoder and decoder state.
+     *
+     * Used when a stream is restarted so that no state from an unrelated
+     * earlier stream leaks into the new one.
+     */
+    void reset();
+
+private:
+    Q_DISABLE_COPY(OpusCodec)
+
+    OpusDecoder *m_decoder; // Lazily created decoder state
+    OpusEncoder *m_encoder; // Lazily created encoder state
+    int m_bitrate; // Encoder bitrate in bits per second
+};
+
+#endif // MUMBLE_MURMUR_OPUSCODEC_H_
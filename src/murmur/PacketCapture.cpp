@@ -0,0 +1,288 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "PacketCapture.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+namespace {
+    // Capture file, all little-endian except addresses, which are in network order:
+    //   header:   magic, version (u32 each), capture start in ms since the epoch (i64)
+    //   records:  kind (u8), then
+    //     session:  session (u32), channel (i32), flags (u8), power (i32),
+    //               antenna gain (f32), locator length (u8) and Latin-1 locator,
+    //               listened channel count (u16) and the channels (i32 each)
+    //     datagram: microseconds since the previous datagram (u32), session (u32),
+    //               port (u16), address length (u8, 4 or 16) and address,
+    //               payload length (u16) and payload
+    const quint32 FILE_MAGIC = 0x5043504D; // "MPCP"
+    const quint32 FILE_VERSION = 1;
+
+    const quint8 SESSION_RECORD = 1;
+    const quint8 DATAGRAM_RECORD = 2;
+    // Kind, delta, session, port, address length, payload length
+    const int DATAGRAM_OVERHEAD = 1 + 4 + 4 + 2 + 1 + 2;
+
+    template<typename T>
+    void appendLittleEndian(QByteArray &out, T value) {
+        uchar bytes[sizeof(T)];
+        qToLittleEndian(value, bytes);
+        out.append(reinterpret_cast<const char *>(bytes), static_cast<int>(sizeof(T)));
+    }
+
+    // Reads fields of a capture, and stops at the first that runs past its end
+    class Cursor {
+    public:
+        explicit Cursor(const QByteArray &data)
+            : m_data(reinterpret_cast<const uchar *>(data.constData())), m_size(data.size()), m_offset(0),
+              m_overrun(false) {}
+
+        template<typename T>
+        T read() {
+            if (!take(static_cast<int>(sizeof(T)))) {
+                return T();
+            }
+            return qFromLittleEndian<T>(m_data + m_offset - sizeof(T));
+        }
+
+        const uchar *bytes(int count) { return take(count) ? m_data + m_offset - count : nullptr; }
+
+        bool atEnd() const { return m_offset >= m_size; }
+        bool overrun() const { return m_overrun; }
+
+    private:
+        bool take(int count) {
+            if (m_overrun || count > m_size - m_offset) {
+                m_overrun = true;
+                return false;
+            }
+            m_offset += count;
+            return true;
+        }
+
+        const uchar *m_data;
+        int m_size;
+        int m_offset;
+        bool m_overrun;
+    };
+} // namespace
+
+PacketCapture::PacketCapture()
+    : m_written(0), m_maxBytes(0), m_full(false), m_failed(false), m_datagrams(0) {
+}
+
+PacketCapture::~PacketCapture() {
+    close();
+}
+
+bool PacketCapture::open(const QString &path, qint64 maxBytes, QString *errorString) {
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (errorString) {
+            *errorString = m_file.errorString();
+        }
+        return false;
+    }
+
+    m_buffer.clear();
+    m_buffer.reserve(FLUSH_BYTES + 1024);
+    m_written = 0;
+    m_maxBytes = maxBytes;
+    m_full = false;
+    m_failed = false;
+    m_datagrams = 0;
+    m_sessions.clear();
+    m_last = std::chrono::steady_clock::now();
+
+    appendLittleEndian(m_buffer, FILE_MAGIC);
+    appendLittleEndian(m_buffer, FILE_VERSION);
+    appendLittleEndian(m_buffer, QDateTime::currentMSecsSinceEpoch());
+    return true;
+}
+
+void PacketCapture::addSession(quint32 session, int channelId, quint8 flags, const QString &grid, int power,
+                               float antennaGain, const QList<int> &listenedChannels) {
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    m_sessions.insert(session);
+
+    quint32 gainBits;
+    std::memcpy(&gainBits, &antennaGain, sizeof(gainBits));
+    const QByteArray locator = grid.toLatin1().left(255);
+    const int listened = qMin(listenedChannels.size(), 0xFFFF);
+
+    appendLittleEndian(m_buffer, SESSION_RECORD);
+    appendLittleEndian(m_buffer, session);
+    appendLittleEndian(m_buffer, static_cast<qint32>(channelId));
+    appendLittleEndian(m_buffer, flags);
+    appendLittleEndian(m_buffer, static_cast<qint32>(power));
+    appendLittleEndian(m_buffer, gainBits);
+    appendLittleEndian(m_buffer, static_cast<quint8>(locator.size()));
+    m_buffer.append(locator);
+    appendLittleEndian(m_buffer, static_cast<quint16>(listened));
+    for (int i = 0; i < listened; ++i) {
+        appendLittleEndian(m_buffer, static_cast<qint32>(listenedChannels[i]));
+    }
+}
+
+bool PacketCapture::addDatagram(quint32 session, const HostAddress &peer, quint16 port, const char *data,
+                                int length) {
+    if (!m_file.isOpen() || m_full || m_failed || length < 0 || length > 0xFFFF) {
+        return !m_full && !m_failed;
+    }
+
+    const bool ipv4 = peer.protocol() == QAbstractSocket::IPv4Protocol;
+    const int addressBytes = ipv4 ? 4 : 16;
+    if (m_written + m_buffer.size() + DATAGRAM_OVERHEAD + addressBytes + length > m_maxBytes) {
+        m_full = true;
+        flush();
+        return false;
+    }
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const qint64 deltaUs = std::chrono::duration_cast<std::chrono::microseconds>(now - m_last).count();
+    m_last = now;
+
+    appendLittleEndian(m_buffer, DATAGRAM_RECORD);
+    appendLittleEndian(m_buffer, static_cast<quint32>(qBound<qint64>(0, deltaUs, 0xFFFFFFFF)));
+    appendLittleEndian(m_buffer, session);
+    appendLittleEndian(m_buffer, port);
+    appendLittleEndian(m_buffer, static_cast<quint8>(addressBytes));
+    if (ipv4) {
+        uchar address[4];
+        qToBigEndian(peer.toIPv4Address(), address);
+        m_buffer.append(reinterpret_cast<const char *>(address), 4);
+    } else {
+        const Q_IPV6ADDR address = peer.toIPv6Address();
+        m_buffer.append(reinterpret_cast<const char *>(address.c), 16);
+    }
+    appendLittleEndian(m_buffer, static_cast<quint16>(length));
+    m_buffer.append(data, length);
+    ++m_datagrams;
+
+    if (m_buffer.size() >= FLUSH_BYTES) {
+        return flush();
+    }
+    return true;
+}
+
+bool PacketCapture::close(QString *errorString) {
+    if (!m_file.isOpen()) {
+        return !m_failed;
+    }
+
+    flush();
+    if (m_failed && errorString) {
+        *errorString = m_file.errorString();
+    }
+    m_file.close();
+    m_buffer.clear();
+    return !m_failed;
+}
+
+bool PacketCapture::flush() {
+    if (m_failed) {
+        return false;
+    }
+    if (!m_buffer.isEmpty()) {
+        if (m_file.write(m_buffer) != m_buffer.size() || !m_file.flush()) {
+            m_failed = true;
+            return false;
+        }
+        m_written += m_buffer.size();
+        // Keeps the reserved capacity for the next block
+        m_buffer.resize(0);
+    }
+    return !m_full;
+}
+
+bool PacketCaptureReader::load(const QString &path, QString *errorString) {
+    m_sessions.clear();
+    m_datagrams.clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorString) {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    const QByteArray data = file.readAll();
+
+    Cursor cursor(data);
+    const quint32 magic = cursor.read<quint32>();
+    const quint32 version = cursor.read<quint32>();
+    m_startTime = cursor.read<qint64>();
+    if (cursor.overrun() || magic != FILE_MAGIC || version != FILE_VERSION) {
+        if (errorString) {
+            *errorString = QStringLiteral("Not a packet capture of version %1").arg(FILE_VERSION);
+        }
+        return false;
+    }
+
+    // Records are only kept once they were read completely
+    quint64 timeUs = 0;
+    while (!cursor.atEnd()) {
+        const quint8 kind = cursor.read<quint8>();
+        if (kind == SESSION_RECORD) {
+            Session session;
+            session.session = cursor.read<quint32>();
+            session.channelId = cursor.read<qint32>();
+            session.flags = cursor.read<quint8>();
+            session.power = cursor.read<qint32>();
+            const quint32 gainBits = cursor.read<quint32>();
+            std::memcpy(&session.antennaGain, &gainBits, sizeof(gainBits));
+            const quint8 locatorLength = cursor.read<quint8>();
+            if (const uchar *locator = cursor.bytes(locatorLength)) {
+                session.grid = QString::fromLatin1(reinterpret_cast<const char *>(locator), locatorLength);
+            }
+            const quint16 listened = cursor.read<quint16>();
+            for (int i = 0; i < listened && !cursor.overrun(); ++i) {
+                session.listenedChannels.append(cursor.read<qint32>());
+            }
+            if (cursor.overrun()) {
+                break;
+            }
+            m_sessions.push_back(session);
+        } else if (kind == DATAGRAM_RECORD) {
+            Datagram datagram;
+            const quint32 deltaUs = cursor.read<quint32>();
+            datagram.session = cursor.read<quint32>();
+            datagram.port = cursor.read<quint16>();
+            const quint8 addressBytes = cursor.read<quint8>();
+            const uchar *address = cursor.bytes(addressBytes);
+            if (address && addressBytes == 4) {
+                datagram.peer = HostAddress(qFromBigEndian<quint32>(address));
+            } else if (address && addressBytes == 16) {
+                Q_IPV6ADDR ip6;
+                std::memcpy(ip6.c, address, 16);
+                datagram.peer = HostAddress(ip6);
+            } else if (!cursor.overrun()) {
+                break;
+            }
+            const quint16 length = cursor.read<quint16>();
+            if (const uchar *payload = cursor.bytes(length)) {
+                datagram.data = QByteArray(reinterpret_cast<const char *>(payload), length);
+            }
+            if (cursor.overrun()) {
+                break;
+            }
+            timeUs += deltaUs;
+            datagram.timeUs = timeUs;
+            m_datagrams.push_back(datagram);
+        } else {
+            // Not written by this version; nothing after it can be trusted
+            break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,176 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_PACKETCAPTURE_H_
+#define MUMBLE_MURMUR_PACKETCAPTURE_H_
+
+#include "HostAddress.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+#include <chrono>
+#include <vector>
+
+/**
+ * @brief Records the datagrams a server receives to a compact binary file.
+ *
+ * A capture starts with the users of the server (their channel, listened
+ * channels, flags and station), followed by every datagram as it arrived:
+ * the time since the previous one, the session it was matched to, the peer
+ * address and the payload. PacketCaptureReader loads a capture so that it
+ * can be fed back through Server::processDatagram().
+ *
+ * Records are collected in memory and appended to the file in blocks.
+ * Capturing stops, and addDatagram() returns false, once the file reaches its
+ * size limit. Not thread-safe; used by the voice thread only once the users
+ * were added.
+ */
+class PacketCapture {
+public:
+    /// Bytes collected before they are appended to the file
+    static const int FLUSH_BYTES = 64 * 1024;
+
+    /// Bits of the flags of addSession()
+    enum SessionFlag : quint8 { Mute = 0x01, Deaf = 0x02, SelfMute = 0x04, SelfDeaf = 0x08, Suppress = 0x10 };
+
+    PacketCapture();
+    ~PacketCapture();
+
+    PacketCapture(const PacketCapture &) = delete;
+    PacketCapture &operator=(const PacketCapture &) = delete;
+
+    /**
+     * @brief Create the capture file, replacing an existing one.
+     *
+     * @param path The file
+     * @param maxBytes Size after which capturing stops
+     * @param errorString Set to the reason if the file could not be created
+     * @return Whether the file was created
+     */
+    bool open(const QString &path, qint64 maxBytes, QString *errorString = nullptr);
+
+    /**
+     * @brief Record a user as it is when capturing starts.
+     *
+     * @param session The session of the user
+     * @param channelId The channel the user is in
+     * @param flags The mute and deaf flags, a combination of the SessionFlag values
+     * @param grid The Maidenhead locator of the station; may be empty
+     * @param power The transmitter power in watts
+     * @param antennaGain The antenna gain in dBi
+     * @param listenedChannels The channels the user listens to
+     */
+    void addSession(quint32 session, int channelId, quint8 flags, const QString &grid, int power, float antennaGain,
+                    const QList<int> &listenedChannels);
+
+    /**
+     * @brief Check whether a user was recorded.
+     *
+     * @param session The session of the user
+     * @return True if addSession() was called for the session
+     */
+    bool hasSession(quint32 session) const { return m_sessions.contains(session); }
+
+    /**
+     * @brief Record a received datagram.
+     *
+     * @param session The session of the sender; 0 if the peer is not known
+     * @param peer The address the datagram came from
+     * @param port The port it came from
+     * @param data The datagram as received
+     * @param length The size of the datagram
+     * @return False once the capture reached its size limit
+     */
+    bool addDatagram(quint32 session, const HostAddress &peer, quint16 port, const char *data, int length);
+
+    /**
+     * @brief Append what was collected and close the file.
+     *
+     * @param errorString Set to the reason if the file could not be written
+     * @return Whether everything was written
+     */
+    bool close(QString *errorString = nullptr);
+
+    /**
+     * @brief Get the number of datagrams recorded.
+     *
+     * @return Datagrams recorded since open()
+     */
+    quint64 datagrams() const { return m_datagrams; }
+
+private:
+    bool flush();
+
+    QFile m_file;
+    QByteArray m_buffer;
+    QSet<quint32> m_sessions; // Sessions recorded by addSession()
+    qint64 m_written; // Bytes in the file
+    qint64 m_maxBytes;
+    bool m_full;
+    bool m_failed; // A write failed; the capture is abandoned
+    quint64 m_datagrams;
+    std::chrono::steady_clock::time_point m_last; // Arrival of the previous datagram
+};
+
+/**
+ * @brief Loads a file written by PacketCapture.
+ *
+ * The whole capture is read into memory up front, so that playing it back
+ * does no I/O.
+ */
+class PacketCaptureReader {
+public:
+    struct Session {
+        quint32 session;
+        int channelId;
+        quint8 flags; ///< PacketCapture::SessionFlag values
+        QString grid;
+        int power;
+        float antennaGain;
+        QList<int> listenedChannels;
+    };
+
+    struct Datagram {
+        quint64 timeUs; ///< Arrival, in microseconds since capturing started
+        quint32 session; ///< 0 if the peer was not known
+        HostAddress peer;
+        quint16 port;
+        QByteArray data;
+    };
+
+    /**
+     * @brief Read a capture.
+     *
+     * A capture cut short, as by a crash of the server, is read up to its
+     * last complete record.
+     *
+     * @param path The file
+     * @param errorString Set to the reason if the file could not be read
+     * @return Whether the file was read
+     */
+    bool load(const QString &path, QString *errorString = nullptr);
+
+    /**
+     * @brief Get the time capturing started.
+     *
+     * @return Milliseconds since the epoch, UTC
+     */
+    qint64 startTime() const { return m_startTime; }
+
+    const std::vector<Session> &sessions() const { return m_sessions; }
+    const std::vector<Datagram> &datagrams() const { return m_datagrams; }
+
+private:
+    qint64 m_startTime = 0;
+    std::vector<Session> m_sessions;
+    std::vector<Datagram> m_datagrams;
+};
+
+#endif // MUMBLE_MURMUR_PACKETCAPTURE_H_
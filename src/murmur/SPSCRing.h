@@ -0,0 +1,123 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SPSCRING_H_
+#define MUMBLE_MURMUR_SPSCRING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/**
+ * @brief Bounded lock-free ring buffer for exactly one producer and one consumer.
+ *
+ * push() may only be called from the producer thread and pop() only from the
+ * consumer thread. Neither call blocks or allocates; a full ring makes push()
+ * fail so a real-time producer can decide to drop instead of waiting.
+ *
+ * The capacity is rounded up to a power of two.
+ *
+ * @tparam T The element type; must be default constructible and movable
+ */
+template<typename T>
+class SPSCRing {
+public:
+    /**
+     * @brief Constructor for SPSCRing.
+     *
+     * @param capacity The minimum number of elements the ring can hold
+     */
+    explicit SPSCRing(size_t capacity)
+        : m_mask(roundUp(capacity) - 1)
+        , m_slots(new T[m_mask + 1])
+        , m_head(0)
+        , m_tail(0) {
+    }
+
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing &operator=(const SPSCRing &) = delete;
+
+    /**
+     * @brief Append an element (producer side).
+     *
+     * @param value The element to append
+     * @return False if the ring is full
+     */
+    bool push(T value) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest element (consumer side).
+     *
+     * @param value Receives the element
+     * @return False if the ring is empty
+     */
+    bool pop(T &value) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Check whether the ring is empty.
+     *
+     * Exact only when called from the consumer thread.
+     *
+     * @return True if there is nothing to pop
+     */
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Get the number of queued elements.
+     *
+     * Approximate when called while the other side is active.
+     *
+     * @return The number of queued elements
+     */
+    size_t size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Get the capacity of the ring.
+     *
+     * @return The maximum number of elements
+     */
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    static size_t roundUp(size_t value) {
+        size_t result = 2;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t m_mask;
+    std::unique_ptr<T[]> m_slots;
+
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+};
+
+#endif // MUMBLE_MURMUR_SPSCRING_H_
@@ -4,13 +4,19 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "Server.h"
+#include "CoarseClock.h"
+#include "CpuTopology.h"
+#include "HotLog.h"
+#include "Metrics.h"
+#include "PacketCapture.h"
+#include "ThreadPlacement.h"
+#include "VoiceTrace.h"
 #include "modules/UserDataModule.h"
 #include "modules/PropagationModule.h"
 #include "modules/UserStatisticsModule.h"
 #include "database/MariaDBConnectionParameter.h"
 
 #include <QtCore/QCoreApplication>
-#include <QtCore/QSettings>
 #include <QtCore/QTextCodec>
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
@@ -19,9 +25,24 @@
 #include <QtCore/QTimer>
 #include <QtCore/QRegularExpression>
 #include <QtCore/QRandomGenerator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMetaObject>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QReadLocker>
+#include <QtCore/QWriteLocker>
+#include <QtCore/QThread>
 #include <QtNetwork/QSslSocket>
 #include <QtNetwork/QHostAddress>
 
+#ifdef Q_OS_WIN
+#	include <winsock2.h>
+#	include <ws2tcpip.h>
+#else
+#	include <arpa/inet.h>
+#	include <netinet/in.h>
+#	include <sys/socket.h>
+#endif
+
 // This is a simplified version of the Server.cpp file
 // In a real implementation, this would include all the functionality
 // from the original Server.cpp file, with modifications for HF band simulation
@@ -33,11 +54,28 @@ Server::Server(unsigned int snum, const ::mumble::db::ConnectionParameter &conne
     // Initialize HFBandSimulation pointer to nullptr - will be set up by PropagationModule later
     m_pHFBandSimulation = nullptr;
     
+    // The voice thread runs from startThread() to stopThread()
+    bRunning = false;
+    
     // Initialize the server
     qsRegName = "Supermorse Mumble Server";
 }
 
 Server::~Server() {
+    // Abandon a routing recompute still running on the module thread pool
+    cancelRoutingUpdate();
+    
+    // The voice thread feeds the DSP workers, so it stops first
+    stopThread();
+    
+    // Stop the DSP workers before the user and channel data they read goes away
+    m_dspExecutor.reset();
+    
+    // Keep the practice frames built during this run for the next start
+    if (m_cwFrameCache && m_cwFrameCache->isDirty()) {
+        m_cwFrameCache->save(m_cwFrameCachePath);
+    }
+    
     // No need to delete m_pHFBandSimulation as it's owned by PropagationModule
     delete m_moduleManager; // Clean up the module manager
 }
@@ -45,11 +83,20 @@ Server::~Server() {
 void Server::initialize() {
     // Initialize the server
     
-    // Load configuration
-    QSettings qs("mumble-server.ini", QSettings::IniFormat);
+    // Every subsystem is set up from the same parsed configuration
+    m_config = ServerConfig::current();
     
     // Set up channels from configuration
-    setupChannels(qs);
+    setupChannels(m_config->channels());
+    
+    // Set up server-side mixing for band channels
+    initializeBandMixing(m_config->audioMixing());
+    
+    // Start the dedicated audio processing workers
+    initializeDSPExecutor(m_config->performance());
+    
+    // Load the pre-encoded CW characters for code practice
+    initializeCodePractice(m_config->codePractice());
     
     // Register modules
     registerModules();
@@ -58,7 +105,71 @@ void Server::initialize() {
     m_moduleManager->initializeAllModules();
     
     // Initialize the HF band simulation for backward compatibility
-    initializeHFBandSimulation();
+    initializeHFBandSimulation(m_config->hfPropagation());
+    
+    // Let the modules compiled into the voice path see their state
+    m_voiceHooks.bind(this);
+    qDebug() << "Server:" << ServerVoiceHooks::size() << "voice path hooks compiled in";
+    
+    // Record the received datagrams if configured
+    setPacketCapture(m_config->packetCapture());
+}
+
+void Server::applyConfig(std::shared_ptr< const ServerConfig > config) {
+    if (!m_config) {
+        // initialize() has not run; it picks up the new snapshot
+        return;
+    }
+    
+    // Compared against what this server was set up from rather than the
+    // snapshot the reload replaced, so a server never misses a change
+    const ServerConfig::Sections changed = config->diff(*m_config);
+    const std::shared_ptr< const ServerConfig > old = m_config;
+    m_config = config;
+    
+    if (changed & ServerConfig::ChannelsSection) {
+        QWriteLocker locker(&qrwlVoiceThread);
+        setupChannels(config->channels());
+    }
+    
+    if (changed & ServerConfig::AudioMixingSection) {
+        const ServerConfig::AudioMixing &mixing = config->audioMixing();
+        const ServerConfig::AudioMixing &oldMixing = old->audioMixing();
+        
+        // The mixed channels and their skimmers are fixed once the voice
+        // thread runs
+        if (mixing.enabled != oldMixing.enabled || mixing.channels != oldMixing.channels
+            || mixing.cwSkimmer != oldMixing.cwSkimmer) {
+            qWarning() << "Server: Changes to the mixed channels take effect after a restart";
+        }
+        if (mixing.enabled && oldMixing.enabled && OpusCodec::isAvailable()) {
+            QWriteLocker locker(&qrwlVoiceThread);
+            applyMixingLevels(mixing);
+        }
+    }
+    
+    if (changed & ServerConfig::PerformanceSection) {
+        qWarning() << "Server: Changes to [performance] take effect after a restart";
+    }
+    
+    if (changed & ServerConfig::CodePracticeSection) {
+        qWarning() << "Server: Changes to [code_practice] take effect after a restart";
+    }
+    
+    if (changed & ServerConfig::PacketCaptureSection) {
+        setPacketCapture(config->packetCapture());
+    }
+    
+    if ((changed & ServerConfig::HFPropagationSection) && m_pHFBandSimulation) {
+        PropagationModule *propagationModule =
+            static_cast< PropagationModule * >(m_moduleManager->getModule("PropagationModule"));
+        if (propagationModule) {
+            propagationModule->applyConfig(config->hfPropagation());
+        }
+        if (startPropagationTimer(config->hfPropagation())) {
+            updateHFBandPropagation();
+        }
+    }
 }
 
 void Server::registerModules() {
@@ -77,142 +188,805 @@ void Server::registerModules() {
     qDebug() << "Server: Registered modules:" << m_moduleManager->getModuleNames().join(", ");
 }
 
-void Server::setupChannels(QSettings &qs) {
-    // Set up channels from configuration
-    qs.beginGroup("channels");
-    QStringList channels = qs.childKeys();
+void Server::setupChannels(const ServerConfig::Channels &channels) {
+    // Create the configured channels, or rename them on a reload
+    for (auto it = channels.names.cbegin(); it != channels.names.cend(); ++it) {
+        Channel *c = qhChannels.value(it.key());
+        if (c) {
+            c->qsName = it.value();
+        } else {
+            c = new Channel(it.key(), it.value());
+            qhChannels.insert(it.key(), c);
+        }
+        if (!m_channelTree.contains(c->iId)) {
+            m_channelTree.add(c->iId);
+        }
+    }
+    
+    // Channels that change parent are lifted to the top level first, so a
+    // reload that swaps two levels is not taken for a cycle
+    QMap<int, int> parents;
+    for (Channel *c : qhChannels) {
+        const int parentId = channels.parents.value(c->iId, -1);
+        parents.insert(c->iId, qhChannels.contains(parentId) ? parentId : -1);
+        if (parentId >= 0 && !qhChannels.contains(parentId)) {
+            qWarning() << "Server: Parent" << parentId << "of channel" << c->iId << "does not exist";
+        }
+        if (m_channelTree.parent(c->iId) != parents.value(c->iId)) {
+            m_channelTree.move(c->iId, -1);
+        }
+    }
+    for (auto it = parents.cbegin(); it != parents.cend(); ++it) {
+        if (it.value() >= 0 && !m_channelTree.move(it.key(), it.value())) {
+            qWarning() << "Server: Channel" << it.key() << "cannot be a subchannel of" << it.value()
+                       << "which is in its own tree";
+        }
+    }
     
-    for (const QString &key : channels) {
-        int id = key.toInt();
-        QString name = qs.value(key).toString();
+    for (Channel *c : qhChannels) {
+        if (!channels.names.contains(c->iId)) {
+            qWarning() << "Server: Channel" << c->iId << "was removed from the configuration and stays until a restart";
+        }
         
-        // Create the channel
-        Channel *c = new Channel(id, name);
-        qhChannels.insert(id, c);
+        // Set up channel links
+        c->qsPermLinks.clear();
+        for (int linkedId : channels.links.value(c->iId)) {
+            if (qhChannels.contains(linkedId)) {
+                c->qsPermLinks.insert(linkedId);
+            }
+        }
+        
+        // Set up channel descriptions
+        c->qsDesc = channels.descriptions.value(c->iId);
+    }
+}
+
+void Server::initializeBandMixing(const ServerConfig::AudioMixing &mixing) {
+    if (!mixing.enabled) {
+        return;
+    }
+    
+    if (!OpusCodec::isAvailable()) {
+        qWarning() << "Band mixing is enabled in configuration, but the server was built without Opus support";
+        return;
+    }
+    
+    applyMixingLevels(mixing);
+    
+    for (int id : mixing.channels) {
+        if (qhChannels.contains(id)) {
+            m_bandMixer.setMixingEnabled(id, true);
+        }
+    }
+    
+    // Decode the CW on every mixed band for spots and trainee scoring
+    if (mixing.cwSkimmer) {
+        for (int id : m_bandMixer.mixedChannels()) {
+            m_cwSkimmers[id].skimmer.reset(new CWSkimmer(id, OpusCodec::SAMPLE_RATE));
+        }
     }
     
-    // Set up channel links
-    qs.endGroup();
-    qs.beginGroup("channel_links");
-    QStringList links = qs.childKeys();
+    QStringList mixed;
+    for (int id : m_bandMixer.mixedChannels()) {
+        mixed << qhChannels.value(id)->qsName;
+    }
+    qWarning() << "Band mixing enabled for channels:" << mixed.join(", ");
+}
+
+void Server::applyMixingLevels(const ServerConfig::AudioMixing &mixing) {
+    m_bandMixer.setGainStep(mixing.gainStepDb);
+    m_bandMixer.setMinimumGain(mixing.minGain);
+    
+    // CW stations that send keying events are synthesized into the mix
+    m_cwSynthesizer.setPitch(mixing.cwPitch);
+    m_cwSynthesizer.setRiseTime(mixing.cwRiseTimeMs);
+    m_cwSynthesizer.setJitterBuffer(mixing.cwJitterBufferMs);
+}
+
+void Server::initializeDSPExecutor(const ServerConfig::Performance &performance) {
+    int threads = performance.dspThreads;
+    const bool realtime = performance.dspRealtime;
     
-    for (const QString &key : links) {
-        int id = key.toInt();
-        QStringList linkedChannels = qs.value(key).toString().split(",");
+    if (!performance.multiCore || threads <= 0) {
+        qWarning() << "DSP workers disabled, audio processing runs on the voice thread";
+        return;
+    }
+    
+    // Never take every core away from the voice and main threads
+    threads = qMin(threads, qMax(1, CpuTopology::system().cpuCount() - 1));
+    
+    // dsp_cpus, or the cores next to the voice thread chosen by the placement
+    const QVector<int> &cpus = ThreadPlacement::current().dspCpus();
+    
+    m_dspExecutor.reset(new DSPExecutor(threads, cpus, realtime));
+    qWarning() << "Started" << threads << "DSP workers" << (cpus.isEmpty() ? "" : "(pinned)");
+}
+
+void Server::initializeCodePractice(const ServerConfig::CodePractice &practice) {
+    const QString &cachePath = practice.frameCache;
+    const QString &schedulePath = practice.schedule;
+    
+    if (!practice.enabled) {
+        return;
+    }
+    
+    if (!OpusCodec::isAvailable()) {
+        qWarning() << "Code practice is enabled in configuration, but the server was built without Opus support";
+        return;
+    }
+    
+    // Characters missing from the file are encoded on first use and written
+    // back on shutdown
+    m_cwFrameCache.reset(new CWFrameCache(practice.riseTimeMs, qBound(6000, practice.bitrate, 64000)));
+    m_cwFrameCachePath = cachePath;
+    m_cwFrameCache->load(cachePath);
+    
+    if (schedulePath.isEmpty()) {
+        return;
+    }
+    
+    // Every speed of every broadcast is built here, once; broadcasting only
+    // copies cached frames
+    m_codePractice.reset(new CodePracticeBroadcaster(m_cwFrameCache.get()));
+    m_codePractice->setPitch(practice.pitch);
+    if (!m_codePractice->loadSchedule(schedulePath) || !m_codePractice->hasSchedule()) {
+        qWarning() << "Code practice schedule" << schedulePath << "has no broadcasts";
+        m_codePractice.reset();
+        return;
+    }
+    m_codePracticeStationGrid = practice.stationGrid;
+}
+
+namespace {
+    // Largest datagram the voice thread reads
+    const int UDP_PACKET_SIZE = 1024;
+    
+    // Records what a replay needs to route the packets of a user as they were
+    void captureSession(PacketCapture &capture, const ServerUser &u, const ChannelListenerManager &listeners) {
+        quint8 flags = 0;
+        flags |= u.bMute ? PacketCapture::Mute : 0;
+        flags |= u.bDeaf ? PacketCapture::Deaf : 0;
+        flags |= u.bSelfMute ? PacketCapture::SelfMute : 0;
+        flags |= u.bSelfDeaf ? PacketCapture::SelfDeaf : 0;
+        flags |= u.bSuppress ? PacketCapture::Suppress : 0;
         
-        Channel *c = qhChannels.value(id);
-        if (c) {
-            for (const QString &linkedId : linkedChannels) {
-                Channel *linked = qhChannels.value(linkedId.toInt());
-                if (linked) {
-                    c->qsPermLinks.insert(linked->iId);
-                }
+        QList<int> listened;
+        for (const Channel *channel : listeners.getListenedChannels(u)) {
+            listened.append(channel->iId);
+        }
+        capture.addSession(u.uiSession, u.cChannel ? u.cChannel->iId : -1, flags, u.qsGridSquare, u.iPower,
+                           u.fAntennaGain, listened);
+    }
+} // namespace
+
+void Server::setPacketCapture(const ServerConfig::PacketCapture &capture) {
+    QMutexLocker locker(&m_captureMutex);
+    
+    if (m_capture) {
+        m_capturing.store(false, std::memory_order_relaxed);
+        QString errorString;
+        if (!m_capture->close(&errorString)) {
+            qWarning() << "Server: Cannot write the packet capture:" << errorString;
+        }
+        qWarning() << "Server: Captured" << m_capture->datagrams() << "datagrams";
+        m_capture.reset();
+    }
+    
+    if (capture.file.isEmpty()) {
+        return;
+    }
+    
+    std::unique_ptr<PacketCapture> packetCapture(new PacketCapture());
+    QString errorString;
+    if (!packetCapture->open(capture.file, static_cast<qint64>(capture.maxSize) * 1024 * 1024, &errorString)) {
+        qWarning() << "Server: Cannot capture datagrams to" << capture.file << ":" << errorString;
+        return;
+    }
+    
+    // The users as they are now; users who connect later are recorded with
+    // their first datagram. Read on the main thread, which owns them.
+    for (const ServerUser *u : qhUsers) {
+        captureSession(*packetCapture, *u, m_channelListenerManager);
+    }
+    
+    m_capture = std::move(packetCapture);
+    m_capturing.store(true, std::memory_order_relaxed);
+    qWarning() << "Server: Capturing the received datagrams to" << capture.file;
+}
+
+void Server::captureDatagram(const ServerUser *u, const HostAddress &peer, quint16 port,
+                             const Mumble::Protocol::byte *data, int len) {
+    // Caller holds a read lock on qrwlVoiceThread
+    QMutexLocker locker(&m_captureMutex);
+    if (!m_capture) {
+        return;
+    }
+    
+    if (u && !m_capture->hasSession(u->uiSession)) {
+        captureSession(*m_capture, *u, m_channelListenerManager);
+    }
+    if (!m_capture->addDatagram(u ? u->uiSession : 0, peer, port, reinterpret_cast<const char *>(data), len)) {
+        m_capturing.store(false, std::memory_order_relaxed);
+        qWarning() << "Server: The packet capture is full or cannot be written; capturing stopped after"
+                   << m_capture->datagrams() << "datagrams";
+    }
+}
+
+void Server::processDatagram(const Mumble::Protocol::byte *data, int len, const HostAddress &peer, quint16 port) {
+    // Everything the voice thread receives passes here, from the socket or
+    // from a replayed capture. The lock is held until the packet is handled,
+    // so the user cannot be removed in between.
+    QReadLocker locker(&qrwlVoiceThread);
+    ServerUser *u = qhPeerUsers.value(qMakePair(peer, port));
+    if (Q_UNLIKELY(m_capturing.load(std::memory_order_relaxed))) {
+        captureDatagram(u, peer, port, data, len);
+    }
+    
+    if (!u || !m_udpDecoder.decode(data, len)) {
+        return;
+    }
+    
+    switch (m_udpDecoder.getType()) {
+        case Mumble::Protocol::UDPMessageType::VoiceData:
+        case Mumble::Protocol::UDPMessageType::VoiceOpus: {
+            if (len < 2) {
+                return;
             }
+            Mumble::Protocol::AudioData audioData;
+            audioData.isOpus = m_udpDecoder.getType() == Mumble::Protocol::UDPMessageType::VoiceOpus;
+            audioData.size = len - 1;
+            audioData.frameSize = OpusCodec::FRAME_SIZE;
+            audioData.data = new Mumble::Protocol::byte[audioData.size];
+            memcpy(audioData.data, data + 1, audioData.size);
+            processMsg(u, audioData, m_udpAudioReceivers, m_udpAudioEncoder);
+            // The copy passed to processMsg() freed the payload
+            audioData.data = nullptr;
+            break;
+        }
+        case Mumble::Protocol::UDPMessageType::CWKeying:
+            processCWKeying(u, data, len);
+            break;
+        case Mumble::Protocol::UDPMessageType::Ping:
+            // Not echoed: the socket the ping came in on is not known here
+            break;
+    }
+}
+
+namespace {
+    // Frames of silence the skimmer still gets after the last speaker, so the
+    // last word of a transmission completes even at 4 WPM
+    const int CW_SKIMMER_TAIL_FRAMES = 100;
+    
+    // Signal strength below which a listener cannot copy the practice
+    // station; matches the band mixer's default audibility floor
+    const float CODE_PRACTICE_MIN_SIGNAL = 0.05f;
+    
+    // Runs the skimmer over one frame and hands its results to the main thread
+    void skimFrame(Server *server, CWSkimmer *skimmer, const BandMixer::MixJob &job) {
+        skimmer->processFrame(job.speakers, job.frames, OpusCodec::FRAME_SIZE);
+        
+        QVector<CWSkimmer::Spot> spots = skimmer->takeSpots();
+        QVector<CWSkimmer::SendingScore> scores = skimmer->takeScores();
+        if (spots.isEmpty() && scores.isEmpty()) {
+            return;
         }
+        
+        QMetaObject::invokeMethod(
+            server, [server, spots, scores]() { server->reportCWSkimmerResults(spots, scores); },
+            Qt::QueuedConnection);
     }
     
-    // Set up channel descriptions
-    qs.endGroup();
-    qs.beginGroup("channel_description");
-    QStringList descriptions = qs.childKeys();
+    // One rendered bucket of a channel mix, held until it is sent
+    struct MixedFrame {
+        unsigned int streamSession;
+        quint64 frameNumber;
+        QVector<unsigned int> sessions;
+        QByteArray data;
+    };
+    
+    BandMixer::FrameSink collectFrames(std::vector<MixedFrame> &frames) {
+        return [&frames](int, unsigned int streamSession, quint64 frameNumber, const QVector<unsigned int> &sessions,
+                         const QByteArray &frame) { frames.push_back({ streamSession, frameNumber, sessions, frame }); };
+    }
     
-    for (const QString &key : descriptions) {
-        int id = key.toInt();
-        QString description = qs.value(key).toString();
+    // Renders one channel mix on a DSP worker and sends the result
+    class BandMixTask : public DSPTask {
+    public:
+        BandMixTask(Server *server, BandMixer::MixJob &&job, CWSkimmer *skimmer, VoiceTrace trace)
+            : m_server(server), m_job(std::move(job)), m_skimmer(skimmer), m_trace(trace) {}
         
-        Channel *c = qhChannels.value(id);
-        if (c) {
-            c->qsDesc = description;
+        void run() override {
+            m_trace.stamp(VoiceTracer::FrameStarted);
+            
+            // Encode without holding any server lock...
+            std::vector<MixedFrame> frames;
+            BandMixer::renderMix(m_job, collectFrames(frames));
+            m_trace.stamp(VoiceTracer::FrameRendered);
+            
+            if (!frames.empty()) {
+                // ...and only take the voice lock to resolve the receivers
+                QReadLocker locker(&m_server->qrwlVoiceThread);
+                for (const MixedFrame &frame : frames) {
+                    m_server->sendMixedFrame(frame.streamSession, frame.frameNumber, frame.sessions, frame.data);
+                }
+            }
+            m_trace.stamp(VoiceTracer::FrameSent);
+            
+            // Decoding is not time critical, so it goes after the send
+            if (m_skimmer) {
+                skimFrame(m_server, m_skimmer, m_job);
+            }
+        }
+        
+    private:
+        Server *m_server;
+        BandMixer::MixJob m_job;
+        CWSkimmer *m_skimmer;
+        VoiceTrace m_trace;
+    };
+}
+
+void Server::flushBandMixes() {
+    // Runs on the voice thread once per 20 ms frame
+    QReadLocker locker(&qrwlVoiceThread);
+    
+    // Keyed CW tones join the mix like any other speaker
+    m_cwSynthesizer.renderFrame(m_bandMixer.sampleClock(), [this](unsigned int session, int channelId, const float *pcm) {
+        ServerUser *station = qhUsers.value(session);
+        if (station) {
+            m_bandMixer.addSpeakerPcm(channelId, station, pcm);
+        }
+    });
+    
+    for (int channelId : m_bandMixer.mixedChannels()) {
+        Channel *c = qhChannels.value(channelId);
+        if (!c) {
+            continue;
+        }
+        
+        // Everyone in the channel plus everyone listening to it hears the mix
+        QList<ServerUser *> receivers;
+        foreach (ServerUser *user, qhUsers) {
+            if (user->cChannel == c && !user->bDeaf && !user->bSelfDeaf) {
+                receivers.append(user);
+            }
+        }
+        m_channelListenerManager.snapshot()->forEachListener(
+            *c, [&receivers](const ServerUser *listener, const VolumeAdjustment &) {
+                ServerUser *user = const_cast<ServerUser *>(listener);
+                if (!receivers.contains(user)) {
+                    receivers.append(user);
+                }
+            });
+        
+        BandMixer::MixJob job;
+        bool mixed = m_bandMixer.prepareMix(channelId, receivers, job);
+        
+        // The skimmer also decodes speakers nobody can hear (a trainee sending
+        // alone), and keeps running for a moment after the band goes quiet
+        CWSkimmer *skimmer = nullptr;
+        auto skimmerIt = m_cwSkimmers.find(channelId);
+        if (skimmerIt != m_cwSkimmers.end()) {
+            ChannelSkimmer &state = skimmerIt->second;
+            state.quietFrames = job.speakers.empty() ? qMin(state.quietFrames + 1, CW_SKIMMER_TAIL_FRAMES + 1) : 0;
+            if (state.quietFrames <= CW_SKIMMER_TAIL_FRAMES) {
+                skimmer = state.skimmer.get();
+            }
+        }
+        
+        if (!mixed && !skimmer) {
+            continue;
+        }
+        
+        const VoiceTrace trace = VoiceTracer::begin(VoiceTracer::FrameQueued);
+        if (m_dspExecutor) {
+            // Mixing and encoding happen on a DSP worker; a channel always maps
+            // to the same worker so its bucket encoders are never shared.
+            // A full queue drops this frame rather than stalling the voice thread.
+            m_dspExecutor->submit(static_cast<unsigned int>(channelId),
+                                  new BandMixTask(this, std::move(job), skimmer, trace));
+        } else {
+            trace.stamp(VoiceTracer::FrameStarted);
+            if (trace.isSampled()) {
+                // Send after rendering every bucket, like the DSP workers, so
+                // the stamps separate the two
+                std::vector<MixedFrame> frames;
+                BandMixer::renderMix(job, collectFrames(frames));
+                trace.stamp(VoiceTracer::FrameRendered);
+                for (const MixedFrame &frame : frames) {
+                    sendMixedFrame(frame.streamSession, frame.frameNumber, frame.sessions, frame.data);
+                }
+            } else {
+                BandMixer::renderMix(job, [this](int, unsigned int streamSession, quint64 frameNumber,
+                                                 const QVector<unsigned int> &sessions, const QByteArray &frame) {
+                    sendMixedFrame(streamSession, frameNumber, sessions, frame);
+                });
+            }
+            trace.stamp(VoiceTracer::FrameSent);
+            if (skimmer) {
+                skimFrame(this, skimmer, job);
+            }
         }
     }
     
-    qs.endGroup();
+    m_bandMixer.advanceClock();
 }
 
-void Server::initializeHFBandSimulation() {
-    // Get the PropagationModule from the ModuleManager
-    PropagationModule* propagationModule = static_cast<PropagationModule*>(
-        m_moduleManager->getModule("PropagationModule"));
+void Server::flushCodePractice() {
+    // Runs on the voice thread once per 20 ms frame
+    QReadLocker locker(&qrwlVoiceThread);
+    
+    // One cached frame per speed, sent unchanged to everyone on its channel
+    const qint64 now = CoarseClock::instance().utcMs();
+    m_codePractice->tick(now, [this](int channelId, const unsigned char *data, int size, bool lastFrame) {
+        Channel *c = qhChannels.value(channelId);
+        if (!c) {
+            return;
+        }
+        
+        // Every channel keeps its stream across broadcasts, so a listener's
+        // client sees one station with rising frame numbers
+        auto stream = m_practiceStreams.find(channelId);
+        if (stream == m_practiceStreams.end()) {
+            stream = m_practiceStreams.insert(channelId, { m_bandMixer.allocateStreamSession(), 0 });
+        }
+        const quint64 frameNumber = stream->nextFrame++;
+        
+        QVector<unsigned int> sessions;
+        foreach (ServerUser *user, qhUsers) {
+            if (user->cChannel == c && !user->bDeaf && !user->bSelfDeaf
+                && m_codePractice->isListenerAudible(user->uiSession)) {
+                sessions.append(user->uiSession);
+            }
+        }
+        m_channelListenerManager.snapshot()->forEachListener(
+            *c, [this, c, &sessions](const ServerUser *listener, const VolumeAdjustment &) {
+                if (listener->cChannel != c && m_codePractice->isListenerAudible(listener->uiSession)) {
+                    sessions.append(listener->uiSession);
+                }
+            });
+        
+        if (!sessions.isEmpty()) {
+            sendMixedFrame(stream->session, frameNumber, sessions,
+                           QByteArray::fromRawData(reinterpret_cast<const char *>(data), size), lastFrame);
+        }
+    });
+}
+
+void Server::updateCodePracticeReception() {
+    // Pre-encoded frames cannot be faded per listener, so reception is
+    // all or nothing: listeners below the readable threshold are cut off.
+    // Users without a grid square always receive the station.
+    if (!m_codePractice || m_codePracticeStationGrid.isEmpty() || !m_pHFBandSimulation) {
+        return;
+    }
     
-    if (!propagationModule) {
-        qWarning() << "Failed to get PropagationModule from ModuleManager. HF band simulation not initialized.";
+    foreach (ServerUser *u, qhUsers) {
+        bool audible = true;
+        if (u->hasValidGridSquare()) {
+            audible = calculateSignalStrength(m_codePracticeStationGrid, u->qsGridSquare) >= CODE_PRACTICE_MIN_SIGNAL;
+        }
+        m_codePractice->setListenerAudible(u->uiSession, audible);
+    }
+}
+
+void Server::sendMixedFrame(unsigned int streamSession, quint64 frameNumber, const QVector<unsigned int> &sessions,
+                            const QByteArray &frame, bool lastFrame) {
+    // Caller holds a read lock on qrwlVoiceThread
+    
+    // Every stream has its own virtual session, so clients keep a decoder
+    // and a jitter buffer per stream instead of mixing them all up
+    Mumble::Protocol::AudioData audioData;
+    if (!frame.isEmpty()) {
+        audioData.data = new Mumble::Protocol::byte[frame.size()];
+        memcpy(audioData.data, frame.constData(), frame.size());
+    }
+    audioData.size = frame.size();
+    audioData.frameSize = OpusCodec::FRAME_SIZE;
+    audioData.senderSession = streamSession;
+    audioData.frameNumber = frameNumber;
+    audioData.isLastFrame = lastFrame || frame.isEmpty();
+    
+    Mumble::Protocol::byte packet[1024];
+    int len = m_udpAudioEncoder.encode(packet, sizeof(packet), audioData);
+    if (len <= 0) {
         return;
     }
     
-    // Get the HFBandSimulation instance from the PropagationModule
-    m_pHFBandSimulation = propagationModule->getHFBandSimulation();
+    // One encode, sent unchanged to every receiver in the bucket that is still connected
+    QByteArray cache;
+    for (unsigned int session : sessions) {
+        ServerUser *receiver = qhUsers.value(session);
+        if (receiver) {
+            sendMessage(*receiver, packet, len, cache);
+        }
+    }
+}
+
+void Server::reportCWSkimmerResults(const QVector<CWSkimmer::Spot> &spots,
+                                    const QVector<CWSkimmer::SendingScore> &scores) {
+    // Runs on the main thread, queued from the DSP workers
+    for (const CWSkimmer::Spot &spot : spots) {
+        qDebug() << "CWSkimmer: Channel" << spot.channelId << "at" << spot.pitchHz << "Hz," << qRound(spot.wpm)
+                 << "WPM," << qRound(spot.snrDb) << "dB:" << spot.text;
+        emit cwSpotted(spot.channelId, spot.pitchHz, spot.wpm, spot.snrDb, spot.text);
+    }
     
-    if (!m_pHFBandSimulation) {
-        qWarning() << "Failed to get HFBandSimulation from PropagationModule. HF band simulation not initialized.";
+    if (scores.isEmpty()) {
         return;
     }
     
-    // Load propagation parameters from configuration
-    QSettings qs("mumble-server.ini", QSettings::IniFormat);
-    qs.beginGroup("hf_propagation");
+    UserStatisticsModule *statistics = m_moduleManager->getModuleAs<UserStatisticsModule>("UserStatistics");
+    if (!statistics) {
+        return;
+    }
     
-    // Check if HF band simulation is enabled
-    bool enabled = qs.value("enabled", true).toBool();
-    if (!enabled) {
-        qWarning() << "HF band simulation is disabled in configuration";
-        qs.endGroup();
+    // Recording only buffers the rows, so it stays on this thread and
+    // sendingScoreRecorded is emitted here; the module writes the CSV files
+    // on the pool
+    for (const CWSkimmer::SendingScore &score : scores) {
+        // The speaker may have disconnected while the frame was being decoded
+        ServerUser *user = qhUsers.value(score.session);
+        if (user) {
+            statistics->recordSendingScore(user->qsName, score.wpm, score.timingAccuracy, score.characters,
+                                           score.errors);
+        }
+    }
+}
+
+void Server::reportSchedulerStats() {
+    ThreadPool::Tenant *tenant = m_moduleManager ? m_moduleManager->tenant() : nullptr;
+    if (!tenant) {
+        return;
+    }
+    
+    // This server's share of the process-wide thread pool since the last report
+    const ThreadPool::Tenant::Stats stats = tenant->stats();
+    const quint64 tasks = stats.completed - m_reportedSchedulerStats.completed;
+    if (tasks > 0) {
+        qWarning() << "Server" << iServerNum << "thread pool usage:" << tasks << "tasks,"
+                   << (stats.busyNs - m_reportedSchedulerStats.busyNs) / 1000000 << "ms busy,"
+                   << (stats.deferred - m_reportedSchedulerStats.deferred) << "held back by the quota of"
+                   << stats.quota << "threads";
+    }
+    m_reportedSchedulerStats = stats;
+}
+
+void Server::reportDSPStats() {
+    if (!m_dspExecutor) {
         return;
     }
     
-    // Set external data source settings
-    bool useExternalData = qs.value("use_external_data", false).toBool();
-    m_pHFBandSimulation->setUseExternalData(useExternalData);
+    DSPExecutor::Stats stats = m_dspExecutor->stats();
     
-    if (useExternalData) {
-        // Set DXView.org data settings
-        bool useDXViewData = qs.value("use_dxview_data", false).toBool();
-        m_pHFBandSimulation->setUseDXViewData(useDXViewData);
-        
-        // Set SWPC data settings
-        bool useSWPCData = qs.value("use_swpc_data", false).toBool();
-        m_pHFBandSimulation->setUseSWPCData(useSWPCData);
-        
-        qWarning() << "HF band simulation using external data sources:"
-                  << "DXView.org:" << (useDXViewData ? "enabled" : "disabled")
-                  << "SWPC:" << (useSWPCData ? "enabled" : "disabled");
+    quint64 overruns = 0;
+    qint64 worstNs = 0;
+    QStringList loads;
+    for (const DSPExecutor::WorkerStats &worker : stats.workers) {
+        overruns += worker.overruns;
+        worstNs = qMax(worstNs, worker.worstProcessingNs);
+        loads << QString::number(worker.load * 100.0, 'f', 1) + "%";
+    }
+    
+    // Only report when something went wrong since the last report
+    if (overruns > m_reportedDSPOverruns || stats.rejected > m_reportedDSPRejected) {
+        qWarning() << "DSP frame deadline missed:" << (overruns - m_reportedDSPOverruns) << "overruns,"
+                   << (stats.rejected - m_reportedDSPRejected) << "dropped jobs, worst frame" << (worstNs / 1000)
+                   << "us, load" << loads.join(" ");
+    }
+    m_reportedDSPOverruns = overruns;
+    m_reportedDSPRejected = stats.rejected;
+}
+
+
+void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, AudioReceiverBuffer &buffer,
+                        Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder) {
+    // Simplified fan-out of a speaker's voice packet to the speaker's channel
+    // and to everyone listening to that channel. The caller holds the voice
+    // thread lock for reading.
+    if (!u || !u->cChannel) {
+        return;
     }
     
-    // Set solar flux index (default: 120)
-    int sfi = qs.value("solar_flux_index", 120).toInt();
-    m_pHFBandSimulation->setSolarFluxIndex(sfi);
+    static MetricCounter &packetsReceived =
+        MetricsRegistry::instance().counter("murmur_voice_packets_total", "Voice packets received");
+    static MetricCounter &packetsDropped = MetricsRegistry::instance().counter(
+        "murmur_voice_packets_dropped_total", "Voice packets dropped by a voice path hook");
+    static MetricCounter &packetsSent =
+        MetricsRegistry::instance().counter("murmur_voice_packets_sent_total", "Voice packets forwarded to receivers");
+    packetsReceived.increment();
+    const VoiceTrace trace = VoiceTracer::begin(VoiceTracer::Received);
+    
+    Channel *c = u->cChannel;
+    
+    // Modules compiled into the voice path may drop the packet
+    const VoicePacket voicePacket = { u, c, &audioData };
+    const bool accepted = m_voiceHooks.onPacket(voicePacket);
+    trace.stamp(VoiceTracer::Hooks);
+    if (!accepted) {
+        packetsDropped.increment();
+        return;
+    }
     
-    // Set K-index (default: 3)
-    int kIndex = qs.value("k_index", 3).toInt();
-    m_pHFBandSimulation->setKIndex(kIndex);
+    // On mixed band channels the frame is folded into the channel mix
+    // instead of being forwarded as a separate stream
+    if (m_bandMixer.isMixingEnabled(c->iId)) {
+        m_bandMixer.addSpeakerFrame(c->iId, u, audioData.data, audioData.size);
+        trace.stamp(VoiceTracer::MixInput);
+        return;
+    }
     
-    // Set season (0=Winter, 1=Spring, 2=Summer, 3=Fall, default: auto)
-    bool autoSeason = qs.value("auto_season", true).toBool();
-    if (autoSeason) {
-        m_pHFBandSimulation->setAutoTimeEnabled(true);
-    } else {
-        int season = qs.value("season", 0).toInt();
-        m_pHFBandSimulation->setSeason(season);
-        m_pHFBandSimulation->setAutoTimeEnabled(false);
+    buffer.removeReceivers(u);
+    foreach (ServerUser *receiver, qhUsers) {
+        if (receiver != u && receiver->cChannel == c && !receiver->bDeaf && !receiver->bSelfDeaf) {
+            VolumeAdjustment volume;
+            if (m_voiceHooks.onRoute(voicePacket, receiver, volume)) {
+                buffer.addReceiver(u, receiver, volume);
+            }
+        }
+    }
+    // Lock-free: the guard keeps the snapshot from being freed while it is read
+    m_channelListenerManager.snapshot()->forEachListener(
+        *c, [&](const ServerUser *listener, const VolumeAdjustment &adjustment) {
+            if (listener != u) {
+                VolumeAdjustment volume = adjustment;
+                if (m_voiceHooks.onRoute(voicePacket, listener, volume)) {
+                    buffer.addReceiver(u, const_cast<ServerUser *>(listener), volume);
+                }
+            }
+        });
+    
+    trace.stamp(VoiceTracer::Routed);
+    
+    audioData.senderSession = u->uiSession;
+    
+    Mumble::Protocol::byte packet[1024];
+    int len = encoder.encode(packet, sizeof(packet), audioData);
+    trace.stamp(VoiceTracer::Encoded);
+    if (len > 0) {
+        QByteArray cache;
+        const QHash<ServerUser *, VolumeAdjustment> receivers = buffer.getReceivers(u);
+        for (auto it = receivers.constBegin(); it != receivers.constEnd(); ++it) {
+            sendMessage(*it.key(), packet, len, cache);
+        }
+        packetsSent.increment(static_cast<quint64>(receivers.size()));
+        trace.stamp(VoiceTracer::Sent);
     }
     
-    // Set update interval (default: 30 minutes)
-    int updateInterval = qs.value("update_interval", 30).toInt();
-    QTimer *timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &Server::updateHFBandPropagation);
-    timer->start(updateInterval * 60 * 1000); // Convert minutes to milliseconds
+    buffer.removeReceivers(u);
+}
+
+void Server::processCWKeying(ServerUser *u, const unsigned char *data, int len) {
+    // Called from the UDP receive path for UDPMessageType::CWKeying packets
+    Mumble::Protocol::CWKeyingDecoder< Mumble::Protocol::Role::Server > decoder;
+    Mumble::Protocol::CWKeyingData keying;
+    
+    if (!u || !decoder.decode(data, len, keying)) {
+        return;
+    }
     
-    qs.endGroup();
+    handleCWKeying(u, keying);
+}
+
+void Server::msgCWKeying(ServerUser *u, MumbleProto::CWKeying &msg) {
+    // TCP form of the keying events, for clients without a working UDP path
+    Mumble::Protocol::CWKeyingData keying;
+    keying.sequence = static_cast<uint16_t>(msg.sequence);
+    keying.timestamp = msg.timestamp;
+    keying.pitchOffset = static_cast<int16_t>(qBound(-1000, msg.pitch_offset, 1000));
+    
+    for (uint32_t edge : msg.edges) {
+        if (keying.edges.size() >= Mumble::Protocol::CW_KEYING_MAX_EDGES) {
+            break;
+        }
+        keying.edges.append({ edge >> 1, (edge & 1) != 0 });
+    }
     
-    // Connect signals and slots for propagation updates
+    QReadLocker locker(&qrwlVoiceThread);
+    handleCWKeying(u, keying);
+}
+
+void Server::handleCWKeying(ServerUser *u, Mumble::Protocol::CWKeyingData &keying) {
+    // The caller holds the voice thread lock for reading
+    if (!u || !u->cChannel) {
+        return;
+    }
+    
+    Channel *c = u->cChannel;
+    keying.senderSession = u->uiSession;
+    
+    // On mixed band channels the tone is synthesized on the server and every
+    // receiver bucket hears it with its own gain, fading and noise
+    if (m_bandMixer.isMixingEnabled(c->iId)) {
+        m_cwSynthesizer.addKeying(c->iId, keying, m_bandMixer.sampleClock());
+        return;
+    }
+    
+    // Elsewhere the keying events are relayed as they are and the receiving
+    // clients synthesize the tone themselves
+    Mumble::Protocol::CWKeyingEncoder< Mumble::Protocol::Role::Server > encoder;
+    Mumble::Protocol::byte packet[1400];
+    int len = encoder.encode(packet, sizeof(packet), keying);
+    if (len <= 0) {
+        return;
+    }
+    
+    QByteArray cache;
+    foreach (ServerUser *receiver, qhUsers) {
+        if (receiver != u && receiver->cChannel == c && !receiver->bDeaf && !receiver->bSelfDeaf) {
+            sendMessage(*receiver, packet, len, cache);
+        }
+    }
+    m_channelListenerManager.snapshot()->forEachListener(
+        *c, [&](const ServerUser *listener, const VolumeAdjustment &) {
+            if (listener != u && listener->cChannel != c) {
+                sendMessage(*const_cast<ServerUser *>(listener), packet, len, cache);
+            }
+        });
+}
+
+void Server::sendMessage(ServerUser &u, const unsigned char *data, int len, QByteArray &cache, bool force) {
+    // In a real implementation, this would send the datagram to the user's UDP
+    // peer and only fall back to the TCP tunnel when UDP is unavailable (or force is set)
+    // For this simplified version, every packet goes through the TCP tunnel
+    Q_UNUSED(force);
+    
+    // The same packet is usually sent to many users, so build the QByteArray once
+    if (cache.isEmpty()) {
+        cache = QByteArray(reinterpret_cast<const char *>(data), len);
+    }
+    
+    emit tcpTransmit(cache, u.uiSession);
+}
+
+void Server::initializeHFBandSimulation(const ServerConfig::HFPropagation &propagation) {
+    // Get the PropagationModule from the ModuleManager
+    PropagationModule* propagationModule = static_cast<PropagationModule*>(
+        m_moduleManager->getModule("PropagationModule"));
+    
+    if (!propagationModule) {
+        qWarning() << "Failed to get PropagationModule from ModuleManager. HF band simulation not initialized.";
+        return;
+    }
+    
+    // Get the HFBandSimulation instance from the PropagationModule
+    m_pHFBandSimulation = propagationModule->getHFBandSimulation();
+    
+    if (!m_pHFBandSimulation) {
+        qWarning() << "Failed to get HFBandSimulation from PropagationModule. HF band simulation not initialized.";
+        return;
+    }
+    
+    // The PropagationModule applied the [hf_propagation] parameters to the
+    // simulation; the server only runs its own update timer
+    connect(&m_propagationTimer, &QTimer::timeout, this, &Server::updateHFBandPropagation);
+    
+    // Connect signals and slots for propagation updates, also while disabled,
+    // so a reload can enable the simulation
     connect(m_pHFBandSimulation, &HFBandSimulation::propagationUpdated, this, &Server::onPropagationUpdated);
     connect(m_pHFBandSimulation, &HFBandSimulation::signalStrengthChanged, this, &Server::onSignalStrengthChanged);
     connect(m_pHFBandSimulation, &HFBandSimulation::mufChanged, this, &Server::onMUFChanged);
     connect(m_pHFBandSimulation, &HFBandSimulation::externalDataUpdated, this, &Server::onExternalDataUpdated);
     
+    if (!startPropagationTimer(propagation)) {
+        return;
+    }
+    
     // Initial propagation update
     updateHFBandPropagation();
 }
 
+bool Server::startPropagationTimer(const ServerConfig::HFPropagation &propagation) {
+    if (!propagation.enabled) {
+        qWarning() << "HF band simulation is disabled in configuration";
+        m_propagationTimer.stop();
+        return false;
+    }
+    
+    m_propagationTimer.start(propagation.updateInterval * 60 * 1000); // Convert minutes to milliseconds
+    return true;
+}
+
 void Server::onPropagationUpdated() {
     // This method is called when propagation conditions change
     // Update the server state based on the new propagation conditions
@@ -243,6 +1017,8 @@ void Server::onPropagationUpdated() {
     // Log the update
     qWarning() << "HF Propagation updated:" << message;
     
+    m_moduleManager->publish(PropagationUpdatedEvent{ sfi, kIndex, season });
+    
     // Notify users of the updated propagation conditions
     foreach(ServerUser *u, qhUsers) {
         if (u->iId > 0) {
@@ -264,6 +1040,8 @@ void Server::onSignalStrengthChanged(const QString &grid1, const QString &grid2,
     // This method is called when the signal strength between two grid locators changes
     qWarning() << "Signal strength changed between" << grid1 << "and" << grid2 << ":" << strength;
     
+    m_moduleManager->publish(SignalStrengthChangedEvent{ grid1, grid2, strength });
+    
     // Find users with these grid locators and update their audio routing
     foreach(ServerUser *u1, qhUsers) {
         if (u1->iId > 0) {
@@ -287,6 +1065,8 @@ void Server::onMUFChanged(float muf) {
     // This method is called when the Maximum Usable Frequency changes
     qWarning() << "Maximum Usable Frequency changed:" << muf << "MHz";
     
+    m_moduleManager->publish(MufChangedEvent{ muf });
+    
     // Notify users of the MUF change
     QString message = QString("Maximum Usable Frequency changed: %1 MHz").arg(muf);
     
@@ -310,10 +1090,31 @@ void Server::sendMessage(ServerUser *u, const QString &message) {
 
 void Server::sendTextMessage(Channel *cChannel, ServerUser *pUser, bool tree, const QString &text) {
     // Implementation for sending text messages
-    Q_UNUSED(cChannel);
-    qWarning() << "Sending text message to" << (pUser ? pUser->qsName : "all users in channel") 
+    QList<ServerUser *> recipients;
+    if (pUser) {
+        recipients.append(pUser);
+    } else if (cChannel) {
+        // A channel tree is one range of positions in m_channelTree, so each
+        // user's channel is checked with a lookup and two comparisons instead
+        // of walking the tree. Users are not grouped by channel, so this is
+        // still one pass over all of them.
+        const int begin = m_channelTree.enter(cChannel->iId);
+        const int end = tree ? m_channelTree.exit(cChannel->iId) : begin + 1;
+        foreach (ServerUser *user, qhUsers) {
+            if (!user->cChannel) {
+                continue;
+            }
+            const int position = m_channelTree.enter(user->cChannel->iId);
+            if (begin >= 0 ? position >= begin && position < end : user->cChannel == cChannel) {
+                recipients.append(user);
+            }
+        }
+    }
+    
+    qWarning() << "Sending text message to" << (pUser ? pUser->qsName : "all users in channel")
               << ":" << text
-              << (tree ? "(including subchannels)" : "");
+              << (tree ? "(including subchannels)" : "")
+              << "-" << recipients.size() << "recipients";
     
     // In a real implementation, this would create and send a TextMessage
     // For this simplified version, we just log the message
@@ -360,6 +1161,37 @@ void Server::newClient() {
 void Server::connectionClosed(QAbstractSocket::SocketError error, const QString &errorString) {
     // Handle closed connection
     qWarning() << "Connection closed with error:" << errorString << "(" << error << ")";
+    // In a full implementation, this would look up the user of the connection and call removeUser()
+}
+
+void Server::removeUser(ServerUser *u) {
+    if (!u) {
+        return;
+    }
+    
+    {
+        QWriteLocker locker(&qrwlVoiceThread);
+        
+        // The mixer keeps decoders, queued frames and link gains per user;
+        // the voice thread must not meet the user in any of them again
+        m_bandMixer.removeUser(u);
+        m_cwSynthesizer.removeStation(static_cast<unsigned int>(u->uiSession));
+        m_channelListenerManager.clearListenedChannels(*u);
+        if (m_codePractice) {
+            m_codePractice->removeListener(static_cast<unsigned int>(u->uiSession));
+        }
+        
+        qhUsers.remove(static_cast<unsigned int>(u->uiSession));
+        for (auto it = qhPeerUsers.begin(); it != qhPeerUsers.end();) {
+            if (it.value() == u) {
+                it = qhPeerUsers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    emit userDisconnected(u);
 }
 
 void Server::sslError(const QList<QSslError> &errors) {
@@ -399,8 +1231,25 @@ void Server::encrypted() {
 }
 
 void Server::udpActivated(int socketDescriptor) {
-    // Handle UDP socket activation
-    qWarning() << "UDP socket activated on descriptor" << socketDescriptor;
+    // One datagram per activation; the notifier fires again while more are queued
+    Mumble::Protocol::byte buffer[UDP_PACKET_SIZE];
+    sockaddr_storage from;
+    socklen_t fromLength = sizeof(from);
+#ifdef Q_OS_WIN
+    const int len = ::recvfrom(static_cast<SOCKET>(socketDescriptor), reinterpret_cast<char *>(buffer),
+                               sizeof(buffer), 0, reinterpret_cast<sockaddr *>(&from), &fromLength);
+#else
+    const int len = static_cast<int>(::recvfrom(socketDescriptor, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                                reinterpret_cast<sockaddr *>(&from), &fromLength));
+#endif
+    if (len <= 0) {
+        return;
+    }
+    
+    const HostAddress peer{ QHostAddress(reinterpret_cast<const sockaddr *>(&from)) };
+    const quint16 port = ntohs(from.ss_family == AF_INET6 ? reinterpret_cast<const sockaddr_in6 *>(&from)->sin6_port
+                                                          : reinterpret_cast<const sockaddr_in *>(&from)->sin_port);
+    processDatagram(buffer, len, peer, port);
 }
 
 void Server::customEvent(QEvent *evt) {
@@ -411,15 +1260,84 @@ void Server::customEvent(QEvent *evt) {
     }
 }
 
+void Server::startThread() {
+    if (!isRunning()) {
+        // Set here rather than in run(), so a stopThread() right after this
+        // cannot be overwritten by a thread that has not started yet
+        bRunning = true;
+        start(QThread::HighestPriority);
+    }
+}
+
+void Server::stopThread() {
+    bRunning = false;
+    wait();
+}
+
 void Server::run() {
     // Main server thread loop
     qWarning() << "Server thread starting";
-    bRunning = true;
+    
+    // Keep the voice thread on the node of the DSP workers it feeds
+    const QVector<int> voiceCpus = ThreadPlacement::current().voiceCpusOf(iServerNum);
+    if (!CpuTopology::pinCurrentThread(voiceCpus)) {
+        qWarning() << "Server: Failed to pin the voice thread to CPUs" << CpuTopology::formatCpuList(voiceCpus);
+    }
+    
+    QElapsedTimer clock;
+    clock.start();
+    qint64 nextMix = 0;
+    qint64 nextDSPReport = 60000;
+    
+    MetricsRegistry &metrics = MetricsRegistry::instance();
+    MetricHistogram &frameDuration = metrics.histogram(
+        "murmur_voice_frame_duration_seconds", "Time the voice thread spent flushing one 20 ms frame");
+    MetricCounter &frameOverruns =
+        metrics.counter("murmur_voice_frame_overruns_total", "20 ms frames the voice thread flushed late");
     
     while (bRunning) {
         // In a real implementation, this would process incoming connections and messages
-        // For this simplified version, we'll just sleep
-        QThread::msleep(100);
+        
+        // Propagation updates change link gains from the thread pool. They
+        // reach the mixer and the voice hooks here, never by stalling the
+        // frame: if a reader is busy, the next pass tries again.
+        if (m_bandMixer.linksChanged() && qrwlVoiceThread.tryLockForWrite()) {
+            m_bandMixer.publishLinks();
+            qrwlVoiceThread.unlock();
+        }
+        
+        if (clock.elapsed() >= nextDSPReport) {
+            reportDSPStats();
+            reportSchedulerStats();
+            nextDSPReport += 60000;
+        }
+        
+        const bool mixing = m_bandMixer.hasMixedChannels();
+        if (mixing || m_codePractice) {
+            // Mixed band channels and practice broadcasts are flushed once per 20 ms frame
+            const std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+            if (mixing) {
+                flushBandMixes();
+            }
+            if (m_codePractice) {
+                flushCodePractice();
+            }
+            frameDuration.recordSince(frameStart);
+            
+            nextMix += 20;
+            qint64 wait = nextMix - clock.elapsed();
+            if (wait > 0) {
+                QThread::msleep(static_cast<unsigned long>(wait));
+            } else {
+                // Overran a frame, resynchronize instead of bursting
+                frameOverruns.increment();
+                nextMix = clock.elapsed();
+            }
+        } else {
+            // For this simplified version, we'll just sleep
+            QThread::msleep(100);
+            nextMix = clock.elapsed();
+        }
     }
     
     qWarning() << "Server thread exiting";
@@ -486,6 +1404,8 @@ void Server::userStateChanged(ServerUser *u) {
     // This method is called when a user's state changes
     // Update the user's state and notify other users as needed
     
+    m_moduleManager->publish(UserStateChangedEvent{ static_cast<unsigned int>(u->uiSession), u });
+    
     // Check if the user has a grid locator in their metadata
     QString grid = u->qmUserData.value("maidenheadgrid", "");
     if (!grid.isEmpty()) {
@@ -497,12 +1417,11 @@ void Server::userStateChanged(ServerUser *u) {
             return;
         }
         
-        // User has a valid grid locator, update propagation
+        // User has a valid grid locator, update propagation. The band
+        // recommendations come from the PropagationModule, which gets the
+        // UserStateChangedEvent published above.
         qWarning() << "User" << u->qsName << "has grid locator:" << grid;
         
-        // Send band recommendations to the user
-        sendBandRecommendations(u, grid);
-        
         // Update audio routing for this user with all other users
         foreach(ServerUser *other, qhUsers) {
             if (other->iId > 0 && other != u) {
@@ -545,49 +1464,38 @@ void Server::updateHFBandPropagation() {
         return;
     }
     
+    // A recompute still running from the previous update is out of date;
+    // stop it before the propagation model changes underneath it
+    cancelRoutingUpdate();
+    
     // Update the HF band simulation
     m_pHFBandSimulation->updatePropagation();
     
-    // Get the list of users with valid IDs
-    QList<ServerUser*> users;
+    // Get the sessions of users with valid IDs. The recompute looks the users
+    // up again, so it never touches one that disconnected in the meantime.
+    QVector<unsigned int> sessions;
     foreach(ServerUser *u, qhUsers) {
         if (u->iId > 0) {
-            users.append(u);
-        }
-    }
-    
-    // Process audio routing in parallel using the ModuleManager's thread pool
-    if (users.size() > 1 && m_moduleManager && m_moduleManager->threadPool()) {
-        qWarning() << "Using thread pool for parallel audio routing updates across" 
-                  << m_moduleManager->threadPool()->threadCount() << "cores";
-        
-        // Create a task for each user pair
-        std::vector<std::future<void>> futures;
-        futures.reserve(users.size() * (users.size() - 1) / 2);
-        
-        // For each user pair, create a task to update audio routing
-        for (int i = 0; i < users.size(); ++i) {
-            for (int j = i + 1; j < users.size(); ++j) {
-                ServerUser *u1 = users[i];
-                ServerUser *u2 = users[j];
-                
-                // Create a task that captures the user pair
-                auto task = [this, u1, u2]() {
-                    updateAudioRouting(u1, u2);
-                    updateAudioRouting(u2, u1);
-                };
-                
-                // Enqueue the task
-                futures.push_back(m_moduleManager->threadPool()->enqueue(task));
-            }
+            sessions.append(u->uiSession);
         }
+    }
+    
+    ThreadPool *pool = m_moduleManager ? m_moduleManager->threadPool() : nullptr;
+    if (sessions.size() > 1 && pool) {
+        qWarning() << "Scheduling background audio routing updates across" 
+                  << pool->threadCount() << "cores";
         
-        // Wait for all tasks to complete
-        for (auto& future : futures) {
-            future.wait();
+        // Row i pairs user i with every later user, one task per row. The
+        // main thread does not wait; the next update cancels what is left.
+        std::unique_ptr<TaskGroup> group(new TaskGroup(pool, ThreadPool::Priority::Background));
+        const std::shared_ptr<const QVector<unsigned int>> rows =
+            std::make_shared<const QVector<unsigned int>>(std::move(sessions));
+        const CancellationToken token = group->token();
+        ThreadPool::TenantScope scope(m_moduleManager->tenant());
+        for (int i = 0; i < rows->size() - 1; ++i) {
+            group->run([this, rows, i, token]() { updateAudioRoutingRow(*rows, i, token); });
         }
-        
-        qWarning() << "Parallel audio routing updates completed";
+        m_routingUpdate = std::move(group);
     } else {
         // Fall back to sequential processing if thread pool is not available
         qWarning() << "Using sequential audio routing updates";
@@ -603,6 +1511,49 @@ void Server::updateHFBandPropagation() {
             }
         }
     }
+    
+    updateCodePracticeReception();
+}
+
+void Server::updateAudioRoutingRow(const QVector<unsigned int> &sessions, int row, const CancellationToken &token) {
+    // Runs on the module thread pool
+    QReadLocker locker(&qrwlVoiceThread);
+    
+    ServerUser *u1 = qhUsers.value(sessions[row]);
+    if (!u1) {
+        return;
+    }
+    
+    for (int j = row + 1; j < sessions.size(); ++j) {
+        // A superseded recompute stops at the next pair
+        if (token.isCancelled()) {
+            return;
+        }
+        
+        ServerUser *u2 = qhUsers.value(sessions[j]);
+        if (u2) {
+            updateAudioRouting(u1, u2);
+            updateAudioRouting(u2, u1);
+        }
+    }
+}
+
+void Server::cancelRoutingUpdate() {
+    if (!m_routingUpdate) {
+        return;
+    }
+    
+    // Rows that have not started are dropped and running rows stop at their
+    // next pair, so this only waits for the pairs in flight
+    m_routingUpdate->cancel();
+    try {
+        m_routingUpdate->wait();
+    } catch (const std::exception &e) {
+        qWarning() << "Server: Audio routing update failed:" << e.what();
+    } catch (...) {
+        qWarning() << "Server: Audio routing update failed";
+    }
+    m_routingUpdate.reset();
 }
 
 void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
@@ -629,11 +1580,9 @@ void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
         m_pHFBandSimulation->getFadingEffects(signalQuality, packetLoss, jitter, noiseFactor);
         
         // Log the audio routing update with detailed signal metrics
-        qWarning() << "Audio routing between" << u1->qsName << "and" << u2->qsName
-                  << ": Signal quality:" << signalQuality 
-                  << ", Packet loss:" << packetLoss * 100.0f << "%"
-                  << ", Jitter:" << jitter
-                  << ", Noise:" << noiseFactor;
+        HOT_LOG_INFO("Server: Audio routing", { "from", u1->qsName }, { "to", u2->qsName },
+                     { "quality", signalQuality }, { "loss_pct", packetLoss * 100.0f }, { "jitter", jitter },
+                     { "noise", noiseFactor });
         
         // Apply graduated audio degradation effects
         // In a real implementation, this would modify audio packets in the transmission pipeline
@@ -641,10 +1590,16 @@ void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
         // 1. Determine if we should block audio completely (very poor signal)
         bool blockAudio = (signalQuality < 0.05f);
         
+        // The signal quality doubles as the link gain on mixed band channels,
+        // where fading and noise are rendered into the mix. The mixer produces
+        // the fading itself, so it takes the depth, not the current level.
+        m_bandMixer.setLinkGain(u1->uiSession, u2->uiSession, blockAudio ? 0.0f : signalQuality);
+        m_bandMixer.setLinkImpairments(u1->uiSession, u2->uiSession,
+                                       m_pHFBandSimulation->getFadingDepth(signalQuality), noiseFactor);
+        
         if (blockAudio) {
             // Signal too weak for any communication
-            qWarning() << "Signal too weak, blocking audio between" 
-                      << u1->qsName << "and" << u2->qsName;
+            HOT_LOG_INFO("Server: Signal too weak, blocking audio", { "from", u1->qsName }, { "to", u2->qsName });
             
             // In a real implementation, this would prevent audio packets from being transmitted
             return;
@@ -654,8 +1609,7 @@ void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
         bool applyPacketLoss = (QRandomGenerator::global()->generateDouble() < packetLoss);
         if (applyPacketLoss) {
             // Randomly drop this audio update to simulate fading
-            qWarning() << "Simulating packet loss between" 
-                      << u1->qsName << "and" << u2->qsName;
+            HOT_LOG_DEBUG("Server: Simulating packet loss", { "from", u1->qsName }, { "to", u2->qsName });
             
             // In a real implementation, this would randomly drop audio packets
             // For now, we just simulate the behavior
@@ -663,9 +1617,8 @@ void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
         
         // 3. Apply noise to the audio signal
         if (noiseFactor > 0.1f) {
-            qWarning() << "Adding" << noiseFactor * 100.0f 
-                      << "% noise to audio between"
-                      << u1->qsName << "and" << u2->qsName;
+            HOT_LOG_DEBUG("Server: Adding noise", { "from", u1->qsName }, { "to", u2->qsName },
+                          { "noise_pct", noiseFactor * 100.0f });
             
             // In a real implementation, this would add white noise to audio samples
             // The intensity would be proportional to the noise factor
@@ -673,9 +1626,8 @@ void Server::updateAudioRouting(ServerUser *u1, ServerUser *u2) {
         
         // 4. Apply jitter effects (timing variations)
         if (jitter > 0.2f) {
-            qWarning() << "Adding jitter factor" << jitter 
-                      << " to audio between"
-                      << u1->qsName << "and" << u2->qsName;
+            HOT_LOG_DEBUG("Server: Adding jitter", { "from", u1->qsName }, { "to", u2->qsName },
+                          { "jitter", jitter });
             
             // In a real implementation, this would vary packet timing
             // and potentially reorder packets to simulate propagation variations
@@ -731,72 +1683,64 @@ void Server::updateChannelLinks() {
     }
     qWarning() << "Open bands based on propagation:" << openBandsStr;
     
+    m_moduleManager->publish(OpenBandsChangedEvent{ openBands });
+    
     // Process channel updates in parallel if thread pool is available
     if (m_moduleManager && m_moduleManager->threadPool()) {
         qWarning() << "Using thread pool for parallel channel link updates";
         
-        // Get all channels
-        QList<Channel*> channels = qhChannels.values();
-        
-        // Create a task for each channel
-        std::vector<std::future<void>> futures;
-        futures.reserve(channels.size());
-        
-        // For each channel, create a task to update its links
-        for (Channel* channel : channels) {
-            // Get the channel's band (if it represents a band)
+        // Collect the channels that represent a band
+        QVector<QPair<Channel*, int>> bandChannels;
+        foreach (Channel* channel, qhChannels) {
             bool ok;
             int band = channel->qsName.toInt(&ok);
-            
             if (ok) {
-                // Create a task that updates this channel's links
-                auto task = [this, channel, band, openBands]() {
-                    // Check if this band is open
-                    bool isOpen = openBands.contains(band);
-                    
-                    // Get current links
-                    QSet<Channel*> currentLinks;
-                    foreach (int linkedId, channel->qsPermLinks) {
-                        Channel* linked = qhChannels.value(linkedId);
-                        if (linked) {
-                            currentLinks.insert(linked);
-                        }
-                    }
-                    
-                    // Determine desired links based on propagation
-                    QSet<Channel*> desiredLinks;
-                    
-                    // Link open bands together
-                    if (isOpen) {
-                        foreach (int openBand, openBands) {
-                            if (band != openBand) {
-                                foreach (Channel* c, qhChannels.values()) {
-                                    bool cOk;
-                                    int cBand = c->qsName.toInt(&cOk);
-                                    if (cOk && cBand == openBand) {
-                                        desiredLinks.insert(c);
-                                    }
-                                }
+                bandChannels.append(qMakePair(channel, band));
+            }
+        }
+        
+        // Update each band channel's links; one chunk per channel
+        ThreadPool::TenantScope scope(m_moduleManager->tenant());
+        m_moduleManager->threadPool()->parallelFor(0, bandChannels.size(), 1, [this, &bandChannels, &openBands](int index) {
+            Channel* channel = bandChannels[index].first;
+            int band = bandChannels[index].second;
+            
+            // Check if this band is open
+            bool isOpen = openBands.contains(band);
+            
+            // Get current links
+            QSet<Channel*> currentLinks;
+            foreach (int linkedId, channel->qsPermLinks) {
+                Channel* linked = qhChannels.value(linkedId);
+                if (linked) {
+                    currentLinks.insert(linked);
+                }
+            }
+            
+            // Determine desired links based on propagation
+            QSet<Channel*> desiredLinks;
+            
+            // Link open bands together
+            if (isOpen) {
+                foreach (int openBand, openBands) {
+                    if (band != openBand) {
+                        foreach (Channel* c, qhChannels.values()) {
+                            bool cOk;
+                            int cBand = c->qsName.toInt(&cOk);
+                            if (cOk && cBand == openBand) {
+                                desiredLinks.insert(c);
                             }
                         }
                     }
-                    
-                    // Update links if necessary
-                    if (currentLinks != desiredLinks) {
-                        // In a real implementation, this would update the channel links
-                        qWarning() << "Updating links for band" << band << "channel";
-                    }
-                };
-                
-                // Enqueue the task
-                futures.push_back(m_moduleManager->threadPool()->enqueue(task));
+                }
             }
-        }
-        
-        // Wait for all tasks to complete
-        for (auto& future : futures) {
-            future.wait();
-        }
+            
+            // Update links if necessary
+            if (currentLinks != desiredLinks) {
+                // In a real implementation, this would update the channel links
+                qWarning() << "Updating links for band" << band << "channel";
+            }
+        });
         
         qWarning() << "Parallel channel link updates completed";
     } else {
@@ -816,8 +1760,8 @@ void Server::sendBandRecommendations(ServerUser *u, const QString &grid) {
         return;
     }
     
-    // Get current time
-    QDateTime now = QDateTime::currentDateTime();
+    // Get the current simulation time
+    QDateTime now = CoarseClock::instance().simulation();
     bool isDaytime = m_pHFBandSimulation->calculateSolarZenithAngle(grid, now) < 90.0f;
     
     // Create a message with band recommendations
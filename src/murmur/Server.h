@@ -15,16 +15,27 @@
 #include "ACL.h"
 #include "AudioReceiverBuffer.h"
 #include "Ban.h"
+#include "BandMixer.h"
+#include "CWFrameCache.h"
+#include "CWSkimmer.h"
+#include "CWSynthesizer.h"
+#include "CodePracticeBroadcaster.h"
 #include "ChannelListenerManager.h"
+#include "ChannelTree.h"
 #include "DBWrapper.h"
+#include "DSPExecutor.h"
 #include "HostAddress.h"
 #include "Mumble.pb.h"
 #include "MumbleMessages.h"
 #include "MumbleProtocol.h"
+#include "PacketCapture.h"
 #include "QtUtils.h"
+#include "ServerConfig.h"
+#include "TaskGroup.h"
 #include "Timer.h"
 #include "User.h"
 #include "Version.h"
+#include "VoiceHooks.h"
 #include "VolumeAdjustment.h"
 #include "WhisperTarget.h"
 #include "gsl.h"
@@ -58,7 +69,10 @@
 #	include <winsock2.h>
 #endif
 
+#include <atomic>
+#include <memory>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 // Modular architecture
@@ -118,8 +132,6 @@ protected:
 #ifdef USE_ZEROCONF
 	Zeroconf *zeroconf;
 #endif
-	void startThread();
-	void stopThread();
 
 	void customEvent(QEvent *evt);
 	// Former ServerParams
@@ -207,6 +219,9 @@ public:
 	// This will be managed by the PropagationModule
 	HFBandSimulation *m_pHFBandSimulation;
 
+	// The band mixer's link gains double as the propagation routing table
+	const BandMixer &bandMixer() const { return m_bandMixer; }
+
 	gsl::span< const Mumble::Protocol::byte >
 		handlePing(const Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > &decoder,
 				   Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > &encoder, bool expectExtended);
@@ -236,6 +251,71 @@ private:
 	AudioReceiverBuffer m_udpAudioReceivers;
 	AudioReceiverBuffer m_tcpAudioReceivers;
 
+	// Server-side mixing of band channels, owned by the voice thread
+	BandMixer m_bandMixer;
+
+	// Module hooks compiled into processMsg(), bound once the modules are up
+	ServerVoiceHooks m_voiceHooks;
+
+	// Recording of the received datagrams, see [packet_capture]. The voice
+	// thread only takes the mutex while m_capturing is set.
+	QMutex m_captureMutex;
+	std::unique_ptr< PacketCapture > m_capture;
+	std::atomic< bool > m_capturing{ false };
+	void captureDatagram(const ServerUser *u, const HostAddress &peer, quint16 port,
+						 const Mumble::Protocol::byte *data, int len);
+
+	// Tone synthesis for CW stations that send keying events instead of audio
+	CWSynthesizer m_cwSynthesizer;
+
+	// Morse decoders for mixed channels. The map is fixed after initialization;
+	// each skimmer is only used by the DSP worker of its channel, quietFrames
+	// only by the voice thread.
+	struct ChannelSkimmer {
+		std::unique_ptr< CWSkimmer > skimmer;
+		int quietFrames = 0;
+	};
+	std::unordered_map< int, ChannelSkimmer > m_cwSkimmers;
+
+	// Pre-encoded CW characters for server-originated practice streams. Null
+	// when code practice is not configured.
+	std::unique_ptr< CWFrameCache > m_cwFrameCache;
+	QString m_cwFrameCachePath;
+
+	// Scheduled practice broadcasts played from the frame cache. Null when no
+	// schedule is configured. Listeners the station's signal does not reach
+	// (see station_grid) are left out.
+	std::unique_ptr< CodePracticeBroadcaster > m_codePractice;
+	QString m_codePracticeStationGrid;
+
+	// The stream of each practice channel, sent as its own virtual session.
+	// Only used on the voice thread.
+	struct PracticeStream {
+		unsigned int session;
+		quint64 nextFrame;
+	};
+	QHash< int, PracticeStream > m_practiceStreams;
+
+	// Dedicated workers for real-time audio processing, fed by the voice thread.
+	// Null when DSP work runs inline on the voice thread.
+	std::unique_ptr< DSPExecutor > m_dspExecutor;
+	quint64 m_reportedDSPOverruns = 0;
+	quint64 m_reportedDSPRejected = 0;
+
+	// Counters of this server's tenant on the shared thread pool at the last report
+	ThreadPool::Tenant::Stats m_reportedSchedulerStats = {};
+
+	// The audio routing recompute started by the last propagation update. It
+	// runs at background priority without blocking the main thread and is
+	// cancelled when the next update supersedes it. Null when none was started.
+	std::unique_ptr< TaskGroup > m_routingUpdate;
+
+	// The configuration snapshot the subsystems were last set up from
+	std::shared_ptr< const ServerConfig > m_config;
+
+	// Periodic propagation updates; the interval is update_interval
+	QTimer m_propagationTimer;
+
 public slots:
 	void regSslError(const QList< QSslError > &);
 	void finished();
@@ -266,6 +346,7 @@ signals:
 	void reqSync(unsigned int);
 	void tcpTransmit(QByteArray, unsigned int id);
 	void signalQualityChanged(unsigned int userSession1, unsigned int userSession2, float quality);
+	void cwSpotted(int channelId, float pitchHz, float wpm, float snrDb, const QString &text);
 
 public:
 	unsigned int iServerNum;
@@ -332,6 +413,8 @@ public:
 	QHash< QPair< HostAddress, quint16 >, ServerUser * > qhPeerUsers;
 	QHash< HostAddress, QSet< ServerUser * > > qhHostUsers;
 	QHash< unsigned int, Channel * > qhChannels;
+	/// The hierarchy of qhChannels, by channel ID
+	ChannelTree m_channelTree;
 
 	QMutex qmCache;
 	ChanACL::ACLCache acCache;
@@ -344,8 +427,10 @@ public:
 	DBWrapper m_dbWrapper;
 
 	void addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, ServerUser &user, const Channel &channel);
+	/// Requires qrwlVoiceThread to be locked for reading, as processDatagram() does.
 	void processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, AudioReceiverBuffer &buffer,
 					Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder);
+	void processDatagram(const Mumble::Protocol::byte *data, int len, const HostAddress &peer, quint16 port);
 	void sendMessage(ServerUser &u, const unsigned char *data, int len, QByteArray &cache, bool force = false);
 	void run();
 
@@ -406,6 +491,10 @@ public:
 
 	bool canNest(Channel *newParent, Channel *channel = nullptr) const;
 
+	/// Forget a user that left: its session, listened channels and the voice state kept for it. Takes the voice
+	/// thread write lock; the caller deletes the user afterwards.
+	void removeUser(ServerUser *u);
+
 	/// @return UserID of authenticated user, -1 for authentication failures, -2 for unknown user (fallthrough),
 	///         -3 for authentication failures where the data could (temporarily) not be verified.
 	int authenticate(QString &name, const QString &password, int sessionId = 0, const QStringList &emails = {},
@@ -460,11 +549,39 @@ public:
 
 	// Initialization methods
 	void initialize();
+
+	/// Start the voice thread, which flushes the 20 ms mixed and practice frames
+	void startThread();
+	/// Stop the voice thread and wait for it to finish
+	void stopThread();
+
+	void applyConfig(std::shared_ptr< const ServerConfig > config);
 	void registerModules();
-	void setupChannels(QSettings &qs);
+	void setupChannels(const ServerConfig::Channels &channels);
+	void initializeBandMixing(const ServerConfig::AudioMixing &mixing);
+	void applyMixingLevels(const ServerConfig::AudioMixing &mixing);
+	void initializeDSPExecutor(const ServerConfig::Performance &performance);
+	void initializeCodePractice(const ServerConfig::CodePractice &practice);
+	void setPacketCapture(const ServerConfig::PacketCapture &capture);
+	CWFrameCache *cwFrameCache() const { return m_cwFrameCache.get(); }
+	void flushBandMixes();
+	void flushCodePractice();
+	void updateCodePracticeReception();
+	/// Send one frame of a server-generated stream. An empty last frame only ends the stream for the receivers.
+	void sendMixedFrame(unsigned int streamSession, quint64 frameNumber, const QVector< unsigned int > &sessions,
+						const QByteArray &frame, bool lastFrame = false);
+	void reportCWSkimmerResults(const QVector< CWSkimmer::Spot > &spots,
+								const QVector< CWSkimmer::SendingScore > &scores);
+	/// Both require qrwlVoiceThread to be locked for reading.
+	void processCWKeying(ServerUser *u, const unsigned char *data, int len);
+	void handleCWKeying(ServerUser *u, Mumble::Protocol::CWKeyingData &keying);
+	void reportDSPStats();
+	void reportSchedulerStats();
+	DSPExecutor *dspExecutor() const { return m_dspExecutor.get(); }
 	
 	// SuperMorse HF Band Simulation Methods
-	void initializeHFBandSimulation();
+	void initializeHFBandSimulation(const ServerConfig::HFPropagation &propagation);
+	bool startPropagationTimer(const ServerConfig::HFPropagation &propagation);
 	void updateHFBandPropagation();
 	float calculatePropagation(ServerUser *user1, ServerUser *user2);
 	bool canCommunicate(ServerUser *user1, ServerUser *user2);
@@ -479,6 +596,8 @@ public:
 	
 	// HF Band Simulation Helpers
 	void updateAudioRouting(ServerUser *u1, ServerUser *u2);
+	void updateAudioRoutingRow(const QVector< unsigned int > &sessions, int row, const CancellationToken &token);
+	void cancelRoutingUpdate();
 	void updateChannelLinks();
 	void sendBandRecommendations(ServerUser *u, const QString &grid);
 	void sendMessage(ServerUser *u, const QString &message);
@@ -0,0 +1,263 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ServerConfig.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+
+#include <atomic>
+
+namespace {
+    // The snapshot in effect; only accessed through the atomic shared_ptr
+    // functions, so readers never see a half-swapped pointer
+    std::shared_ptr<const ServerConfig> s_current;
+
+    // Reads a list of channel IDs. QSettings returns an unquoted
+    // comma-separated value as a string list and a quoted one as a string,
+    // so both are split here.
+    QList<int> readIdList(QSettings &qs, const QString &key) {
+        QList<int> ids;
+        const QStringList values = qs.value(key).toStringList();
+        for (const QString &value : values) {
+            for (const QString &part : value.split(',', Qt::SkipEmptyParts)) {
+                bool ok;
+                const int id = part.trimmed().toInt(&ok);
+                if (ok) {
+                    ids.append(id);
+                }
+            }
+        }
+        return ids;
+    }
+} // namespace
+
+bool ServerConfig::Channels::operator==(const Channels &other) const {
+    return names == other.names && parents == other.parents && links == other.links
+           && descriptions == other.descriptions;
+}
+
+bool ServerConfig::AudioMixing::operator==(const AudioMixing &other) const {
+    return enabled == other.enabled && gainStepDb == other.gainStepDb && minGain == other.minGain
+           && cwPitch == other.cwPitch && cwRiseTimeMs == other.cwRiseTimeMs
+           && cwJitterBufferMs == other.cwJitterBufferMs && channels == other.channels && cwSkimmer == other.cwSkimmer;
+}
+
+bool ServerConfig::Performance::operator==(const Performance &other) const {
+    return multiCore == other.multiCore && dspThreads == other.dspThreads && dspRealtime == other.dspRealtime
+           && placement == other.placement;
+}
+
+bool ServerConfig::CodePractice::operator==(const CodePractice &other) const {
+    return enabled == other.enabled && frameCache == other.frameCache && riseTimeMs == other.riseTimeMs
+           && bitrate == other.bitrate && schedule == other.schedule && pitch == other.pitch
+           && stationGrid == other.stationGrid;
+}
+
+bool ServerConfig::HFPropagation::operator==(const HFPropagation &other) const {
+    return enabled == other.enabled && useExternalData == other.useExternalData
+           && useDXViewData == other.useDXViewData && useSWPCData == other.useSWPCData
+           && solarFluxIndex == other.solarFluxIndex && kIndex == other.kIndex && autoSeason == other.autoSeason
+           && season == other.season && updateInterval == other.updateInterval
+           && simulationOffset == other.simulationOffset && simulationRate == other.simulationRate;
+}
+
+bool ServerConfig::Metrics::operator==(const Metrics &other) const {
+    return enabled == other.enabled && bind == other.bind && port == other.port && dumpFile == other.dumpFile
+           && dumpInterval == other.dumpInterval;
+}
+
+bool ServerConfig::VoiceTracing::operator==(const VoiceTracing &other) const {
+    return sampleEvery == other.sampleEvery && file == other.file && format == other.format
+           && interval == other.interval;
+}
+
+bool ServerConfig::PacketCapture::operator==(const PacketCapture &other) const {
+    return file == other.file && maxSize == other.maxSize;
+}
+
+ServerConfig::ServerConfig() = default;
+
+std::shared_ptr<const ServerConfig> ServerConfig::load(const QString &path) {
+    QSettings qs(path, QSettings::IniFormat);
+    if (qs.status() != QSettings::NoError) {
+        qWarning() << "ServerConfig: Cannot parse" << path;
+        return nullptr;
+    }
+
+    std::shared_ptr<ServerConfig> config = std::make_shared<ServerConfig>();
+    config->m_path = path;
+    config->readChannels(qs);
+    config->readAudioMixing(qs);
+    config->readPerformance(qs);
+    config->readCodePractice(qs);
+    config->readHFPropagation(qs);
+    config->readMetrics(qs);
+    config->readVoiceTracing(qs);
+    config->readPacketCapture(qs);
+
+    return config;
+}
+
+std::shared_ptr<const ServerConfig> ServerConfig::current() {
+    std::shared_ptr<const ServerConfig> config = std::atomic_load(&s_current);
+    if (!config) {
+        static const std::shared_ptr<const ServerConfig> defaults = std::make_shared<ServerConfig>();
+        return defaults;
+    }
+    return config;
+}
+
+void ServerConfig::setCurrent(std::shared_ptr<const ServerConfig> config) {
+    std::atomic_store(&s_current, std::move(config));
+}
+
+ServerConfig::Sections ServerConfig::diff(const ServerConfig &other) const {
+    Sections changed = NoSection;
+    if (m_channels != other.m_channels) {
+        changed |= ChannelsSection;
+    }
+    if (m_audioMixing != other.m_audioMixing) {
+        changed |= AudioMixingSection;
+    }
+    if (m_performance != other.m_performance) {
+        changed |= PerformanceSection;
+    }
+    if (m_codePractice != other.m_codePractice) {
+        changed |= CodePracticeSection;
+    }
+    if (m_hfPropagation != other.m_hfPropagation) {
+        changed |= HFPropagationSection;
+    }
+    if (m_metrics != other.m_metrics) {
+        changed |= MetricsSection;
+    }
+    if (m_voiceTracing != other.m_voiceTracing) {
+        changed |= VoiceTraceSection;
+    }
+    if (m_packetCapture != other.m_packetCapture) {
+        changed |= PacketCaptureSection;
+    }
+    return changed;
+}
+
+void ServerConfig::readChannels(QSettings &qs) {
+    qs.beginGroup("channels");
+    for (const QString &key : qs.childKeys()) {
+        m_channels.names.insert(key.toInt(), qs.value(key).toString());
+    }
+    qs.endGroup();
+
+    qs.beginGroup("channel_parent");
+    for (const QString &key : qs.childKeys()) {
+        m_channels.parents.insert(key.toInt(), qs.value(key).toInt());
+    }
+    qs.endGroup();
+
+    qs.beginGroup("channel_links");
+    for (const QString &key : qs.childKeys()) {
+        m_channels.links.insert(key.toInt(), readIdList(qs, key));
+    }
+    qs.endGroup();
+
+    qs.beginGroup("channel_description");
+    for (const QString &key : qs.childKeys()) {
+        m_channels.descriptions.insert(key.toInt(), qs.value(key).toString());
+    }
+    qs.endGroup();
+}
+
+void ServerConfig::readAudioMixing(QSettings &qs) {
+    AudioMixing &mixing = m_audioMixing;
+
+    qs.beginGroup("audio_mixing");
+    mixing.enabled = qs.value("enabled", mixing.enabled).toBool();
+    mixing.gainStepDb = qs.value("gain_step_db", mixing.gainStepDb).toFloat();
+    mixing.minGain = qs.value("min_gain", mixing.minGain).toFloat();
+    mixing.cwPitch = qs.value("cw_pitch", mixing.cwPitch).toFloat();
+    mixing.cwRiseTimeMs = qs.value("cw_rise_time_ms", mixing.cwRiseTimeMs).toFloat();
+    mixing.cwJitterBufferMs = qs.value("cw_jitter_buffer_ms", mixing.cwJitterBufferMs).toFloat();
+    mixing.channels = readIdList(qs, "channels");
+    mixing.cwSkimmer = qs.value("cw_skimmer", mixing.cwSkimmer).toBool();
+    qs.endGroup();
+}
+
+void ServerConfig::readPerformance(QSettings &qs) {
+    Performance &performance = m_performance;
+
+    qs.beginGroup("performance");
+    performance.multiCore = qs.value("enable_multi_core", performance.multiCore).toBool();
+    performance.dspThreads = qs.value("dsp_threads", performance.dspThreads).toInt();
+    performance.dspRealtime = qs.value("dsp_realtime", performance.dspRealtime).toBool();
+    qs.endGroup();
+
+    // Reads the same section for the CPU lists and the pool size
+    performance.placement = ThreadPlacement::fromSettings(qs);
+}
+
+void ServerConfig::readCodePractice(QSettings &qs) {
+    CodePractice &practice = m_codePractice;
+
+    qs.beginGroup("code_practice");
+    practice.enabled = qs.value("enabled", practice.enabled).toBool();
+    practice.frameCache = qs.value("frame_cache", practice.frameCache).toString();
+    practice.riseTimeMs = qs.value("rise_time_ms", practice.riseTimeMs).toFloat();
+    practice.bitrate = qs.value("bitrate", practice.bitrate).toInt();
+    practice.schedule = qs.value("schedule").toString();
+    practice.pitch = qs.value("pitch", practice.pitch).toInt();
+    practice.stationGrid = qs.value("station_grid").toString();
+    qs.endGroup();
+}
+
+void ServerConfig::readHFPropagation(QSettings &qs) {
+    HFPropagation &propagation = m_hfPropagation;
+
+    qs.beginGroup("hf_propagation");
+    propagation.enabled = qs.value("enabled", propagation.enabled).toBool();
+    propagation.useExternalData = qs.value("use_external_data", propagation.useExternalData).toBool();
+    propagation.useDXViewData = qs.value("use_dxview_data", propagation.useDXViewData).toBool();
+    propagation.useSWPCData = qs.value("use_swpc_data", propagation.useSWPCData).toBool();
+    propagation.solarFluxIndex = qs.value("solar_flux_index", propagation.solarFluxIndex).toInt();
+    propagation.kIndex = qs.value("k_index", propagation.kIndex).toInt();
+    propagation.autoSeason = qs.value("auto_season", propagation.autoSeason).toBool();
+    propagation.season = qs.value("season", propagation.season).toInt();
+    propagation.updateInterval = qs.value("update_interval", propagation.updateInterval).toInt();
+    propagation.simulationOffset = qs.value("simulation_offset", propagation.simulationOffset).toInt();
+    propagation.simulationRate = qs.value("simulation_rate", propagation.simulationRate).toDouble();
+    qs.endGroup();
+}
+
+void ServerConfig::readMetrics(QSettings &qs) {
+    Metrics &metrics = m_metrics;
+
+    qs.beginGroup("metrics");
+    metrics.enabled = qs.value("enabled", metrics.enabled).toBool();
+    metrics.bind = qs.value("bind", metrics.bind).toString();
+    metrics.port = qs.value("port", metrics.port).toInt();
+    metrics.dumpFile = qs.value("dump_file").toString();
+    metrics.dumpInterval = qs.value("dump_interval", metrics.dumpInterval).toInt();
+    qs.endGroup();
+}
+
+void ServerConfig::readVoiceTracing(QSettings &qs) {
+    VoiceTracing &tracing = m_voiceTracing;
+
+    qs.beginGroup("voice_trace");
+    tracing.sampleEvery = qMax(0, qs.value("sample_every", tracing.sampleEvery).toInt());
+    tracing.file = qs.value("file", tracing.file).toString();
+    tracing.format = qs.value("format", tracing.format).toString().toLower();
+    tracing.interval = qs.value("interval", tracing.interval).toInt();
+    qs.endGroup();
+}
+
+void ServerConfig::readPacketCapture(QSettings &qs) {
+    PacketCapture &capture = m_packetCapture;
+
+    qs.beginGroup("packet_capture");
+    capture.file = qs.value("file").toString();
+    capture.maxSize = qMax(1, qs.value("max_size", capture.maxSize).toInt());
+    qs.endGroup();
+}
@@ -0,0 +1,246 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SERVERCONFIG_H_
+#define MUMBLE_MURMUR_SERVERCONFIG_H_
+
+#include "ThreadPlacement.h"
+
+#include <QtCore/QFlags>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+
+#include <memory>
+
+class QSettings;
+
+/**
+ * @brief Parsed, typed snapshot of the server configuration file.
+ *
+ * The file is read once into plain structs, one per section, with the
+ * defaults applied. A snapshot never changes after load(); a reload builds a
+ * new one and swaps it in with setCurrent(). Any thread may call current()
+ * and keep the returned pointer for as long as it needs a consistent view,
+ * without locking and without ever touching QSettings.
+ *
+ * diff() names the sections that differ between two snapshots, so a reload
+ * only re-initializes the subsystems whose settings actually changed.
+ */
+class ServerConfig {
+public:
+    /**
+     * @brief Sections of the configuration file.
+     */
+    enum Section {
+        NoSection = 0x00,
+        ChannelsSection = 0x01, ///< [channels], [channel_parent], [channel_links] and [channel_description]
+        AudioMixingSection = 0x02, ///< [audio_mixing]
+        PerformanceSection = 0x04, ///< [performance]
+        CodePracticeSection = 0x08, ///< [code_practice]
+        HFPropagationSection = 0x10, ///< [hf_propagation]
+        MetricsSection = 0x20, ///< [metrics]
+        VoiceTraceSection = 0x40, ///< [voice_trace]
+        PacketCaptureSection = 0x80, ///< [packet_capture]
+        AllSections = 0xff
+    };
+    Q_DECLARE_FLAGS(Sections, Section)
+
+    /**
+     * @brief The channel tree: [channels], [channel_parent], [channel_links] and [channel_description].
+     */
+    struct Channels {
+        QMap<int, QString> names; ///< Channel ID to name
+        QMap<int, int> parents; ///< Channel ID to the ID of its parent; unlisted channels are top-level
+        QMap<int, QList<int>> links; ///< Channel ID to the IDs it is permanently linked to
+        QMap<int, QString> descriptions; ///< Channel ID to description
+
+        bool operator==(const Channels &other) const;
+        bool operator!=(const Channels &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief Server-side band mixing: [audio_mixing].
+     */
+    struct AudioMixing {
+        bool enabled = false;
+        float gainStepDb = 1.5f;
+        float minGain = 0.05f;
+        float cwPitch = 600.0f;
+        float cwRiseTimeMs = 5.0f;
+        float cwJitterBufferMs = 60.0f;
+        QList<int> channels; ///< Channels that are mixed
+        bool cwSkimmer = false;
+
+        bool operator==(const AudioMixing &other) const;
+        bool operator!=(const AudioMixing &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief Threading: [performance].
+     */
+    struct Performance {
+        bool multiCore = true;
+        int dspThreads = 2;
+        bool dspRealtime = false;
+        ThreadPlacement placement; ///< Where the voice, DSP and pool threads run
+
+        bool operator==(const Performance &other) const;
+        bool operator!=(const Performance &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief Code practice broadcasts: [code_practice].
+     */
+    struct CodePractice {
+        bool enabled = false;
+        QString frameCache = QStringLiteral("cw-frames.cache");
+        float riseTimeMs = 5.0f;
+        int bitrate = 16000;
+        QString schedule; ///< Schedule file; empty for no broadcasts
+        int pitch = 600;
+        QString stationGrid;
+
+        bool operator==(const CodePractice &other) const;
+        bool operator!=(const CodePractice &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief The HF band simulation: [hf_propagation].
+     */
+    struct HFPropagation {
+        bool enabled = true;
+        bool useExternalData = false;
+        bool useDXViewData = false;
+        bool useSWPCData = false;
+        int solarFluxIndex = 120;
+        int kIndex = 3;
+        bool autoSeason = true;
+        int season = 0; ///< 0 = winter, 1 = spring, 2 = summer, 3 = fall; used without auto_season
+        int updateInterval = 30; ///< Minutes between propagation updates
+        int simulationOffset = 0; ///< Minutes the simulation time is ahead of the wall clock
+        double simulationRate = 1.0; ///< Simulated minutes per real minute
+
+        bool operator==(const HFPropagation &other) const;
+        bool operator!=(const HFPropagation &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief The metrics endpoint: [metrics].
+     */
+    struct Metrics {
+        bool enabled = true;
+        QString bind = QStringLiteral("127.0.0.1"); ///< Address the HTTP endpoint listens on
+        int port = 9464;
+        QString dumpFile; ///< File the metrics are also written to; empty for none
+        int dumpInterval = 15; ///< Seconds between two writes of dumpFile
+
+        bool operator==(const Metrics &other) const;
+        bool operator!=(const Metrics &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief The packet latency tracer: [voice_trace].
+     */
+    struct VoiceTracing {
+        int sampleEvery = 0; ///< Trace one packet in this many per thread; 0 turns tracing off
+        QString file = QStringLiteral("voice-trace.json"); ///< File the traces are written to
+        QString format = QStringLiteral("chrome"); ///< "chrome" for trace event JSON, "binary" for compact records
+        int interval = 10; ///< Seconds between two writes of file
+
+        bool operator==(const VoiceTracing &other) const;
+        bool operator!=(const VoiceTracing &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief The capture of incoming voice datagrams: [packet_capture].
+     */
+    struct PacketCapture {
+        QString file; ///< File the datagrams are recorded to; empty turns capturing off
+        int maxSize = 256; ///< Megabytes after which capturing stops
+
+        bool operator==(const PacketCapture &other) const;
+        bool operator!=(const PacketCapture &other) const { return !(*this == other); }
+    };
+
+    /**
+     * @brief Constructor for a ServerConfig with every setting at its default.
+     */
+    ServerConfig();
+
+    /**
+     * @brief Parse a configuration file.
+     *
+     * A missing file gives the defaults, like an empty one.
+     *
+     * @param path The INI file
+     * @return The snapshot, or nullptr if the file could not be read or parsed
+     */
+    static std::shared_ptr<const ServerConfig> load(const QString &path);
+
+    /**
+     * @brief Get the configuration in effect.
+     *
+     * @return The snapshot passed to setCurrent(), or the defaults; never nullptr
+     */
+    static std::shared_ptr<const ServerConfig> current();
+
+    /**
+     * @brief Set the configuration in effect.
+     *
+     * Readers that already hold the previous snapshot keep using it.
+     *
+     * @param config The new snapshot
+     */
+    static void setCurrent(std::shared_ptr<const ServerConfig> config);
+
+    /**
+     * @brief Get the file this snapshot was read from.
+     *
+     * @return The path, empty for the defaults
+     */
+    const QString &path() const { return m_path; }
+
+    const Channels &channels() const { return m_channels; }
+    const AudioMixing &audioMixing() const { return m_audioMixing; }
+    const Performance &performance() const { return m_performance; }
+    const CodePractice &codePractice() const { return m_codePractice; }
+    const HFPropagation &hfPropagation() const { return m_hfPropagation; }
+    const Metrics &metrics() const { return m_metrics; }
+    const VoiceTracing &voiceTracing() const { return m_voiceTracing; }
+    const PacketCapture &packetCapture() const { return m_packetCapture; }
+
+    /**
+     * @brief Compare with another snapshot.
+     *
+     * @param other The snapshot to compare with
+     * @return The sections whose settings differ
+     */
+    Sections diff(const ServerConfig &other) const;
+
+private:
+    void readChannels(QSettings &qs);
+    void readAudioMixing(QSettings &qs);
+    void readPerformance(QSettings &qs);
+    void readCodePractice(QSettings &qs);
+    void readHFPropagation(QSettings &qs);
+    void readMetrics(QSettings &qs);
+    void readVoiceTracing(QSettings &qs);
+    void readPacketCapture(QSettings &qs);
+
+    QString m_path;
+    Channels m_channels;
+    AudioMixing m_audioMixing;
+    Performance m_performance;
+    CodePractice m_codePractice;
+    HFPropagation m_hfPropagation;
+    Metrics m_metrics;
+    VoiceTracing m_voiceTracing;
+    PacketCapture m_packetCapture;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(ServerConfig::Sections)
+
+#endif // MUMBLE_MURMUR_SERVERCONFIG_H_
@@ -0,0 +1,93 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ServerConfigWatcher.h"
+
+#include "ThreadPool.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QFileInfo>
+
+#include <stdexcept>
+
+ServerConfigWatcher::ServerConfigWatcher(const QString &path, QObject *parent)
+    : QObject(parent), m_path(path), m_loads(ThreadPool::shared(), ThreadPool::Priority::Background),
+      m_loading(false), m_reloadPending(false) {
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(DEBOUNCE_MS);
+    connect(&m_debounce, &QTimer::timeout, this, &ServerConfigWatcher::reload);
+
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &ServerConfigWatcher::scheduleReload);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &ServerConfigWatcher::scheduleReload);
+
+    const QFileInfo info(m_path);
+    m_watcher.addPath(info.absolutePath());
+    if (info.exists()) {
+        m_watcher.addPath(info.absoluteFilePath());
+    }
+}
+
+ServerConfigWatcher::~ServerConfigWatcher() {
+    // A parse that finishes now posts to an object that is gone, which Qt
+    // discards
+    m_loads.cancel();
+}
+
+void ServerConfigWatcher::scheduleReload() {
+    m_debounce.start();
+}
+
+void ServerConfigWatcher::reload() {
+    if (m_loading) {
+        m_reloadPending = true;
+        return;
+    }
+
+    // Between the unlink and the rename of an atomic save; the rename
+    // triggers another reload
+    if (!QFileInfo::exists(m_path)) {
+        return;
+    }
+
+    m_loading = true;
+    const QString path = m_path;
+    try {
+        m_loads.run([this, path]() {
+            std::shared_ptr<const ServerConfig> config = ServerConfig::load(path);
+            QMetaObject::invokeMethod(
+                this, [this, config]() { finishReload(config); }, Qt::QueuedConnection);
+        });
+    } catch (const std::runtime_error &) {
+        // The pool is shutting down
+        m_loading = false;
+    }
+}
+
+void ServerConfigWatcher::finishReload(std::shared_ptr<const ServerConfig> config) {
+    m_loading = false;
+
+    // A file replaced by a rename is a new inode and dropped from the watch
+    const QString file = QFileInfo(m_path).absoluteFilePath();
+    if (!m_watcher.files().contains(file) && QFileInfo::exists(file)) {
+        m_watcher.addPath(file);
+    }
+
+    if (config) {
+        std::shared_ptr<const ServerConfig> previous = ServerConfig::current();
+        const ServerConfig::Sections changed = config->diff(*previous);
+        if (changed != ServerConfig::NoSection) {
+            ServerConfig::setCurrent(config);
+            qWarning() << "ServerConfigWatcher: Reloaded" << m_path << "- changed sections:" << changed;
+            emit configChanged(config, changed);
+        }
+    } else {
+        qWarning() << "ServerConfigWatcher: Keeping the running configuration";
+    }
+
+    if (m_reloadPending) {
+        m_reloadPending = false;
+        reload();
+    }
+}
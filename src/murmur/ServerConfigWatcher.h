@@ -0,0 +1,90 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SERVERCONFIGWATCHER_H_
+#define MUMBLE_MURMUR_SERVERCONFIGWATCHER_H_
+
+#include "ServerConfig.h"
+#include "TaskGroup.h"
+
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+
+#include <memory>
+
+/**
+ * @brief Reloads the configuration file when it changes on disk.
+ *
+ * Watches the file and its directory with QFileSystemWatcher (inotify on
+ * Linux); the directory catches editors that save by writing a new file and
+ * renaming it over the old one. Changes are debounced, so a save that
+ * arrives as several events is parsed once.
+ *
+ * The file is parsed on the shared ThreadPool at background priority. Back on
+ * the thread of the watcher, the new snapshot is compared with the current
+ * one; if any section changed, it becomes ServerConfig::current() and
+ * configChanged() names the sections, so each subsystem only re-initializes
+ * when its own settings differ. A file that fails to parse is ignored and
+ * the running configuration stays in effect.
+ */
+class ServerConfigWatcher : public QObject {
+    Q_OBJECT
+
+public:
+    /// Quiet time after the last change before the file is parsed
+    static const int DEBOUNCE_MS = 250;
+
+    /**
+     * @brief Constructor for ServerConfigWatcher.
+     *
+     * @param path The configuration file
+     * @param parent The parent object
+     */
+    explicit ServerConfigWatcher(const QString &path, QObject *parent = nullptr);
+
+    /**
+     * @brief Destructor for ServerConfigWatcher.
+     *
+     * Waits for a reload that is still being parsed.
+     */
+    ~ServerConfigWatcher() override;
+
+    /**
+     * @brief Get the watched file.
+     *
+     * @return The path
+     */
+    const QString &path() const { return m_path; }
+
+public slots:
+    /**
+     * @brief Parse the file now instead of waiting for a change.
+     */
+    void reload();
+
+signals:
+    /**
+     * @brief Emitted after a changed configuration became current.
+     *
+     * @param config The new snapshot
+     * @param changed The sections that differ from the snapshot it replaced
+     */
+    void configChanged(std::shared_ptr<const ServerConfig> config, ServerConfig::Sections changed);
+
+private:
+    void scheduleReload();
+    void finishReload(std::shared_ptr<const ServerConfig> config);
+
+    QString m_path;
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounce;
+    TaskGroup m_loads;
+    bool m_loading; // A parse is running on the pool
+    bool m_reloadPending; // The file changed again while it was being parsed
+};
+
+#endif // MUMBLE_MURMUR_SERVERCONFIGWATCHER_H_
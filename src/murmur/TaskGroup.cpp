@@ -0,0 +1,96 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "TaskGroup.h"
+
+#include <QtCore/QDebug>
+
+bool CancellationToken::isCancelled() const {
+    return m_state && m_state->cancelled.load(std::memory_order_acquire);
+}
+
+TaskGroup::TaskGroup(ThreadPool *pool, ThreadPool::Priority priority)
+    : m_pool(pool)
+    , m_priority(priority)
+    , m_state(std::make_shared<State>()) {
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // Nobody is left to rethrow to
+        qWarning() << "TaskGroup: Discarding an exception of a task that was never waited for";
+    }
+}
+
+void TaskGroup::cancel() {
+    m_state->cancelled.store(true, std::memory_order_release);
+}
+
+bool TaskGroup::isCancelled() const {
+    return isCancelled(*m_state);
+}
+
+CancellationToken TaskGroup::token() const {
+    return CancellationToken(m_state);
+}
+
+bool TaskGroup::isDone() const {
+    return m_state->pending.load(std::memory_order_acquire) == 0;
+}
+
+void TaskGroup::wait() {
+    State &state = *m_state;
+
+    while (state.pending.load(std::memory_order_acquire) != 0) {
+        // A worker keeps the pool going instead of blocking one of its
+        // threads; this also runs the group's own tasks from its deque
+        if (m_pool->runPendingTask()) {
+            continue;
+        }
+
+        EventCount::Key key = state.done.prepareWait();
+        if (state.pending.load(std::memory_order_acquire) == 0) {
+            state.done.cancelWait();
+            break;
+        }
+        state.done.wait(key);
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(state.errorMutex);
+        std::swap(error, state.error);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool TaskGroup::isCancelled(const State &state) {
+    return state.cancelled.load(std::memory_order_acquire);
+}
+
+void TaskGroup::setError(State &state, std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(state.errorMutex);
+    if (!state.error) {
+        state.error = std::move(error);
+    }
+}
+
+void TaskGroup::finishTask(State &state) {
+    if (state.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        state.done.notifyAll();
+    }
+}
+
+void TaskGroup::startTask() {
+    m_state->pending.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TaskGroup::abortTask() {
+    finishTask(*m_state);
+}
@@ -0,0 +1,202 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TASKGROUP_H_
+#define MUMBLE_MURMUR_TASKGROUP_H_
+
+#include "EventCount.h"
+#include "ThreadPool.h"
+
+#include <QtCore/QtGlobal>
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+class TaskGroup;
+
+/**
+ * @brief Read side of a TaskGroup's cancellation flag.
+ *
+ * Long-running tasks poll isCancelled() at convenient points and return
+ * early once it is set. A default-constructed token is never cancelled.
+ * Tokens are cheap to copy and stay valid after their group is destroyed.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    /**
+     * @brief Check whether the work this token belongs to was cancelled.
+     *
+     * @return True once TaskGroup::cancel() was called
+     */
+    bool isCancelled() const;
+
+private:
+    friend class TaskGroup;
+
+    struct State;
+    explicit CancellationToken(std::shared_ptr<const State> state) : m_state(std::move(state)) {}
+
+    std::shared_ptr<const State> m_state;
+};
+
+/**
+ * @brief A set of tasks on a ThreadPool that can be waited for and cancelled together.
+ *
+ * Every run() adds one task at the group's priority. The group counts its
+ * unfinished tasks: isDone() checks the count without blocking and wait()
+ * sleeps until it reaches zero. A worker thread that waits runs other pool
+ * tasks in the meantime, so groups can be nested without starving the pool.
+ *
+ * cancel() is cooperative: tasks that have not started yet are dropped
+ * without running and running tasks see the flag through token(). This is
+ * how a recompute that has been superseded is abandoned without waiting for
+ * it to finish.
+ *
+ * The destructor waits for the remaining tasks; cancel first to make that
+ * quick. The group itself is not thread-safe except for cancel(),
+ * isCancelled(), isDone() and token().
+ */
+class TaskGroup {
+public:
+    /**
+     * @brief Constructor for TaskGroup.
+     *
+     * @param pool The pool the tasks run on; must outlive the group
+     * @param priority The priority of every task of the group
+     */
+    explicit TaskGroup(ThreadPool *pool, ThreadPool::Priority priority = ThreadPool::Priority::Normal);
+
+    /**
+     * @brief Destructor for TaskGroup.
+     *
+     * Waits for the tasks that are still queued or running.
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    /**
+     * @brief Add a task to the group.
+     *
+     * @param fn The function to run; called without arguments
+     * @throws std::runtime_error if the pool is stopping
+     */
+    template<class Fn>
+    void run(Fn &&fn);
+
+    /**
+     * @brief Cancel the group.
+     *
+     * Queued tasks are skipped and running tasks can check token(). Tasks
+     * added afterwards are skipped as well.
+     */
+    void cancel();
+
+    /**
+     * @brief Check whether the group was cancelled.
+     *
+     * @return True after cancel()
+     */
+    bool isCancelled() const;
+
+    /**
+     * @brief Get a token for polling the cancellation flag.
+     *
+     * @return A token that is cancelled together with this group
+     */
+    CancellationToken token() const;
+
+    /**
+     * @brief Check without blocking whether all tasks have finished.
+     *
+     * @return True if no task is queued or running
+     */
+    bool isDone() const;
+
+    /**
+     * @brief Block until all tasks have finished.
+     *
+     * Rethrows the first exception a task threw, if any.
+     */
+    void wait();
+
+private:
+    using State = CancellationToken::State;
+
+    template<class Fn>
+    class GroupTask : public ThreadPool::Task {
+    public:
+        template<class Callable>
+        GroupTask(std::shared_ptr<State> state, Callable &&callable)
+            : m_state(std::move(state)), m_fn(std::forward<Callable>(callable)) {}
+
+        void run() override {
+            // Tasks of a cancelled group are dropped without running
+            std::shared_ptr<State> state = std::move(m_state);
+            if (!TaskGroup::isCancelled(*state)) {
+                try {
+                    m_fn();
+                } catch (...) {
+                    TaskGroup::setError(*state, std::current_exception());
+                }
+            }
+            delete this;
+            TaskGroup::finishTask(*state);
+        }
+
+    private:
+        std::shared_ptr<State> m_state;
+        Fn m_fn;
+    };
+
+    static bool isCancelled(const State &state);
+    static void setError(State &state, std::exception_ptr error);
+    static void finishTask(State &state);
+    void startTask();
+    void abortTask();
+
+    ThreadPool *m_pool;
+    ThreadPool::Priority m_priority;
+
+    // Shared with the tasks and tokens, so a finishing task never touches
+    // a group that its waiter already destroyed
+    std::shared_ptr<State> m_state;
+};
+
+/**
+ * @brief State shared by a TaskGroup, its tasks and its tokens.
+ */
+struct CancellationToken::State {
+    std::atomic<bool> cancelled{ false };
+    std::atomic<int> pending{ 0 };
+    EventCount done;
+
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+template<class Fn>
+void TaskGroup::run(Fn &&fn) {
+    using Callable = typename std::decay<Fn>::type;
+
+    std::unique_ptr<GroupTask<Callable>> task(new GroupTask<Callable>(m_state, std::forward<Fn>(fn)));
+    startTask();
+    try {
+        m_pool->submit(task.get(), m_priority);
+    } catch (...) {
+        abortTask();
+        throw;
+    }
+    task.release();
+}
+
+#endif // MUMBLE_MURMUR_TASKGROUP_H_
@@ -0,0 +1,193 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ThreadPlacement.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+
+namespace {
+    // Cores that auto mode must leave to the pool before it reserves any for audio
+    const int MIN_POOL_CORES = 2;
+
+    ThreadPlacement &currentPlacement() {
+        static ThreadPlacement placement;
+        return placement;
+    }
+
+    // QSettings splits unquoted values at commas, so a CPU list arrives as a
+    // string list; join it back before parsing
+    QVector<int> readCpuList(QSettings &qs, const char *key, const CpuTopology &topology) {
+        const QString text = qs.value(key, QStringList()).toStringList().join(",");
+
+        bool ok;
+        const QVector<int> parsed = CpuTopology::parseCpuList(text, &ok);
+        if (!ok) {
+            qWarning() << "ThreadPlacement: Ignoring malformed entries in" << key << "=" << text;
+        }
+
+        QVector<int> cpus;
+        for (int cpu : parsed) {
+            if (topology.nodeOf(cpu) >= 0) {
+                cpus.append(cpu);
+            } else {
+                qWarning() << "ThreadPlacement: CPU" << cpu << "in" << key << "is not available to the server";
+            }
+        }
+        return cpus;
+    }
+
+    QString describeCpus(const QVector<int> &cpus) {
+        return cpus.isEmpty() ? QString("any") : CpuTopology::formatCpuList(cpus);
+    }
+
+    const char *modeName(ThreadPlacement::Mode mode) {
+        switch (mode) {
+            case ThreadPlacement::Mode::Auto:
+                return "auto";
+            case ThreadPlacement::Mode::Manual:
+                return "manual";
+            case ThreadPlacement::Mode::Off:
+                return "off";
+        }
+        return "unknown";
+    }
+}
+
+ThreadPlacement::ThreadPlacement()
+    : m_mode(Mode::Off)
+    , m_multiCore(true)
+    , m_poolThreads(qMax(1, CpuTopology::system().cpuCount()))
+    , m_serverThreadQuota(0) {
+}
+
+ThreadPlacement ThreadPlacement::fromSettings(QSettings &qs, const CpuTopology &topology) {
+    ThreadPlacement placement;
+
+    qs.beginGroup("performance");
+
+    placement.m_multiCore = qs.value("enable_multi_core", true).toBool();
+    const int maxThreads = qs.value("max_threads", 0).toInt();
+    const int dspThreads = placement.m_multiCore ? qMax(0, qs.value("dsp_threads", 2).toInt()) : 0;
+    placement.m_serverThreadQuota = qMax(0, qs.value("server_max_threads", 0).toInt());
+
+    const QString mode = qs.value("cpu_affinity", "auto").toString().trimmed().toLower();
+    if (mode == "auto") {
+        placement.m_mode = Mode::Auto;
+    } else if (mode == "manual") {
+        placement.m_mode = Mode::Manual;
+    } else {
+        if (mode != "off") {
+            qWarning() << "ThreadPlacement: Unknown cpu_affinity" << mode << "- not pinning any threads";
+        }
+        placement.m_mode = Mode::Off;
+    }
+
+    if (placement.m_mode != Mode::Off) {
+        placement.m_voiceCpus = readCpuList(qs, "voice_cpus", topology);
+        placement.m_dspCpus = readCpuList(qs, "dsp_cpus", topology);
+        placement.m_poolCpus = readCpuList(qs, "pool_cpus", topology);
+    }
+
+    qs.endGroup();
+
+    if (placement.m_mode == Mode::Auto) {
+        const QVector<int> nodes = topology.nodes();
+        const QVector<int> audioNodeCpus = topology.cpusOfNode(nodes.first());
+
+        // One core for the voice thread and one per DSP worker, all on the
+        // first node, taken first hardware thread of each core first
+        QVector<int> audioCores;
+        QVector<int> audioCpus;
+        for (int cpu : audioNodeCpus) {
+            const int core = topology.coreOf(cpu);
+            if (!audioCores.contains(core)) {
+                audioCores.append(core);
+                audioCpus.append(cpu);
+            }
+        }
+
+        const int reserve = 1 + dspThreads;
+        const bool exclusive = reserve <= audioCpus.size() && topology.coreCount() - reserve >= MIN_POOL_CORES;
+
+        QSet<int> reservedCores;
+        if (exclusive) {
+            if (placement.m_voiceCpus.isEmpty()) {
+                placement.m_voiceCpus.append(audioCpus.at(0));
+                reservedCores.insert(audioCores.at(0));
+                // Further servers share the audio cores instead of all
+                // crowding onto the first one
+                placement.m_audioCpus = audioCpus.mid(0, reserve);
+            }
+            if (placement.m_dspCpus.isEmpty()) {
+                for (int i = 1; i < reserve; ++i) {
+                    placement.m_dspCpus.append(audioCpus.at(i));
+                    reservedCores.insert(audioCores.at(i));
+                }
+            }
+        } else if (nodes.size() > 1) {
+            // Too few cores to give audio its own; still keep it on one socket
+            if (placement.m_voiceCpus.isEmpty()) {
+                placement.m_voiceCpus = audioNodeCpus;
+            }
+            if (placement.m_dspCpus.isEmpty()) {
+                placement.m_dspCpus = audioNodeCpus;
+            }
+        }
+
+        // The pool gets every core audio did not take, node by node. Only
+        // worth pinning when that actually restricts or groups the workers.
+        if (placement.m_poolCpus.isEmpty() && (!reservedCores.isEmpty() || nodes.size() > 1)) {
+            for (int node : nodes) {
+                for (int cpu : topology.cpusOfNode(node)) {
+                    if (!reservedCores.contains(topology.coreOf(cpu))) {
+                        placement.m_poolCpus.append(cpu);
+                    }
+                }
+            }
+        }
+    }
+
+    int poolThreads = placement.m_poolCpus.isEmpty() ? topology.cpuCount() : placement.m_poolCpus.size();
+    if (!placement.m_multiCore) {
+        poolThreads = 1;
+    } else if (maxThreads > 0) {
+        poolThreads = qMin(poolThreads, maxThreads);
+    }
+    placement.m_poolThreads = qMax(1, poolThreads);
+
+    return placement;
+}
+
+QVector<int> ThreadPlacement::voiceCpusOf(unsigned int serverNum) const {
+    if (m_audioCpus.isEmpty() || serverNum == 0) {
+        return m_voiceCpus;
+    }
+    const unsigned int index = (serverNum - 1) % static_cast<unsigned int>(m_audioCpus.size());
+    return QVector<int>{ m_audioCpus.at(static_cast<int>(index)) };
+}
+
+const ThreadPlacement &ThreadPlacement::current() {
+    return currentPlacement();
+}
+
+void ThreadPlacement::setCurrent(const ThreadPlacement &placement) {
+    currentPlacement() = placement;
+}
+
+bool ThreadPlacement::operator==(const ThreadPlacement &other) const {
+    return m_mode == other.m_mode && m_multiCore == other.m_multiCore && m_poolThreads == other.m_poolThreads
+           && m_serverThreadQuota == other.m_serverThreadQuota && m_voiceCpus == other.m_voiceCpus
+           && m_dspCpus == other.m_dspCpus && m_poolCpus == other.m_poolCpus && m_audioCpus == other.m_audioCpus;
+}
+
+void ThreadPlacement::log() const {
+    qWarning() << "ThreadPlacement: Mode" << modeName(m_mode) << "- voice CPUs" << describeCpus(m_voiceCpus)
+               << ", DSP CPUs" << describeCpus(m_dspCpus) << ", pool CPUs" << describeCpus(m_poolCpus) << "with"
+               << m_poolThreads << "threads," << (m_serverThreadQuota > 0 ? QString::number(m_serverThreadQuota) : QString("an equal share"))
+               << "per server";
+}
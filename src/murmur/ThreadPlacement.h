@@ -0,0 +1,156 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_THREADPLACEMENT_H_
+#define MUMBLE_MURMUR_THREADPLACEMENT_H_
+
+#include "CpuTopology.h"
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class QSettings;
+
+/**
+ * @brief Which CPUs the voice thread, the DSP workers and the general thread pool run on.
+ *
+ * Built from the [performance] section of the configuration:
+ * - enable_multi_core: false shrinks the pool to one thread and disables the DSP workers
+ * - max_threads: upper bound for the pool threads (0 = one per usable CPU)
+ * - cpu_affinity: auto, manual or off
+ * - voice_cpus, dsp_cpus, pool_cpus: explicit CPU lists such as "0-7,16-23"
+ * - server_max_threads: pool workers one virtual server may occupy at once
+ *   (0 = an equal share among all servers)
+ *
+ * In auto mode the voice thread and the DSP workers each get a core of their
+ * own on the first NUMA node, so audio frames never cross a socket, and the
+ * pool gets every other CPU. The voice threads of several virtual servers are
+ * spread round-robin over those audio cores (see voiceCpusOf()). Pool workers
+ * stay on one node each (see ThreadPool). An explicit list overrides the automatic choice for its role.
+ * In manual mode only the explicit lists are applied; off pins nothing.
+ *
+ * The placement in effect is set once by main() before any server starts.
+ */
+class ThreadPlacement {
+public:
+    enum class Mode {
+        Auto, ///< Derive the CPU sets from the topology
+        Manual, ///< Only apply the configured CPU lists
+        Off ///< Leave placement to the operating system
+    };
+
+    /**
+     * @brief Constructor for ThreadPlacement.
+     *
+     * Creates a placement that pins nothing and uses one pool thread per CPU.
+     */
+    ThreadPlacement();
+
+    /**
+     * @brief Build a placement from the [performance] configuration section.
+     *
+     * @param qs The settings; must not be inside a group
+     * @param topology The CPUs to place the threads on
+     * @return The placement
+     */
+    static ThreadPlacement fromSettings(QSettings &qs, const CpuTopology &topology = CpuTopology::system());
+
+    /**
+     * @brief Get the placement in effect.
+     *
+     * @return The placement passed to setCurrent(), or a default one
+     */
+    static const ThreadPlacement &current();
+
+    /**
+     * @brief Set the placement in effect.
+     *
+     * Must be called before any thread that reads it is started.
+     *
+     * @param placement The new placement
+     */
+    static void setCurrent(const ThreadPlacement &placement);
+
+    /**
+     * @brief Get the placement mode.
+     *
+     * @return The mode
+     */
+    Mode mode() const { return m_mode; }
+
+    /**
+     * @brief Check whether multi-core processing is enabled.
+     *
+     * @return The value of enable_multi_core
+     */
+    bool multiCore() const { return m_multiCore; }
+
+    /**
+     * @brief Get the number of general thread pool workers.
+     *
+     * @return The number of threads, at least 1
+     */
+    int poolThreads() const { return m_poolThreads; }
+
+    /**
+     * @brief Get the quota of each virtual server on the shared thread pool.
+     *
+     * @return The number of workers, or 0 for an equal share
+     */
+    int serverThreadQuota() const { return m_serverThreadQuota; }
+
+    /**
+     * @brief Get the CPUs of the voice thread.
+     *
+     * @return The CPUs, empty for no pinning
+     */
+    const QVector<int> &voiceCpus() const { return m_voiceCpus; }
+
+    /**
+     * @brief Get the CPUs of one virtual server's voice thread.
+     *
+     * When auto mode chose the voice CPU, server N gets audio core N - 1,
+     * wrapping around, so the voice threads of several servers do not all
+     * share one core. Otherwise this is voiceCpus() for every server.
+     *
+     * @param serverNum The server's number, starting at 1
+     * @return The CPUs, empty for no pinning
+     */
+    QVector<int> voiceCpusOf(unsigned int serverNum) const;
+
+    /**
+     * @brief Get the CPUs of the DSP workers, assigned round-robin.
+     *
+     * @return The CPUs, empty for no pinning
+     */
+    const QVector<int> &dspCpus() const { return m_dspCpus; }
+
+    /**
+     * @brief Get the CPUs of the general thread pool.
+     *
+     * @return The CPUs grouped by node, empty for no pinning
+     */
+    const QVector<int> &poolCpus() const { return m_poolCpus; }
+
+    /**
+     * @brief Log the placement.
+     */
+    void log() const;
+
+    bool operator==(const ThreadPlacement &other) const;
+    bool operator!=(const ThreadPlacement &other) const { return !(*this == other); }
+
+private:
+    Mode m_mode;
+    bool m_multiCore;
+    int m_poolThreads;
+    int m_serverThreadQuota;
+    QVector<int> m_voiceCpus;
+    QVector<int> m_dspCpus;
+    QVector<int> m_poolCpus;
+    QVector<int> m_audioCpus; // Spread the voice threads over these; empty unless auto mode chose the voice CPU
+};
+
+#endif // MUMBLE_MURMUR_THREADPLACEMENT_H_
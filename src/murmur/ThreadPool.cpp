@@ -4,14 +4,101 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "ThreadPool.h"
+#include "CpuTopology.h"
+#include "Metrics.h"
+#include "ThreadPlacement.h"
+#include "WorkStealingDeque.h"
 
-#include <QtCore/QThread>
 #include <QtCore/QtGlobal>
 
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+namespace {
+    // Tasks an idle worker moves from the injection queue at once
+    const int INJECT_BATCH = 16;
+
+    // Rounds of stealing before an idle worker parks
+    const int SPIN_ROUNDS = 16;
+
+    // The pool and worker the current thread belongs to, and the priority
+    // level of the task it is running
+    thread_local const ThreadPool *t_pool = nullptr;
+    thread_local void *t_worker = nullptr;
+    thread_local int t_level = static_cast<int>(ThreadPool::Priority::Normal);
+
+    // The tenant the current thread submits for: set by TenantScope outside
+    // the pool and inherited from the running task on workers
+    thread_local ThreadPool::Tenant *t_tenant = nullptr;
+
+    // Tasks run by the pools of the process, by priority level
+    MetricCounter &tasksRun(int level) {
+        static MetricCounter *const counters[] = {
+            &MetricsRegistry::instance().counter("murmur_threadpool_tasks_total", "ThreadPool tasks run",
+                                                 "priority=\"realtime\""),
+            &MetricsRegistry::instance().counter("murmur_threadpool_tasks_total", "ThreadPool tasks run",
+                                                 "priority=\"normal\""),
+            &MetricsRegistry::instance().counter("murmur_threadpool_tasks_total", "ThreadPool tasks run",
+                                                 "priority=\"background\""),
+        };
+        return *counters[level];
+    }
+}
+
+ThreadPool::Tenant::Tenant(ThreadPool *pool, const QString &name, int requestedQuota)
+    : m_pool(pool)
+    , m_name(name)
+    , m_requestedQuota(requestedQuota)
+    , m_quota(1)
+    , m_running(0)
+    , m_submitted(0)
+    , m_completed(0)
+    , m_deferrals(0)
+    , m_busyNs(0)
+    , m_backlogCount(0) {
+}
+
+ThreadPool::Tenant::Stats ThreadPool::Tenant::stats() const {
+    Stats stats;
+    stats.completed = m_completed.load(std::memory_order_acquire);
+    stats.submitted = m_submitted.load(std::memory_order_acquire);
+    stats.deferred = m_deferrals.load(std::memory_order_relaxed);
+    stats.busyNs = m_busyNs.load(std::memory_order_relaxed);
+    stats.running = m_running.load(std::memory_order_relaxed);
+    stats.quota = m_quota.load(std::memory_order_relaxed);
+    return stats;
+}
+
+ThreadPool::TenantScope::TenantScope(Tenant *tenant) : m_previous(t_tenant) {
+    t_tenant = tenant;
+}
+
+ThreadPool::TenantScope::~TenantScope() {
+    t_tenant = m_previous;
+}
+
+struct ThreadPool::Worker {
+    // One deque per priority level
+    WorkStealingDeque<Task *> deques[PRIORITY_COUNT];
+    int index = 0;
+    int node = -1;
+    quint32 random = 0;
+
+    // Written only by this worker; summed for pendingTaskCount()
+    alignas(64) std::atomic<quint64> submitted{ 0 };
+    std::atomic<quint64> completed{ 0 };
+};
+
 ThreadPool::ThreadPool(int numThreads, QObject *parent)
+    : ThreadPool(numThreads, QVector<int>(), parent) {
+}
+
+ThreadPool::ThreadPool(int numThreads, const QVector<int> &cpus, QObject *parent)
     : QObject(parent)
-    , m_stop(false)
-    , m_activeThreads(0) {
+    , m_startedCount(0)
+    , m_injectedTotal(0)
+    , m_stop(false) {
     
     // Determine the number of worker threads to create
     if (numThreads <= 0) {
@@ -22,66 +109,346 @@ ThreadPool::ThreadPool(int numThreads, QObject *parent)
     
     qDebug() << "Creating ThreadPool with" << m_threadCount << "worker threads";
     
-    // Create and start the worker threads
-    m_workers.reserve(m_threadCount);
+    for (std::atomic<int> &count : m_injectedCount) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    
+    // Worker i runs anywhere on the node of cpus[i % size], so workers fill
+    // the preferred CPUs first and a node's workers can balance among its CPUs
+    const CpuTopology &topology = CpuTopology::system();
+    m_workers.resize(m_threadCount);
+    m_threads.reserve(m_threadCount);
     for (int i = 0; i < m_threadCount; ++i) {
-        m_workers.emplace_back(&ThreadPool::workerThread, this);
+        QVector<int> workerCpus;
+        int node = -1;
+        if (!cpus.isEmpty()) {
+            node = topology.nodeOf(cpus.at(i % cpus.size()));
+            for (int cpu : cpus) {
+                if (topology.nodeOf(cpu) == node) {
+                    workerCpus.append(cpu);
+                }
+            }
+        }
+        m_threads.emplace_back(&ThreadPool::workerThread, this, i, workerCpus, node);
     }
+
+    // Every deque must exist before the first worker tries to steal from it
+    std::unique_lock<std::mutex> lock(m_startMutex);
+    m_startCondition.wait(lock, [this] { return m_startedCount == m_threadCount; });
 }
 
 ThreadPool::~ThreadPool() {
-    // Signal worker threads to stop
-    {
-        std::lock_guard<std::mutex> lock(m_queueMutex);
-        m_stop = true;
-    }
+    // Signal worker threads to stop once they run out of work
+    m_stop.store(true, std::memory_order_seq_cst);
     
-    // Notify all waiting threads
-    m_condition.notify_all();
+    // Wake all parked threads
+    m_idle.notifyAll();
     
     // Wait for all threads to finish
-    for (auto& worker : m_workers) {
-        if (worker.joinable()) {
-            worker.join();
+    for (std::thread &thread : m_threads) {
+        if (thread.joinable()) {
+            thread.join();
         }
     }
     
+    if (!m_tenants.isEmpty()) {
+        qWarning() << "ThreadPool: Destroyed with" << m_tenants.size() << "tenants still registered";
+    }
+    
     qDebug() << "ThreadPool destroyed";
 }
 
+// A parallelFor() in progress. The same job is submitted once per helping
+// worker; every run claims chunks until none are left. The job is freed by
+// whoever drops the last reference, so helpers that only start after the
+// caller returned find no chunks and never touch the caller's stack.
+class ThreadPool::BulkJob : public ThreadPool::Task {
+public:
+    BulkJob(ChunkBody body, void *context, int begin, int end, int grain, int chunks, int references)
+        : m_body(body)
+        , m_context(context)
+        , m_begin(begin)
+        , m_end(end)
+        , m_grain(grain)
+        , m_chunks(chunks)
+        , m_next(0)
+        , m_remaining(chunks)
+        , m_references(references) {
+    }
+
+    void run() override {
+        runChunks();
+        release();
+    }
+
+    void runChunks() {
+        for (;;) {
+            const int chunk = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= m_chunks) {
+                return;
+            }
+
+            const int chunkBegin = m_begin + chunk * m_grain;
+            const int chunkEnd = qMin(m_end, chunkBegin + m_grain);
+            try {
+                m_body(m_context, chunkBegin, chunkEnd);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_errorMutex);
+                if (!m_error) {
+                    m_error = std::current_exception();
+                }
+            }
+
+            if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                m_done.notifyAll();
+            }
+        }
+    }
+
+    void wait() {
+        while (m_remaining.load(std::memory_order_acquire) != 0) {
+            EventCount::Key key = m_done.prepareWait();
+            if (m_remaining.load(std::memory_order_acquire) == 0) {
+                m_done.cancelWait();
+                break;
+            }
+            m_done.wait(key);
+        }
+    }
+
+    std::exception_ptr error() {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        return m_error;
+    }
+
+    void release() {
+        if (m_references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    const ChunkBody m_body;
+    void *const m_context;
+    const int m_begin;
+    const int m_end;
+    const int m_grain;
+    const int m_chunks;
+
+    std::atomic<int> m_next;
+    std::atomic<int> m_remaining;
+    std::atomic<int> m_references;
+    EventCount m_done;
+
+    std::mutex m_errorMutex;
+    std::exception_ptr m_error;
+};
+
+void ThreadPool::submit(Task *task, Priority priority) {
+    submitMany(&task, nullptr, 1, priority);
+}
+
+void ThreadPool::submitBulk(Task *const *tasks, int count, Priority priority) {
+    submitMany(tasks, nullptr, count, priority);
+}
+
+void ThreadPool::submitMany(Task *const *tasks, Task *repeated, int count, Priority priority) {
+    // Don't allow enqueueing after stopping the pool
+    if (m_stop.load(std::memory_order_relaxed)) {
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    if (count <= 0) {
+        return;
+    }
+
+    // Tasks belong to the tenant of the submitting thread; only those from
+    // outside the pool count against its quota
+    Tenant *tenant = t_tenant && t_tenant->m_pool == this ? t_tenant : nullptr;
+    const bool root = t_pool != this;
+    for (int i = 0; i < (repeated ? 1 : count); ++i) {
+        Task *task = repeated ? repeated : tasks[i];
+        task->m_tenant = tenant;
+        task->m_root = root;
+    }
+    if (tenant) {
+        tenant->m_submitted.fetch_add(static_cast<quint64>(count), std::memory_order_release);
+    }
+
+    const int level = static_cast<int>(priority);
+    if (t_pool == this) {
+        // From one of our workers: its own deque, no shared state touched
+        Worker *self = static_cast<Worker *>(t_worker);
+        self->submitted.store(self->submitted.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        for (int i = 0; i < count; ++i) {
+            self->deques[level].push(repeated ? repeated : tasks[i]);
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(m_injectMutex);
+        std::deque<Task *> &queue = m_injected[level];
+        for (int i = 0; i < count; ++i) {
+            queue.push_back(repeated ? repeated : tasks[i]);
+        }
+        m_injectedCount[level].store(static_cast<int>(queue.size()), std::memory_order_relaxed);
+        m_injectedTotal.fetch_add(static_cast<quint64>(count), std::memory_order_release);
+    }
+
+    // Only costs a syscall if a worker is parked
+    if (count >= m_threadCount) {
+        m_idle.notifyAll();
+    } else {
+        for (int i = 0; i < count; ++i) {
+            m_idle.notifyOne();
+        }
+    }
+}
+
+void ThreadPool::runChunked(int begin, int end, int grain, ChunkBody body, void *context) {
+    if (end <= begin) {
+        return;
+    }
+
+    grain = qMax(1, grain);
+    const int chunks = static_cast<int>((static_cast<qint64>(end) - begin + grain - 1) / grain);
+    if (chunks == 1) {
+        body(context, begin, end);
+        return;
+    }
+
+    // The caller takes chunks too, so at most one helper per other chunk.
+    // Helpers run at the caller's priority.
+    const int helpers = qMin(chunks - 1, m_threadCount);
+    const Priority priority = t_pool == this ? static_cast<Priority>(t_level) : Priority::Normal;
+    BulkJob *job = new BulkJob(body, context, begin, end, grain, chunks, helpers + 1);
+    try {
+        submitMany(nullptr, job, helpers, priority);
+    } catch (...) {
+        delete job;
+        throw;
+    }
+
+    job->runChunks();
+    job->wait();
+
+    std::exception_ptr error = job->error();
+    job->release();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 int ThreadPool::threadCount() const {
     return m_threadCount;
 }
 
 int ThreadPool::queuedTaskCount() const {
-    std::lock_guard<std::mutex> lock(m_queueMutex);
-    return static_cast<int>(m_tasks.size());
+    int count = 0;
+    for (int level = 0; level < PRIORITY_COUNT; ++level) {
+        count += m_injectedCount[level].load(std::memory_order_relaxed);
+        for (const auto &worker : m_workers) {
+            count += static_cast<int>(worker->deques[level].size());
+        }
+    }
+    return count;
 }
 
 void ThreadPool::waitForDone() {
-    // We'll wait until there are no active threads and no queued tasks
-    while (true) {
-        std::unique_lock<std::mutex> lock(m_queueMutex);
-        if (m_tasks.empty() && m_activeThreads == 0) {
+    // We'll wait until every submitted task has completed. Workers signal
+    // each time they run out of work, so this sleeps instead of polling.
+    for (;;) {
+        EventCount::Key key = m_quiescent.prepareWait();
+        if (pendingTaskCount() == 0) {
+            m_quiescent.cancelWait();
             break;
         }
-        
-        // Wait for a short time and check again
-        lock.unlock();
-        QThread::msleep(10);
+        m_quiescent.wait(key);
     }
     
     qDebug() << "All tasks completed";
 }
 
-int ThreadPool::optimalThreadCount() {
-    // Get the number of hardware threads
-    int cores = std::thread::hardware_concurrency();
-    
-    // If we can't detect, use a reasonable default
-    if (cores <= 0) {
-        cores = 4;
+bool ThreadPool::isWorkerThread() const {
+    return t_pool == this;
+}
+
+ThreadPool::Tenant *ThreadPool::addTenant(const QString &name, int quota) {
+    std::lock_guard<std::mutex> lock(m_tenantsMutex);
+
+    m_tenantStorage.emplace_back(new Tenant(this, name, quota));
+    Tenant *tenant = m_tenantStorage.back().get();
+    m_tenants.append(tenant);
+    updateQuotas();
+
+    qDebug() << "ThreadPool: Added tenant" << name << "with a quota of" << tenant->quota() << "threads";
+    return tenant;
+}
+
+void ThreadPool::removeTenant(Tenant *tenant) {
+    if (!tenant) {
+        return;
     }
+
+    // Let everything the tenant submitted finish, including its backlog
+    for (;;) {
+        EventCount::Key key = tenant->m_idle.prepareWait();
+        const quint64 completed = tenant->m_completed.load(std::memory_order_acquire);
+        if (completed == tenant->m_submitted.load(std::memory_order_acquire)) {
+            tenant->m_idle.cancelWait();
+            break;
+        }
+        tenant->m_idle.wait(key);
+    }
+
+    std::lock_guard<std::mutex> lock(m_tenantsMutex);
+    m_tenants.removeAll(tenant);
+    updateQuotas();
+}
+
+QVector<ThreadPool::Tenant *> ThreadPool::tenants() const {
+    std::lock_guard<std::mutex> lock(m_tenantsMutex);
+    return m_tenants;
+}
+
+void ThreadPool::updateQuotas() {
+    // Caller holds m_tenantsMutex. Tenants without a fixed quota split the
+    // workers evenly, rounded up so that every worker can be in use.
+    int sharing = 0;
+    for (Tenant *tenant : m_tenants) {
+        if (tenant->m_requestedQuota <= 0) {
+            ++sharing;
+        }
+    }
+    const int share = sharing > 0 ? qMax(1, (m_threadCount + sharing - 1) / sharing) : m_threadCount;
+
+    for (Tenant *tenant : m_tenants) {
+        tenant->m_quota.store(tenant->m_requestedQuota > 0 ? tenant->m_requestedQuota : share,
+                              std::memory_order_relaxed);
+        // A larger quota may let waiting tasks run now
+        releaseBacklog(tenant);
+    }
+}
+
+ThreadPool *ThreadPool::shared() {
+    // Outlives every server; destroyed when the process exits
+    static ThreadPool pool(ThreadPlacement::current().poolThreads(), ThreadPlacement::current().poolCpus());
+    static const bool metricsRegistered = [] {
+        MetricsRegistry &metrics = MetricsRegistry::instance();
+        metrics.gauge("murmur_threadpool_queued_tasks", "Tasks waiting in the shared ThreadPool", QString(),
+                      [] { return static_cast<double>(pool.queuedTaskCount()); });
+        metrics.gauge("murmur_threadpool_pending_tasks", "Tasks of the shared ThreadPool that have not finished",
+                      QString(), [] { return static_cast<double>(pool.pendingTaskCount()); });
+        metrics.gauge("murmur_threadpool_workers", "Worker threads of the shared ThreadPool", QString(),
+                      [] { return static_cast<double>(pool.threadCount()); });
+        return true;
+    }();
+    Q_UNUSED(metricsRegistered);
+    return &pool;
+}
+
+int ThreadPool::optimalThreadCount() {
+    // One thread per CPU the process may run on; unlike
+    // hardware_concurrency() this honours taskset and cgroup CPU sets
+    int cores = CpuTopology::system().cpuCount();
     
     qDebug() << "Detected" << cores << "CPU cores";
     
@@ -89,42 +456,286 @@ int ThreadPool::optimalThreadCount() {
     return cores;
 }
 
-void ThreadPool::workerThread() {
+quint64 ThreadPool::pendingTaskCount() const {
+    // Completions are read before submissions: a task that was seen to
+    // complete was submitted before, so its submission is seen as well and
+    // the difference can never drop to zero while a task is outstanding
+    quint64 completed = 0;
+    for (const auto &worker : m_workers) {
+        completed += worker->completed.load(std::memory_order_acquire);
+    }
+
+    quint64 submitted = m_injectedTotal.load(std::memory_order_acquire);
+    for (const auto &worker : m_workers) {
+        submitted += worker->submitted.load(std::memory_order_acquire);
+    }
+
+    return submitted - completed;
+}
+
+void ThreadPool::workerThread(int index, QVector<int> cpus, int node) {
+    if (!CpuTopology::pinCurrentThread(cpus)) {
+        qWarning() << "ThreadPool: Failed to pin worker" << index << "to CPUs" << CpuTopology::formatCpuList(cpus);
+    }
+    
+    // Allocated here rather than in the constructor so that the queues are
+    // first touched, and therefore placed, on this worker's node
+    Worker *self = new Worker;
+    self->index = index;
+    self->node = node;
+    self->random = 0x9E3779B9u * static_cast<quint32>(index + 1);
+    
+    {
+        std::unique_lock<std::mutex> lock(m_startMutex);
+        m_workers[index].reset(self);
+        if (++m_startedCount == m_threadCount) {
+            m_startCondition.notify_all();
+        }
+        m_startCondition.wait(lock, [this] { return m_startedCount == m_threadCount; });
+    }
+    
+    t_pool = this;
+    t_worker = self;
+
     while (true) {
-        std::function<void()> task;
+        int level = 0;
+        Task *task = findTask(self, level);
         
-        // Wait for a task or stop signal
-        {
-            std::unique_lock<std::mutex> lock(m_queueMutex);
-            
-            // Wait until there's a task or we're stopping
-            m_condition.wait(lock, [this] {
-                return m_stop || !m_tasks.empty();
-            });
-            
-            // Exit if we're stopping and there are no more tasks
-            if (m_stop && m_tasks.empty()) {
+        // Briefly keep looking before going to sleep; work often arrives in bursts
+        for (int round = 0; !task && round < SPIN_ROUNDS; ++round) {
+            std::this_thread::yield();
+            task = findTask(self, level);
+        }
+        
+        if (!task) {
+            // Out of work: let waitForDone() check whether everything is done
+            m_quiescent.notifyAll();
+
+            // Announce the wait, then look once more so that a task submitted
+            // in between cannot be missed
+            EventCount::Key key = m_idle.prepareWait();
+            task = findTask(self, level);
+            if (task) {
+                m_idle.cancelWait();
+            } else if (m_stop.load(std::memory_order_seq_cst)) {
+                // Exit if we're stopping and there are no more tasks
+                m_idle.cancelWait();
                 return;
+            } else {
+                m_idle.wait(key);
+                continue;
             }
-            
-            // Get the next task
-            task = std::move(m_tasks.front());
-            m_tasks.pop();
-            
-            // Increment active thread count
-            ++m_activeThreads;
         }
         
-        // Execute the task
-        try {
-            task();
-        } catch (const std::exception& e) {
-            qWarning() << "Exception in ThreadPool task:" << e.what();
-        } catch (...) {
-            qWarning() << "Unknown exception in ThreadPool task";
+        runTask(self, task, level);
+    }
+}
+
+ThreadPool::Task *ThreadPool::findTask(Worker *self, int &level) {
+    // Advance the victim sequence once per search
+    self->random ^= self->random << 13;
+    self->random ^= self->random >> 17;
+    self->random ^= self->random << 5;
+
+    const int count = static_cast<int>(m_workers.size());
+    const int start = static_cast<int>(self->random % static_cast<quint32>(count));
+
+    // The most urgent level with any work wins, wherever that work is
+    Task *task = nullptr;
+    for (level = 0; level < PRIORITY_COUNT; ++level) {
+        // Own work first, newest first
+        if (self->deques[level].pop(task)) {
+            return task;
         }
-        
-        // Decrement active thread count
-        --m_activeThreads;
+
+        task = takeInjected(self, level);
+        if (task) {
+            return task;
+        }
+
+        // Steal the oldest task of another worker, starting at a random
+        // victim so that thieves spread out. Workers on the same node come
+        // first, so that a task and its data rarely cross sockets.
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < count; ++i) {
+                Worker *victim = m_workers[(start + i) % count].get();
+                if (victim == self || (victim->node == self->node) != (pass == 0)) {
+                    continue;
+                }
+
+                // A failed steal with work left means another thief won; try again
+                WorkStealingDeque<Task *> &deque = victim->deques[level];
+                while (!deque.empty()) {
+                    if (deque.steal(task)) {
+                        static MetricCounter &steals = MetricsRegistry::instance().counter(
+                            "murmur_threadpool_steals_total", "Tasks ThreadPool workers took from each other");
+                        steals.increment();
+                        return task;
+                    }
+                }
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+ThreadPool::Task *ThreadPool::takeInjected(Worker *self, int level) {
+    if (m_injectedCount[level].load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_injectMutex);
+    std::deque<Task *> &queue = m_injected[level];
+    if (queue.empty()) {
+        return nullptr;
     }
-}
\ No newline at end of file
+
+    Task *task = queue.front();
+    queue.pop_front();
+
+    // Take a fair share along so that a burst of external submissions is
+    // spread by stealing rather than by every worker taking this lock
+    const int share = qMin(INJECT_BATCH, static_cast<int>(queue.size()) / m_threadCount);
+    for (int i = 0; i < share; ++i) {
+        self->deques[level].push(queue.front());
+        queue.pop_front();
+    }
+
+    m_injectedCount[level].store(static_cast<int>(queue.size()), std::memory_order_relaxed);
+    return task;
+}
+
+void ThreadPool::runTask(Worker *self, Task *task, int level) {
+    // Read before running; the task may delete itself
+    Tenant *tenant = task->m_tenant;
+    const bool counted = tenant && task->m_root;
+    if (counted && !admit(tenant, task, level)) {
+        // Parked in the tenant's backlog until one of its tasks finishes
+        return;
+    }
+
+    // Tasks started from this one inherit its priority and tenant by default
+    const int outerLevel = t_level;
+    Tenant *outerTenant = t_tenant;
+    t_level = level;
+    t_tenant = tenant;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Execute the task
+    try {
+        task->run();
+    } catch (const std::exception& e) {
+        qWarning() << "Exception in ThreadPool task:" << e.what();
+    } catch (...) {
+        qWarning() << "Unknown exception in ThreadPool task";
+    }
+
+    t_level = outerLevel;
+    t_tenant = outerTenant;
+
+    static MetricHistogram &duration = MetricsRegistry::instance().histogram(
+        "murmur_threadpool_task_duration_seconds", "Time ThreadPool tasks ran");
+    const qint64 busyNs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    duration.record(static_cast<quint64>(busyNs / 1000));
+    tasksRun(level).increment();
+
+    if (tenant) {
+        tenant->m_busyNs.fetch_add(busyNs, std::memory_order_relaxed);
+        finishTenantTask(tenant, counted);
+    }
+    self->completed.store(self->completed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool ThreadPool::admit(Tenant *tenant, Task *task, int level) {
+    // A task released from the backlog already holds a slot
+    int released = task->m_released.load(std::memory_order_relaxed);
+    while (released > 0) {
+        if (task->m_released.compare_exchange_weak(released, released - 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+
+    // New tasks queue behind those already waiting, so the backlog drains in order
+    if (tenant->m_backlogCount.load(std::memory_order_seq_cst) == 0) {
+        if (tenant->m_running.fetch_add(1, std::memory_order_seq_cst) < tenant->m_quota.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        tenant->m_running.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(tenant->m_backlogMutex);
+        tenant->m_backlog.emplace_back(task, level);
+        tenant->m_backlogCount.fetch_add(1, std::memory_order_seq_cst);
+    }
+    tenant->m_deferrals.fetch_add(1, std::memory_order_relaxed);
+
+    // A task that finished since the check above may have missed the new entry
+    releaseBacklog(tenant);
+    return false;
+}
+
+void ThreadPool::finishTenantTask(Tenant *tenant, bool counted) {
+    if (counted) {
+        tenant->m_running.fetch_sub(1, std::memory_order_seq_cst);
+        if (tenant->m_backlogCount.load(std::memory_order_seq_cst) > 0) {
+            releaseBacklog(tenant);
+        }
+    }
+
+    const quint64 completed = tenant->m_completed.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (completed == tenant->m_submitted.load(std::memory_order_acquire)) {
+        tenant->m_idle.notifyAll();
+    }
+}
+
+void ThreadPool::releaseBacklog(Tenant *tenant) {
+    std::lock_guard<std::mutex> lock(tenant->m_backlogMutex);
+    while (!tenant->m_backlog.empty()) {
+        // Reserve the slot before handing the task back to the workers, so
+        // that new submissions cannot take it first
+        if (tenant->m_running.fetch_add(1, std::memory_order_seq_cst) >= tenant->m_quota.load(std::memory_order_relaxed)) {
+            tenant->m_running.fetch_sub(1, std::memory_order_seq_cst);
+            break;
+        }
+
+        const std::pair<Task *, int> entry = tenant->m_backlog.front();
+        tenant->m_backlog.pop_front();
+        tenant->m_backlogCount.fetch_sub(1, std::memory_order_seq_cst);
+
+        entry.first->m_released.fetch_add(1, std::memory_order_relaxed);
+        reschedule(entry.first, entry.second);
+    }
+}
+
+void ThreadPool::reschedule(Task *task, int level) {
+    // Already counted as submitted, so only the queue changes
+    if (t_pool == this) {
+        static_cast<Worker *>(t_worker)->deques[level].push(task);
+    } else {
+        std::lock_guard<std::mutex> lock(m_injectMutex);
+        m_injected[level].push_back(task);
+        m_injectedCount[level].store(static_cast<int>(m_injected[level].size()), std::memory_order_relaxed);
+    }
+    m_idle.notifyOne();
+}
+
+bool ThreadPool::runPendingTask() {
+    // Only a worker of this pool can help; its deques are not shared with
+    // other threads' pushes
+    if (t_pool != this) {
+        return false;
+    }
+
+    Worker *self = static_cast<Worker *>(t_worker);
+    int level = 0;
+    Task *task = findTask(self, level);
+    if (!task) {
+        return false;
+    }
+
+    runTask(self, task, level);
+    return true;
+}
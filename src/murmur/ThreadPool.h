@@ -6,19 +6,25 @@
 #ifndef MUMBLE_MURMUR_THREADPOOL_H_
 #define MUMBLE_MURMUR_THREADPOOL_H_
 
+#include "EventCount.h"
+
 #include <QtCore/QtGlobal>
 #include <QtCore/QObject>
 #include <QtCore/QDebug>
+#include <QtCore/QString>
+#include <QtCore/QVector>
 
+#include <condition_variable>
 #include <functional>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
-#include <queue>
+#include <deque>
 #include <future>
 #include <vector>
 #include <memory>
 #include <atomic>
+#include <type_traits>
+#include <utility>
 
 /**
  * @brief The ThreadPool class provides a pool of worker threads for parallel task execution.
@@ -26,10 +32,158 @@
  * This class manages a group of worker threads and distributes tasks among them to enable
  * parallel execution across multiple CPU cores. It is designed to improve the performance
  * of computationally intensive operations by utilizing all available processor cores.
+ *
+ * Scheduling is work-stealing: every worker owns a Chase-Lev deque that it
+ * pushes to and pops from without locking. Tasks submitted from a worker go
+ * to that worker's deque; tasks submitted from other threads go to a shared
+ * injection queue that idle workers drain in small batches. A worker that
+ * runs out of work steals from the other deques before parking on an
+ * EventCount, so submitting to a busy pool never touches a shared lock and
+ * waking a worker costs nothing while none is asleep.
+ *
+ * Every task has a priority. A worker always takes the most urgent task it
+ * can find, own or stolen, so realtime work overtakes queued normal and
+ * background work; a task that is already running is never interrupted.
+ * TaskGroup builds grouped waiting and cancellation on top of this.
+ *
+ * One pool is shared by the whole process (see shared()). Each virtual
+ * server submits on behalf of its own Tenant, which counts the server's
+ * tasks and CPU time and caps how many of its tasks run at once, so one busy
+ * server cannot occupy every worker. Tasks started by a running task belong
+ * to the same tenant and are not capped, which keeps nested waits from
+ * deadlocking on the quota.
  */
 class ThreadPool : public QObject {
     Q_OBJECT
 public:
+    /**
+     * @brief Scheduling priority of a task.
+     */
+    enum class Priority {
+        Realtime, ///< Latency-sensitive work that must not queue behind anything else
+        Normal, ///< The default
+        Background ///< Work that only runs when nothing else is waiting
+    };
+
+    class Tenant;
+
+    /**
+     * @brief A unit of work for submit().
+     *
+     * The pool does not own tasks. A task that lives on the heap deletes
+     * itself at the end of run().
+     */
+    class Task {
+    public:
+        virtual ~Task() = default;
+
+        /**
+         * @brief Execute the task on a worker thread.
+         */
+        virtual void run() = 0;
+
+    private:
+        friend class ThreadPool;
+
+        // Set by the pool on submission
+        Tenant *m_tenant = nullptr;
+        bool m_root = false;
+
+        // Backlog releases that already hold a quota slot for this task
+        std::atomic<int> m_released{ 0 };
+    };
+
+    /**
+     * @brief A client of the pool, typically one virtual server, with a quota and counters.
+     *
+     * Tasks submitted inside a TenantScope belong to its tenant, and so do
+     * the tasks they start. At most quota() tasks submitted from outside the
+     * pool run at the same time; further ones wait in the tenant's backlog
+     * until one of them finishes, without blocking a worker.
+     */
+    class Tenant {
+    public:
+        /**
+         * @brief Counters of a tenant.
+         */
+        struct Stats {
+            quint64 submitted; ///< Tasks submitted
+            quint64 completed; ///< Tasks that finished running
+            quint64 deferred; ///< Times a task waited because the quota was used up
+            qint64 busyNs; ///< Wall time spent running the tenant's tasks
+            int running; ///< Quota-counted tasks running now
+            int quota; ///< Current quota
+        };
+
+        /**
+         * @brief Get the name of the tenant.
+         *
+         * @return The name given to addTenant()
+         */
+        const QString &name() const { return m_name; }
+
+        /**
+         * @brief Get the number of quota-counted tasks that may run at once.
+         *
+         * @return The quota
+         */
+        int quota() const { return m_quota.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Get a snapshot of the tenant's counters.
+         *
+         * @return The counters
+         */
+        Stats stats() const;
+
+    private:
+        friend class ThreadPool;
+
+        Tenant(ThreadPool *pool, const QString &name, int requestedQuota);
+
+        ThreadPool *const m_pool;
+        const QString m_name;
+        const int m_requestedQuota;
+
+        std::atomic<int> m_quota;
+        std::atomic<int> m_running;
+        std::atomic<quint64> m_submitted;
+        std::atomic<quint64> m_completed;
+        std::atomic<quint64> m_deferrals;
+        std::atomic<qint64> m_busyNs;
+
+        // Tasks held back by the quota, with their priority level
+        std::mutex m_backlogMutex;
+        std::deque<std::pair<Task *, int>> m_backlog;
+        std::atomic<int> m_backlogCount;
+
+        // Signalled when the last outstanding task finishes
+        EventCount m_idle;
+    };
+
+    /**
+     * @brief Makes the calling thread submit on behalf of a tenant while it exists.
+     *
+     * Scopes nest; the previous tenant is restored on destruction.
+     */
+    class TenantScope {
+    public:
+        /**
+         * @brief Constructor for TenantScope.
+         *
+         * @param tenant The tenant; null submits without one
+         */
+        explicit TenantScope(Tenant *tenant);
+
+        ~TenantScope();
+
+        TenantScope(const TenantScope &) = delete;
+        TenantScope &operator=(const TenantScope &) = delete;
+
+    private:
+        Tenant *m_previous;
+    };
+
     /**
      * @brief Constructor for ThreadPool.
      * 
@@ -39,11 +193,25 @@ public:
      * @param parent The parent QObject
      */
     explicit ThreadPool(int numThreads = 0, QObject *parent = nullptr);
+
+    /**
+     * @brief Constructor for ThreadPool with CPU placement.
+     *
+     * Worker i is confined to the NUMA node of cpus[i % cpus.size()], on the
+     * CPUs of that node that appear in cpus, and allocates its own queues
+     * after moving there so that they live in node-local memory. Idle workers
+     * steal from workers on their own node first.
+     *
+     * @param numThreads The number of worker threads to create. If 0, it will use the number of CPU cores.
+     * @param cpus The CPUs the workers may run on, ordered by preference (empty = no pinning)
+     * @param parent The parent QObject
+     */
+    ThreadPool(int numThreads, const QVector<int> &cpus, QObject *parent = nullptr);
     
     /**
      * @brief Destructor for ThreadPool.
      * 
-     * Ensures all worker threads are properly terminated.
+     * Runs the tasks that are still queued, then terminates the worker threads.
      */
     virtual ~ThreadPool();
     
@@ -60,6 +228,71 @@ public:
     auto enqueue(F&& func, Args&&... args) 
         -> std::future<typename std::result_of<F(Args...)>::type>;
     
+    /**
+     * @brief Schedules a task without allocating.
+     *
+     * Called from a worker of this pool, the task goes to that worker's own
+     * deque; otherwise to the injection queue.
+     *
+     * @param task The task; must stay valid until its run() returns
+     * @param priority The priority of the task
+     * @throws std::runtime_error if the pool is stopping
+     */
+    void submit(Task *task, Priority priority = Priority::Normal);
+
+    /**
+     * @brief Schedules several tasks with one wake-up pass.
+     *
+     * Tasks from outside the pool take the injection lock once for the whole
+     * batch instead of once per task.
+     *
+     * @param tasks The tasks; each must stay valid until its run() returns
+     * @param count The number of tasks
+     * @param priority The priority of the tasks
+     * @throws std::runtime_error if the pool is stopping
+     */
+    void submitBulk(Task *const *tasks, int count, Priority priority = Priority::Normal);
+
+    /**
+     * @brief Calls fn(i) for every i in [begin, end) and waits until all calls returned.
+     *
+     * The range is cut into chunks of grain indices that the workers and the
+     * calling thread claim from a shared counter, so there is one allocation
+     * per call and none per index or chunk. The caller waits on a single
+     * completion count. Safe to call from a worker thread: the caller works
+     * through the chunks itself and only waits for chunks already running.
+     *
+     * Chunks run at the priority of the calling task, or at normal priority
+     * when called from outside the pool. If fn throws, the remaining chunks
+     * still run and the first exception is rethrown to the caller.
+     *
+     * @param begin The first index
+     * @param end One past the last index
+     * @param grain The number of indices per chunk; small for uneven work,
+     * large for cheap per-index work
+     * @param fn The function to call with each index
+     */
+    template<class Fn>
+    void parallelFor(int begin, int end, int grain, Fn &&fn);
+
+    /**
+     * @brief Reduces map(i) over [begin, end) with combine.
+     *
+     * Each chunk is folded in index order and the chunk results are combined
+     * in chunk order, so the result does not depend on scheduling (which
+     * matters for floating point sums).
+     *
+     * @param begin The first index
+     * @param end One past the last index
+     * @param grain The number of indices per chunk
+     * @param identity The neutral element of combine
+     * @param map Produces the value of one index
+     * @param combine Combines two values
+     * @return The combined value, identity for an empty range
+     */
+    template<class T, class Map, class Combine>
+    T parallelReduce(int begin, int end, int grain, T identity, Map &&map, Combine &&combine);
+
     /**
      * @brief Gets the number of worker threads in the pool.
      * 
@@ -70,15 +303,64 @@ public:
     /**
      * @brief Gets the number of tasks currently in the queue.
      * 
+     * Approximate while workers are running.
+     *
      * @return The number of queued tasks
      */
     int queuedTaskCount() const;
     
     /**
      * @brief Waits for all tasks to complete.
+     *
+     * Sleeps until the workers run out of work. Must not be called from a
+     * worker thread.
      */
     void waitForDone();
+
+    /**
+     * @brief Checks whether the calling thread is a worker of this pool.
+     *
+     * @return True on a worker thread of this pool
+     */
+    bool isWorkerThread() const;
     
+    /**
+     * @brief Registers a client of the pool.
+     *
+     * @param name A name for the logs
+     * @param quota The number of its tasks from outside the pool that may
+     * run at once; 0 for an equal share of the workers among all tenants
+     * registered with 0
+     * @return The tenant, owned by the pool until removeTenant()
+     */
+    Tenant *addTenant(const QString &name, int quota = 0);
+
+    /**
+     * @brief Unregisters a client of the pool.
+     *
+     * Waits until every task of the tenant has finished, then frees it.
+     * Must not be called from a task of that tenant.
+     *
+     * @param tenant The tenant
+     */
+    void removeTenant(Tenant *tenant);
+
+    /**
+     * @brief Gets the registered tenants.
+     *
+     * @return The tenants in registration order
+     */
+    QVector<Tenant *> tenants() const;
+
+    /**
+     * @brief Gets the pool shared by all servers of the process.
+     *
+     * Created on first use with the size and CPUs of ThreadPlacement::current().
+     *
+     * @return The shared pool
+     */
+    static ThreadPool *shared();
+
     /**
      * @brief Gets the optimal number of threads based on CPU cores.
      * 
@@ -87,17 +369,76 @@ public:
     static int optimalThreadCount();
 
 private:
-    std::vector<std::thread> m_workers;
-    std::queue<std::function<void()>> m_tasks;
+    friend class TaskGroup;
+
+    struct Worker;
+    class BulkJob;
+
+    static constexpr int PRIORITY_COUNT = 3;
+
+    // Runs the indices [begin, end) of one chunk
+    using ChunkBody = void (*)(void *context, int begin, int end);
     
-    mutable std::mutex m_queueMutex;
-    std::condition_variable m_condition;
+    // Runs a packaged task and frees itself; replaces the shared_ptr and
+    // std::function wrappers around each enqueued task
+    template<class R>
+    class PackagedTask : public Task {
+    public:
+        template<class Callable>
+        explicit PackagedTask(Callable &&callable) : m_task(std::forward<Callable>(callable)) {}
+
+        std::future<R> future() { return m_task.get_future(); }
+
+        void run() override {
+            m_task();
+            delete this;
+        }
+
+    private:
+        std::packaged_task<R()> m_task;
+    };
+
+    // Each worker allocates its own entry once it runs on its node; the
+    // constructor returns only after all of them have done so
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::mutex m_startMutex;
+    std::condition_variable m_startCondition;
+    int m_startedCount;
+
+    // Tasks from threads outside the pool, one queue per priority
+    mutable std::mutex m_injectMutex;
+    std::deque<Task *> m_injected[PRIORITY_COUNT];
+    std::atomic<int> m_injectedCount[PRIORITY_COUNT];
+    std::atomic<quint64> m_injectedTotal;
+
+    // Idle workers park on m_idle; waitForDone() waits on m_quiescent, which
+    // workers signal whenever they run out of work
+    EventCount m_idle;
+    EventCount m_quiescent;
     std::atomic<bool> m_stop;
-    std::atomic<int> m_activeThreads;
     
     int m_threadCount;
     
-    void workerThread();
+    // Removed tenants stay allocated until the pool is destroyed, because a
+    // worker may still be signalling one after its last task finished
+    mutable std::mutex m_tenantsMutex;
+    QVector<Tenant *> m_tenants;
+    std::vector<std::unique_ptr<Tenant>> m_tenantStorage;
+    
+    void runChunked(int begin, int end, int grain, ChunkBody body, void *context);
+    void submitMany(Task *const *tasks, Task *repeated, int count, Priority priority);
+    void workerThread(int index, QVector<int> cpus, int node);
+    Task *findTask(Worker *self, int &level);
+    Task *takeInjected(Worker *self, int level);
+    void runTask(Worker *self, Task *task, int level);
+    bool admit(Tenant *tenant, Task *task, int level);
+    void finishTenantTask(Tenant *tenant, bool counted);
+    void releaseBacklog(Tenant *tenant);
+    void reschedule(Task *task, int level);
+    void updateQuotas();
+    bool runPendingTask();
+    quint64 pendingTaskCount() const;
 };
 
 // Template implementation must be in the header file
@@ -108,30 +449,61 @@ auto ThreadPool::enqueue(F&& func, Args&&... args)
     using return_type = typename std::result_of<F(Args...)>::type;
     
     // Create a packaged task with the function and its arguments
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
-        std::bind(std::forward<F>(func), std::forward<Args>(args)...)
-    );
+    std::unique_ptr<PackagedTask<return_type>> task(
+        new PackagedTask<return_type>(std::bind(std::forward<F>(func), std::forward<Args>(args)...)));
     
     // Get the future result
-    std::future<return_type> result = task->get_future();
+    std::future<return_type> result = task->future();
+    
+    // Throws if the pool is stopping, in which case the task is freed here
+    submit(task.get());
+    task.release();
     
-    // Add the task to the queue
-    {
-        std::lock_guard<std::mutex> lock(m_queueMutex);
-        
-        // Don't allow enqueueing after stopping the pool
-        if (m_stop) {
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+    return result;
+}
+
+template<class Fn>
+void ThreadPool::parallelFor(int begin, int end, int grain, Fn &&fn) {
+    using Callable = typename std::remove_reference<Fn>::type;
+
+    // The callable stays on the caller's stack; chunks reach it through a
+    // plain function pointer
+    ChunkBody body = [](void *context, int chunkBegin, int chunkEnd) {
+        Callable &callable = *static_cast<Callable *>(context);
+        for (int i = chunkBegin; i < chunkEnd; ++i) {
+            callable(i);
         }
-        
-        // Wrap the packaged task in a void function
-        m_tasks.emplace([task]() { (*task)(); });
+    };
+    runChunked(begin, end, grain, body, const_cast<typename std::remove_const<Callable>::type *>(std::addressof(fn)));
+}
+
+template<class T, class Map, class Combine>
+T ThreadPool::parallelReduce(int begin, int end, int grain, T identity, Map &&map, Combine &&combine) {
+    if (end <= begin) {
+        return identity;
+    }
+
+    grain = qMax(1, grain);
+    const int chunks = static_cast<int>((static_cast<qint64>(end) - begin + grain - 1) / grain);
+
+    // One partial result per chunk
+    std::vector<T> partials(chunks, identity);
+    parallelFor(0, chunks, 1, [&](int chunk) {
+        const int chunkBegin = begin + chunk * grain;
+        const int chunkEnd = qMin(end, chunkBegin + grain);
+
+        T value = identity;
+        for (int i = chunkBegin; i < chunkEnd; ++i) {
+            value = combine(std::move(value), map(i));
+        }
+        partials[chunk] = std::move(value);
+    });
+
+    T result = std::move(identity);
+    for (T &partial : partials) {
+        result = combine(std::move(result), std::move(partial));
     }
-    
-    // Notify one worker thread that there's a new task
-    m_condition.notify_one();
-    
     return result;
 }
 
-#endif // MUMBLE_MURMUR_THREADPOOL_H_
\ No newline at end of file
+#endif // MUMBLE_MURMUR_THREADPOOL_H_
@@ -10,6 +10,7 @@
 #include <QObject>
 
 #include "Timer.h"
+#include "CoarseClock.h"
 
 Timer::Timer() : m_additionalTime(0), m_active(false) {
 }
@@ -25,7 +26,7 @@ Timer::~Timer() {
 
 void Timer::start() {
     QMutexLocker locker(&m_mutex);
-    m_startTime = QDateTime::currentDateTime();
+    m_startTime = CoarseClock::instance().utc();
     m_timer.start();
     m_active = true;
 }
@@ -41,7 +42,7 @@ void Timer::stop() {
 void Timer::restart() {
     QMutexLocker locker(&m_mutex);
     m_additionalTime = 0;
-    m_startTime = QDateTime::currentDateTime();
+    m_startTime = CoarseClock::instance().utc();
     m_timer.restart();
     m_active = true;
 }
@@ -0,0 +1,219 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ToneBank.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double PI = 3.141592653589793;
+
+    const int TABLE_SIZE = 1 << ToneBank::TABLE_BITS;
+    const int FRACTION_BITS = 32 - ToneBank::TABLE_BITS;
+    const uint32_t FRACTION_MASK = (1u << FRACTION_BITS) - 1;
+    const float FRACTION_SCALE = 1.0f / static_cast<float>(1u << FRACTION_BITS);
+}
+
+ToneBank::ToneBank(int sampleRate, float riseTimeMs)
+    : m_sampleRate(qMax(1, sampleRate))
+    , m_riseSamples(1)
+    , m_allocated(0) {
+    m_sine.resize(TABLE_SIZE + 1);
+    for (int i = 0; i <= TABLE_SIZE; ++i) {
+        m_sine[static_cast<size_t>(i)] = static_cast<float>(std::sin(2.0 * PI * i / TABLE_SIZE));
+    }
+
+    setRiseTime(riseTimeMs);
+}
+
+void ToneBank::setRiseTime(float ms) {
+    const int riseSamples = qMax(1, static_cast<int>(std::lround(m_sampleRate * ms / 1000.0f)));
+
+    // Keep tones that are mid-edge at the same relative position
+    for (int &envelope : m_envelope) {
+        envelope = static_cast<int>(static_cast<qint64>(envelope) * riseSamples / m_riseSamples);
+    }
+
+    m_riseSamples = riseSamples;
+    m_edge.resize(static_cast<size_t>(m_riseSamples) + 1);
+    for (int i = 0; i <= m_riseSamples; ++i) {
+        m_edge[static_cast<size_t>(i)] = static_cast<float>(0.5 * (1.0 - std::cos(PI * i / m_riseSamples)));
+    }
+}
+
+int ToneBank::allocate(float pitchHz, float amplitude) {
+    int slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slot = static_cast<int>(m_phase.size());
+        m_phase.push_back(0);
+        m_increment.push_back(0);
+        m_amplitude.push_back(0.0f);
+        m_envelope.push_back(0);
+        m_keyDown.push_back(0);
+        m_inUse.push_back(0);
+        m_edges.emplace_back();
+    }
+
+    const size_t i = static_cast<size_t>(slot);
+    m_phase[i] = 0;
+    m_increment[i] = phaseIncrement(pitchHz);
+    m_amplitude[i] = amplitude;
+    m_envelope[i] = 0;
+    m_keyDown[i] = 0;
+    m_inUse[i] = 1;
+    m_edges[i].clear();
+    ++m_allocated;
+
+    return slot;
+}
+
+void ToneBank::release(int slot) {
+    if (slot < 0 || slot >= static_cast<int>(m_inUse.size()) || !m_inUse[static_cast<size_t>(slot)]) {
+        return;
+    }
+
+    m_inUse[static_cast<size_t>(slot)] = 0;
+    m_edges[static_cast<size_t>(slot)].clear();
+    m_freeSlots.push_back(slot);
+    --m_allocated;
+}
+
+void ToneBank::setPitch(int slot, float pitchHz) {
+    m_increment[static_cast<size_t>(slot)] = phaseIncrement(pitchHz);
+}
+
+void ToneBank::setAmplitude(int slot, float amplitude) {
+    m_amplitude[static_cast<size_t>(slot)] = amplitude;
+}
+
+void ToneBank::key(int slot, int offset, bool keyDown) {
+    std::vector<Edge> &edges = m_edges[static_cast<size_t>(slot)];
+    Edge edge = { qMax(0, offset), keyDown };
+
+    // Keep the block's edges sorted; they almost always arrive in order
+    auto pos = std::upper_bound(edges.begin(), edges.end(), edge,
+                                [](const Edge &a, const Edge &b) { return a.offset < b.offset; });
+    edges.insert(pos, edge);
+}
+
+bool ToneBank::isSilent(int slot) const {
+    const size_t i = static_cast<size_t>(slot);
+    return !m_keyDown[i] && m_envelope[i] == 0 && m_edges[i].empty();
+}
+
+void ToneBank::render(int slot, float *out, int frames) {
+    std::vector<Edge> &edges = m_edges[static_cast<size_t>(slot)];
+
+    // Split the block at the scheduled edges
+    int pos = 0;
+    for (const Edge &edge : edges) {
+        const int at = qMin(edge.offset, frames);
+        if (at > pos) {
+            renderRun(slot, out + pos, at - pos);
+            pos = at;
+        }
+        m_keyDown[static_cast<size_t>(slot)] = edge.keyDown ? 1 : 0;
+    }
+
+    if (pos < frames) {
+        renderRun(slot, out + pos, frames - pos);
+    }
+
+    edges.clear();
+}
+
+int ToneBank::renderAll(int frames, const ToneSink &sink) {
+    m_scratch.resize(static_cast<size_t>(qMax(0, frames)));
+
+    int delivered = 0;
+    for (size_t i = 0; i < m_inUse.size(); ++i) {
+        if (!m_inUse[i]) {
+            continue;
+        }
+
+        const int slot = static_cast<int>(i);
+        if (isSilent(slot)) {
+            // Keep the phase running so a later key-down continues the same carrier
+            m_phase[i] += m_increment[i] * static_cast<uint32_t>(frames);
+            continue;
+        }
+
+        render(slot, m_scratch.data(), frames);
+        sink(slot, m_scratch.data(), frames);
+        ++delivered;
+    }
+
+    return delivered;
+}
+
+uint32_t ToneBank::phaseIncrement(float pitchHz) const {
+    const double cycles = qBound(0.0, static_cast<double>(pitchHz) / m_sampleRate, 0.5);
+    return static_cast<uint32_t>(std::llround(cycles * 4294967296.0));
+}
+
+void ToneBank::renderRun(int slot, float *out, int frames) {
+    const size_t i = static_cast<size_t>(slot);
+    const bool keyDown = m_keyDown[i] != 0;
+    const float amplitude = m_amplitude[i];
+    const uint32_t increment = m_increment[i];
+    int &envelope = m_envelope[i];
+
+    int pos = 0;
+
+    // Finish (or start) the edge first; it walks the edge table one step per sample
+    const int edgeLength = qMin(frames, keyDown ? m_riseSamples - envelope : envelope);
+    if (edgeLength > 0) {
+        if (keyDown) {
+            renderEdge(m_phase[i], increment, amplitude, m_edge.data() + envelope + 1, 1, out, edgeLength);
+            envelope += edgeLength;
+        } else {
+            renderEdge(m_phase[i], increment, amplitude, m_edge.data() + envelope - 1, -1, out, edgeLength);
+            envelope -= edgeLength;
+        }
+        m_phase[i] += increment * static_cast<uint32_t>(edgeLength);
+        pos = edgeLength;
+    }
+
+    if (pos < frames) {
+        if (keyDown) {
+            renderSine(m_phase[i], increment, amplitude, out + pos, frames - pos);
+        } else {
+            std::fill(out + pos, out + frames, 0.0f);
+        }
+        m_phase[i] += increment * static_cast<uint32_t>(frames - pos);
+    }
+}
+
+void ToneBank::renderSine(uint32_t phase, uint32_t increment, float amplitude, float *out, int frames) const {
+    const float *sine = m_sine.data();
+
+    // Each sample's phase is derived from the run start, so iterations are independent
+    for (int n = 0; n < frames; ++n) {
+        const uint32_t p = phase + increment * static_cast<uint32_t>(n);
+        const uint32_t index = p >> FRACTION_BITS;
+        const float fraction = static_cast<float>(p & FRACTION_MASK) * FRACTION_SCALE;
+        const float a = sine[index];
+        const float b = sine[index + 1];
+        out[n] = amplitude * (a + fraction * (b - a));
+    }
+}
+
+void ToneBank::renderEdge(uint32_t phase, uint32_t increment, float amplitude, const float *edge, int step, float *out,
+                          int frames) const {
+    const float *sine = m_sine.data();
+
+    for (int n = 0; n < frames; ++n) {
+        const uint32_t p = phase + increment * static_cast<uint32_t>(n);
+        const uint32_t index = p >> FRACTION_BITS;
+        const float fraction = static_cast<float>(p & FRACTION_MASK) * FRACTION_SCALE;
+        const float a = sine[index];
+        const float b = sine[index + 1];
+        out[n] = amplitude * edge[n * step] * (a + fraction * (b - a));
+    }
+}
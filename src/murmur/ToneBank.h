@@ -0,0 +1,180 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TONEBANK_H_
+#define MUMBLE_MURMUR_TONEBANK_H_
+
+#include <QtCore/QtGlobal>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The ToneBank class renders many keyed sine tones cheaply.
+ *
+ * Every tone is a slot in a structure-of-arrays bank: a 32-bit phase
+ * accumulator stepping through a small interpolated sine table, an amplitude
+ * and a keying envelope. Key edges follow a raised-cosine table so the tone
+ * starts and stops without clicks.
+ *
+ * Rendering is split at key edges into runs where the envelope is either
+ * constant or follows the edge table. Within a run the phase of every sample
+ * is computed directly from the run's start phase, so there is no
+ * loop-carried dependency and the sample loop can be vectorized (the edge
+ * table is read contiguously; the sine table is a gather). Tones whose key is
+ * up and whose edge has decayed cost nothing beyond advancing the phase.
+ *
+ * A ToneBank is not thread-safe; it is meant to be owned by one renderer.
+ */
+class ToneBank {
+public:
+    /// log2 of the sine table size
+    static constexpr int TABLE_BITS = 10;
+
+    /**
+     * @brief Callback that receives a rendered tone.
+     *
+     * @param slot The tone's slot
+     * @param pcm The rendered samples
+     * @param frames The number of samples
+     */
+    using ToneSink = std::function<void(int slot, const float *pcm, int frames)>;
+
+    /**
+     * @brief Constructor for ToneBank.
+     *
+     * @param sampleRate The output sample rate in Hz
+     * @param riseTimeMs The duration of a key edge in milliseconds
+     */
+    explicit ToneBank(int sampleRate = 48000, float riseTimeMs = 5.0f);
+
+    /**
+     * @brief Set the duration of the key edges.
+     *
+     * Tones that are in the middle of an edge finish it with the new shape.
+     *
+     * @param ms The edge duration in milliseconds
+     */
+    void setRiseTime(float ms);
+
+    /**
+     * @brief Allocate a tone.
+     *
+     * The tone starts with its key up.
+     *
+     * @param pitchHz The tone pitch in Hz
+     * @param amplitude The peak amplitude
+     * @return The slot of the new tone
+     */
+    int allocate(float pitchHz, float amplitude = 0.5f);
+
+    /**
+     * @brief Release a tone so its slot can be reused.
+     *
+     * @param slot The tone's slot
+     */
+    void release(int slot);
+
+    /**
+     * @brief Change the pitch of a tone without a phase jump.
+     *
+     * @param slot The tone's slot
+     * @param pitchHz The new pitch in Hz
+     */
+    void setPitch(int slot, float pitchHz);
+
+    /**
+     * @brief Change the amplitude of a tone.
+     *
+     * @param slot The tone's slot
+     * @param amplitude The new peak amplitude
+     */
+    void setAmplitude(int slot, float amplitude);
+
+    /**
+     * @brief Schedule a key edge in the next rendered block.
+     *
+     * @param slot The tone's slot
+     * @param offset The sample within the next block at which the edge starts
+     * @param keyDown True for key-down, false for key-up
+     */
+    void key(int slot, int offset, bool keyDown);
+
+    /**
+     * @brief Check whether the next block of a tone would be silent.
+     *
+     * @param slot The tone's slot
+     * @return True if the key is up, the edge has decayed and nothing is scheduled
+     */
+    bool isSilent(int slot) const;
+
+    /**
+     * @brief Render the next block of one tone.
+     *
+     * Applies and clears the edges scheduled for the block.
+     *
+     * @param slot The tone's slot
+     * @param out Receives the samples
+     * @param frames The block length
+     */
+    void render(int slot, float *out, int frames);
+
+    /**
+     * @brief Render the next block of every allocated tone.
+     *
+     * Silent tones are advanced but not delivered.
+     *
+     * @param frames The block length
+     * @param sink Callback that receives each audible tone
+     * @return The number of tones delivered
+     */
+    int renderAll(int frames, const ToneSink &sink);
+
+    /**
+     * @brief Get the number of allocated tones.
+     *
+     * @return The number of allocated tones
+     */
+    int toneCount() const { return m_allocated; }
+
+private:
+    Q_DISABLE_COPY(ToneBank)
+
+    struct Edge {
+        int offset;
+        bool keyDown;
+    };
+
+    int m_sampleRate;
+    int m_riseSamples;
+
+    // Shared tables: sine with one guard point for interpolation, and the
+    // raised-cosine edge from 0 to 1 in m_riseSamples steps
+    std::vector<float> m_sine;
+    std::vector<float> m_edge;
+
+    // Per-tone state, one entry per slot
+    std::vector<uint32_t> m_phase;
+    std::vector<uint32_t> m_increment;
+    std::vector<float> m_amplitude;
+    std::vector<int> m_envelope; // Position in m_edge
+    std::vector<uint8_t> m_keyDown;
+    std::vector<uint8_t> m_inUse;
+    std::vector<std::vector<Edge>> m_edges; // Edges scheduled for the next block
+
+    std::vector<int> m_freeSlots;
+    std::vector<float> m_scratch;
+    int m_allocated;
+
+    uint32_t phaseIncrement(float pitchHz) const;
+
+    void renderRun(int slot, float *out, int frames);
+    void renderSine(uint32_t phase, uint32_t increment, float amplitude, float *out, int frames) const;
+    void renderEdge(uint32_t phase, uint32_t increment, float amplitude, const float *edge, int step, float *out,
+                    int frames) const;
+};
+
+#endif // MUMBLE_MURMUR_TONEBANK_H_
@@ -0,0 +1,158 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICEHOOK_H_
+#define MUMBLE_MURMUR_VOICEHOOK_H_
+
+#include "MumbleProtocol.h"
+#include "VolumeAdjustment.h"
+
+#include <QtCore/QtGlobal>
+
+#include <tuple>
+#include <type_traits>
+
+class Channel;
+class Server;
+class ServerUser;
+
+/**
+ * @brief One voice packet on its way through Server::processMsg().
+ */
+struct VoicePacket {
+    ServerUser *speaker; ///< The user who sent the packet
+    Channel *channel; ///< The speaker's channel
+    const Mumble::Protocol::AudioData *audio; ///< The decoded packet
+};
+
+/**
+ * @brief Base of the hooks modules add to the voice path.
+ *
+ * A hook is a plain class that derives from VoiceHook and hides the member
+ * functions it needs. There are no virtual functions: VoiceHookChain calls
+ * each hook through its concrete type, so a hook's functions are inlined into
+ * the voice path and the empty defaults below compile away.
+ *
+ * Hooks run on the voice thread with qrwlVoiceThread held for reading.
+ */
+class VoiceHook {
+public:
+    /**
+     * @brief Connect the hook to its server once the modules are initialized.
+     *
+     * Called on the main thread before the voice thread starts.
+     *
+     * @param server The server
+     */
+    void bind(Server *server) { Q_UNUSED(server); }
+
+    /**
+     * @brief Inspect a packet before it is routed or mixed.
+     *
+     * @param packet The packet
+     * @return False to drop the packet
+     */
+    bool onPacket(const VoicePacket &packet) {
+        Q_UNUSED(packet);
+        return true;
+    }
+
+    /**
+     * @brief Decide whether a receiver gets a forwarded packet.
+     *
+     * Called once per receiver; mixed band channels apply their link gains
+     * in the BandMixer instead.
+     *
+     * @param packet The packet
+     * @param receiver A user in the speaker's channel or listening to it
+     * @param volume The volume adjustment for this receiver; may be changed
+     * @return False to leave the receiver out
+     */
+    bool onRoute(const VoicePacket &packet, const ServerUser *receiver, VolumeAdjustment &volume) {
+        Q_UNUSED(packet);
+        Q_UNUSED(receiver);
+        Q_UNUSED(volume);
+        return true;
+    }
+};
+
+/**
+ * @brief Hooks composed at compile time and called in order.
+ *
+ * onPacket() and onRoute() stop at the first hook that returns false. With no
+ * hooks every call is a constant true.
+ *
+ * @tparam Hooks The hook classes
+ */
+template<typename... Hooks>
+class VoiceHookChain {
+public:
+    /**
+     * @brief Bind every hook to the server.
+     *
+     * @param server The server
+     */
+    void bind(Server *server) {
+        std::apply([&](Hooks &... hooks) { (hooks.bind(server), ...); }, m_hooks);
+    }
+
+    /**
+     * @brief Run the packet hooks.
+     *
+     * @param packet The packet
+     * @return False if a hook dropped the packet
+     */
+    bool onPacket(const VoicePacket &packet) {
+        return std::apply([&](Hooks &... hooks) { return (hooks.onPacket(packet) && ...); }, m_hooks);
+    }
+
+    /**
+     * @brief Run the routing hooks for one receiver.
+     *
+     * @param packet The packet
+     * @param receiver The receiver
+     * @param volume The volume adjustment for this receiver
+     * @return False if a hook left the receiver out
+     */
+    bool onRoute(const VoicePacket &packet, const ServerUser *receiver, VolumeAdjustment &volume) {
+        return std::apply([&](Hooks &... hooks) { return (hooks.onRoute(packet, receiver, volume) && ...); }, m_hooks);
+    }
+
+    /**
+     * @brief Get the number of hooks compiled in.
+     *
+     * @return The number of hooks
+     */
+    static constexpr int size() { return static_cast<int>(sizeof...(Hooks)); }
+
+private:
+    std::tuple<Hooks...> m_hooks;
+};
+
+/**
+ * @brief A hook that is part of the chain only if enabled.
+ *
+ * @tparam Hook The hook class
+ * @tparam Enabled Usually the value of the hook's build option
+ */
+template<typename Hook, bool Enabled>
+struct OptionalVoiceHook {};
+
+/**
+ * @brief Build a VoiceHookChain from the enabled entries of a list of OptionalVoiceHook.
+ */
+template<typename Chain, typename... Entries>
+struct VoiceHookSelect {
+    using Type = Chain;
+};
+
+template<typename... Selected, typename Hook, bool Enabled, typename... Rest>
+struct VoiceHookSelect<VoiceHookChain<Selected...>, OptionalVoiceHook<Hook, Enabled>, Rest...> {
+    using Type = typename VoiceHookSelect<
+        typename std::conditional<Enabled, VoiceHookChain<Selected..., Hook>, VoiceHookChain<Selected...>>::type,
+        Rest...>::Type;
+};
+
+#endif // MUMBLE_MURMUR_VOICEHOOK_H_
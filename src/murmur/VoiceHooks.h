@@ -0,0 +1,29 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICEHOOKS_H_
+#define MUMBLE_MURMUR_VOICEHOOKS_H_
+
+// The voice path hooks compiled into the server. To add one, write a class
+// deriving from VoiceHook, add a build option for it to CMakeLists.txt and
+// list it below.
+
+#include "VoiceHook.h"
+
+// Build options (see CMakeLists.txt); a hook that is off is not part of the
+// chain and costs nothing
+#ifndef MURMUR_VOICE_HOOK_PROPAGATION
+#	define MURMUR_VOICE_HOOK_PROPAGATION 0
+#endif
+
+#include "modules/PropagationVoiceHook.h"
+
+/**
+ * @brief The voice path hooks of this build, in call order.
+ */
+using ServerVoiceHooks =
+    VoiceHookSelect<VoiceHookChain<>, OptionalVoiceHook<PropagationVoiceHook, MURMUR_VOICE_HOOK_PROPAGATION>>::Type;
+
+#endif // MUMBLE_MURMUR_VOICEHOOKS_H_
@@ -0,0 +1,277 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "VoiceTrace.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+std::atomic<int> VoiceTracer::s_sampleEvery(0);
+
+namespace {
+    // Binary trace, all little-endian:
+    //   header:  magic, version, stage count, record count (u32 each),
+    //            ticks per microsecond (f64)
+    //   stages:  name length (u8) and name, stage count times
+    //   records: trace id (u32), thread (u16), stage (u8), padding (u8), ticks (u64)
+    const quint32 FILE_MAGIC = 0x5254564D; // "MVTR"
+    const quint32 FILE_VERSION = 1;
+
+    template<typename T>
+    void appendLittleEndian(QByteArray &out, T value) {
+        uchar bytes[sizeof(T)];
+        qToLittleEndian(value, bytes);
+        out.append(reinterpret_cast<const char *>(bytes), static_cast<int>(sizeof(T)));
+    }
+
+    void appendDouble(QByteArray &out, double value) {
+        quint64 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        appendLittleEndian(out, bits);
+    }
+} // namespace
+
+VoiceTracer::VoiceTracer()
+    : m_nextId(1), m_nextThread(0), m_historyNext(0), m_dropped(0), m_anchorTicks(ticks()), m_anchorNs(steadyNs()) {
+}
+
+VoiceTracer &VoiceTracer::instance() {
+    static VoiceTracer tracer;
+    return tracer;
+}
+
+void VoiceTracer::setSampling(int sampleEvery) {
+    // Creates the tracer, and with it the time anchor, before the first stamp
+    instance();
+    s_sampleEvery.store(qMax(0, sampleEvery), std::memory_order_relaxed);
+}
+
+VoiceTrace VoiceTracer::sample(int sampleEvery, Stage stage) {
+    // Per thread, so sampling takes no shared write for the packets it skips
+    thread_local int countdown = 0;
+    if (--countdown > 0) {
+        return VoiceTrace();
+    }
+    countdown = sampleEvery;
+
+    // Registers the ring of a new thread before the first stamp is taken
+    threadBuffer();
+
+    quint32 id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+    if (id == 0) {
+        // 0 is the empty trace; skip it when the ids wrap
+        id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+    stamp(id, stage);
+    return VoiceTrace(id);
+}
+
+void VoiceTracer::stamp(quint32 id, Stage stage) {
+    const quint64 now = ticks();
+    ThreadBuffer &buffer = threadBuffer();
+    if (!buffer.ring.push({ id, stage, now })) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+VoiceTracer::ThreadBuffer &VoiceTracer::threadBuffer() {
+    // Hands the ring to collect() when the thread ends; it is freed once it
+    // is drained
+    struct Holder {
+        std::shared_ptr<ThreadBuffer> buffer;
+
+        ~Holder() {
+            if (buffer) {
+                buffer->exited.store(true, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Holder holder;
+
+    if (!holder.buffer) {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        holder.buffer = std::make_shared<ThreadBuffer>(m_nextThread++);
+        m_buffers.push_back(holder.buffer);
+    }
+    return *holder.buffer;
+}
+
+void VoiceTracer::collect() {
+    std::lock_guard<std::mutex> historyLock(m_historyMutex);
+    if (m_history.empty()) {
+        m_history.resize(HISTORY_CAPACITY);
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        buffers = m_buffers;
+    }
+
+    Record record;
+    for (const std::shared_ptr<ThreadBuffer> &buffer : buffers) {
+        // Checked first, so whatever the thread pushed before it ended is
+        // drained below
+        const bool exited = buffer->exited.load(std::memory_order_acquire);
+
+        while (buffer->ring.pop(record)) {
+            m_history[m_historyNext % HISTORY_CAPACITY] = { record.id, record.stage, buffer->index, record.ticks };
+            ++m_historyNext;
+        }
+        m_dropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+
+        if (exited) {
+            std::lock_guard<std::mutex> lock(m_buffersMutex);
+            m_buffers.erase(std::remove(m_buffers.begin(), m_buffers.end(), buffer), m_buffers.end());
+        }
+    }
+}
+
+bool VoiceTracer::write(const QString &path, Format format, QString *errorString) {
+    collect();
+
+    std::vector<Entry> entries;
+    quint64 dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_historyMutex);
+        const size_t count = std::min<size_t>(m_historyNext, HISTORY_CAPACITY);
+        entries.reserve(count);
+        for (size_t i = m_historyNext - count; i < m_historyNext; ++i) {
+            entries.push_back(m_history[i % HISTORY_CAPACITY]);
+        }
+        dropped = m_dropped + (m_historyNext - count);
+        m_historyNext = 0;
+        m_dropped = 0;
+    }
+
+    // The counter rate, measured over the whole run so far
+    const quint64 elapsedTicks = ticks() - m_anchorTicks;
+    const quint64 elapsedNs = steadyNs() - m_anchorNs;
+    const double ticksPerUs = elapsedNs > 0 ? static_cast<double>(elapsedTicks) * 1000.0 / elapsedNs : 1000.0;
+
+    const QByteArray data =
+        format == Format::Chrome ? chromeTrace(entries, ticksPerUs) : binaryTrace(entries, ticksPerUs);
+
+    if (dropped > 0) {
+        qWarning() << "VoiceTracer: Dropped" << dropped << "stamps; sample fewer packets or write more often";
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) < 0 || !file.commit()) {
+        if (errorString) {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+const char *VoiceTracer::stageName(Stage stage) {
+    switch (stage) {
+        case Received:
+            return "receive";
+        case Hooks:
+            return "hooks";
+        case MixInput:
+            return "mix_input";
+        case Routed:
+            return "route";
+        case Encoded:
+            return "encode";
+        case Sent:
+            return "send";
+        case FrameQueued:
+            return "frame_queue";
+        case FrameStarted:
+            return "dsp_queue";
+        case FrameRendered:
+            return "dsp_mix_encode";
+        case FrameSent:
+            return "frame_send";
+        case StageCount:
+            break;
+    }
+    return "unknown";
+}
+
+QByteArray VoiceTracer::chromeTrace(std::vector<Entry> &entries, double ticksPerUs) const {
+    // The stages of a trace are ordered, even when the counters of two cores
+    // are a few ticks apart
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.id != b.id ? a.id < b.id : a.stage < b.stage;
+    });
+
+    const auto micros = [this, ticksPerUs](const Entry &entry) {
+        return static_cast<double>(static_cast<qint64>(entry.ticks - m_anchorTicks)) / ticksPerUs;
+    };
+
+    QByteArray json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    const auto addSpan = [&json, &first](const char *name, const Entry &from, const Entry &to, double start,
+                                         double end) {
+        json += first ? "\n" : ",\n";
+        first = false;
+        json += "{\"name\":\"";
+        json += name;
+        json += "\",\"cat\":\"voice\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(to.thread)
+                + ",\"ts\":" + QByteArray::number(start, 'f', 3)
+                + ",\"dur\":" + QByteArray::number(qMax(0.0, end - start), 'f', 3)
+                + ",\"args\":{\"trace\":" + QByteArray::number(from.id) + "}}";
+    };
+
+    // One span for the whole trace, with a nested span per stage that ends
+    // at the stamp of the stage
+    for (size_t begin = 0; begin < entries.size();) {
+        size_t end = begin + 1;
+        while (end < entries.size() && entries[end].id == entries[begin].id) {
+            ++end;
+        }
+
+        if (end - begin > 1) {
+            const Entry &head = entries[begin];
+            addSpan(head.stage < FrameQueued ? "packet" : "frame", head, head, micros(head),
+                    micros(entries[end - 1]));
+            for (size_t i = begin + 1; i < end; ++i) {
+                addSpan(stageName(static_cast<Stage>(entries[i].stage)), entries[i - 1], entries[i],
+                        micros(entries[i - 1]), micros(entries[i]));
+            }
+        }
+        begin = end;
+    }
+
+    json += "\n]}\n";
+    return json;
+}
+
+QByteArray VoiceTracer::binaryTrace(const std::vector<Entry> &entries, double ticksPerUs) const {
+    QByteArray out;
+    out.reserve(static_cast<int>(64 + 16 * entries.size()));
+
+    appendLittleEndian(out, FILE_MAGIC);
+    appendLittleEndian(out, FILE_VERSION);
+    appendLittleEndian(out, static_cast<quint32>(StageCount));
+    appendLittleEndian(out, static_cast<quint32>(entries.size()));
+    appendDouble(out, ticksPerUs);
+
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const char *name = stageName(static_cast<Stage>(stage));
+        const quint8 length = static_cast<quint8>(std::strlen(name));
+        appendLittleEndian(out, length);
+        out.append(name, length);
+    }
+
+    for (const Entry &entry : entries) {
+        appendLittleEndian(out, entry.id);
+        appendLittleEndian(out, entry.thread);
+        appendLittleEndian(out, entry.stage);
+        appendLittleEndian(out, static_cast<quint8>(0));
+        appendLittleEndian(out, entry.ticks);
+    }
+    return out;
+}
@@ -0,0 +1,248 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICETRACE_H_
+#define MUMBLE_MURMUR_VOICETRACE_H_
+
+#include "SPSCRing.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#	include <intrin.h>
+#	define MURMUR_VOICE_TRACE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#	define MURMUR_VOICE_TRACE_TSC
+#endif
+
+class VoiceTrace;
+
+/**
+ * @brief Sampled latency tracing of voice packets through the server.
+ *
+ * One packet in every N is given a trace id when it is received, and is
+ * stamped with the time stamp counter at each stage of the voice pipeline
+ * it passes. Stamps go to a ring of the stamping thread, so tracing a packet
+ * takes no lock; collect() moves them to a bounded history, and write()
+ * exports the history as a Chrome trace (chrome://tracing, Perfetto) or as
+ * compact binary records.
+ *
+ * Tracing is off until setSampling() is called. While it is off, begin()
+ * is a relaxed load and a branch, and the stamps of the untraced packet are
+ * a test of its id.
+ */
+class VoiceTracer {
+public:
+    /**
+     * @brief Stages of the voice pipeline, in the order a packet passes them.
+     */
+    enum Stage : quint8 {
+        Received, ///< Server::processMsg() was entered
+        Hooks, ///< The voice path hooks ran
+        MixInput, ///< The packet was handed to the band mixer instead of being routed
+        Routed, ///< The receivers were chosen
+        Encoded, ///< The packet was encoded for the receivers
+        Sent, ///< The packet was sent to every receiver
+        FrameQueued, ///< A band mix frame was queued for the DSP workers
+        FrameStarted, ///< A DSP worker picked the frame up
+        FrameRendered, ///< The frame was mixed and encoded
+        FrameSent, ///< The frame was sent to the listeners
+        StageCount
+    };
+
+    /// Export formats of write()
+    enum class Format { Chrome, Binary };
+
+    /// Stamps a thread can hold before collect() empties its ring
+    static const int RING_CAPACITY = 4096;
+    /// Stamps kept between two writes; the oldest are dropped
+    static const int HISTORY_CAPACITY = 1 << 16;
+
+    /**
+     * @brief Get the tracer shared by the whole process.
+     *
+     * @return The tracer, created on first use
+     */
+    static VoiceTracer &instance();
+
+    VoiceTracer(const VoiceTracer &) = delete;
+    VoiceTracer &operator=(const VoiceTracer &) = delete;
+
+    /**
+     * @brief Start tracing a packet if it is sampled.
+     *
+     * @param stage The first stage of the packet
+     * @return A trace that stamps the packet, or an empty one that does nothing
+     */
+    static VoiceTrace begin(Stage stage);
+
+    /**
+     * @brief Set how many packets are traced.
+     *
+     * @param sampleEvery Trace one packet in this many per thread; 0 turns tracing off
+     */
+    static void setSampling(int sampleEvery);
+
+    /**
+     * @brief Get the sampling set by setSampling().
+     *
+     * @return One in how many packets is traced; 0 if tracing is off
+     */
+    static int sampling() { return s_sampleEvery.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Record a stamp of a traced packet.
+     *
+     * @param id The trace id
+     * @param stage The stage the packet reached
+     */
+    void stamp(quint32 id, Stage stage);
+
+    /**
+     * @brief Move the stamps of every thread into the history.
+     *
+     * Has to be called more often than a thread fills its ring; stamps a
+     * full ring does not take are dropped and counted.
+     */
+    void collect();
+
+    /**
+     * @brief Write the history to a file and clear it.
+     *
+     * Each file holds the stamps recorded since the previous write; the file
+     * is replaced atomically.
+     *
+     * @param path The file
+     * @param format The export format
+     * @param errorString Set to the reason if the file could not be written
+     * @return Whether the file was written
+     */
+    bool write(const QString &path, Format format, QString *errorString = nullptr);
+
+    /**
+     * @brief Get the name of a stage as used in the exports.
+     *
+     * @param stage The stage
+     * @return The name of the time span that ends at the stage
+     */
+    static const char *stageName(Stage stage);
+
+private:
+    VoiceTracer();
+
+    static quint64 steadyNs() {
+        return static_cast<quint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now().time_since_epoch())
+                                        .count());
+    }
+
+    // Ticks of the time stamp counter, or nanoseconds where there is none
+    static quint64 ticks() {
+#ifdef MURMUR_VOICE_TRACE_TSC
+        return __rdtsc();
+#else
+        return steadyNs();
+#endif
+    }
+
+    VoiceTrace sample(int sampleEvery, Stage stage);
+
+    struct Record {
+        quint32 id;
+        quint8 stage;
+        quint64 ticks;
+    };
+
+    struct Entry {
+        quint32 id;
+        quint8 stage;
+        quint16 thread;
+        quint64 ticks;
+    };
+
+    struct ThreadBuffer {
+        explicit ThreadBuffer(quint16 index) : ring(RING_CAPACITY), index(index), dropped(0), exited(false) {}
+
+        SPSCRing<Record> ring;
+        const quint16 index; // Thread id in the exports
+        std::atomic<quint64> dropped; // Stamps the full ring did not take
+        std::atomic<bool> exited; // The thread is gone; removed once drained
+    };
+
+    ThreadBuffer &threadBuffer();
+    QByteArray chromeTrace(std::vector<Entry> &entries, double ticksPerUs) const;
+    QByteArray binaryTrace(const std::vector<Entry> &entries, double ticksPerUs) const;
+
+    static std::atomic<int> s_sampleEvery;
+    std::atomic<quint32> m_nextId;
+
+    std::mutex m_buffersMutex; // Guards m_buffers and m_nextThread
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+    quint16 m_nextThread;
+
+    std::mutex m_historyMutex; // Guards the history; also serializes collect()
+    std::vector<Entry> m_history; // Ring of HISTORY_CAPACITY entries
+    size_t m_historyNext; // Entries ever added since the last write
+    quint64 m_dropped; // Stamps lost since the last write
+
+    // Ticks and time of construction, to convert ticks to microseconds
+    const quint64 m_anchorTicks;
+    const quint64 m_anchorNs;
+};
+
+/**
+ * @brief Handle of one traced packet, as returned by VoiceTracer::begin().
+ *
+ * Cheap to copy; an empty trace (the packet was not sampled) ignores the
+ * stamps.
+ */
+class VoiceTrace {
+public:
+    VoiceTrace() : m_id(0) {}
+
+    /**
+     * @brief Check whether the packet is traced.
+     *
+     * @return True if stamps are recorded
+     */
+    bool isSampled() const { return m_id != 0; }
+
+    /**
+     * @brief Record that the packet reached a stage.
+     *
+     * @param stage The stage
+     */
+    void stamp(VoiceTracer::Stage stage) const {
+        if (Q_UNLIKELY(m_id != 0)) {
+            VoiceTracer::instance().stamp(m_id, stage);
+        }
+    }
+
+private:
+    friend class VoiceTracer;
+
+    explicit VoiceTrace(quint32 id) : m_id(id) {}
+
+    quint32 m_id;
+};
+
+inline VoiceTrace VoiceTracer::begin(Stage stage) {
+    const int sampleEvery = s_sampleEvery.load(std::memory_order_relaxed);
+    if (Q_LIKELY(sampleEvery == 0)) {
+        return VoiceTrace();
+    }
+    return instance().sample(sampleEvery, stage);
+}
+
+#endif // MUMBLE_MURMUR_VOICETRACE_H_
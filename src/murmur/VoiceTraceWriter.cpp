@@ -0,0 +1,98 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "VoiceTraceWriter.h"
+
+#include <QtCore/QDebug>
+
+#include <stdexcept>
+
+VoiceTraceWriter::VoiceTraceWriter(QObject *parent)
+    : QObject(parent), m_writes(ThreadPool::shared(), ThreadPool::Priority::Background), m_collections(0),
+      m_configured(false), m_format(VoiceTracer::Format::Chrome), m_writeFailed(false) {
+    connect(&m_timer, &QTimer::timeout, this, &VoiceTraceWriter::collect);
+}
+
+VoiceTraceWriter::~VoiceTraceWriter() {
+    // m_writes waits for a running write; its result posts to an object that
+    // is gone, which Qt discards
+    VoiceTracer::setSampling(0);
+}
+
+void VoiceTraceWriter::applyConfig(std::shared_ptr<const ServerConfig> config) {
+    const ServerConfig::VoiceTracing &settings = config->voiceTracing();
+    if (m_configured && settings == m_settings) {
+        return;
+    }
+    const bool wasTracing = m_configured && m_settings.sampleEvery > 0;
+    if (wasTracing && settings.sampleEvery == 0) {
+        // Keep what was traced until now
+        VoiceTracer::setSampling(0);
+        writeTrace(m_settings.file, m_format);
+        qWarning() << "VoiceTraceWriter: Voice packet tracing stopped";
+    }
+
+    m_configured = true;
+    m_settings = settings;
+    m_writeFailed = false;
+
+    if (settings.format == "binary") {
+        m_format = VoiceTracer::Format::Binary;
+    } else {
+        if (settings.format != "chrome") {
+            qWarning() << "VoiceTraceWriter: Unknown format" << settings.format << "- writing a Chrome trace";
+        }
+        m_format = VoiceTracer::Format::Chrome;
+    }
+
+    if (settings.sampleEvery == 0) {
+        m_timer.stop();
+        return;
+    }
+
+    if (settings.file.isEmpty()) {
+        qWarning() << "VoiceTraceWriter: No file set for the voice packet traces; tracing stays off";
+        VoiceTracer::setSampling(0);
+        m_timer.stop();
+        return;
+    }
+
+    VoiceTracer::setSampling(settings.sampleEvery);
+    m_collections = 0;
+    m_timer.start(COLLECT_INTERVAL_MS);
+    qWarning() << "VoiceTraceWriter: Tracing one voice packet in" << settings.sampleEvery << "to" << settings.file;
+}
+
+void VoiceTraceWriter::collect() {
+    VoiceTracer::instance().collect();
+
+    if (++m_collections * COLLECT_INTERVAL_MS >= qMax(1, m_settings.interval) * 1000) {
+        m_collections = 0;
+        writeTrace(m_settings.file, m_format);
+    }
+}
+
+void VoiceTraceWriter::writeTrace(const QString &path, VoiceTracer::Format format) {
+    try {
+        m_writes.run([this, path, format]() {
+            QString errorString;
+            const bool written = VoiceTracer::instance().write(path, format, &errorString);
+            QMetaObject::invokeMethod(
+                this, [this, written, path, errorString]() { finishWrite(written, path, errorString); },
+                Qt::QueuedConnection);
+        });
+    } catch (const std::runtime_error &) {
+        // The pool is shutting down
+    }
+}
+
+void VoiceTraceWriter::finishWrite(bool written, const QString &path, const QString &errorString) {
+    if (written) {
+        m_writeFailed = false;
+    } else if (!m_writeFailed) {
+        qWarning() << "VoiceTraceWriter: Cannot write" << path << ":" << errorString;
+        m_writeFailed = true;
+    }
+}
@@ -0,0 +1,70 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICETRACEWRITER_H_
+#define MUMBLE_MURMUR_VOICETRACEWRITER_H_
+
+#include "ServerConfig.h"
+#include "TaskGroup.h"
+#include "VoiceTrace.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+
+#include <memory>
+
+/**
+ * @brief Turns VoiceTracer on and off and writes its traces to a file.
+ *
+ * Follows the [voice_trace] section: sets the sampling, collects the stamps
+ * of the voice threads every second so their rings never fill, and rewrites
+ * the trace file every interval with the packets traced since the previous
+ * write. Formatting and writing the file run on the shared thread pool.
+ */
+class VoiceTraceWriter : public QObject {
+    Q_OBJECT
+
+public:
+    /// Time between two collections of the thread rings
+    static const int COLLECT_INTERVAL_MS = 1000;
+
+    /**
+     * @brief Constructor for VoiceTraceWriter.
+     *
+     * Tracing stays off until applyConfig() is called.
+     *
+     * @param parent The parent object
+     */
+    explicit VoiceTraceWriter(QObject *parent = nullptr);
+    ~VoiceTraceWriter() override;
+
+public slots:
+    /**
+     * @brief Trace and write the file as the [voice_trace] section says.
+     *
+     * Turning tracing off writes what was traced until then. Can be connected
+     * to ServerConfigWatcher::configChanged().
+     *
+     * @param config The configuration
+     */
+    void applyConfig(std::shared_ptr<const ServerConfig> config);
+
+private:
+    void collect();
+    void writeTrace(const QString &path, VoiceTracer::Format format);
+    void finishWrite(bool written, const QString &path, const QString &errorString);
+
+    TaskGroup m_writes;
+    QTimer m_timer;
+    int m_collections; // Collections since the last write
+
+    bool m_configured;
+    ServerConfig::VoiceTracing m_settings;
+    VoiceTracer::Format m_format;
+    bool m_writeFailed; // The last write failed; warned once until it works again
+};
+
+#endif // MUMBLE_MURMUR_VOICETRACEWRITER_H_
@@ -0,0 +1,87 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "WhisperTarget.h"
+
+/**
+ * Add a direct target user session ID
+ */
+void WhisperTarget::addSession(unsigned int session) {
+    if (!m_sessions.contains(session)) {
+        m_sessions.append(session);
+    }
+}
+
+/**
+ * Add a channel target
+ */
+void WhisperTarget::addChannel(unsigned int channel, bool recursive) {
+    if (!m_channels.contains(channel)) {
+        m_channels.append(channel);
+    }
+    m_recursive = m_recursive || recursive;
+}
+
+/**
+ * Check if the target names any session or channel
+ */
+bool WhisperTarget::isValid() const {
+    return !m_sessions.isEmpty() || !m_channels.isEmpty();
+}
+
+/**
+ * Get the list of session IDs
+ */
+const QList<unsigned int> &WhisperTarget::getSessions() const {
+    return m_sessions;
+}
+
+/**
+ * Get the list of channel targets
+ */
+const QList<unsigned int> &WhisperTarget::getChannels() const {
+    return m_channels;
+}
+
+/**
+ * Get whether channels should be processed recursively
+ */
+bool WhisperTarget::isRecursive() const {
+    return m_recursive;
+}
+
+/**
+ * Add a user to the target cache; the cache is valid from then on
+ */
+void WhisperTargetCache::addUser(ServerUser *user) {
+    if (!user) {
+        return;
+    }
+
+    m_users.insert(user);
+    m_valid = true;
+}
+
+/**
+ * Get the users in the cache
+ */
+const QSet<ServerUser *> &WhisperTargetCache::getUsers() const {
+    return m_users;
+}
+
+/**
+ * Check if the cache is valid
+ */
+bool WhisperTargetCache::isValid() const {
+    return m_valid;
+}
+
+/**
+ * Clear the cache
+ */
+void WhisperTargetCache::clear() {
+    m_users.clear();
+    m_valid = false;
+}
@@ -0,0 +1,176 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_WORKSTEALINGDEQUE_H_
+#define MUMBLE_MURMUR_WORKSTEALINGDEQUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Lock-free Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom (LIFO, so recently created
+ * work runs while its data is still in cache); any other thread steals from
+ * the top (FIFO, so thieves take the oldest and usually largest work).
+ * Owner operations only synchronize with thieves when the deque is about to
+ * run empty.
+ *
+ * The buffer grows when full. Old buffers are kept until the deque is
+ * destroyed because a thief may still be reading from them; growth doubles
+ * the size, so this at most doubles the memory use.
+ *
+ * Follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Lê, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ *
+ * @tparam T The element type; must be trivially copyable and fit in an atomic
+ * (typically a pointer)
+ */
+template<typename T>
+class WorkStealingDeque {
+public:
+    /**
+     * @brief Constructor for WorkStealingDeque.
+     *
+     * @param capacity The initial capacity, rounded up to a power of two
+     */
+    explicit WorkStealingDeque(size_t capacity = 256)
+        : m_top(0)
+        , m_bottom(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_buffers.emplace_back(new Buffer(size));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    /**
+     * @brief Add an element at the bottom (owner only).
+     *
+     * @param value The element
+     */
+    void push(T value) {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_acquire);
+        Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > buffer->mask) {
+            buffer = grow(buffer, top, bottom);
+        }
+
+        buffer->put(bottom, value);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Remove the element at the bottom (owner only).
+     *
+     * @param value Receives the element
+     * @return False if the deque is empty or a thief took the last element
+     */
+    bool pop(T &value) {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // Empty
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = buffer->get(bottom);
+        if (top == bottom) {
+            // Last element: race the thieves for it
+            const bool won =
+                m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Remove the element at the top (any thread).
+     *
+     * @param value Receives the element
+     * @return False if the deque is empty or another thread won the element
+     */
+    bool steal(T &value) {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom) {
+            return false;
+        }
+
+        Buffer *buffer = m_buffer.load(std::memory_order_acquire);
+        value = buffer->get(top);
+        return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Check whether the deque is empty.
+     *
+     * Approximate when called while other threads are active.
+     *
+     * @return True if there is nothing to pop or steal
+     */
+    bool empty() const { return size() == 0; }
+
+    /**
+     * @brief Get the number of queued elements.
+     *
+     * Approximate when called while other threads are active.
+     *
+     * @return The number of queued elements
+     */
+    size_t size() const {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+private:
+    struct Buffer {
+        explicit Buffer(size_t size) : mask(static_cast<int64_t>(size) - 1), cells(new std::atomic<T>[size]) {}
+
+        T get(int64_t index) const { return cells[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, T value) { cells[index & mask].store(value, std::memory_order_relaxed); }
+
+        const int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> cells;
+    };
+
+    Buffer *grow(Buffer *buffer, int64_t top, int64_t bottom) {
+        Buffer *bigger = new Buffer(static_cast<size_t>(buffer->mask + 1) * 2);
+        for (int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, buffer->get(i));
+        }
+        m_buffers.emplace_back(bigger);
+        m_buffer.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    // Thieves and the owner contend on top; bottom is written by the owner only
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) std::atomic<Buffer *> m_buffer;
+
+    // Every buffer ever used, owned by the owner thread
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+};
+
+#endif // MUMBLE_MURMUR_WORKSTEALINGDEQUE_H_
@@ -0,0 +1,380 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Synthetic client load: thousands of simulated sessions talking through the
+// voice path of a real Server.
+//
+// Each session gets a random Maidenhead locator, transmitter power and
+// antenna, listens to up to two other channels, alternates talk spurts and
+// pauses with the ITU-T P.59 mean durations, sends an Opus-sized voice packet
+// every 20 ms while it talks, and now and then moves to another channel.
+//
+// Sessions are connected in-process: packets go into Server::processMsg() from
+// one receive thread, as the UDP socket would deliver them, and are collected
+// from Server::tcpTransmit() on the thread that sends them. Channel moves take
+// the voice lock on the main thread, like a UserState message would.
+//
+// Reported: packets sent and delivered per second, the latency from sending a
+// packet to its delivery to each receiver (forwarded channels only; mixed band
+// channels deliver one encoded mix per 20 ms frame instead), how busy the
+// receive thread was inside the server, and the CPU time per session.
+//
+// Usage: murmur_loadgen [-c config] [-u sessions] [-t seconds] [--hop seconds]
+
+#include "Channel.h"
+#include "Metrics.h"
+#include "MumbleProtocol.h"
+#include "Server.h"
+#include "ServerConfig.h"
+#include "ThreadPlacement.h"
+#include "User.h"
+#include "database/MariaDBConnectionParameter.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QReadLocker>
+#include <QtCore/QTimer>
+#include <QtCore/QWriteLocker>
+#include <QtCore/QtEndian>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const std::chrono::milliseconds FRAME(20);
+
+    // ITU-T P.59 conversational speech: mean talk spurt and pause
+    const double MEAN_TALK_SECONDS = 1.004;
+    const double MEAN_PAUSE_SECONDS = 1.587;
+
+    // Opus voice frames of 20 ms at roughly 16 to 48 kbit/s
+    const int MIN_PAYLOAD_BYTES = 40;
+    const int MAX_PAYLOAD_BYTES = 120;
+
+    // Start of every generated payload: magic, then the send time in nanoseconds
+    const quint32 PAYLOAD_MAGIC = 0x4E45474C; // "LGEN"
+    const int PAYLOAD_HEADER_BYTES = 12;
+
+    const int CHANNEL_HOP_TICK_MS = 100;
+
+    struct Antenna {
+        const char *type;
+        float gainDbi;
+    };
+    const Antenna ANTENNAS[] = { { "dipole", 2.15f },  { "vertical", 0.0f }, { "yagi", 7.5f },
+                                 { "loop", 1.5f },     { "end-fed", 1.0f } };
+    const int POWERS_WATTS[] = { 5, 10, 25, 50, 100, 400, 1000 };
+
+    struct Session {
+        ServerUser *user;
+        bool talking;
+        Clock::time_point spurtEnd;
+    };
+
+    // Filled on every thread that sends voice
+    struct Deliveries {
+        Deliveries() : forwarded(0), mixed(0), latency(1.0, 30) {}
+
+        std::atomic<quint64> forwarded;
+        std::atomic<quint64> mixed;
+        MetricHistogram latency; // Send to delivery, microseconds
+    };
+
+    qint64 nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    QString randomGrid(std::mt19937 &rng) {
+        std::uniform_int_distribution<int> field(0, 17);
+        std::uniform_int_distribution<int> square(0, 9);
+        std::uniform_int_distribution<int> subsquare(0, 23);
+        QString grid;
+        grid += QChar('A' + field(rng));
+        grid += QChar('A' + field(rng));
+        grid += QChar('0' + square(rng));
+        grid += QChar('0' + square(rng));
+        grid += QChar('a' + subsquare(rng));
+        grid += QChar('a' + subsquare(rng));
+        return grid;
+    }
+
+    Clock::duration exponential(std::mt19937 &rng, double meanSeconds) {
+        std::exponential_distribution<double> distribution(1.0 / meanSeconds);
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(distribution(rng)));
+    }
+
+    // Upper bound of the bucket holding quantile q
+    double percentile(const MetricHistogram::Snapshot &snapshot, double q) {
+        const quint64 rank = static_cast<quint64>(q * static_cast<double>(snapshot.count));
+        quint64 cumulative = 0;
+        for (int bucket = 0; bucket < snapshot.bounds.size(); ++bucket) {
+            cumulative += snapshot.buckets[bucket];
+            if (cumulative > rank) {
+                return snapshot.bounds[bucket];
+            }
+        }
+        return snapshot.bounds.isEmpty() ? 0.0 : snapshot.bounds.last();
+    }
+
+    // Plays the sessions: the only thread that calls processMsg(), like the
+    // server's UDP receive loop
+    class Sender {
+    public:
+        Sender(Server &server, std::vector<Session> &sessions)
+            : m_server(server), m_sessions(sessions), m_stop(false), m_sent(0), m_late(0), m_busyNs(0) {}
+
+        void start() {
+            m_thread = std::thread([this] { run(); });
+        }
+
+        void stop() {
+            m_stop.store(true, std::memory_order_relaxed);
+            m_thread.join();
+        }
+
+        quint64 sent() const { return m_sent; }
+        quint64 late() const { return m_late; }
+        qint64 busyNs() const { return m_busyNs; }
+
+    private:
+        using Due = std::pair<Clock::time_point, size_t>;
+
+        void run() {
+            std::mt19937 rng(1);
+            std::uniform_int_distribution<int> payloadBytes(MIN_PAYLOAD_BYTES, MAX_PAYLOAD_BYTES);
+            std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+
+            const Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < m_sessions.size(); ++i) {
+                due.push({ start + exponential(rng, MEAN_PAUSE_SECONDS), i });
+            }
+
+            AudioReceiverBuffer buffer;
+            Mumble::Protocol::UDPAudioEncoder<Mumble::Protocol::Role::Server> encoder;
+
+            while (!m_stop.load(std::memory_order_relaxed)) {
+                const Due next = due.top();
+                const Clock::time_point now = Clock::now();
+                if (next.first > now) {
+                    std::this_thread::sleep_until(std::min(next.first, now + std::chrono::milliseconds(50)));
+                    continue;
+                }
+                due.pop();
+
+                Session &session = m_sessions[next.second];
+                if (!session.talking) {
+                    session.talking = true;
+                    session.spurtEnd = next.first + exponential(rng, MEAN_TALK_SECONDS);
+                } else if (next.first >= session.spurtEnd) {
+                    session.talking = false;
+                    due.push({ next.first + exponential(rng, MEAN_PAUSE_SECONDS), next.second });
+                    continue;
+                }
+                if (now - next.first > FRAME) {
+                    ++m_late;
+                }
+
+                const int size = payloadBytes(rng);
+                Mumble::Protocol::AudioData audio;
+                audio.data = new Mumble::Protocol::byte[size]();
+                audio.size = size;
+                audio.frameSize = 960;
+                audio.isOpus = true;
+                qToLittleEndian(PAYLOAD_MAGIC, audio.data);
+
+                const Clock::time_point begin = Clock::now();
+                qToLittleEndian(static_cast<quint64>(nowNs()), audio.data + 4);
+                {
+                    QReadLocker locker(&m_server.qrwlVoiceThread);
+                    m_server.processMsg(session.user, audio, buffer, encoder);
+                }
+                m_busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+                // The copy passed to processMsg() freed the payload
+                audio.data = nullptr;
+
+                ++m_sent;
+                due.push({ next.first + FRAME, next.second });
+            }
+        }
+
+        Server &m_server;
+        std::vector<Session> &m_sessions;
+        std::atomic<bool> m_stop;
+        std::thread m_thread;
+
+        // Read after stop()
+        quint64 m_sent;
+        quint64 m_late;
+        qint64 m_busyNs;
+    };
+} // namespace
+
+int main(int argc, char **argv) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives the voice path of the server with simulated sessions");
+    parser.addHelpOption();
+    QCommandLineOption configOption(QStringList() << "c" << "config", "Configuration file of the server", "file",
+                                    "mumble-server.ini");
+    QCommandLineOption sessionsOption(QStringList() << "u" << "sessions", "Simulated sessions", "count", "1000");
+    QCommandLineOption secondsOption(QStringList() << "t" << "seconds", "Length of the run", "seconds", "30");
+    QCommandLineOption hopOption("hop", "Mean time a session stays in a channel", "seconds", "60");
+    parser.addOption(configOption);
+    parser.addOption(sessionsOption);
+    parser.addOption(secondsOption);
+    parser.addOption(hopOption);
+    parser.process(a);
+
+    const int sessionCount = qMax(1, parser.value(sessionsOption).toInt());
+    const int seconds = qMax(1, parser.value(secondsOption).toInt());
+    const double hopSeconds = qMax(1.0, parser.value(hopOption).toDouble());
+
+    const std::shared_ptr<const ServerConfig> config = ServerConfig::load(parser.value(configOption));
+    if (!config) {
+        return 1;
+    }
+    ServerConfig::setCurrent(config);
+    ThreadPlacement::setCurrent(config->performance().placement);
+
+    mumble::db::MariaDBConnectionParameter connectionParam("supermorse");
+    std::unique_ptr<mumble::db::ConnectionParameter> dbParam(connectionParam.toConnectionParameter());
+    Server server(1, *dbParam);
+    server.initialize();
+
+    QList<Channel *> channels = server.qhChannels.values();
+    if (channels.isEmpty()) {
+        // No [channels] section; a few bands are enough for routing
+        QWriteLocker locker(&server.qrwlVoiceThread);
+        for (int id = 1; id <= 10; ++id) {
+            server.qhChannels.insert(id, new Channel(id, QString("Band %1").arg(id)));
+        }
+        channels = server.qhChannels.values();
+    }
+
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> pickChannel(0, channels.size() - 1);
+    std::uniform_int_distribution<int> pickListens(0, 2);
+    std::uniform_int_distribution<int> pickAntenna(0, static_cast<int>(sizeof(ANTENNAS) / sizeof(ANTENNAS[0])) - 1);
+    std::uniform_int_distribution<int> pickPower(0, static_cast<int>(sizeof(POWERS_WATTS) / sizeof(int)) - 1);
+
+    std::vector<Session> sessions;
+    sessions.reserve(static_cast<size_t>(sessionCount));
+    {
+        QWriteLocker locker(&server.qrwlVoiceThread);
+        for (int i = 0; i < sessionCount; ++i) {
+            ServerUser *user = new ServerUser(&server);
+            user->uiSession = i + 1;
+            user->qsName = QString("loadgen-%1").arg(i + 1);
+            user->cChannel = channels[pickChannel(rng)];
+            user->bMute = user->bDeaf = user->bSuppress = false;
+            user->bSelfMute = user->bSelfDeaf = false;
+
+            const Antenna &antenna = ANTENNAS[pickAntenna(rng)];
+            user->qsGridSquare = randomGrid(rng);
+            user->qmUserData.insert("maidenheadgrid", user->qsGridSquare);
+            user->iPower = POWERS_WATTS[pickPower(rng)];
+            user->qsAntennaType = antenna.type;
+            user->fAntennaGain = antenna.gainDbi;
+
+            for (int listens = pickListens(rng); listens > 0; --listens) {
+                server.m_channelListenerManager.addListener(*user, *channels[pickChannel(rng)]);
+            }
+
+            server.qhUsers.insert(static_cast<unsigned int>(user->uiSession), user);
+            sessions.push_back({ user, false, Clock::time_point() });
+        }
+    }
+
+    Deliveries deliveries;
+    QObject::connect(
+        &server, &Server::tcpTransmit, &server,
+        [&deliveries](QByteArray data, unsigned int) {
+            const qint64 received = nowNs();
+            // Read as a client would; forwarded payloads still carry the magic
+            Mumble::Protocol::UDPAudioDecoder<Mumble::Protocol::Role::Client> decoder;
+            Mumble::Protocol::AudioData audio;
+            if (decoder.decode(reinterpret_cast<const Mumble::Protocol::byte *>(data.constData()), data.size(), audio)
+                && audio.size >= PAYLOAD_HEADER_BYTES && qFromLittleEndian<quint32>(audio.data) == PAYLOAD_MAGIC) {
+                const qint64 sent = static_cast<qint64>(qFromLittleEndian<quint64>(audio.data + 4));
+                deliveries.latency.record(static_cast<quint64>(qMax<qint64>(0, received - sent) / 1000));
+                deliveries.forwarded.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                deliveries.mixed.fetch_add(1, std::memory_order_relaxed);
+            }
+        },
+        Qt::DirectConnection);
+
+    // Channel moves, applied on the main thread under the voice lock
+    QTimer hops;
+    quint64 hopCount = 0;
+    std::poisson_distribution<int> hopsPerTick(sessionCount * CHANNEL_HOP_TICK_MS / 1000.0 / hopSeconds);
+    std::uniform_int_distribution<size_t> pickSession(0, sessions.size() - 1);
+    QObject::connect(&hops, &QTimer::timeout, [&]() {
+        const int count = hopsPerTick(rng);
+        if (count == 0) {
+            return;
+        }
+        QWriteLocker locker(&server.qrwlVoiceThread);
+        for (int i = 0; i < count; ++i) {
+            sessions[pickSession(rng)].user->cChannel = channels[pickChannel(rng)];
+        }
+        hopCount += static_cast<quint64>(count);
+    });
+
+    std::printf("murmur_loadgen: %d sessions in %d channels for %d s\n", sessionCount, channels.size(), seconds);
+
+    Sender sender(server, sessions);
+    const std::clock_t cpuStart = std::clock();
+    const Clock::time_point wallStart = Clock::now();
+    server.startThread();
+    sender.start();
+    hops.start(CHANNEL_HOP_TICK_MS);
+
+    QTimer::singleShot(seconds * 1000, &a, &QCoreApplication::quit);
+    a.exec();
+
+    hops.stop();
+    sender.stop();
+    server.stopThread();
+    const double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+    const double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    const MetricHistogram::Snapshot latency = deliveries.latency.snapshot();
+    std::printf("  voice packets sent        %llu (%.0f/s), %llu more than a frame behind schedule\n",
+                static_cast<unsigned long long>(sender.sent()), sender.sent() / wall,
+                static_cast<unsigned long long>(sender.late()));
+    std::printf("  forwarded deliveries      %llu (%.0f/s)\n",
+                static_cast<unsigned long long>(deliveries.forwarded.load()), deliveries.forwarded.load() / wall);
+    std::printf("  mixed frame deliveries    %llu (%.0f/s)\n",
+                static_cast<unsigned long long>(deliveries.mixed.load()), deliveries.mixed.load() / wall);
+    std::printf("  channel moves             %llu\n", static_cast<unsigned long long>(hopCount));
+    if (latency.count > 0) {
+        std::printf("  delivery latency          p50 < %.3f ms, p90 < %.3f ms, p99 < %.3f ms, p99.9 < %.3f ms\n",
+                    percentile(latency, 0.5) / 1000.0, percentile(latency, 0.9) / 1000.0,
+                    percentile(latency, 0.99) / 1000.0, percentile(latency, 0.999) / 1000.0);
+    }
+    std::printf("  receive thread in server  %.1f %% (%.2f us per packet)\n", 100.0 * sender.busyNs() / 1e9 / wall,
+                sender.sent() > 0 ? sender.busyNs() / 1000.0 / sender.sent() : 0.0);
+    std::printf("  process CPU               %.2f s, %.3f ms per second per session\n", cpu,
+                1000.0 * cpu / wall / sessionCount);
+
+    // Through the server, so the band mixer forgets the users before they go
+    for (const Session &session : sessions) {
+        server.removeUser(session.user);
+        delete session.user;
+    }
+    return 0;
+}
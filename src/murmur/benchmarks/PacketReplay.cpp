@@ -0,0 +1,181 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Max-speed replay of a packet capture (see [packet_capture]) through the
+// voice path of a real Server.
+//
+// The users recorded in the capture are recreated with their channel,
+// listened channels, flags and station, and every datagram is fed to
+// Server::processDatagram() back to back, as if the socket had all of them
+// queued. Sends go to a null sink that only counts them, so a run measures
+// the server alone and does the same work every time, which is what a
+// profiler wants.
+//
+// Not replayed: channel moves and other control messages during the capture,
+// and the 20 ms flushes of mixed band channels, which need the voice thread
+// and real time (their frames are still taken in).
+//
+// Usage: murmur_replay [-c config] [-n passes] capture
+
+#include "Channel.h"
+#include "PacketCapture.h"
+#include "Server.h"
+#include "ServerConfig.h"
+#include "ThreadPlacement.h"
+#include "User.h"
+#include "database/MariaDBConnectionParameter.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QSet>
+#include <QtCore/QWriteLocker>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    Channel *channelFor(Server &server, int id) {
+        Channel *channel = server.qhChannels.value(id);
+        if (!channel) {
+            // Not in this configuration; routing only needs it to exist
+            channel = new Channel(id, QString("Replay %1").arg(id));
+            server.qhChannels.insert(id, channel);
+        }
+        return channel;
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Feeds a packet capture through the voice path of the server at full speed");
+    parser.addHelpOption();
+    QCommandLineOption configOption(QStringList() << "c" << "config", "Configuration file of the server", "file",
+                                    "mumble-server.ini");
+    QCommandLineOption passesOption(QStringList() << "n" << "passes", "Times the capture is played", "count", "1");
+    parser.addOption(configOption);
+    parser.addOption(passesOption);
+    parser.addPositionalArgument("capture", "File written by [packet_capture]");
+    parser.process(a);
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+    const QString capturePath = parser.positionalArguments().first();
+    const int passes = qMax(1, parser.value(passesOption).toInt());
+
+    PacketCaptureReader capture;
+    QString errorString;
+    if (!capture.load(capturePath, &errorString)) {
+        std::fprintf(stderr, "murmur_replay: Cannot read %s: %s\n", qPrintable(capturePath), qPrintable(errorString));
+        return 1;
+    }
+
+    const std::shared_ptr<const ServerConfig> config = ServerConfig::load(parser.value(configOption));
+    if (!config) {
+        return 1;
+    }
+    ServerConfig::setCurrent(config);
+    ThreadPlacement::setCurrent(config->performance().placement);
+
+    mumble::db::MariaDBConnectionParameter connectionParam("supermorse");
+    std::unique_ptr<mumble::db::ConnectionParameter> dbParam(connectionParam.toConnectionParameter());
+    Server server(1, *dbParam);
+    server.initialize();
+    // A replay is never recorded again, whatever the configuration says
+    server.setPacketCapture(ServerConfig::PacketCapture());
+
+    std::vector<ServerUser *> users;
+    {
+        QWriteLocker locker(&server.qrwlVoiceThread);
+        for (const PacketCaptureReader::Session &session : capture.sessions()) {
+            ServerUser *user = new ServerUser(&server);
+            user->uiSession = session.session;
+            user->qsName = QString("replay-%1").arg(session.session);
+            user->cChannel = session.channelId >= 0 ? channelFor(server, session.channelId) : nullptr;
+            user->bMute = (session.flags & PacketCapture::Mute) != 0;
+            user->bDeaf = (session.flags & PacketCapture::Deaf) != 0;
+            user->bSelfMute = (session.flags & PacketCapture::SelfMute) != 0;
+            user->bSelfDeaf = (session.flags & PacketCapture::SelfDeaf) != 0;
+            user->bSuppress = (session.flags & PacketCapture::Suppress) != 0;
+            user->qsGridSquare = session.grid;
+            if (!session.grid.isEmpty()) {
+                user->qmUserData.insert("maidenheadgrid", session.grid);
+            }
+            user->iPower = session.power;
+            user->fAntennaGain = session.antennaGain;
+
+            for (int channelId : session.listenedChannels) {
+                server.m_channelListenerManager.addListener(*user, *channelFor(server, channelId));
+            }
+
+            server.qhUsers.insert(static_cast<unsigned int>(session.session), user);
+            users.push_back(user);
+        }
+
+        // Datagrams find their user by peer address, as they did when captured
+        for (const PacketCaptureReader::Datagram &datagram : capture.datagrams()) {
+            ServerUser *user = server.qhUsers.value(datagram.session);
+            if (user) {
+                server.qhPeerUsers.insert(qMakePair(datagram.peer, datagram.port), user);
+            }
+        }
+    }
+
+    // Null sink: nothing leaves the process, sends are only counted
+    std::atomic<quint64> sent(0);
+    QObject::connect(
+        &server, &Server::tcpTransmit, &server,
+        [&sent](QByteArray, unsigned int) { sent.fetch_add(1, std::memory_order_relaxed); }, Qt::DirectConnection);
+
+    const std::vector<PacketCaptureReader::Datagram> &datagrams = capture.datagrams();
+    const double capturedSeconds = datagrams.empty() ? 0.0 : datagrams.back().timeUs / 1e6;
+    std::printf("murmur_replay: %zu users, %zu datagrams over %.1f s, %d passes\n", capture.sessions().size(),
+                datagrams.size(), capturedSeconds, passes);
+
+    const std::clock_t cpuStart = std::clock();
+    const Clock::time_point start = Clock::now();
+    for (int pass = 0; pass < passes; ++pass) {
+        for (const PacketCaptureReader::Datagram &datagram : datagrams) {
+            server.processDatagram(reinterpret_cast<const Mumble::Protocol::byte *>(datagram.data.constData()),
+                                   datagram.data.size(), datagram.peer, datagram.port);
+        }
+    }
+    const double wall = std::chrono::duration<double>(Clock::now() - start).count();
+    const double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    QSet<quint32> unknown;
+    for (const PacketCaptureReader::Datagram &datagram : datagrams) {
+        if (!server.qhUsers.contains(datagram.session)) {
+            unknown.insert(datagram.session);
+        }
+    }
+
+    const double replayed = static_cast<double>(datagrams.size()) * passes;
+    std::printf("  replayed                  %.0f datagrams in %.3f s (%.0f/s, %.2f us each)\n", replayed, wall,
+                wall > 0 ? replayed / wall : 0.0, replayed > 0 ? wall * 1e6 / replayed : 0.0);
+    if (capturedSeconds > 0 && wall > 0) {
+        std::printf("  speed                     %.1fx real time\n", capturedSeconds * passes / wall);
+    }
+    std::printf("  sends to the null sink    %llu\n", static_cast<unsigned long long>(sent.load()));
+    std::printf("  process CPU               %.3f s\n", cpu);
+    if (!unknown.isEmpty()) {
+        std::printf("  datagrams of %d unknown peers were dropped, as the server dropped them\n", unknown.size());
+    }
+
+    // Through the server, so the band mixer forgets the users before they go
+    for (ServerUser *user : users) {
+        server.removeUser(user);
+        delete user;
+    }
+    return 0;
+}
@@ -0,0 +1,709 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Routing data-structure benchmark: the time and the heap allocations per
+// operation of the structures the voice path consults for every packet, at
+// the size of a busy server (1,000 users in 50 channels, each listening to 5
+// other channels).
+//
+//   AudioReceiverBuffer     the receivers of every user while all of them talk
+//   ChannelListenerManager  5 listened channels per user
+//   WhisperTargetCache      per user, a whisper to its own and one more channel
+//   VolumeAdjustment        a factor for every user
+//   ThreadPool              one task per user, as the per-packet fan-out
+//
+// Each benchmark repeats until it ran for the minimum time; set-up and
+// tear-down are not measured. Allocations are counted process-wide, so the
+// ThreadPool numbers include what its workers allocate.
+//
+// Usage: murmur_bench [output.json] [seconds per benchmark]
+
+#include "AudioReceiverBuffer.h"
+#include "Channel.h"
+#include "ChannelListenerManager.h"
+#include "TaskGroup.h"
+#include "ThreadPool.h"
+#include "User.h"
+#include "VolumeAdjustment.h"
+#include "WhisperTarget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    std::atomic<quint64> g_allocations(0);
+    std::atomic<quint64> g_allocatedBytes(0);
+
+    inline void countAllocation(size_t bytes) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+} // namespace
+
+// Qt containers allocate their nodes with malloc(), not operator new. On glibc
+// malloc() itself is replaced, which also sees operator new; elsewhere only
+// operator new is counted.
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size) noexcept {
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept {
+    countAllocation(size);
+    return __libc_realloc(pointer, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) noexcept {
+    countAllocation(size);
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+
+void free(void *pointer) noexcept {
+    __libc_free(pointer);
+}
+}
+
+static const char *const ALLOCATION_COUNTING = "malloc";
+#else
+void *operator new(size_t size) {
+    countAllocation(size);
+    if (void *pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+static const char *const ALLOCATION_COUNTING = "operator new";
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int USERS = 1000;
+    const int CHANNELS = 50;
+    const int LISTENS_PER_USER = 5;
+    // Whisper targets name the channel of the user and this many more
+    const int WHISPER_CHANNELS = 2;
+
+    // Keeps results that are computed only to be measured
+    volatile quint64 g_sink;
+
+    /**
+     * Accumulates the time, operations and allocations of the measured parts
+     * of a benchmark.
+     */
+    class Meter {
+    public:
+        Meter() : m_nanoseconds(0), m_operations(0), m_allocations(0), m_bytes(0) {}
+
+        void start() {
+            m_startAllocations = g_allocations.load(std::memory_order_relaxed);
+            m_startBytes = g_allocatedBytes.load(std::memory_order_relaxed);
+            m_start = Clock::now();
+        }
+
+        void stop(quint64 operations) {
+            const Clock::time_point end = Clock::now();
+            m_allocations += g_allocations.load(std::memory_order_relaxed) - m_startAllocations;
+            m_bytes += g_allocatedBytes.load(std::memory_order_relaxed) - m_startBytes;
+            m_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count();
+            m_operations += operations;
+        }
+
+        double seconds() const { return m_nanoseconds / 1e9; }
+        quint64 operations() const { return m_operations; }
+        double nsPerOperation() const { return m_operations ? double(m_nanoseconds) / m_operations : 0.0; }
+        double allocationsPerOperation() const { return m_operations ? double(m_allocations) / m_operations : 0.0; }
+        double bytesPerOperation() const { return m_operations ? double(m_bytes) / m_operations : 0.0; }
+
+    private:
+        Clock::time_point m_start;
+        quint64 m_startAllocations;
+        quint64 m_startBytes;
+        qint64 m_nanoseconds;
+        quint64 m_operations;
+        quint64 m_allocations;
+        quint64 m_bytes;
+    };
+
+    struct Result {
+        std::string structure;
+        std::string operation;
+        int items; // Entries in the structure while it is measured
+        quint64 operations;
+        double nsPerOperation;
+        double allocationsPerOperation;
+        double bytesPerOperation;
+    };
+
+    class Bench {
+    public:
+        explicit Bench(double minSeconds) : m_minSeconds(minSeconds) {}
+
+        /**
+         * Calls round(meter) once to warm up, then until the measured parts
+         * took at least the minimum time.
+         */
+        template<class Round>
+        void measure(const char *structure, const char *operation, int items, Round round) {
+            Meter warmUp;
+            round(warmUp);
+
+            Meter meter;
+            do {
+                round(meter);
+            } while (meter.seconds() < m_minSeconds);
+
+            m_results.push_back({ structure, operation, items, meter.operations(), meter.nsPerOperation(),
+                                  meter.allocationsPerOperation(), meter.bytesPerOperation() });
+            const Result &result = m_results.back();
+            std::printf("%-24s %-18s %8d %12.1f %10.3f %12.1f\n", structure, operation, items, result.nsPerOperation,
+                        result.allocationsPerOperation, result.bytesPerOperation);
+            std::fflush(stdout);
+        }
+
+        bool writeJson(const char *path) const {
+            std::FILE *file = std::fopen(path, "w");
+            if (!file) {
+                return false;
+            }
+            std::fprintf(file,
+                         "{\n  \"users\": %d,\n  \"channels\": %d,\n  \"listens_per_user\": %d,\n"
+                         "  \"allocation_counting\": \"%s\",\n  \"results\": [",
+                         USERS, CHANNELS, LISTENS_PER_USER, ALLOCATION_COUNTING);
+            for (size_t i = 0; i < m_results.size(); ++i) {
+                const Result &result = m_results[i];
+                std::fprintf(file,
+                             "%s\n    {\"structure\": \"%s\", \"operation\": \"%s\", \"items\": %d, "
+                             "\"operations\": %llu, \"ns_per_op\": %.2f, \"allocations_per_op\": %.4f, "
+                             "\"bytes_per_op\": %.2f}",
+                             i ? "," : "", result.structure.c_str(), result.operation.c_str(), result.items,
+                             static_cast<unsigned long long>(result.operations), result.nsPerOperation,
+                             result.allocationsPerOperation, result.bytesPerOperation);
+            }
+            std::fprintf(file, "\n  ]\n}\n");
+            return std::fclose(file) == 0;
+        }
+
+    private:
+        double m_minSeconds;
+        std::vector<Result> m_results;
+    };
+
+    /**
+     * The users and channels of the simulated server.
+     *
+     * A ServerUser needs a running Server, but the structures benchmarked here
+     * only hash and compare user addresses, so each user is a separately
+     * allocated block of the size of a ServerUser: the addresses are spread as
+     * those of real users would be, and are never dereferenced.
+     */
+    class Population {
+    public:
+        Population() {
+            for (int i = 0; i < USERS; ++i) {
+                m_userStorage.emplace_back(new char[sizeof(ServerUser)]);
+                users.push_back(reinterpret_cast<ServerUser *>(m_userStorage.back().get()));
+            }
+            for (int i = 0; i < CHANNELS; ++i) {
+                channels.emplace_back(new Channel(i, QString("Channel %1").arg(i)));
+            }
+
+            listened.resize(USERS);
+            members.resize(CHANNELS);
+            listeners.resize(CHANNELS);
+            for (int user = 0; user < USERS; ++user) {
+                const int home = channelOf(user);
+                members[home].push_back(user);
+                // Offsets 1, 10, 19, 28 and 37 are distinct and never the home channel
+                for (int k = 0; k < LISTENS_PER_USER; ++k) {
+                    const int channel = (home + 1 + 9 * k) % CHANNELS;
+                    listened[user].push_back(channel);
+                    listeners[channel].push_back(user);
+                }
+            }
+        }
+
+        static int channelOf(int user) { return user % CHANNELS; }
+
+        /// Everybody who hears user talk: the other members of its channel and the listeners of it
+        std::vector<int> receiversOf(int user) const {
+            std::vector<int> receivers;
+            const int home = channelOf(user);
+            for (int member : members[home]) {
+                if (member != user) {
+                    receivers.push_back(member);
+                }
+            }
+            for (int listener : listeners[home]) {
+                receivers.push_back(listener);
+            }
+            return receivers;
+        }
+
+        /// The users reached by a whisper of user to its own channel and the next ones
+        std::vector<int> whisperTargetsOf(int user) const {
+            std::vector<int> targets;
+            for (int k = 0; k < WHISPER_CHANNELS; ++k) {
+                for (int member : members[(channelOf(user) + k) % CHANNELS]) {
+                    if (member != user) {
+                        targets.push_back(member);
+                    }
+                }
+            }
+            return targets;
+        }
+
+        std::vector<ServerUser *> users;
+        std::vector<std::unique_ptr<Channel>> channels;
+        std::vector<std::vector<int>> listened; // Channels each user listens to
+        std::vector<std::vector<int>> members; // Users in each channel
+        std::vector<std::vector<int>> listeners; // Users listening to each channel
+
+    private:
+        std::vector<std::unique_ptr<char[]>> m_userStorage;
+    };
+
+    void benchAudioReceiverBuffer(Bench &bench, const Population &population) {
+        std::vector<std::vector<int>> receivers;
+        int entries = 0;
+        for (int user = 0; user < USERS; ++user) {
+            receivers.push_back(population.receiversOf(user));
+            entries += static_cast<int>(receivers.back().size());
+        }
+        const VolumeAdjustment adjustment;
+
+        const auto fill = [&](AudioReceiverBuffer &buffer) {
+            for (int speaker = 0; speaker < USERS; ++speaker) {
+                for (int receiver : receivers[speaker]) {
+                    buffer.addReceiver(population.users[speaker], population.users[receiver], adjustment);
+                }
+            }
+        };
+
+        bench.measure("AudioReceiverBuffer", "insert", entries, [&](Meter &meter) {
+            AudioReceiverBuffer buffer;
+            meter.start();
+            fill(buffer);
+            meter.stop(entries);
+        });
+
+        AudioReceiverBuffer buffer;
+        fill(buffer);
+
+        bench.measure("AudioReceiverBuffer", "lookup", entries, [&](Meter &meter) {
+            // Every receiver of a speaker, and as many users who are not
+            quint64 found = 0;
+            meter.start();
+            for (int speaker = 0; speaker < USERS; ++speaker) {
+                ServerUser *user = population.users[speaker];
+                const int count = static_cast<int>(receivers[speaker].size());
+                for (int i = 0; i < count; ++i) {
+                    found += buffer.isReceiving(user, population.users[receivers[speaker][i]]);
+                    found += buffer.isReceiving(user, population.users[(speaker + 1 + i * CHANNELS) % USERS]);
+                }
+            }
+            meter.stop(2 * static_cast<quint64>(entries));
+            g_sink = found;
+        });
+
+        bench.measure("AudioReceiverBuffer", "iterate", entries, [&](Meter &meter) {
+            float sum = 0.0f;
+            meter.start();
+            for (int speaker = 0; speaker < USERS; ++speaker) {
+                const QHash<ServerUser *, VolumeAdjustment> speakerReceivers =
+                    buffer.getReceivers(population.users[speaker]);
+                for (auto it = speakerReceivers.constBegin(); it != speakerReceivers.constEnd(); ++it) {
+                    sum += it.value().getAdjustmentFactor(nullptr);
+                }
+            }
+            meter.stop(entries);
+            g_sink = static_cast<quint64>(sum);
+        });
+
+        bench.measure("AudioReceiverBuffer", "remove", entries, [&](Meter &meter) {
+            AudioReceiverBuffer filled;
+            fill(filled);
+            meter.start();
+            for (int speaker = 0; speaker < USERS; ++speaker) {
+                for (int receiver : receivers[speaker]) {
+                    filled.removeReceiver(population.users[speaker], population.users[receiver]);
+                }
+            }
+            meter.stop(entries);
+        });
+    }
+
+    void benchChannelListenerManager(Bench &bench, const Population &population) {
+        const int entries = USERS * LISTENS_PER_USER;
+
+        const auto fill = [&](ChannelListenerManager &manager) {
+            for (int user = 0; user < USERS; ++user) {
+                for (int channel : population.listened[user]) {
+                    manager.addListener(*population.users[user], *population.channels[channel]);
+                }
+            }
+        };
+
+        bench.measure("ChannelListenerManager", "insert", entries, [&](Meter &meter) {
+            ChannelListenerManager manager;
+            meter.start();
+            fill(manager);
+            meter.stop(entries);
+        });
+
+        ChannelListenerManager manager;
+        fill(manager);
+
+        bench.measure("ChannelListenerManager", "lookup", entries, [&](Meter &meter) {
+            // Every listened channel, and the home channel, which is never listened to
+            quint64 found = 0;
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                const ServerUser &listener = *population.users[user];
+                for (int channel : population.listened[user]) {
+                    found += manager.isListening(listener, *population.channels[channel]);
+                    found += manager.isListening(listener, *population.channels[Population::channelOf(user)]);
+                }
+            }
+            meter.stop(2 * static_cast<quint64>(entries));
+            g_sink = found;
+        });
+
+        bench.measure("ChannelListenerManager", "iterate_listeners", entries, [&](Meter &meter) {
+            quintptr sum = 0;
+            meter.start();
+            for (int channel = 0; channel < CHANNELS; ++channel) {
+                const QSet<const ServerUser *> listeners = manager.getListeners(*population.channels[channel]);
+                for (const ServerUser *listener : listeners) {
+                    sum += reinterpret_cast<quintptr>(listener);
+                }
+            }
+            meter.stop(entries);
+            g_sink = sum;
+        });
+
+        bench.measure("ChannelListenerManager", "snapshot_iterate_listeners", entries, [&](Meter &meter) {
+            quintptr sum = 0;
+            meter.start();
+            const ChannelListenerManager::ReadGuard snapshot = manager.snapshot();
+            for (int channel = 0; channel < CHANNELS; ++channel) {
+                snapshot->forEachListener(*population.channels[channel],
+                                          [&sum](const ServerUser *listener, const VolumeAdjustment &) {
+                                              sum += reinterpret_cast<quintptr>(listener);
+                                          });
+            }
+            meter.stop(entries);
+            g_sink = sum;
+        });
+
+        bench.measure("ChannelListenerManager", "snapshot_unite", entries, [&](Meter &meter) {
+            // The listeners of every channel and the next one, as for a
+            // whisper to two channels
+            quintptr sum = 0;
+            ChannelListenerSnapshot::Bits bits;
+            meter.start();
+            const ChannelListenerManager::ReadGuard snapshot = manager.snapshot();
+            for (int channel = 0; channel < CHANNELS; ++channel) {
+                std::fill(bits.begin(), bits.end(), 0);
+                snapshot->unite(*population.channels[channel], bits);
+                snapshot->unite(*population.channels[(channel + 1) % CHANNELS], bits);
+                snapshot->forEachUser(bits, [&sum](const ServerUser *listener) {
+                    sum += reinterpret_cast<quintptr>(listener);
+                });
+            }
+            meter.stop(2 * static_cast<quint64>(entries));
+            g_sink = sum;
+        });
+
+        bench.measure("ChannelListenerManager", "iterate_channels", entries, [&](Meter &meter) {
+            quintptr sum = 0;
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                const QSet<const Channel *> channels = manager.getListenedChannels(*population.users[user]);
+                for (const Channel *channel : channels) {
+                    sum += reinterpret_cast<quintptr>(channel);
+                }
+            }
+            meter.stop(entries);
+            g_sink = sum;
+        });
+
+        bench.measure("ChannelListenerManager", "volume_lookup", entries, [&](Meter &meter) {
+            float sum = 0.0f;
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                for (int channel : population.listened[user]) {
+                    sum += manager
+                               .getListenerVolumeAdjustment(*population.users[user], *population.channels[channel])
+                               .getAdjustmentFactor(nullptr);
+                }
+            }
+            meter.stop(entries);
+            g_sink = static_cast<quint64>(sum);
+        });
+
+        bench.measure("ChannelListenerManager", "remove", entries, [&](Meter &meter) {
+            ChannelListenerManager filled;
+            fill(filled);
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                for (int channel : population.listened[user]) {
+                    filled.removeListener(*population.users[user], *population.channels[channel]);
+                }
+            }
+            meter.stop(entries);
+        });
+    }
+
+    void benchWhisperTargetCache(Bench &bench, const Population &population) {
+        std::vector<std::vector<int>> targets;
+        int entries = 0;
+        for (int user = 0; user < USERS; ++user) {
+            targets.push_back(population.whisperTargetsOf(user));
+            entries += static_cast<int>(targets.back().size());
+        }
+
+        const auto fill = [&](std::vector<WhisperTargetCache> &caches) {
+            for (int user = 0; user < USERS; ++user) {
+                for (int target : targets[user]) {
+                    caches[user].addUser(population.users[target]);
+                }
+            }
+        };
+
+        bench.measure("WhisperTargetCache", "insert", entries, [&](Meter &meter) {
+            std::vector<WhisperTargetCache> caches(USERS);
+            meter.start();
+            fill(caches);
+            meter.stop(entries);
+        });
+
+        std::vector<WhisperTargetCache> caches(USERS);
+        fill(caches);
+
+        bench.measure("WhisperTargetCache", "lookup", entries, [&](Meter &meter) {
+            // Every target, and as many users from a channel not whispered to
+            quint64 found = 0;
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                const QSet<ServerUser *> &users = caches[user].getUsers();
+                const int count = static_cast<int>(targets[user].size());
+                for (int i = 0; i < count; ++i) {
+                    found += users.contains(population.users[targets[user][i]]);
+                    found += users.contains(population.users[(user + WHISPER_CHANNELS + i * CHANNELS) % USERS]);
+                }
+            }
+            meter.stop(2 * static_cast<quint64>(entries));
+            g_sink = found;
+        });
+
+        bench.measure("WhisperTargetCache", "iterate", entries, [&](Meter &meter) {
+            quintptr sum = 0;
+            meter.start();
+            for (int user = 0; user < USERS; ++user) {
+                for (ServerUser *target : caches[user].getUsers()) {
+                    sum += reinterpret_cast<quintptr>(target);
+                }
+            }
+            meter.stop(entries);
+            g_sink = sum;
+        });
+
+        bench.measure("WhisperTargetCache", "clear", entries, [&](Meter &meter) {
+            std::vector<WhisperTargetCache> filled(USERS);
+            fill(filled);
+            meter.start();
+            for (WhisperTargetCache &cache : filled) {
+                cache.clear();
+            }
+            meter.stop(entries);
+        });
+    }
+
+    void benchVolumeAdjustment(Bench &bench, const Population &population) {
+        const auto user = [&population](int i) { return reinterpret_cast<const User *>(population.users[i]); };
+
+        const auto fill = [&](VolumeAdjustment &adjustment) {
+            for (int i = 0; i < USERS; ++i) {
+                adjustment.setAdjustmentFactor(user(i), 0.5f + (i % 8) * 0.25f);
+            }
+        };
+
+        bench.measure("VolumeAdjustment", "insert", USERS, [&](Meter &meter) {
+            VolumeAdjustment adjustment(VolumeAdjustment::UserSpecific);
+            meter.start();
+            fill(adjustment);
+            meter.stop(USERS);
+        });
+
+        VolumeAdjustment adjustment(VolumeAdjustment::UserSpecific);
+        fill(adjustment);
+
+        bench.measure("VolumeAdjustment", "lookup", USERS, [&](Meter &meter) {
+            float sum = 0.0f;
+            meter.start();
+            for (int i = 0; i < USERS; ++i) {
+                sum += adjustment.getAdjustmentFactor(user(i));
+            }
+            meter.stop(USERS);
+            g_sink = static_cast<quint64>(sum);
+        });
+
+        bench.measure("VolumeAdjustment", "adjust", USERS, [&](Meter &meter) {
+            float sum = 0.0f;
+            meter.start();
+            for (int i = 0; i < USERS; ++i) {
+                sum += adjustment.adjustForUser(0.25f, user(i));
+            }
+            meter.stop(USERS);
+            g_sink = static_cast<quint64>(sum);
+        });
+
+        // The receiver buffer and the listener manager hold adjustments by value
+        bench.measure("VolumeAdjustment", "copy_and_update", USERS, [&](Meter &meter) {
+            float sum = 0.0f;
+            meter.start();
+            for (int i = 0; i < USERS; ++i) {
+                VolumeAdjustment copy = adjustment;
+                copy.setAdjustmentFactor(user(i), 1.0f);
+                sum += copy.getAdjustmentFactor(user(i));
+            }
+            meter.stop(USERS);
+            g_sink = static_cast<quint64>(sum);
+        });
+    }
+
+    class CountingTask : public ThreadPool::Task {
+    public:
+        CountingTask() : m_remaining(nullptr) {}
+
+        void arm(std::atomic<int> *remaining) { m_remaining = remaining; }
+
+        void run() override { m_remaining->fetch_sub(1, std::memory_order_acq_rel); }
+
+    private:
+        std::atomic<int> *m_remaining;
+    };
+
+    void waitFor(const std::atomic<int> &remaining) {
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    void benchThreadPool(Bench &bench) {
+        ThreadPool pool;
+        std::vector<CountingTask> tasks(USERS);
+        std::vector<ThreadPool::Task *> taskPointers;
+        for (CountingTask &task : tasks) {
+            taskPointers.push_back(&task);
+        }
+
+        bench.measure("ThreadPool", "submit", USERS, [&](Meter &meter) {
+            std::atomic<int> remaining(USERS);
+            for (CountingTask &task : tasks) {
+                task.arm(&remaining);
+            }
+            meter.start();
+            for (ThreadPool::Task *task : taskPointers) {
+                pool.submit(task);
+            }
+            waitFor(remaining);
+            meter.stop(USERS);
+        });
+
+        bench.measure("ThreadPool", "submit_bulk", USERS, [&](Meter &meter) {
+            std::atomic<int> remaining(USERS);
+            for (CountingTask &task : tasks) {
+                task.arm(&remaining);
+            }
+            meter.start();
+            pool.submitBulk(taskPointers.data(), USERS);
+            waitFor(remaining);
+            meter.stop(USERS);
+        });
+
+        bench.measure("ThreadPool", "task_group", USERS, [&](Meter &meter) {
+            std::atomic<int> done(0);
+            meter.start();
+            {
+                TaskGroup group(&pool);
+                for (int i = 0; i < USERS; ++i) {
+                    group.run([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                }
+                group.wait();
+            }
+            meter.stop(USERS);
+        });
+
+        bench.measure("ThreadPool", "parallel_for", USERS, [&](Meter &meter) {
+            std::atomic<int> done(0);
+            meter.start();
+            pool.parallelFor(0, USERS, 16, [&done](int) { done.fetch_add(1, std::memory_order_relaxed); });
+            meter.stop(USERS);
+        });
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *output = argc > 1 ? argv[1] : "murmur_bench.json";
+    const double minSeconds = argc > 2 ? std::atof(argv[2]) : 0.5;
+
+    Population population;
+    Bench bench(minSeconds);
+
+    std::printf("%-24s %-18s %8s %12s %10s %12s\n", "structure", "operation", "items", "ns/op", "allocs/op",
+                "bytes/op");
+    benchAudioReceiverBuffer(bench, population);
+    benchChannelListenerManager(bench, population);
+    benchWhisperTargetCache(bench, population);
+    benchVolumeAdjustment(bench, population);
+    benchThreadPool(bench);
+
+    if (!bench.writeJson(output)) {
+        std::fprintf(stderr, "murmur_bench: Cannot write %s\n", output);
+        return 1;
+    }
+    std::printf("Results written to %s\n", output);
+    return 0;
+}
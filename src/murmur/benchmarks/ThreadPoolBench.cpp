@@ -0,0 +1,231 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Scheduler contention benchmark: ThreadPool against the single mutex-and-
+// condition-variable queue it replaced, at 1, 4, 16 and 32 threads.
+//
+//   external  N threads outside the pool each submit a share of tiny tasks
+//   nested    tasks spawn their children from inside the pool (fork-join tree)
+//
+// Usage: threadpool_bench [tasks]
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Counts finished tasks and wakes the benchmark thread after the last one
+    class Latch {
+    public:
+        explicit Latch(long count) : m_count(count) {}
+
+        void countDown() {
+            if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_condition.notify_all();
+            }
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_count.load(std::memory_order_acquire) == 0; });
+        }
+
+    private:
+        std::atomic<long> m_count;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+    };
+
+    // The previous ThreadPool design: one queue, one mutex, one condition variable
+    class MutexQueuePool {
+    public:
+        explicit MutexQueuePool(int threads) : m_stop(false) {
+            for (int i = 0; i < threads; ++i) {
+                m_workers.emplace_back([this] {
+                    for (;;) {
+                        std::function<void()> task;
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+                            if (m_stop && m_tasks.empty()) {
+                                return;
+                            }
+                            task = std::move(m_tasks.front());
+                            m_tasks.pop();
+                        }
+                        task();
+                    }
+                });
+            }
+        }
+
+        ~MutexQueuePool() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_condition.notify_all();
+            for (std::thread &worker : m_workers) {
+                worker.join();
+            }
+        }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.push(std::move(task));
+            }
+            m_condition.notify_one();
+        }
+
+    private:
+        std::vector<std::thread> m_workers;
+        std::queue<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        bool m_stop;
+    };
+
+    // A little work so that tasks are not pure scheduling overhead
+    inline void spin(unsigned int seed) {
+        volatile unsigned int x = seed;
+        for (int i = 0; i < 64; ++i) {
+            x = x * 1664525u + 1013904223u;
+        }
+    }
+
+    class LeafTask : public ThreadPool::Task {
+    public:
+        explicit LeafTask(Latch *latch) : m_latch(latch) {}
+
+        void run() override {
+            spin(reinterpret_cast<uintptr_t>(this));
+            Latch *latch = m_latch;
+            delete this;
+            latch->countDown();
+        }
+
+    private:
+        Latch *m_latch;
+    };
+
+    class TreeTask : public ThreadPool::Task {
+    public:
+        TreeTask(ThreadPool *pool, Latch *latch, int depth) : m_pool(pool), m_latch(latch), m_depth(depth) {}
+
+        void run() override {
+            if (m_depth > 0) {
+                m_pool->submit(new TreeTask(m_pool, m_latch, m_depth - 1));
+                m_pool->submit(new TreeTask(m_pool, m_latch, m_depth - 1));
+            }
+            spin(static_cast<unsigned int>(m_depth));
+            Latch *latch = m_latch;
+            delete this;
+            latch->countDown();
+        }
+
+    private:
+        ThreadPool *m_pool;
+        Latch *m_latch;
+        int m_depth;
+    };
+
+    void legacyTree(MutexQueuePool *pool, Latch *latch, int depth) {
+        if (depth > 0) {
+            pool->submit([pool, latch, depth] { legacyTree(pool, latch, depth - 1); });
+            pool->submit([pool, latch, depth] { legacyTree(pool, latch, depth - 1); });
+        }
+        spin(static_cast<unsigned int>(depth));
+        latch->countDown();
+    }
+
+    template<typename Submit>
+    double runExternal(int threads, long tasks, Latch &latch, Submit submit) {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> submitters;
+        for (int t = 0; t < threads; ++t) {
+            submitters.emplace_back([&, t] {
+                for (long i = t; i < tasks; i += threads) {
+                    submit();
+                }
+            });
+        }
+        for (std::thread &submitter : submitters) {
+            submitter.join();
+        }
+        latch.wait();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double elapsedSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char **argv) {
+    const long tasks = argc > 1 ? std::atol(argv[1]) : 1000000;
+
+    // A full binary tree with about the same number of tasks
+    int depth = 0;
+    while ((2L << (depth + 1)) - 1 <= tasks) {
+        ++depth;
+    }
+    const long treeTasks = (2L << depth) - 1;
+
+    std::printf("%-8s %-10s %14s %14s %8s\n", "threads", "scenario", "mutex queue/s", "stealing/s", "speedup");
+
+    for (int threads : { 1, 4, 16, 32 }) {
+        double legacyExternal, legacyNested, stealingExternal, stealingNested;
+
+        {
+            MutexQueuePool pool(threads);
+
+            Latch external(tasks);
+            legacyExternal = runExternal(threads, tasks, external, [&] {
+                pool.submit([&external] {
+                    spin(0);
+                    external.countDown();
+                });
+            });
+
+            Latch nested(treeTasks);
+            const auto start = std::chrono::steady_clock::now();
+            pool.submit([&pool, &nested, depth] { legacyTree(&pool, &nested, depth); });
+            nested.wait();
+            legacyNested = elapsedSince(start);
+        }
+
+        {
+            ThreadPool pool(threads);
+
+            Latch external(tasks);
+            stealingExternal = runExternal(threads, tasks, external, [&] { pool.submit(new LeafTask(&external)); });
+
+            Latch nested(treeTasks);
+            const auto start = std::chrono::steady_clock::now();
+            pool.submit(new TreeTask(&pool, &nested, depth));
+            nested.wait();
+            stealingNested = elapsedSince(start);
+        }
+
+        std::printf("%-8d %-10s %14.0f %14.0f %7.2fx\n", threads, "external", tasks / legacyExternal,
+                    tasks / stealingExternal, legacyExternal / stealingExternal);
+        std::printf("%-8d %-10s %14.0f %14.0f %7.2fx\n", threads, "nested", treeTasks / legacyNested,
+                    treeTasks / stealingNested, legacyNested / stealingNested);
+    }
+
+    return 0;
+}
@@ -3,12 +3,16 @@
 // that can be found in the LICENSE file at the root of the
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
+#include "MetricsServer.h"
 #include "Server.h"
 #include "ServerApplication.h"
+#include "ServerConfig.h"
+#include "ServerConfigWatcher.h"
+#include "ThreadPlacement.h"
+#include "VoiceTraceWriter.h"
 #include "database/MariaDBConnectionParameter.h"
 
 #include <QtCore/QCoreApplication>
-#include <QtCore/QSettings>
 #include <QtCore/QTextCodec>
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
@@ -75,24 +79,28 @@ int main(int argc, char **argv) {
         return 1;
     }
     
-    // Detect available CPU cores
-    int cpuCores = QThread::idealThreadCount();
-    qWarning() << "Detected" << cpuCores << "CPU cores available for parallel processing";
+    // Detect the CPUs, sockets and NUMA nodes available to the server
+    const CpuTopology &topology = CpuTopology::system();
+    qWarning() << "Detected" << topology.describe() << "available for parallel processing";
     
-    // Load configuration
-    QSettings qs(configFile, QSettings::IniFormat);
+    // Load configuration; every subsystem reads this snapshot
+    const std::shared_ptr<const ServerConfig> config = ServerConfig::load(configFile);
+    if (!config) {
+        qWarning() << "Failed to read the configuration file.";
+        return 1;
+    }
+    ServerConfig::setCurrent(config);
     
-    // Check for multi-core configuration
-    qs.beginGroup("performance");
-    bool enableMultiCore = qs.value("enable_multi_core", true).toBool();
-    int maxThreads = qs.value("max_threads", 0).toInt(); // 0 means use all available cores
-    qs.endGroup();
+    // Decide where the voice, DSP and pool threads run; this must happen
+    // before the server creates any of them
+    const ThreadPlacement &placement = config->performance().placement;
+    ThreadPlacement::setCurrent(placement);
+    placement.log();
     
-    if (!enableMultiCore) {
+    if (!placement.multiCore()) {
         qWarning() << "Multi-core processing is disabled in configuration. Server will use single-threaded mode.";
     } else {
-        int threadsToUse = (maxThreads > 0 && maxThreads < cpuCores) ? maxThreads : cpuCores;
-        qWarning() << "Server will utilize" << threadsToUse << "CPU cores for parallel processing";
+        qWarning() << "Server will utilize" << placement.poolThreads() << "CPU cores for parallel processing";
     }
     
     // Create the database connection parameter for MariaDB
@@ -111,7 +119,7 @@ int main(int argc, char **argv) {
     
     try {
         // Initialize the server
-        // server->initialize(); // Method doesn't exist
+        server->initialize();
         
         // Log server information
         qWarning() << "Server initialized successfully.";
@@ -119,16 +127,14 @@ int main(int argc, char **argv) {
         qWarning() << "Max users:" << server->iMaxUsers;
         
         // Check if HF band simulation is enabled
-        QSettings qs(configFile, QSettings::IniFormat);
-        qs.beginGroup("hf_propagation");
-        bool hfEnabled = qs.value("enabled", true).toBool();
+        const ServerConfig::HFPropagation &propagation = config->hfPropagation();
+        bool hfEnabled = propagation.enabled;
         
         // Read external data source settings
-        bool useExternalData = qs.value("use_external_data", true).toBool();
-        bool useDXViewData = qs.value("use_dxview_data", true).toBool();
-        bool useSWPCData = qs.value("use_swpc_data", true).toBool();
-        int updateInterval = qs.value("update_interval", 30).toInt();
-        qs.endGroup();
+        bool useExternalData = propagation.useExternalData;
+        bool useDXViewData = propagation.useDXViewData;
+        bool useSWPCData = propagation.useSWPCData;
+        int updateInterval = propagation.updateInterval;
         
         if (hfEnabled) {
             qWarning() << "HF band simulation is enabled.";
@@ -156,7 +162,27 @@ int main(int argc, char **argv) {
             qWarning() << "HF band simulation is disabled.";
         }
         
-        // Start the server
+        // Serve the metrics of the server internals
+        MetricsServer *metricsServer = new MetricsServer(&a);
+        metricsServer->applyConfig(config);
+        
+        // Sampled latency traces of voice packets, off unless configured
+        VoiceTraceWriter *voiceTraceWriter = new VoiceTraceWriter(&a);
+        voiceTraceWriter->applyConfig(config);
+        
+        // Pick up edits of the configuration file without a restart
+        ServerConfigWatcher *configWatcher = new ServerConfigWatcher(configFile, &a);
+        QObject::connect(configWatcher, &ServerConfigWatcher::configChanged, server, &Server::applyConfig);
+        QObject::connect(configWatcher, &ServerConfigWatcher::configChanged, metricsServer,
+                         &MetricsServer::applyConfig);
+        QObject::connect(configWatcher, &ServerConfigWatcher::configChanged, voiceTraceWriter,
+                         &VoiceTraceWriter::applyConfig);
+        
+        // Start the server; the voice thread flushes the mixed band channels
+        // and the code practice streams, and is stopped before the event loop
+        // objects it reports to go away
+        server->startThread();
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, server, [server]() { server->stopThread(); });
         qWarning() << "Supermorse Mumble Server started successfully.";
         
         // Run the application
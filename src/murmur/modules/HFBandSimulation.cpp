@@ -4,6 +4,8 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "HFBandSimulation.h"
+#include "../CoarseClock.h"
+#include "../Metrics.h"
 #include "../User.h"
 
 #include <QtCore/QDebug>
@@ -75,17 +77,24 @@ float HFBandSimulation::getSignalQuality(ServerUser *user1, ServerUser *user2) {
 }
 
 float HFBandSimulation::calculateSignalStrength(const QString &grid1, const QString &grid2) {
+    static MetricCounter &cacheHits = MetricsRegistry::instance().counter(
+        "murmur_hf_signal_cache_hits_total", "Signal strength lookups answered from the cache");
+    static MetricCounter &cacheMisses = MetricsRegistry::instance().counter(
+        "murmur_hf_signal_cache_misses_total", "Signal strength lookups that were computed");
+    
     // Check if the signal strength is already cached
     QPair<QString, QString> gridPair(grid1, grid2);
     if (m_signalStrengthCache.contains(gridPair)) {
+        cacheHits.increment();
         return m_signalStrengthCache.value(gridPair);
     }
+    cacheMisses.increment();
     
     // Calculate the distance between the grids
     float distance = calculateDistance(grid1, grid2);
     
-    // Get the current time
-    QDateTime now = QDateTime::currentDateTime();
+    // Get the current simulation time
+    QDateTime now = CoarseClock::instance().simulation();
     
     // Calculate the solar zenith angle at both locations
     float sza1 = calculateSolarZenithAngle(grid1, now);
@@ -394,7 +403,7 @@ void HFBandSimulation::getFadingEffects(float signalStrength, float &packetLoss,
     float baseDegradation = 1.0f - signalStrength;
     
     // Get current time for time-based fading components
-    qint64 currentTimeMs = QDateTime::currentMSecsSinceEpoch();
+    qint64 currentTimeMs = CoarseClock::instance().monotonicMs();
     
     // Slow fading component (changes over seconds)
     // This simulates gradual ionospheric changes that affect signal strength
@@ -445,6 +454,17 @@ void HFBandSimulation::getFadingEffects(float signalStrength, float &packetLoss,
     noiseFactor = qBound(0.0f, noiseFactor, 0.9f);
 }
 
+float HFBandSimulation::getFadingDepth(float signalStrength) const {
+    // Weaker signals fade deeper, with the same non-linear curve as the base
+    // fading in getFadingEffects()
+    float baseFading = std::pow(1.0f - qBound(0.0f, signalStrength, 1.0f), 1.3f);
+    
+    // A disturbed ionosphere (high K-index) makes the fading deeper
+    float geomagneticFactor = 0.5f + (m_kIndex / 9.0f) * 0.5f;
+    
+    return qBound(0.0f, baseFading * geomagneticFactor, 0.95f);
+}
+
 int HFBandSimulation::recommendBand(float distance) {
     // Calculate the MUF
     float muf = calculateMUF(distance);
@@ -519,6 +539,12 @@ float HFBandSimulation::calculateMUF(float distance) {
 }
 
 void HFBandSimulation::updatePropagation() {
+    static MetricHistogram &duration = MetricsRegistry::instance().histogram(
+        "murmur_hf_propagation_update_duration_seconds", "Time a propagation update took");
+    static MetricCounter &updates =
+        MetricsRegistry::instance().counter("murmur_hf_propagation_updates_total", "Propagation updates");
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
     // Update the season if auto time is enabled
     if (m_autoTimeEnabled) {
         updateSeason();
@@ -532,13 +558,16 @@ void HFBandSimulation::updatePropagation() {
     // Clear the signal strength cache
     m_signalStrengthCache.clear();
     
+    updates.increment();
+    duration.recordSince(start);
+    
     // Emit the propagation updated signal
     emit propagationUpdated();
 }
 
 void HFBandSimulation::updateSeason() {
-    // Get the current date
-    QDate currentDate = QDate::currentDate();
+    // Get the current simulation date
+    QDate currentDate = CoarseClock::instance().simulation().date();
     
     // Get the month
     int month = currentDate.month();
@@ -219,6 +219,18 @@ public:
      */
     void getFadingEffects(float signalStrength, float &packetLoss, float &jitter, float &noiseFactor);
     
+    /**
+     * @brief Get the depth of the slow fading (QSB) for a given signal strength.
+     * 
+     * Unlike getFadingEffects(), this does not vary from call to call: it is
+     * the depth of the fading, not its current level, for renderers that
+     * produce the fading themselves.
+     * 
+     * @param signalStrength The signal strength
+     * @return The fading depth (0.0 to 0.95)
+     */
+    float getFadingDepth(float signalStrength) const;
+    
     /**
      * @brief Recommend a band for a given distance.
      * 
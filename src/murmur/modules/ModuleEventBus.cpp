@@ -0,0 +1,48 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ModuleEventBus.h"
+
+ModuleEventBus::ModuleEventBus() : m_lastId(0) {
+    for (std::atomic<const ListBase *> &list : m_lists) {
+        list.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ModuleEventBus::~ModuleEventBus() = default;
+
+bool ModuleEventBus::unsubscribe(Subscription &subscription) {
+    if (!subscription.isValid()) {
+        return false;
+    }
+
+    const int event = static_cast<int>(subscription.m_event);
+    const quint64 id = subscription.m_id;
+    subscription = Subscription();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const ListBase *current = m_lists[event].load(std::memory_order_relaxed);
+    if (!current) {
+        return false;
+    }
+
+    std::unique_ptr<ListBase> next(current->without(id));
+    if (!next) {
+        return false;
+    }
+
+    replace(event, std::move(next));
+    return true;
+}
+
+void ModuleEventBus::replace(int event, std::unique_ptr<ListBase> list) {
+    // Publishers only ever see a complete list: it is filled in before the
+    // release store makes it visible
+    const ListBase *published = list->size() > 0 ? list.get() : nullptr;
+    if (published) {
+        m_storage.push_back(std::move(list));
+    }
+    m_lists[event].store(published, std::memory_order_release);
+}
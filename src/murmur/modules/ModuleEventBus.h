@@ -0,0 +1,236 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_MODULEEVENTBUS_H_
+#define MUMBLE_MURMUR_MODULEEVENTBUS_H_
+
+#include "ModuleEvents.h"
+
+#include <QtCore/QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Typed publish/subscribe channel between the server and its modules.
+ *
+ * Events are plain structs from ModuleEvents.h, identified at compile time by
+ * their Id member and handed to the handlers by const reference, so
+ * publishing neither allocates nor copies the payload.
+ *
+ * Each event has an immutable list of handlers behind an atomic pointer.
+ * publish() loads that pointer and calls the handlers without taking a lock.
+ * Subscribing or unsubscribing copies the list, changes the copy and swaps
+ * it in under a mutex. An old list is kept until the bus is destroyed,
+ * because a publish running on another thread may still be reading it.
+ * Handlers change rarely (modules subscribe in initialize() and unsubscribe in
+ * shutdown()), so the retired lists stay small.
+ *
+ * Handlers run synchronously on the publishing thread, in subscription order.
+ * A handler may publish, subscribe and unsubscribe.
+ */
+class ModuleEventBus {
+public:
+    /**
+     * @brief Handle to one subscription, used to unsubscribe.
+     */
+    class Subscription {
+    public:
+        /**
+         * @brief Constructor for an empty Subscription.
+         */
+        Subscription() : m_event(ModuleEventId::Count), m_id(0) {}
+
+        /**
+         * @brief Check whether this refers to a subscription.
+         *
+         * @return False for a default-constructed or unsubscribed handle
+         */
+        bool isValid() const { return m_id != 0; }
+
+    private:
+        friend class ModuleEventBus;
+
+        Subscription(ModuleEventId event, quint64 id) : m_event(event), m_id(id) {}
+
+        ModuleEventId m_event;
+        quint64 m_id;
+    };
+
+    /**
+     * @brief Constructor for ModuleEventBus.
+     */
+    ModuleEventBus();
+
+    /**
+     * @brief Destructor for ModuleEventBus.
+     *
+     * No publish may be in progress.
+     */
+    ~ModuleEventBus();
+
+    ModuleEventBus(const ModuleEventBus &) = delete;
+    ModuleEventBus &operator=(const ModuleEventBus &) = delete;
+
+    /**
+     * @brief Call a function for every event of type E.
+     *
+     * @tparam E The event struct
+     * @param handler The function; called on the publishing thread
+     * @return The subscription
+     */
+    template<typename E>
+    Subscription subscribe(std::function<void(const E &)> handler) {
+        checkEvent<E>();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const quint64 id = ++m_lastId;
+
+        const List<E> *current = static_cast<const List<E> *>(m_lists[index<E>()].load(std::memory_order_relaxed));
+        std::unique_ptr<List<E>> next(current ? new List<E>(*current) : new List<E>());
+        next->handlers.emplace_back(id, std::move(handler));
+        replace(index<E>(), std::move(next));
+
+        return Subscription(E::Id, id);
+    }
+
+    /**
+     * @brief Call a member function for every event of type E.
+     *
+     * @tparam E The event struct
+     * @tparam C The receiver class
+     * @param receiver The receiver; must outlive the subscription
+     * @param method The member function
+     * @return The subscription
+     */
+    template<typename E, typename C>
+    Subscription subscribe(C *receiver, void (C::*method)(const E &)) {
+        return subscribe<E>([receiver, method](const E &event) { (receiver->*method)(event); });
+    }
+
+    /**
+     * @brief Remove a subscription.
+     *
+     * A publish that started on another thread before this call may still
+     * call the handler once; unsubscribe on the publishing thread before
+     * destroying what the handler uses.
+     *
+     * @param subscription The subscription; reset to an empty handle
+     * @return False if it was empty or already removed
+     */
+    bool unsubscribe(Subscription &subscription);
+
+    /**
+     * @brief Deliver an event to every handler subscribed to its type.
+     *
+     * Lock-free and allocation-free; does nothing beyond one atomic load
+     * when nobody is subscribed.
+     *
+     * @tparam E The event struct
+     * @param event The event
+     */
+    template<typename E>
+    void publish(const E &event) const {
+        checkEvent<E>();
+
+        const ListBase *list = m_lists[index<E>()].load(std::memory_order_acquire);
+        if (!list) {
+            return;
+        }
+
+        for (const auto &handler : static_cast<const List<E> *>(list)->handlers) {
+            handler.second(event);
+        }
+    }
+
+    /**
+     * @brief Check whether anybody is subscribed to an event type.
+     *
+     * Lets publishers skip building an expensive payload.
+     *
+     * @tparam E The event struct
+     * @return True if a publish would call at least one handler
+     */
+    template<typename E>
+    bool hasSubscribers() const {
+        checkEvent<E>();
+        return m_lists[index<E>()].load(std::memory_order_acquire) != nullptr;
+    }
+
+private:
+    static const int EVENT_COUNT = static_cast<int>(ModuleEventId::Count);
+
+    struct ListBase {
+        virtual ~ListBase() = default;
+
+        /**
+         * @brief Copy the list without one handler.
+         *
+         * @param id The subscription to drop
+         * @return The copy, or nullptr if id is not in the list
+         */
+        virtual ListBase *without(quint64 id) const = 0;
+
+        /**
+         * @brief Get the number of handlers.
+         *
+         * @return The number of handlers
+         */
+        virtual size_t size() const = 0;
+    };
+
+    template<typename E>
+    struct List : ListBase {
+        std::vector<std::pair<quint64, std::function<void(const E &)>>> handlers;
+
+        ListBase *without(quint64 id) const override {
+            for (size_t i = 0; i < handlers.size(); ++i) {
+                if (handlers[i].first == id) {
+                    List *copy = new List(*this);
+                    copy->handlers.erase(copy->handlers.begin() + i);
+                    return copy;
+                }
+            }
+            return nullptr;
+        }
+
+        size_t size() const override { return handlers.size(); }
+    };
+
+    template<typename E>
+    static void checkEvent() {
+        static_assert(std::is_same<typename std::remove_cv<decltype(E::Id)>::type, ModuleEventId>::value,
+                      "Events need a static ModuleEventId Id member");
+        static_assert(E::Id != ModuleEventId::Count, "ModuleEventId::Count is not an event");
+    }
+
+    template<typename E>
+    static constexpr int index() {
+        return static_cast<int>(E::Id);
+    }
+
+    /**
+     * @brief Publish a new list for an event and retire the old one.
+     *
+     * Must be called with m_mutex held.
+     *
+     * @param event The event index
+     * @param list The new list; an empty list is stored as nullptr
+     */
+    void replace(int event, std::unique_ptr<ListBase> list);
+
+    std::array<std::atomic<const ListBase *>, EVENT_COUNT> m_lists;
+    std::mutex m_mutex; // Serializes subscription changes
+    std::vector<std::unique_ptr<ListBase>> m_storage; // Current and retired lists
+    quint64 m_lastId;
+};
+
+#endif // MUMBLE_MURMUR_MODULEEVENTBUS_H_
@@ -0,0 +1,81 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_MODULEEVENTS_H_
+#define MUMBLE_MURMUR_MODULEEVENTS_H_
+
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+class ServerUser;
+
+/**
+ * @brief Compile-time identifiers of the events on the ModuleEventBus.
+ *
+ * Every payload struct below names its identifier in a static Id member.
+ * Add new events before Count.
+ */
+enum class ModuleEventId : int {
+    UserStateChanged,
+    PropagationUpdated,
+    MufChanged,
+    SignalStrengthChanged,
+    OpenBandsChanged,
+    Count
+};
+
+/**
+ * @brief A user's state or metadata changed.
+ *
+ * The user pointer is only valid while the event is being dispatched.
+ */
+struct UserStateChangedEvent {
+    static constexpr ModuleEventId Id = ModuleEventId::UserStateChanged;
+
+    unsigned int session; ///< Session of the user
+    const ServerUser *user; ///< The user
+};
+
+/**
+ * @brief The HF propagation conditions were recomputed.
+ */
+struct PropagationUpdatedEvent {
+    static constexpr ModuleEventId Id = ModuleEventId::PropagationUpdated;
+
+    int solarFluxIndex; ///< Solar flux index
+    int kIndex; ///< Geomagnetic K-index
+    int season; ///< 0 = winter, 1 = spring, 2 = summer, 3 = fall
+};
+
+/**
+ * @brief The maximum usable frequency changed.
+ */
+struct MufChangedEvent {
+    static constexpr ModuleEventId Id = ModuleEventId::MufChanged;
+
+    float muf; ///< The new MUF in MHz
+};
+
+/**
+ * @brief The simulated signal strength between two grid locators changed.
+ */
+struct SignalStrengthChangedEvent {
+    static constexpr ModuleEventId Id = ModuleEventId::SignalStrengthChanged;
+
+    QString grid1; ///< First grid locator
+    QString grid2; ///< Second grid locator
+    float strength; ///< Signal strength from 0.0 to 1.0
+};
+
+/**
+ * @brief The set of open bands was recomputed from the propagation conditions.
+ */
+struct OpenBandsChangedEvent {
+    static constexpr ModuleEventId Id = ModuleEventId::OpenBandsChanged;
+
+    QList<int> openBands; ///< Open bands in metres, such as 20 for the 20m band
+};
+
+#endif // MUMBLE_MURMUR_MODULEEVENTS_H_
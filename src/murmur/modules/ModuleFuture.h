@@ -0,0 +1,334 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_MODULEFUTURE_H_
+#define MUMBLE_MURMUR_MODULEFUTURE_H_
+
+#include <QtCore/QDebug>
+#include <QtCore/QObject>
+
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+template<typename T>
+class ModuleFuture;
+
+template<typename T>
+class ModulePromise;
+
+/**
+ * @brief State shared by a ModulePromise and its ModuleFuture.
+ */
+template<typename T>
+class ModuleFutureState {
+public:
+    ~ModuleFutureState() {
+        if (error && !consumed) {
+            qWarning() << "ModuleFuture: Discarding an exception nobody continued from";
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool ready = false;
+    bool consumed = false; // A continuation or result() took the outcome
+    std::optional<typename std::conditional<std::is_void<T>::value, bool, T>::type> value;
+    std::exception_ptr error;
+    std::function<void()> continuation; // Called once, on the completing thread
+};
+
+/**
+ * @brief Write side of a ModuleFuture.
+ *
+ * Finished from any thread with setValue() or setException(). A promise
+ * destroyed before that fails its future, so a continuation that was
+ * discarded never leaves a later step waiting forever.
+ *
+ * @tparam T The result type; may be void
+ */
+template<typename T>
+class ModulePromise {
+public:
+    /**
+     * @brief Constructor for ModulePromise.
+     */
+    ModulePromise() : m_state(std::make_shared<ModuleFutureState<T>>()) {}
+
+    /**
+     * @brief Destructor for ModulePromise.
+     *
+     * Fails the future if it has not finished yet.
+     */
+    ~ModulePromise() {
+        if (m_state && !m_finished) {
+            setException(std::make_exception_ptr(std::runtime_error("ModuleFuture: The work was abandoned")));
+        }
+    }
+
+    ModulePromise(ModulePromise &&) = default;
+    ModulePromise(const ModulePromise &) = delete;
+    ModulePromise &operator=(const ModulePromise &) = delete;
+
+    /**
+     * @brief Get the future of this promise.
+     *
+     * @param context The object whose event loop runs continuations by default
+     * @return The future
+     */
+    ModuleFuture<T> future(QObject *context) const { return ModuleFuture<T>(m_state, context); }
+
+    /**
+     * @brief Finish with a result.
+     *
+     * @param value The result; nothing for void
+     */
+    template<typename... V>
+    void setValue(V &&... value) {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        if constexpr (!std::is_void<T>::value) {
+            m_state->value.emplace(std::forward<V>(value)...);
+        }
+        finish(lock);
+    }
+
+    /**
+     * @brief Finish with an exception.
+     *
+     * @param error The exception
+     */
+    void setException(std::exception_ptr error) {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->error = std::move(error);
+        finish(lock);
+    }
+
+private:
+    void finish(std::unique_lock<std::mutex> &lock) {
+        assert(!m_finished);
+        m_finished = true;
+        m_state->ready = true;
+        std::function<void()> continuation = std::move(m_state->continuation);
+        lock.unlock();
+
+        m_state->finished.notify_all();
+        if (continuation) {
+            continuation();
+        }
+    }
+
+    std::shared_ptr<ModuleFutureState<T>> m_state;
+    bool m_finished = false;
+};
+
+/**
+ * @brief Result of asynchronous module work, continued on an event loop instead of waited for.
+ *
+ * then() attaches a function that receives the result once it is there. The
+ * function is posted to the event loop of a context object, by default the
+ * ModuleManager on the control thread, so it never runs on a pool worker and
+ * the thread that attached it never blocks. then() returns the future of the
+ * continuation's own result, so steps can be chained. An exception skips the
+ * following then() steps and reaches the first onFailed() handler.
+ *
+ * A future can be continued once. Cheap to copy; copies share the result.
+ * A context object must stay alive until the continuation has been posted to
+ * it; continuations still queued when it is destroyed are discarded.
+ *
+ * @tparam T The result type; may be void
+ */
+template<typename T>
+class ModuleFuture {
+public:
+    /**
+     * @brief Constructor for an invalid ModuleFuture.
+     */
+    ModuleFuture() : m_context(nullptr) {}
+
+    /**
+     * @brief Check whether this future belongs to a promise.
+     *
+     * @return False for a default-constructed future
+     */
+    bool isValid() const { return m_state != nullptr; }
+
+    /**
+     * @brief Check whether the result or an exception is there, without blocking.
+     *
+     * @return True once the work has finished
+     */
+    bool isReady() const {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->ready;
+    }
+
+    /**
+     * @brief Block until the work has finished.
+     *
+     * Meant for shutdown; the control thread should use then() instead.
+     */
+    void waitForFinished() const {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->finished.wait(lock, [this]() { return m_state->ready; });
+    }
+
+    /**
+     * @brief Block until the work has finished and get its result.
+     *
+     * @return The result
+     * @throws The exception the work finished with
+     */
+    T result() const {
+        waitForFinished();
+
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->consumed = true;
+        if (m_state->error) {
+            std::rethrow_exception(m_state->error);
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return *m_state->value;
+        }
+    }
+
+    /**
+     * @brief Continue with a function on the event loop of a context object.
+     *
+     * @param context The object whose thread runs fn
+     * @param fn Called with the result (nothing for void); may return a value
+     * @return The future of fn's result; fails with the same exception if
+     * this future fails or with the one fn throws
+     */
+    template<typename F>
+    auto then(QObject *context, F &&fn) {
+        using Callable = typename std::decay<F>::type;
+        using R = typename std::decay<decltype(
+            call(std::declval<Callable &>(), std::declval<ModuleFutureState<T> &>()))>::type;
+
+        std::shared_ptr<ModulePromise<R>> next = std::make_shared<ModulePromise<R>>();
+        ModuleFuture<R> future = next->future(context);
+
+        std::shared_ptr<ModuleFutureState<T>> state = m_state;
+        Callable callable(std::forward<F>(fn));
+        continueWith(context, [state, next, callable]() mutable {
+            if (state->error) {
+                next->setException(state->error);
+                return;
+            }
+            try {
+                if constexpr (std::is_void<R>::value) {
+                    call(callable, *state);
+                    next->setValue();
+                } else {
+                    next->setValue(call(callable, *state));
+                }
+            } catch (...) {
+                next->setException(std::current_exception());
+            }
+        });
+
+        return future;
+    }
+
+    /**
+     * @brief Continue with a function on the event loop of this future's context.
+     *
+     * @param fn Called with the result (nothing for void); may return a value
+     * @return The future of fn's result
+     */
+    template<typename F>
+    auto then(F &&fn) {
+        return then(m_context, std::forward<F>(fn));
+    }
+
+    /**
+     * @brief Handle an exception on the event loop of a context object.
+     *
+     * @param context The object whose thread runs fn
+     * @param fn Called with the exception if this future failed
+     * @return A future that finishes once fn has run, or right away on success
+     */
+    template<typename F>
+    ModuleFuture<void> onFailed(QObject *context, F &&fn) {
+        std::shared_ptr<ModulePromise<void>> next = std::make_shared<ModulePromise<void>>();
+        ModuleFuture<void> future = next->future(context);
+
+        std::shared_ptr<ModuleFutureState<T>> state = m_state;
+        typename std::decay<F>::type callable(std::forward<F>(fn));
+        continueWith(context, [state, next, callable]() mutable {
+            try {
+                if (state->error) {
+                    callable(state->error);
+                }
+                next->setValue();
+            } catch (...) {
+                next->setException(std::current_exception());
+            }
+        });
+
+        return future;
+    }
+
+    /**
+     * @brief Handle an exception on the event loop of this future's context.
+     *
+     * @param fn Called with the exception if this future failed
+     * @return A future that finishes once fn has run, or right away on success
+     */
+    template<typename F>
+    ModuleFuture<void> onFailed(F &&fn) {
+        return onFailed(m_context, std::forward<F>(fn));
+    }
+
+private:
+    friend class ModulePromise<T>;
+
+    ModuleFuture(std::shared_ptr<ModuleFutureState<T>> state, QObject *context)
+        : m_state(std::move(state)), m_context(context) {}
+
+    // The call that then() makes: fn(const T &), or fn() for void
+    template<typename F>
+    static decltype(auto) call(F &fn, ModuleFutureState<T> &state) {
+        if constexpr (std::is_void<T>::value) {
+            Q_UNUSED(state);
+            return fn();
+        } else {
+            return fn(*state.value);
+        }
+    }
+
+    // Posts step to context once the state is ready, even if it already is,
+    // so a continuation never runs inside then()
+    template<typename Step>
+    void continueWith(QObject *context, Step &&step) {
+        assert(context);
+
+        std::function<void()> post = [context, step]() {
+            QMetaObject::invokeMethod(context, step, Qt::QueuedConnection);
+        };
+
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        assert(!m_state->consumed);
+        m_state->consumed = true;
+        if (!m_state->ready) {
+            m_state->continuation = std::move(post);
+            return;
+        }
+        lock.unlock();
+        post();
+    }
+
+    std::shared_ptr<ModuleFutureState<T>> m_state;
+    QObject *m_context;
+};
+
+#endif // MUMBLE_MURMUR_MODULEFUTURE_H_
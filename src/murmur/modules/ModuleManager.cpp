@@ -4,17 +4,25 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "ModuleManager.h"
+#include "../Metrics.h"
 #include "../Server.h"
+#include "../ThreadPlacement.h"
 
 #include <QtCore/QDebug>
 #include <QtCore/QThread>
 
+#include <atomic>
+#include <mutex>
+
 ModuleManager::ModuleManager(Server *server, QObject *parent)
     : QObject(parent)
     , m_server(server) {
-    // Create the thread pool with optimal number of threads
-    m_threadPool = new ThreadPool(ThreadPool::optimalThreadCount(), this);
-    qDebug() << "ModuleManager: Created thread pool with" << m_threadPool->threadCount() << "threads";
+    // Every virtual server shares one pool; this server's work is accounted
+    // to its own tenant and capped by the per-server quota
+    m_threadPool = ThreadPool::shared();
+    m_tenant = m_threadPool->addTenant(QString("server %1").arg(server->iServerNum),
+                                       ThreadPlacement::current().serverThreadQuota());
+    qDebug() << "ModuleManager: Using the shared thread pool with" << m_threadPool->threadCount() << "threads";
 }
 
 ModuleManager::~ModuleManager() {
@@ -24,57 +32,23 @@ ModuleManager::~ModuleManager() {
     // Clear the module registry
     m_modules.clear();
     
-    // The thread pool will be automatically deleted since it's a child QObject
-}
-void ModuleManager::broadcastEventParallel(const QString &eventName, const QVariant &data) {
-    // Create a list of futures to track task completion
-    std::vector<std::future<void>> futures;
-    
-    // Reserve space for the futures
-    futures.reserve(m_modules.size());
-    
-    // Enqueue tasks for each module
-    foreach (IServerModule *module, m_modules.values()) {
-        // Create a copy of the event data and module pointer for the task
-        auto task = [module, eventName, data]() {
-            // Emit the event signal for this module
-            emit module->moduleEvent(eventName, data);
-        };
-        
-        // Enqueue the task and store the future
-        futures.push_back(m_threadPool->enqueue(task));
-    }
-    
-    // Wait for all tasks to complete
-    for (auto& future : futures) {
-        future.wait();
-    }
-    
-    qDebug() << "ModuleManager: Parallel broadcast of event" << eventName << "to" << m_modules.size() << "modules completed";
+    // The shared pool stays; only wait for this server's remaining tasks
+    m_threadPool->removeTenant(m_tenant);
 }
 
 void ModuleManager::executeOnAllModules(const std::function<void(IServerModule*)>& func) {
-    // Create a list of futures to track task completion
-    std::vector<std::future<void>> futures;
-    
-    // Reserve space for the futures
-    futures.reserve(m_modules.size());
-    
-    // Enqueue tasks for each module
-    foreach (IServerModule *module, m_modules.values()) {
-        // Create a task that will execute the function on the module
-        auto task = [module, func]() {
-            func(module);
-        };
-        
-        // Enqueue the task and store the future
-        futures.push_back(m_threadPool->enqueue(task));
-    }
-    
-    // Wait for all tasks to complete
-    for (auto& future : futures) {
-        future.wait();
-    }
+    static MetricHistogram &duration = MetricsRegistry::instance().histogram(
+        "murmur_module_dispatch_duration_seconds", "Time a call on all modules took until every module returned",
+        1e-6, 24, "kind=\"execute\"");
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    // One chunk per module, with a single wait for all of them
+    const QList<IServerModule *> modules = m_modules.values();
+    ThreadPool::TenantScope scope(m_tenant);
+    m_threadPool->parallelFor(0, modules.size(), 1, [&modules, &func](int index) {
+        func(modules[index]);
+    });
+    duration.recordSince(start);
     
     qDebug() << "ModuleManager: Parallel execution on" << m_modules.size() << "modules completed";
 }
@@ -90,6 +64,7 @@ bool ModuleManager::executeOnModule(const QString &moduleName, const std::functi
     IServerModule *module = m_modules.value(moduleName);
     
     // Enqueue the task
+    ThreadPool::TenantScope scope(m_tenant);
     auto future = m_threadPool->enqueue([module, func]() {
         func(module);
     });
@@ -99,6 +74,76 @@ bool ModuleManager::executeOnModule(const QString &moduleName, const std::functi
     
     return true;
 }
+
+ModuleFuture<void> ModuleManager::executeOnAllModulesAsync(std::function<void(IServerModule*)> func) {
+    // Completion state shared by the per-module tasks; the last one to
+    // finish fulfils the promise
+    struct Fanout {
+        std::function<void(IServerModule*)> func;
+        std::atomic<int> remaining;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        ModulePromise<void> promise;
+    };
+    
+    const QList<IServerModule *> modules = m_modules.values();
+    std::shared_ptr<Fanout> fanout = std::make_shared<Fanout>();
+    fanout->func = std::move(func);
+    fanout->remaining.store(modules.size(), std::memory_order_relaxed);
+    ModuleFuture<void> future = fanout->promise.future(this);
+    
+    if (modules.isEmpty()) {
+        fanout->promise.setValue();
+        return future;
+    }
+    
+    std::vector<ThreadPool::Task *> tasks;
+    tasks.reserve(static_cast<size_t>(modules.size()));
+    for (IServerModule *module : modules) {
+        auto run = [fanout, module]() {
+            try {
+                fanout->func(module);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(fanout->errorMutex);
+                if (!fanout->error) {
+                    fanout->error = std::current_exception();
+                }
+            }
+            
+            if (fanout->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (fanout->error) {
+                    fanout->promise.setException(fanout->error);
+                } else {
+                    fanout->promise.setValue();
+                }
+            }
+        };
+        tasks.push_back(new AsyncTask<decltype(run)>(std::move(run)));
+    }
+    submitAsync(tasks.data(), static_cast<int>(tasks.size()));
+    
+    return future;
+}
+
+void ModuleManager::submitAsync(ThreadPool::Task *const *tasks, int count) {
+    static MetricCounter &submitted = MetricsRegistry::instance().counter(
+        "murmur_module_async_tasks_total", "Module tasks scheduled without waiting for them");
+    static MetricCounter &rejected = MetricsRegistry::instance().counter(
+        "murmur_module_async_tasks_rejected_total", "Module tasks the thread pool did not accept");
+    
+    ThreadPool::TenantScope scope(m_tenant);
+    try {
+        m_threadPool->submitBulk(tasks, count);
+        submitted.increment(static_cast<quint64>(count));
+    } catch (const std::exception &e) {
+        rejected.increment(static_cast<quint64>(count));
+        qWarning() << "ModuleManager: Cannot schedule module work:" << e.what();
+        for (int i = 0; i < count; ++i) {
+            delete tasks[i];
+        }
+    }
+}
+
 bool ModuleManager::registerModule(IServerModule *module) {
     if (!module) {
         qWarning() << "ModuleManager: Cannot register null module";
@@ -192,15 +237,6 @@ void ModuleManager::shutdownAllModules() {
     }
 }
 
-void ModuleManager::broadcastEvent(const QString &eventName, const QVariant &data) {
-    // Broadcast the event to all modules
-    foreach (IServerModule *module, m_modules.values()) {
-        // The modules will receive this event through the moduleEvent signal
-        // which is connected to their respective slots
-        emit module->moduleEvent(eventName, data);
-    }
-}
-
 void ModuleManager::onModuleEvent(const QString &eventName, const QVariant &data) {
     // Get the sender module
     QObject *sender = QObject::sender();
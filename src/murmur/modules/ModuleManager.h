@@ -7,15 +7,21 @@
 #define MUMBLE_MURMUR_MODULEMANAGER_H_
 
 #include "IServerModule.h"
+#include "ModuleEventBus.h"
+#include "ModuleFuture.h"
 #include "../ThreadPool.h"
 
 #include <QtCore/QObject>
+#include <QtCore/QDebug>
 #include <QtCore/QHash>
 #include <QtCore/QString>
 #include <QtCore/QVariant>
 #include <QtCore/QFuture>
 
 #include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 class Server;
@@ -113,40 +119,32 @@ public:
     void shutdownAllModules();
     
     /**
-     * @brief Send an event to all modules.
-     * 
-     * This allows for broadcasting events to all registered modules.
-     * 
-     * @param eventName The name of the event
-     * @param data The event data
-     */
-    void broadcastEvent(const QString &eventName, const QVariant &data);
-    
-    /**
-     * @brief Send an event to all modules using parallel processing.
+     * @brief Execute a function on all modules in parallel.
      * 
-     * This method broadcasts events to all registered modules in parallel,
-     * utilizing multiple CPU cores for better performance.
+     * This method runs the provided function on all modules in parallel,
+     * utilizing multiple CPU cores for better performance. It blocks until
+     * every module is done; the control thread should use
+     * executeOnAllModulesAsync() instead.
      * 
-     * @param eventName The name of the event
-     * @param data The event data
+     * @param func The function to execute on each module
      */
-    void broadcastEventParallel(const QString &eventName, const QVariant &data);
+    void executeOnAllModules(const std::function<void(IServerModule*)>& func);
     
     /**
-     * @brief Execute a function on all modules in parallel.
-     * 
-     * This method runs the provided function on all modules in parallel,
-     * utilizing multiple CPU cores for better performance.
+     * @brief Execute a function on all modules in parallel without waiting.
      * 
      * @param func The function to execute on each module
+     * @return A future that finishes when every module is done, failing with
+     * the first exception func threw; continued on this manager's thread
      */
-    void executeOnAllModules(const std::function<void(IServerModule*)>& func);
+    ModuleFuture<void> executeOnAllModulesAsync(std::function<void(IServerModule*)> func);
     
     /**
      * @brief Execute a function on a specific module.
      * 
      * This method runs the provided function on the specified module.
+     * It blocks until the function returns; the control thread should use
+     * executeOnModuleAsync() instead.
      * 
      * @param moduleName The name of the module
      * @param func The function to execute
@@ -154,12 +152,60 @@ public:
      */
     bool executeOnModule(const QString &moduleName, const std::function<void(IServerModule*)>& func);
     
+    /**
+     * @brief Execute a function on a specific module without waiting.
+     * 
+     * The function runs on the thread pool; continuations attached with
+     * ModuleFuture::then() run on this manager's thread.
+     * 
+     * @param moduleName The name of the module
+     * @param func The function to execute; its return value is the result
+     * @return A future of the function's result; fails with
+     * std::invalid_argument if the module is unknown
+     */
+    template<typename F>
+    auto executeOnModuleAsync(const QString &moduleName, F &&func);
+    
+    /**
+     * @brief Get the typed event bus shared by the server and its modules.
+     * 
+     * Modules subscribe to the events they need in initialize() and
+     * unsubscribe in shutdown().
+     * 
+     * @return The event bus
+     */
+    ModuleEventBus* eventBus() { return &m_eventBus; }
+    
+    /**
+     * @brief Deliver a typed event to the modules subscribed to it.
+     * 
+     * Runs the handlers synchronously without locking or allocating.
+     * 
+     * @tparam E The event struct from ModuleEvents.h
+     * @param event The event
+     */
+    template<typename E>
+    void publish(const E &event) const {
+        m_eventBus.publish(event);
+    }
+    
     /**
      * @brief Get the thread pool used for parallel execution.
      * 
+     * This is the process-wide pool shared with the other virtual servers.
+     * Submit inside a ThreadPool::TenantScope for tenant() so that the work
+     * is accounted to this server and limited by its quota.
+     * 
      * @return Pointer to the thread pool
      */
     ThreadPool* threadPool() const { return m_threadPool; }
+    
+    /**
+     * @brief Get this server's tenant on the shared thread pool.
+     * 
+     * @return The tenant
+     */
+    ThreadPool::Tenant* tenant() const { return m_tenant; }
 
 public slots:
     /**
@@ -201,9 +247,69 @@ signals:
     void moduleEventReceived(const QString &moduleName, const QString &eventName, const QVariant &data);
 
 private:
+    // Runs a callable on the pool and frees itself
+    template<typename Fn>
+    class AsyncTask : public ThreadPool::Task {
+    public:
+        explicit AsyncTask(Fn &&fn) : m_fn(std::move(fn)) {}
+        
+        void run() override {
+            m_fn();
+            delete this;
+        }
+        
+    private:
+        Fn m_fn;
+    };
+    
+    /**
+     * @brief Submit tasks on behalf of this server's tenant.
+     * 
+     * Tasks that cannot be submitted are freed, which fails their promises.
+     * 
+     * @param tasks The tasks; ownership passes to the pool
+     * @param count The number of tasks
+     */
+    void submitAsync(ThreadPool::Task *const *tasks, int count);
+    
     Server *m_server; // Pointer to the server instance
     QHash<QString, IServerModule*> m_modules; // Registry of modules
-    ThreadPool *m_threadPool; // Thread pool for parallel execution
+    ModuleEventBus m_eventBus; // Typed events between the server and the modules
+    ThreadPool *m_threadPool; // Process-wide thread pool for parallel execution
+    ThreadPool::Tenant *m_tenant; // This server's share and counters on m_threadPool
 };
 
+template<typename F>
+auto ModuleManager::executeOnModuleAsync(const QString &moduleName, F &&func) {
+    using R = typename std::decay<decltype(func(std::declval<IServerModule *>()))>::type;
+    
+    ModulePromise<R> promise;
+    ModuleFuture<R> future = promise.future(this);
+    
+    IServerModule *module = m_modules.value(moduleName);
+    if (!module) {
+        qWarning() << "ModuleManager: Cannot execute on unknown module" << moduleName;
+        promise.setException(std::make_exception_ptr(std::invalid_argument("Unknown module")));
+        return future;
+    }
+    
+    auto run = [module, fn = typename std::decay<F>::type(std::forward<F>(func)), promise = std::move(promise)]() mutable {
+        try {
+            if constexpr (std::is_void<R>::value) {
+                fn(module);
+                promise.setValue();
+            } else {
+                promise.setValue(fn(module));
+            }
+        } catch (...) {
+            promise.setException(std::current_exception());
+        }
+    };
+    
+    ThreadPool::Task *task = new AsyncTask<decltype(run)>(std::move(run));
+    submitAsync(&task, 1);
+    
+    return future;
+}
+
 #endif // MUMBLE_MURMUR_MODULEMANAGER_H_
\ No newline at end of file
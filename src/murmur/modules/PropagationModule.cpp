@@ -5,16 +5,18 @@
 
 #include "PropagationModule.h"
 #include "../Server.h"
+#include "../CoarseClock.h"
 
 #include <QtCore/QDebug>
 #include <QtCore/QRandomGenerator>
-#include <QtCore/QSettings>
 #include <QtCore/QDateTime>
 #include <QtCore/QRegularExpression>
 
 PropagationModule::PropagationModule(QObject *parent)
     : IServerModule(parent)
-    , m_server(nullptr) {
+    , m_server(nullptr)
+    , m_simulationOffset(0)
+    , m_simulationRate(1.0) {
     // Connect signals from HFBandSimulation
     connect(&m_hfBandSimulation, &HFBandSimulation::propagationUpdated,
             this, &PropagationModule::onPropagationUpdated);
@@ -41,67 +43,64 @@ bool PropagationModule::initialize(Server *server) {
     }
     
     m_server = server;
+    m_userStateSubscription =
+        server->m_moduleManager->eventBus()->subscribe(this, &PropagationModule::onUserStateChanged);
     
-    // Load configuration
-    QSettings qs("mumble-server.ini", QSettings::IniFormat);
-    qs.beginGroup("hf_propagation");
+    const std::shared_ptr<const ServerConfig> config = ServerConfig::current();
+    applyConfig(config->hfPropagation());
+    if (!config->hfPropagation().enabled) {
+        return true; // Still considered initialized successfully
+    }
+    
+    // Initial propagation update
+    updatePropagation();
+    
+    qDebug() << "PropagationModule: Initialized";
     
-    // Check if HF band simulation is enabled
-    bool enabled = qs.value("enabled", true).toBool();
-    if (!enabled) {
+    return true;
+}
+
+void PropagationModule::applyConfig(const ServerConfig::HFPropagation &config) {
+    if (!config.enabled) {
         qWarning() << "PropagationModule: HF band simulation is disabled in configuration";
-        qs.endGroup();
-        return true; // Still considered initialized successfully
+        m_updateTimer.stop();
+        return;
     }
     
     // Set external data source settings
-    bool useExternalData = qs.value("use_external_data", false).toBool();
-    m_hfBandSimulation.setUseExternalData(useExternalData);
+    m_hfBandSimulation.setUseExternalData(config.useExternalData);
     
-    if (useExternalData) {
-        // Set DXView.org data settings
-        bool useDXViewData = qs.value("use_dxview_data", false).toBool();
-        m_hfBandSimulation.setUseDXViewData(useDXViewData);
-        
-        // Set SWPC data settings
-        bool useSWPCData = qs.value("use_swpc_data", false).toBool();
-        m_hfBandSimulation.setUseSWPCData(useSWPCData);
+    if (config.useExternalData) {
+        m_hfBandSimulation.setUseDXViewData(config.useDXViewData);
+        m_hfBandSimulation.setUseSWPCData(config.useSWPCData);
         
         qWarning() << "PropagationModule: Using external data sources:"
-                  << "DXView.org:" << (useDXViewData ? "enabled" : "disabled")
-                  << "SWPC:" << (useSWPCData ? "enabled" : "disabled");
+                  << "DXView.org:" << (config.useDXViewData ? "enabled" : "disabled")
+                  << "SWPC:" << (config.useSWPCData ? "enabled" : "disabled");
     }
     
-    // Set solar flux index (default: 120)
-    int sfi = qs.value("solar_flux_index", 120).toInt();
-    m_hfBandSimulation.setSolarFluxIndex(sfi);
-    
-    // Set K-index (default: 3)
-    int kIndex = qs.value("k_index", 3).toInt();
-    m_hfBandSimulation.setKIndex(kIndex);
+    m_hfBandSimulation.setSolarFluxIndex(config.solarFluxIndex);
+    m_hfBandSimulation.setKIndex(config.kIndex);
     
-    // Set season (0=Winter, 1=Spring, 2=Summer, 3=Fall, default: auto)
-    bool autoSeason = qs.value("auto_season", true).toBool();
-    if (autoSeason) {
+    // Season: 0=Winter, 1=Spring, 2=Summer, 3=Fall, or derived from the date
+    if (config.autoSeason) {
         m_hfBandSimulation.setAutoTimeEnabled(true);
     } else {
-        int season = qs.value("season", 0).toInt();
-        m_hfBandSimulation.setSeason(season);
+        m_hfBandSimulation.setSeason(config.season);
         m_hfBandSimulation.setAutoTimeEnabled(false);
     }
     
-    // Set update interval (default: 30 minutes)
-    int updateInterval = qs.value("update_interval", 30).toInt();
-    m_updateTimer.start(updateInterval * 60 * 1000); // Convert minutes to milliseconds
-    
-    qs.endGroup();
+    m_updateTimer.start(config.updateInterval * 60 * 1000); // Convert minutes to milliseconds
     
-    // Initial propagation update
-    updatePropagation();
-    
-    qDebug() << "PropagationModule: Initialized";
-    
-    return true;
+    // Only restart the simulated clock when its own settings change, so a
+    // reload of other settings does not reset an accelerated simulation
+    if (config.simulationOffset != m_simulationOffset || config.simulationRate != m_simulationRate) {
+        const double rate = config.simulationRate > 0.0 ? config.simulationRate : 1.0;
+        CoarseClock::instance().setSimulation(static_cast<qint64>(config.simulationOffset) * 60 * 1000, rate);
+        m_simulationOffset = config.simulationOffset;
+        m_simulationRate = config.simulationRate;
+        qWarning() << "PropagationModule: Simulation time offset" << config.simulationOffset << "minutes, rate" << rate;
+    }
 }
 
 QString PropagationModule::name() const {
@@ -142,6 +141,10 @@ void PropagationModule::shutdown() {
     // Stop the timer
     m_updateTimer.stop();
     
+    if (m_server) {
+        m_server->m_moduleManager->eventBus()->unsubscribe(m_userStateSubscription);
+    }
+    
     qDebug() << "PropagationModule: Shutdown";
 }
 
@@ -389,8 +392,8 @@ void PropagationModule::updateChannelLinks() {
 void PropagationModule::sendBandRecommendations(ServerUser *u, const QString &grid) {
     QMutexLocker locker(&m_mutex);
     
-    // Get current time
-    QDateTime now = QDateTime::currentDateTime();
+    // Get the current simulation time
+    QDateTime now = CoarseClock::instance().simulation();
     bool isDaytime = m_hfBandSimulation.calculateSolarZenithAngle(grid, now) < 90.0f;
     
     // Create a message with band recommendations
@@ -487,17 +490,28 @@ void PropagationModule::onExternalDataUpdated(const QString &source, bool succes
              << ":" << (success ? "success" : "failure");
 }
 
+void PropagationModule::onUserStateChanged(const UserStateChangedEvent &event) {
+    // Published on the main thread, which owns the user list
+    ServerUser *u = m_server ? m_server->qhUsers.value(event.session) : nullptr;
+    if (!u) {
+        return;
+    }
+    
+    // The server warns about a malformed locator; only recommend for valid ones
+    static const QRegularExpression gridRegex("^[A-R]{2}[0-9]{2}([a-x]{2})?$");
+    const QString grid = u->qmUserData.value("maidenheadgrid", "");
+    if (!grid.isEmpty() && gridRegex.match(grid).hasMatch()) {
+        sendBandRecommendations(u, grid);
+    }
+}
+
 void PropagationModule::sendMessage(ServerUser *u, const QString &message) {
     QMutexLocker locker(&m_mutex);
     
-    // In a real implementation, this would send a message to the user
-    // For this simplified version, we just log the message
     qDebug() << "PropagationModule: Message to" << u->qsName << ":" << message;
     
     // Delegate to the server to send the message
     if (m_server) {
-        // In a real implementation, this would call m_server->sendMessage(u, message)
-        // For this simplified version, we just log that we would send the message
-        qDebug() << "PropagationModule: Would send message to" << u->qsName << "via server";
+        m_server->sendMessage(u, message);
     }
 }
\ No newline at end of file
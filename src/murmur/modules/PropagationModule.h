@@ -8,6 +8,8 @@
 
 #include "IServerModule.h"
 #include "HFBandSimulation.h"
+#include "ModuleEventBus.h"
+#include "../ServerConfig.h"
 
 #include <QtCore/QObject>
 #include <QtCore/QString>
@@ -176,6 +178,16 @@ public:
     HFBandSimulation* getHFBandSimulation() {
         return &m_hfBandSimulation;
     }
+    
+    /**
+     * @brief Apply the [hf_propagation] settings to the simulation.
+     * 
+     * Called on initialization and again whenever a configuration reload
+     * changes the section.
+     * 
+     * @param config The settings
+     */
+    void applyConfig(const ServerConfig::HFPropagation &config);
 
 public slots:
     /**
@@ -239,6 +251,16 @@ private:
     HFBandSimulation m_hfBandSimulation; // HF band simulation engine
     QRecursiveMutex m_mutex; // Mutex for thread safety
     QTimer m_updateTimer; // Timer for periodic updates
+    int m_simulationOffset; // simulation_offset last applied to the clock
+    double m_simulationRate; // simulation_rate last applied to the clock
+    ModuleEventBus::Subscription m_userStateSubscription; // Band recommendations on user state changes
+    
+    /**
+     * @brief Send band recommendations to a user whose grid locator is valid.
+     * 
+     * @param event The user state change
+     */
+    void onUserStateChanged(const UserStateChangedEvent &event);
     
     /**
      * @brief Send a message to a user.
@@ -0,0 +1,59 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_PROPAGATIONVOICEHOOK_H_
+#define MUMBLE_MURMUR_PROPAGATIONVOICEHOOK_H_
+
+#include "../BandMixer.h"
+#include "../User.h"
+#include "../VoiceHook.h"
+
+/**
+ * @brief Drops forwarded voice on links the HF propagation model has closed.
+ *
+ * Server::updateAudioRouting() stores the signal quality of every pair of
+ * users with a grid locator as the BandMixer link gain, which already mutes
+ * weak links on mixed band channels. This hook applies the same decision to
+ * packets forwarded on every other channel: a receiver whose link from the
+ * speaker is below the mixer's minimum gain does not get the packet.
+ *
+ * Built with MURMUR_VOICE_HOOK_PROPAGATION.
+ */
+class PropagationVoiceHook : public VoiceHook {
+public:
+    PropagationVoiceHook() : m_mixer(nullptr) {}
+
+    /**
+     * @brief Read the link gains of a server's band mixer.
+     *
+     * @param server The server
+     */
+    void bind(Server *server);
+
+    /**
+     * @brief Leave out receivers the speaker's signal does not reach.
+     *
+     * @param packet The packet
+     * @param receiver The receiver
+     * @param volume Unchanged
+     * @return False if the link is below the audible gain
+     */
+    bool onRoute(const VoicePacket &packet, const ServerUser *receiver, VolumeAdjustment &volume) {
+        Q_UNUSED(volume);
+        if (!m_mixer) {
+            return true;
+        }
+        // Runs under the voice thread read lock, so the published links
+        // cannot change underneath the lookup
+        const float gain = m_mixer->linkGain(static_cast<unsigned int>(packet.speaker->uiSession),
+                                             static_cast<unsigned int>(receiver->uiSession));
+        return gain >= m_mixer->minimumGain() && gain > 0.0f;
+    }
+
+private:
+    const BandMixer *m_mixer;
+};
+
+#endif // MUMBLE_MURMUR_PROPAGATIONVOICEHOOK_H_
@@ -4,6 +4,7 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "UserDataModule.h"
+#include "../HotLog.h"
 #include "../Server.h"
 
 #include <QtCore/QDebug>
@@ -198,7 +199,7 @@ QString UserDataModule::getRegisteredUserName(int userID) {
     
     // Return the username from cache
     QString name = m_userNameCache.value(userID, QString());
-    qDebug() << "UserDataModule: Retrieved username for user ID" << userID << ":" << (name.isEmpty() ? "not found" : name);
+    HOT_LOG_DEBUG("UserDataModule: Retrieved username", { "id", userID }, { "found", !name.isEmpty() }, { "name", name });
     return name;
 }
 
@@ -207,7 +208,7 @@ int UserDataModule::getRegisteredUserID(const QString &name) {
     
     // Return the user ID from cache
     int userID = m_userIDCache.value(name, -1);
-    qDebug() << "UserDataModule: Retrieved user ID for name" << name << ":" << (userID > 0 ? QString::number(userID) : "not found");
+    HOT_LOG_DEBUG("UserDataModule: Retrieved user ID", { "name", name }, { "found", userID > 0 }, { "id", userID });
     return userID;
 }
 
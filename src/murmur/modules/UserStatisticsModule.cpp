@@ -10,6 +10,11 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QDateTime>
 
+namespace {
+    // How long sending scores are buffered before they are written
+    const int SENDING_SCORE_FLUSH_INTERVAL_MS = 10000;
+} // namespace
+
 UserStatisticsModule::UserStatisticsModule(QObject *parent)
     : IServerModule(parent)
     , m_server(nullptr) {
@@ -17,6 +22,8 @@ UserStatisticsModule::UserStatisticsModule(QObject *parent)
     m_statsDirectory = QDir::current();
     m_statsDirectory.cdUp(); // Move up one level from the binary directory
     m_statsDirectory.cd("user-stats"); // Try to move into the user-stats directory
+    
+    connect(&m_flushTimer, &QTimer::timeout, this, &UserStatisticsModule::scheduleFlush);
 }
 
 UserStatisticsModule::~UserStatisticsModule() {
@@ -38,6 +45,8 @@ bool UserStatisticsModule::initialize(Server *server) {
     // Emit the directory status signal
     emit directoryStatusChanged(directoryExists);
     
+    m_flushTimer.start(SENDING_SCORE_FLUSH_INTERVAL_MS);
+    
     return directoryExists;
 }
 
@@ -90,6 +99,10 @@ bool UserStatisticsModule::setSetting(const QString &key, const QVariant &value)
 void UserStatisticsModule::shutdown() {
     qDebug() << "UserStatisticsModule: Shutting down";
     
+    // Write what is still buffered before the server goes away
+    m_flushTimer.stop();
+    flushSendingScores();
+    
     // Clean up resources if needed
     m_server = nullptr;
 }
@@ -222,6 +235,96 @@ QStringList UserStatisticsModule::getUserStatsFiles(const QString &userName) con
     return userDir.entryList(QDir::Files, QDir::Time);
 }
 
+bool UserStatisticsModule::recordSendingScore(const QString &userName, float wpm, float timingAccuracy, int characters,
+                                              int errors) {
+    QByteArray line = QString("%1,%2,%3,%4,%5\n")
+                          .arg(QDateTime::currentDateTimeUtc().toString(Qt::ISODate))
+                          .arg(wpm, 0, 'f', 1)
+                          .arg(timingAccuracy, 0, 'f', 2)
+                          .arg(characters)
+                          .arg(errors)
+                          .toUtf8();
+    
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pendingScores[userName] += line;
+    }
+    
+    emit sendingScoreRecorded(userName, wpm, timingAccuracy);
+    
+    return true;
+}
+
+bool UserStatisticsModule::flushSendingScores() {
+    QMutexLocker flushLocker(&m_flushMutex);
+    
+    QHash<QString, QByteArray> pending;
+    {
+        QMutexLocker locker(&m_mutex);
+        pending.swap(m_pendingScores);
+        if (pending.isEmpty()) {
+            return true;
+        }
+        if (!ensureDirectoryExists()) {
+            qWarning() << "UserStatisticsModule: Cannot record sending scores, dropping" << pending.size() << "users' rows";
+            return false;
+        }
+    }
+    
+    bool success = true;
+    for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        const QString &userName = it.key();
+        QString filePath;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!ensureUserDirectoryExists(userName)) {
+                qWarning() << "UserStatisticsModule: Cannot record sending scores for" << userName;
+                success = false;
+                continue;
+            }
+            filePath = m_statsDirectory.absolutePath() + "/" + userName + "/cw-sending.csv";
+        }
+        
+        QFile file(filePath);
+        bool isNew = !file.exists();
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            qWarning() << "UserStatisticsModule: Failed to open file for writing:" << filePath;
+            success = false;
+            continue;
+        }
+        
+        QByteArray lines;
+        if (isNew) {
+            lines = "timestamp,wpm,timing accuracy,characters,errors\n";
+        }
+        lines += it.value();
+        
+        qint64 bytesWritten = file.write(lines);
+        file.close();
+        
+        if (bytesWritten != lines.size()) {
+            qWarning() << "UserStatisticsModule: Failed to write sending scores to" << filePath;
+            success = false;
+        }
+    }
+    
+    return success;
+}
+
+void UserStatisticsModule::scheduleFlush() {
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_pendingScores.isEmpty() || !m_server) {
+            return;
+        }
+    }
+    
+    // File I/O stays off the main thread
+    m_server->m_moduleManager->executeOnModuleAsync(name(), [](IServerModule *module) {
+        return static_cast<UserStatisticsModule *>(module)->flushSendingScores();
+    });
+}
+
 bool UserStatisticsModule::ensureDirectoryExists() {
     // Check if the directory exists
     if (m_statsDirectory.exists()) {
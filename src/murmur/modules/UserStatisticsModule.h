@@ -13,6 +13,8 @@
 #include <QtCore/QRecursiveMutex>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <QtCore/QTimer>
 
 class Server;
@@ -79,6 +81,33 @@ public:
      * @return List of file paths for the user's statistics
      */
     QStringList getUserStatsFiles(const QString &userName) const;
+    
+    /**
+     * @brief Record how well a user sent one word of CW.
+     * 
+     * Scores come from the server's CW skimmer. The row is buffered and
+     * appended to the user's cw-sending.csv by the next flush, so recording
+     * does no file I/O. Thread-safe; sendingScoreRecorded is emitted on the
+     * calling thread, which for the server is its control thread.
+     * 
+     * @param userName The username of the sender
+     * @param wpm The estimated sending speed in words per minute
+     * @param timingAccuracy How close the element timing was to ideal (0.0 to 1.0)
+     * @param characters The number of characters decoded
+     * @param errors The number of element patterns that are not valid Morse
+     * @return True if the score was recorded, false otherwise
+     */
+    bool recordSendingScore(const QString &userName, float wpm, float timingAccuracy, int characters, int errors);
+    
+    /**
+     * @brief Append the buffered sending scores to the users' CSV files.
+     * 
+     * Runs on the thread pool every few seconds and once more on shutdown.
+     * Thread-safe.
+     * 
+     * @return True if every buffered row was written, false otherwise
+     */
+    bool flushSendingScores();
 
 signals:
     /**
@@ -95,11 +124,31 @@ signals:
      * @param exists True if the directory exists, false otherwise
      */
     void directoryStatusChanged(bool exists);
+    
+    /**
+     * @brief Signal emitted when a CW sending score was recorded.
+     * 
+     * Emitted on the thread that called recordSendingScore(); receivers on
+     * other threads need a queued connection.
+     * 
+     * @param userName The username of the sender
+     * @param wpm The estimated sending speed in words per minute
+     * @param timingAccuracy How close the element timing was to ideal (0.0 to 1.0)
+     */
+    void sendingScoreRecorded(const QString &userName, float wpm, float timingAccuracy);
 
 private:
     Server *m_server; // Pointer to the server instance
     QRecursiveMutex m_mutex; // Mutex for thread safety
     QDir m_statsDirectory; // The user statistics directory
+    QHash<QString, QByteArray> m_pendingScores; // Sending score rows not yet written, by username
+    QMutex m_flushMutex; // Keeps flushes in order so rows of one user are appended in sequence
+    QTimer m_flushTimer; // Hands the buffered rows to the thread pool periodically
+    
+    /**
+     * @brief Flush the buffered sending scores on the thread pool.
+     */
+    void scheduleFlush();
     
     /**
      * @brief Ensure the user statistics directory exists.
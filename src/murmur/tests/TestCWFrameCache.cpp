@@ -0,0 +1,56 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CWFrameCache.h"
+#include "OpusCodec.h"
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+class TestCWFrameCache : public QObject {
+    Q_OBJECT
+private slots:
+    void latin1Characters();
+    void beyondLatin1();
+    void beyondLatin1InText();
+};
+
+void TestCWFrameCache::latin1Characters() {
+    if (!OpusCodec::isAvailable()) {
+        QSKIP("Built without Opus");
+    }
+
+    CWFrameCache cache;
+    QVERIFY(!cache.sequence(QLatin1Char('A'), 20, 20, 600).isNull());
+    // Lower case shares the sequence of upper case
+    int lowerSize = 0;
+    int upperSize = 0;
+    QCOMPARE(cache.sequence(QLatin1Char('a'), 20, 20, 600).frame(0, lowerSize),
+             cache.sequence(QLatin1Char('A'), 20, 20, 600).frame(0, upperSize));
+}
+
+void TestCWFrameCache::beyondLatin1() {
+    CWFrameCache cache;
+    // U+0141 and U+0241 end in 0x41, which used to be sent as 'A'
+    QVERIFY(cache.sequence(QChar(0x0141), 20, 20, 600).isNull());
+    QVERIFY(cache.sequence(QChar(0x0241), 20, 20, 600).isNull());
+    // Latin-1 characters whose upper case is beyond Latin-1
+    QVERIFY(cache.sequence(QChar(0x00FF), 20, 20, 600).isNull());
+    QVERIFY(cache.sequence(QChar(0x00B5), 20, 20, 600).isNull());
+}
+
+void TestCWFrameCache::beyondLatin1InText() {
+    if (!OpusCodec::isAvailable()) {
+        QSKIP("Built without Opus");
+    }
+
+    CWFrameCache cache;
+    // Skipped like any other character without Morse code
+    QCOMPARE(cache.sequencesForText(QString::fromUtf8("\xC5\x81" "E"), 20, 20, 600).size(), 1);
+    QCOMPARE(cache.sequencesForText(QStringLiteral("AE"), 20, 20, 600).size(), 2);
+}
+
+QTEST_APPLESS_MAIN(TestCWFrameCache)
+#include "TestCWFrameCache.moc"
@@ -0,0 +1,288 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ChannelTree.h"
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include <random>
+
+class TestChannelTree : public QObject {
+    Q_OBJECT
+private slots:
+    void add();
+    void moveDown();
+    void moveUp();
+    void moveToTopLevel();
+    void moveIntoOwnSubtree();
+    void removeSubtree();
+    void randomEdits();
+};
+
+namespace {
+    // The same hierarchy kept the obvious way, to compare the tour against
+    class Model {
+    public:
+        void add(int id, int parentId) {
+            m_parents.insert(id, parentId);
+            m_children[parentId].append(id);
+        }
+
+        void move(int id, int parentId) {
+            if (m_parents.value(id) == parentId) {
+                return;
+            }
+            m_children[m_parents.value(id)].removeOne(id);
+            add(id, parentId);
+        }
+
+        void remove(int id) {
+            for (int child : m_children.value(id)) {
+                remove(child);
+            }
+            m_children.remove(id);
+            m_children[m_parents.value(id)].removeOne(id);
+            m_parents.remove(id);
+        }
+
+        bool isInSubtree(int rootId, int id) const {
+            for (int s = id; s >= 0; s = m_parents.value(s, -1)) {
+                if (s == rootId) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        QList<int> ids() const { return m_parents.keys(); }
+
+        QList<int> tour(int id = -1) const {
+            QList<int> ids;
+            if (id >= 0) {
+                ids.append(id);
+            }
+            for (int child : m_children.value(id)) {
+                ids.append(tour(child));
+            }
+            return ids;
+        }
+
+    private:
+        QHash<int, int> m_parents;
+        QHash<int, QList<int>> m_children;
+    };
+
+    QList<int> tourOf(const ChannelTree &tree) {
+        QList<int> ids;
+        for (int position = 0; position < tree.size(); ++position) {
+            ids.append(tree.channelAt(position));
+        }
+        return ids;
+    }
+
+    // Every channel's enter() is its position and exit() ends its subtree
+    void verifyTour(const ChannelTree &tree) {
+        for (int position = 0; position < tree.size(); ++position) {
+            const int id = tree.channelAt(position);
+            QCOMPARE(tree.enter(id), position);
+            int end = position + 1;
+            for (int child : tree.children(id)) {
+                QCOMPARE(tree.enter(child), end);
+                QCOMPARE(tree.parent(child), id);
+                end = tree.exit(child);
+            }
+            QCOMPARE(tree.exit(id), end);
+        }
+    }
+
+    // 1
+    // +- 2
+    // |  +- 4
+    // |  +- 5
+    // +- 3
+    //    +- 6
+    // 7
+    void addSample(ChannelTree &tree) {
+        QVERIFY(tree.add(1));
+        QVERIFY(tree.add(2, 1));
+        QVERIFY(tree.add(3, 1));
+        QVERIFY(tree.add(4, 2));
+        QVERIFY(tree.add(5, 2));
+        QVERIFY(tree.add(6, 3));
+        QVERIFY(tree.add(7));
+    }
+} // namespace
+
+void TestChannelTree::add() {
+    ChannelTree tree;
+    addSample(tree);
+    verifyTour(tree);
+
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 2, 4, 5, 3, 6, 7 }));
+    QCOMPARE(tree.enter(2), 1);
+    QCOMPARE(tree.exit(2), 4);
+    QCOMPARE(tree.exit(1), 6);
+    QCOMPARE(tree.children(-1), QList<int>({ 1, 7 }));
+    QCOMPARE(tree.subtree(3), QList<int>({ 3, 6 }));
+
+    QVERIFY(tree.isInSubtree(1, 5));
+    QVERIFY(tree.isInSubtree(2, 2));
+    QVERIFY(!tree.isInSubtree(2, 3));
+    QVERIFY(!tree.isInSubtree(5, 2));
+    QVERIFY(!tree.isInSubtree(1, 7));
+
+    // Existing channels and unknown parents are rejected
+    QVERIFY(!tree.add(4, 1));
+    QVERIFY(!tree.add(8, 42));
+    QCOMPARE(tree.size(), 7);
+    QCOMPARE(tree.enter(42), -1);
+    QCOMPARE(tree.exit(42), -1);
+}
+
+void TestChannelTree::moveDown() {
+    ChannelTree tree;
+    addSample(tree);
+
+    // 2 and its subtree move behind 6, later in the tour
+    QVERIFY(tree.move(2, 6));
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 3, 6, 2, 4, 5, 7 }));
+    QCOMPARE(tree.parent(2), 6);
+    QVERIFY(tree.isInSubtree(3, 5));
+    QVERIFY(tree.isInSubtree(6, 4));
+    QCOMPARE(tree.children(1), QList<int>({ 3 }));
+}
+
+void TestChannelTree::moveUp() {
+    ChannelTree tree;
+    addSample(tree);
+
+    // 3 and its subtree move under 4, earlier in the tour
+    QVERIFY(tree.move(3, 4));
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 2, 4, 3, 6, 5, 7 }));
+    QVERIFY(tree.isInSubtree(2, 6));
+    QVERIFY(!tree.isInSubtree(5, 6));
+
+    // 7 becomes the last child of 5, which already ends right before it, so
+    // only the subtree sizes change
+    QVERIFY(tree.move(7, 5));
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 2, 4, 3, 6, 5, 7 }));
+    QCOMPARE(tree.exit(1), 7);
+    QCOMPARE(tree.children(-1), QList<int>({ 1 }));
+
+    // Moving to the same parent changes nothing
+    QVERIFY(tree.move(3, 4));
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 2, 4, 3, 6, 5, 7 }));
+}
+
+void TestChannelTree::moveToTopLevel() {
+    ChannelTree tree;
+    addSample(tree);
+
+    QVERIFY(tree.move(2, -1));
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 3, 6, 7, 2, 4, 5 }));
+    QCOMPARE(tree.parent(2), -1);
+    QCOMPARE(tree.children(-1), QList<int>({ 1, 7, 2 }));
+    QVERIFY(!tree.isInSubtree(1, 4));
+}
+
+void TestChannelTree::moveIntoOwnSubtree() {
+    ChannelTree tree;
+    addSample(tree);
+    const QList<int> before = tourOf(tree);
+
+    QVERIFY(!tree.move(1, 1));
+    QVERIFY(!tree.move(1, 2));
+    QVERIFY(!tree.move(1, 5));
+    QVERIFY(!tree.move(2, 4));
+    QVERIFY(!tree.move(2, 42));
+    QVERIFY(!tree.move(42, 1));
+
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), before);
+    QCOMPARE(tree.parent(2), 1);
+}
+
+void TestChannelTree::removeSubtree() {
+    ChannelTree tree;
+    addSample(tree);
+
+    QCOMPARE(tree.remove(2), 3);
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 3, 6, 7 }));
+    QVERIFY(!tree.contains(2));
+    QVERIFY(!tree.contains(4));
+    QVERIFY(!tree.contains(5));
+    QCOMPARE(tree.children(1), QList<int>({ 3 }));
+    QCOMPARE(tree.exit(1), 3);
+    QVERIFY(!tree.isInSubtree(1, 4));
+    QCOMPARE(tree.remove(2), 0);
+
+    // The freed slots are reused
+    QVERIFY(tree.add(4, 7));
+    QVERIFY(tree.add(2, 4));
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 1, 3, 6, 7, 4, 2 }));
+
+    QCOMPARE(tree.remove(1), 3);
+    verifyTour(tree);
+    QCOMPARE(tourOf(tree), QList<int>({ 7, 4, 2 }));
+
+    tree.clear();
+    QCOMPARE(tree.size(), 0);
+    QVERIFY(tree.children(-1).isEmpty());
+}
+
+void TestChannelTree::randomEdits() {
+    ChannelTree tree;
+    Model model;
+    std::mt19937 rng(75);
+    int nextId = 0;
+
+    for (int step = 0; step < 2000; ++step) {
+        const QList<int> ids = model.ids();
+        const auto pick = [&]() {
+            return ids.isEmpty() || rng() % 8 == 0 ? -1 : ids.at(static_cast<int>(rng() % ids.size()));
+        };
+        const unsigned int action = ids.size() < 5 ? 0 : rng() % 10;
+
+        if (action < 5) {
+            const int parentId = pick();
+            QVERIFY(tree.add(nextId, parentId));
+            model.add(nextId, parentId);
+            ++nextId;
+        } else if (action < 9) {
+            const int id = pick();
+            const int parentId = pick();
+            if (id < 0) {
+                continue;
+            }
+            const bool allowed = parentId < 0 || !model.isInSubtree(id, parentId);
+            QCOMPARE(tree.move(id, parentId), allowed);
+            if (allowed) {
+                QCOMPARE(tree.parent(id), parentId);
+                model.move(id, parentId);
+            }
+        } else {
+            const int id = pick();
+            if (id < 0) {
+                continue;
+            }
+            const int count = model.tour(id).size();
+            QCOMPARE(tree.remove(id), count);
+            model.remove(id);
+        }
+
+        QCOMPARE(tourOf(tree), model.tour());
+        verifyTour(tree);
+    }
+}
+
+QTEST_APPLESS_MAIN(TestChannelTree)
+#include "TestChannelTree.moc"
@@ -0,0 +1,94 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "Metrics.h"
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include <cmath>
+
+class TestMetricHistogram : public QObject {
+    Q_OBJECT
+private slots:
+    void bucketEdges_data();
+    void bucketEdges();
+    void smallValuesAreExact();
+    void bucketWidth();
+    void overflow();
+};
+
+namespace {
+    // The bucket a single sample lands in
+    int bucketOf(int maxBits, int subBucketBits, quint64 value) {
+        MetricHistogram histogram(1.0, maxBits, subBucketBits);
+        histogram.record(value);
+        const MetricHistogram::Snapshot snapshot = histogram.snapshot();
+        for (int bucket = 0; bucket < snapshot.buckets.size(); ++bucket) {
+            if (snapshot.buckets[bucket] != 0) {
+                return bucket;
+            }
+        }
+        return -1;
+    }
+} // namespace
+
+void TestMetricHistogram::bucketEdges_data() {
+    QTest::addColumn<int>("subBucketBits");
+
+    QTest::newRow("1 per power of two") << 0;
+    QTest::newRow("2 per power of two") << 1;
+    QTest::newRow("8 per power of two") << 3;
+    QTest::newRow("16 per power of two") << 4;
+}
+
+void TestMetricHistogram::bucketEdges() {
+    QFETCH(int, subBucketBits);
+    const int maxBits = 16;
+
+    MetricHistogram histogram(1.0, maxBits, subBucketBits);
+    const QVector<double> bounds = histogram.snapshot().bounds;
+    QCOMPARE(bounds.size(), (maxBits - subBucketBits + 1) << subBucketBits);
+    QCOMPARE(bounds.last(), std::ldexp(1.0, maxBits));
+
+    // The last value below a bound is in the bucket, the bound is in the next
+    for (int bucket = 0; bucket < bounds.size(); ++bucket) {
+        const quint64 bound = static_cast<quint64>(bounds[bucket]);
+        QVERIFY(bucket == 0 || bounds[bucket] > bounds[bucket - 1]);
+        QCOMPARE(bucketOf(maxBits, subBucketBits, bound - 1), bucket);
+        QCOMPARE(bucketOf(maxBits, subBucketBits, bound), bucket + 1);
+    }
+}
+
+void TestMetricHistogram::smallValuesAreExact() {
+    MetricHistogram histogram(1.0, 24, 3);
+    const QVector<double> bounds = histogram.snapshot().bounds;
+    for (int value = 0; value < 16; ++value) {
+        QCOMPARE(bounds[value], value + 1.0);
+    }
+}
+
+void TestMetricHistogram::bucketWidth() {
+    MetricHistogram histogram(1.0, 24, 3);
+    const QVector<double> bounds = histogram.snapshot().bounds;
+    for (int bucket = 8; bucket < bounds.size(); ++bucket) {
+        QVERIFY(bounds[bucket] - bounds[bucket - 1] <= bounds[bucket - 1] / 8);
+    }
+}
+
+void TestMetricHistogram::overflow() {
+    MetricHistogram histogram(1.0, 10, 3);
+    histogram.record(1023);
+    histogram.record(1024);
+    histogram.record(Q_UINT64_C(1) << 40);
+
+    const MetricHistogram::Snapshot snapshot = histogram.snapshot();
+    QCOMPARE(snapshot.count, quint64(3));
+    QCOMPARE(snapshot.buckets[snapshot.buckets.size() - 2], quint64(1));
+    QCOMPARE(snapshot.buckets.last(), quint64(2));
+}
+
+QTEST_APPLESS_MAIN(TestMetricHistogram)
+#include "TestMetricHistogram.moc"
@@ -0,0 +1,101 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "modules/ModuleEventBus.h"
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+class TestModuleEventBus : public QObject {
+    Q_OBJECT
+private slots:
+    void userStateChanged();
+    void memberHandler();
+    void unsubscribe();
+    void unsubscribeWhilePublishing();
+    void otherEvents();
+};
+
+namespace {
+    struct Recorder {
+        QList<unsigned int> sessions;
+
+        void onUserStateChanged(const UserStateChangedEvent &event) { sessions.append(event.session); }
+    };
+} // namespace
+
+void TestModuleEventBus::userStateChanged() {
+    ModuleEventBus bus;
+    QVERIFY(!bus.hasSubscribers<UserStateChangedEvent>());
+    // Without subscribers this is a single load
+    bus.publish(UserStateChangedEvent{ 1, nullptr });
+
+    QStringList calls;
+    bus.subscribe<UserStateChangedEvent>(
+        [&calls](const UserStateChangedEvent &event) { calls.append(QString("first %1").arg(event.session)); });
+    bus.subscribe<UserStateChangedEvent>(
+        [&calls](const UserStateChangedEvent &event) { calls.append(QString("second %1").arg(event.session)); });
+    QVERIFY(bus.hasSubscribers<UserStateChangedEvent>());
+
+    // Handlers run synchronously, in subscription order
+    bus.publish(UserStateChangedEvent{ 42, nullptr });
+    QCOMPARE(calls, QStringList({ "first 42", "second 42" }));
+}
+
+void TestModuleEventBus::memberHandler() {
+    ModuleEventBus bus;
+    Recorder recorder;
+    bus.subscribe(&recorder, &Recorder::onUserStateChanged);
+
+    bus.publish(UserStateChangedEvent{ 7, nullptr });
+    bus.publish(UserStateChangedEvent{ 8, nullptr });
+    QCOMPARE(recorder.sessions, QList<unsigned int>({ 7, 8 }));
+}
+
+void TestModuleEventBus::unsubscribe() {
+    ModuleEventBus bus;
+    Recorder kept;
+    Recorder removed;
+    bus.subscribe(&kept, &Recorder::onUserStateChanged);
+    ModuleEventBus::Subscription subscription = bus.subscribe(&removed, &Recorder::onUserStateChanged);
+
+    QVERIFY(subscription.isValid());
+    QVERIFY(bus.unsubscribe(subscription));
+    QVERIFY(!subscription.isValid());
+    QVERIFY(!bus.unsubscribe(subscription));
+
+    bus.publish(UserStateChangedEvent{ 3, nullptr });
+    QCOMPARE(kept.sessions, QList<unsigned int>({ 3 }));
+    QVERIFY(removed.sessions.isEmpty());
+}
+
+void TestModuleEventBus::unsubscribeWhilePublishing() {
+    ModuleEventBus bus;
+    ModuleEventBus::Subscription subscription;
+    int calls = 0;
+    subscription = bus.subscribe<UserStateChangedEvent>([&](const UserStateChangedEvent &) {
+        ++calls;
+        bus.unsubscribe(subscription);
+    });
+
+    // The publish in progress keeps the list it started with
+    bus.publish(UserStateChangedEvent{ 1, nullptr });
+    bus.publish(UserStateChangedEvent{ 2, nullptr });
+    QCOMPARE(calls, 1);
+    QVERIFY(!bus.hasSubscribers<UserStateChangedEvent>());
+}
+
+void TestModuleEventBus::otherEvents() {
+    ModuleEventBus bus;
+    Recorder recorder;
+    bus.subscribe(&recorder, &Recorder::onUserStateChanged);
+
+    bus.publish(MufChangedEvent{ 14.2f });
+    QVERIFY(recorder.sessions.isEmpty());
+    QVERIFY(!bus.hasSubscribers<MufChangedEvent>());
+}
+
+QTEST_APPLESS_MAIN(TestModuleEventBus)
+#include "TestModuleEventBus.moc"